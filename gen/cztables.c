@@ -0,0 +1,619 @@
+/******************************************************************************/
+/* gbstyle (prototype code for Felisynth) - No Shinobi Knows Me 2026          */
+/******************************************************************************/
+
+/******************************************************************************/
+/* cztables.c (apu table generator)                                           */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* this is a c port of the .m files in the octave directory. */
+/* each formula is written out in the same order as there,   */
+/* so that the rounding matches the octave output exactly    */
+
+#define CZTABLES_DEFAULT_CLOCK_RATE 48000
+
+/* the clock dividers (these match the ones in apu.c) */
+#define CZTABLES_SEQ_DIVIDER  8
+#define CZTABLES_PCM_DIVIDER  2
+#define CZTABLES_OUT_DIVIDER  2
+
+/* filter cutoffs (hz) */
+#define CZTABLES_HP_CUTOFF    32    /* c-1 */
+#define CZTABLES_LP_CUTOFF    2840  /* sega genesis lowpass cutoff */
+
+/* the downsampler cutoff is the middle of the transition  */
+/* band, as a fraction of the output nyquist (10500 hz at  */
+/* an output rate of 24000 hz, for a ~3 khz band)          */
+#define CZTABLES_DS_CUTOFF    0.875
+
+/* downsampler kernel (same as fir1 in octave) */
+#define CZTABLES_DS_ORDER     64
+#define CZTABLES_DS_GRID_SIZE 512
+
+#define CZTABLES_PI 3.14159265358979323846
+
+#define CZTABLES_MAX_TABLE_SIZE 256
+
+static long S_cztables_values[CZTABLES_MAX_TABLE_SIZE];
+
+/******************************************************************************/
+/* cztables_round()                                                           */
+/******************************************************************************/
+long cztables_round(double x)
+{
+  /* round half away from zero, like octave */
+  if (x < 0)
+    return -((long) floor(-x + 0.5));
+  else
+    return (long) floor(x + 0.5);
+}
+
+/******************************************************************************/
+/* cztables_log2()                                                            */
+/******************************************************************************/
+double cztables_log2(double x)
+{
+  return log(x) / log(2);
+}
+
+/******************************************************************************/
+/* cztables_exp2()                                                            */
+/******************************************************************************/
+double cztables_exp2(double x)
+{
+  return exp(log(2) * x);
+}
+
+/******************************************************************************/
+/* cztables_write_table()                                                     */
+/******************************************************************************/
+int cztables_write_table(FILE* fp, char* comment, char* type, char* name,
+                         int num_values, int per_line, int width)
+{
+  int k;
+
+  if (num_values > CZTABLES_MAX_TABLE_SIZE)
+    return 1;
+
+  if (comment != NULL)
+    fprintf(fp, "/* %s */\n", comment);
+
+  fprintf(fp, "static %s %s[%d] = \n", type, name, num_values);
+
+  for (k = 0; k < num_values; k++)
+  {
+    if (k == 0)
+      fprintf(fp, "  { ");
+    else if (k % per_line == 0)
+      fprintf(fp, "    ");
+
+    /* a width of 0 means 16 bit hex values */
+    if (width == 0)
+      fprintf(fp, "0x%04lX", (unsigned long) S_cztables_values[k]);
+    else
+      fprintf(fp, "%*ld", width, S_cztables_values[k]);
+
+    if (k < num_values - 1)
+    {
+      if ((k + 1) % per_line == 0)
+        fprintf(fp, ",\n");
+      else
+        fprintf(fp, ", ");
+    }
+    else
+      fprintf(fp, "\n");
+  }
+
+  fprintf(fp, "  };\n\n");
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cztables_write_seq()                                                       */
+/******************************************************************************/
+int cztables_write_seq(FILE* fp, unsigned long clock_rate)
+{
+  int k;
+
+  double seq_1hz_inc;
+  double tempo_freq;
+  double x;
+
+  /* sequencer phase incs (16 bit mantissas) */
+  /* bpm is 32 to 255, 960 parts per beat    */
+  seq_1hz_inc = cztables_exp2(16) / (clock_rate / CZTABLES_SEQ_DIVIDER);
+
+  for (k = 0; k < 224; k++)
+  {
+    tempo_freq = ((32 + k) / 60.0) * 960;
+    S_cztables_values[k] = cztables_round(seq_1hz_inc * tempo_freq);
+  }
+
+  if (cztables_write_table(fp, "phase tables", "unsigned short",
+                           "S_apu_seq_phase_incs_table", 224, 8, 5))
+  {
+    return 1;
+  }
+
+  /* midi tables */
+  for (k = 0; k < 128; k++)
+  {
+    if ((k >= 21) && (k < 21 + 88))
+      S_cztables_values[k] = 9 + (k - 21);
+    else
+      S_cztables_values[k] = 0;
+  }
+
+  if (cztables_write_table(fp, "midi note tables", "unsigned char",
+                           "S_apu_seq_midi_note_number_table", 128, 12, 2))
+  {
+    return 1;
+  }
+
+  S_cztables_values[0] = 4095;
+
+  for (k = 1; k < 128; k++)
+    S_cztables_values[k] = 8 * (127 - k);
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_seq_midi_note_velocity_table", 128, 8, 4))
+  {
+    return 1;
+  }
+
+  /* instrument volume and panning */
+  for (k = 0; k < 128; k++)
+  {
+    x = k / 127.0;
+    S_cztables_values[k] = cztables_round(32768 * (x * x));
+  }
+
+  if (cztables_write_table(fp, "volume and panning (15 bit mantissas)",
+                           "unsigned short", "S_apu_inst_vol_table",
+                           128, 8, 5))
+  {
+    return 1;
+  }
+
+  for (k = 0; k < 128; k++)
+  {
+    if (k <= 64)
+      x = (CZTABLES_PI / 2) * (k / 128.0);
+    else
+      x = (CZTABLES_PI / 2) * (k / 127.0);
+
+    S_cztables_values[k] = cztables_round(32768 * cos(x));
+  }
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_inst_pan_L_table", 128, 8, 5))
+  {
+    return 1;
+  }
+
+  for (k = 0; k < 128; k++)
+  {
+    if (k <= 64)
+      x = (CZTABLES_PI / 2) * (k / 128.0);
+    else
+      x = (CZTABLES_PI / 2) * (k / 127.0);
+
+    S_cztables_values[k] = cztables_round(32768 * sin(x));
+  }
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_inst_pan_R_table", 128, 8, 5))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cztables_write_env()                                                       */
+/******************************************************************************/
+int cztables_write_env(FILE* fp)
+{
+  int k;
+
+  /* step patterns */
+  S_cztables_values[0]  = 0x0000;
+  S_cztables_values[1]  = 0x0080;
+  S_cztables_values[2]  = 0x0808;
+  S_cztables_values[3]  = 0x0888;
+  S_cztables_values[4]  = 0x2222;
+  S_cztables_values[5]  = 0x22A2;
+  S_cztables_values[6]  = 0x2A2A;
+  S_cztables_values[7]  = 0x2AAA;
+  S_cztables_values[8]  = 0x5555;
+  S_cztables_values[9]  = 0x55D5;
+  S_cztables_values[10] = 0x5D5D;
+  S_cztables_values[11] = 0x5DDD;
+  S_cztables_values[12] = 0x7777;
+  S_cztables_values[13] = 0x77F7;
+  S_cztables_values[14] = 0x7F7F;
+  S_cztables_values[15] = 0x7FFF;
+
+  if (cztables_write_table(fp, "step patterns", "unsigned short",
+                           "S_apu_env_step_patterns", 16, 8, 0))
+  {
+    return 1;
+  }
+
+  /* parameter mapping (100 values each) */
+  for (k = 0; k < 100; k++)
+    S_cztables_values[k] = cztables_round(127 * ((99 - k) / 99.0));
+
+  if (cztables_write_table(fp, "parameter mapping", "unsigned short",
+                           "S_apu_env_adsr_rate_map", 100, 10, 3))
+  {
+    return 1;
+  }
+
+  S_cztables_values[0] = 1023;
+
+  for (k = 1; k < 100; k++)
+    S_cztables_values[k] = cztables_round(8 * 104 * (99.0 - k) / 99);
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_env_total_level_map", 100, 10, 4))
+  {
+    return 1;
+  }
+
+  S_cztables_values[0] = 1023;
+
+  for (k = 1; k < 100; k++)
+    S_cztables_values[k] = cztables_round(32 * 14 * (100.0 - k) / 99);
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_env_sustain_level_map", 100, 10, 4))
+  {
+    return 1;
+  }
+
+  /* rate keyscaling: multipliers from 2^0 / 12 to 2^3 / 12 */
+  for (k = 0; k < 100; k++)
+  {
+    S_cztables_values[k] =
+      cztables_round(256 * (cztables_exp2(3.0 * k / 99) / 12));
+  }
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_env_rate_ks_map", 100, 10, 4))
+  {
+    return 1;
+  }
+
+  /* level keyscaling: multipliers from 2^1 / 3 to 2^4 / 3 */
+  for (k = 0; k < 100; k++)
+  {
+    S_cztables_values[k] =
+      cztables_round(256 * (cztables_exp2(1 + 3.0 * k / 99) / 3));
+  }
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_env_level_ks_map", 100, 10, 4))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cztables_write_osc()                                                       */
+/******************************************************************************/
+int cztables_write_osc(FILE* fp, unsigned long clock_rate)
+{
+  int k;
+
+  double base_f;
+  double base_inc;
+  double x;
+
+  long   pitches[48];
+
+  /* pitch table: 1 octave in 1/4 semitones, from c-2 */
+  base_f = 440 * cztables_exp2(-2 - 9 / 12.0);
+  base_inc = base_f * cztables_exp2(20) / clock_rate;
+
+  for (k = 0; k < 48; k++)
+  {
+    pitches[k] = cztables_round(base_inc * exp(log(2) * k / 48));
+    S_cztables_values[k] = pitches[k];
+  }
+
+  if (cztables_write_table(fp, "pitch table", "unsigned short",
+                           "S_apu_osc_pitch_table", 48, 4, 4))
+  {
+    return 1;
+  }
+
+  /* the last delta wraps around to the next octave */
+  for (k = 0; k < 47; k++)
+    S_cztables_values[k] = pitches[k + 1] - pitches[k];
+
+  S_cztables_values[47] = (2 * pitches[0]) - pitches[47];
+
+  if (cztables_write_table(fp, NULL, "unsigned short",
+                           "S_apu_osc_pitch_deltas", 48, 4, 2))
+  {
+    return 1;
+  }
+
+  /* sine wavetable */
+  for (k = 0; k < 256; k++)
+  {
+    x = sin(2 * CZTABLES_PI * (2 * k + 1) / 2048);
+    S_cztables_values[k] = cztables_round(-256 * cztables_log2(x));
+  }
+
+  if (cztables_write_table(fp,
+        "sine wavetable (10 bit index, 1st quarter cycle stored)",
+        "unsigned short", "S_apu_osc_sine_table", 256, 8, 5))
+  {
+    return 1;
+  }
+
+  /* level table: 11 bit values shifted over to 13 bits */
+  /* (like on the sega genesis), so the lower 2 bits    */
+  /* are always 0                                       */
+  for (k = 0; k < 256; k++)
+  {
+    x = cztables_round(cztables_exp2(13) * exp(log(0.5) * (k + 1) / 256));
+    S_cztables_values[k] = cztables_round(4 * floor(x / 4));
+  }
+
+  if (cztables_write_table(fp,
+        "converting from 12 bit db value to 13 bit linear value",
+        "unsigned short", "S_apu_osc_level_table", 256, 8, 4))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cztables_write_pcm()                                                       */
+/******************************************************************************/
+int cztables_write_pcm(FILE* fp, unsigned long clock_rate)
+{
+  int k;
+
+  double pcm_1hz_inc;
+
+  /* the sample rates, in the order of the apu pcm rates */
+  S_cztables_values[0] = 8287;
+  S_cztables_values[1] = 8363;
+  S_cztables_values[2] = 11025;
+  S_cztables_values[3] = 22050;
+
+  pcm_1hz_inc = cztables_exp2(16) / (clock_rate / CZTABLES_PCM_DIVIDER);
+
+  for (k = 0; k < 4; k++)
+  {
+    S_cztables_values[k] =
+      cztables_round(pcm_1hz_inc * S_cztables_values[k]);
+  }
+
+  if (cztables_write_table(fp,
+        "phase incs (16 bit mantissas), indexed by the sample rate",
+        "unsigned short", "S_apu_pcm_phase_incs_table", 4, 4, 5))
+  {
+    return 1;
+  }
+
+  /* curve table */
+  for (k = 0; k < 128; k++)
+  {
+    S_cztables_values[k] =
+      cztables_round(-256 * cztables_log2((2 * k + 1) / 255.0));
+  }
+
+  if (cztables_write_table(fp,
+        "converting from 7 bit magnitude to 12 bit db value",
+        "unsigned short", "S_apu_pcm_curve_table", 128, 8, 4))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cztables_write_out()                                                       */
+/******************************************************************************/
+int cztables_write_out(FILE* fp, unsigned long clock_rate)
+{
+  int k;
+  int t;
+
+  double fs;
+  double w;
+  double c;
+  double a1;
+  double b0;
+  double x;
+  double sum;
+
+  double window[CZTABLES_DS_ORDER + 1];
+  double taps[CZTABLES_DS_ORDER + 1];
+
+  fs = clock_rate;
+
+  /* dac (9 bits to 16 bits, 6 bit mantissas). the step  */
+  /* between -1 and 0 is about twice the others, like on */
+  /* the sega genesis                                    */
+  fprintf(fp, "/* dac (6 bit mantissas) */\n");
+  fprintf(fp, "#define APU_DAC_POS_MULT %4ld\n",
+              cztables_round(64 * (32767 / 255.0)));
+  fprintf(fp, "#define APU_DAC_NEG_MULT %4ld\n",
+              cztables_round(64 * ((32768 - 256) / 255.0)));
+  fprintf(fp, "\n");
+
+  /* first order butterworth filters (bilinear transform, */
+  /* with the cutoff prewarped, same as butter in octave) */
+  c = tan(CZTABLES_PI * CZTABLES_HP_CUTOFF / fs);
+  a1 = (c - 1) / (c + 1);
+  b0 = 1 / (1 + c);
+
+  fprintf(fp, "/* highpass filters (15 bit mantissas) */\n");
+  fprintf(fp, "#define APU_HP_MULT_A0 %6ld\n", cztables_round(32768.0));
+  fprintf(fp, "#define APU_HP_MULT_A1 %6ld\n", cztables_round(32768 * a1));
+  fprintf(fp, "#define APU_HP_MULT_B0 %6ld\n", cztables_round(32768 * b0));
+  fprintf(fp, "#define APU_HP_MULT_B1 %6ld\n", cztables_round(-32768 * b0));
+  fprintf(fp, "\n");
+
+  c = tan(CZTABLES_PI * CZTABLES_LP_CUTOFF / fs);
+  a1 = (c - 1) / (c + 1);
+  b0 = c / (1 + c);
+
+  fprintf(fp, "/* lowpass filters (15 bit mantissas) */\n");
+  fprintf(fp, "#define APU_LP_MULT_A0 %6ld\n", cztables_round(32768.0));
+  fprintf(fp, "#define APU_LP_MULT_A1 %6ld\n", cztables_round(32768 * a1));
+  fprintf(fp, "#define APU_LP_MULT_B0 %6ld\n", cztables_round(32768 * b0));
+  fprintf(fp, "#define APU_LP_MULT_B1 %6ld\n", cztables_round(32768 * b0));
+  fprintf(fp, "\n");
+
+  /* downsampler kernel: the ideal lowpass is sampled on a  */
+  /* frequency grid (the cutoff point itself is in the stop */
+  /* band), the impulse response is found with an inverse   */
+  /* cosine transform, and then it is hamming windowed and  */
+  /* scaled to unity gain at dc (as in fir1 / fir2)         */
+  w = CZTABLES_DS_CUTOFF / CZTABLES_OUT_DIVIDER;
+
+  for (t = 0; t <= CZTABLES_DS_ORDER; t++)
+  {
+    window[t] =
+      0.54 - 0.46 * cos(2 * CZTABLES_PI * t / CZTABLES_DS_ORDER);
+  }
+
+  sum = 0;
+
+  for (t = 0; t <= CZTABLES_DS_ORDER; t++)
+  {
+    x = 0;
+
+    for (k = 0; k <= CZTABLES_DS_GRID_SIZE; k++)
+    {
+      if ((double) k / CZTABLES_DS_GRID_SIZE >= w)
+        break;
+
+      if (k == 0)
+        x += 1;
+      else
+      {
+        x += 2 * cos(2 * CZTABLES_PI * k * (t - CZTABLES_DS_ORDER / 2) /
+                     (2 * CZTABLES_DS_GRID_SIZE));
+      }
+    }
+
+    taps[t] = (x / (2 * CZTABLES_DS_GRID_SIZE)) * window[t];
+    sum += taps[t];
+  }
+
+  /* the kernel is symmetric, so only the first half is stored */
+  for (t = 0; t <= CZTABLES_DS_ORDER / 2; t++)
+    S_cztables_values[t] = cztables_round(32768 * (taps[t] / sum));
+
+  if (cztables_write_table(fp, "downsampler filters", "short",
+                           "S_apu_ds_kernel",
+                           (CZTABLES_DS_ORDER / 2) + 1, 8, 5))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* main()                                                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+  int k;
+
+  unsigned long clock_rate;
+  char*         filename;
+
+  FILE*         fp;
+
+  /* parse command line:                                        */
+  /*   cztables [-clock hz] file.h                              */
+  /* writes the apu tables for the given clock rate (the output */
+  /* rate is half of it). the makefile runs this before apu.c   */
+  /* is compiled, so the tables are never pasted in by hand.    */
+  clock_rate = CZTABLES_DEFAULT_CLOCK_RATE;
+  filename = NULL;
+
+  for (k = 1; k < argc; k++)
+  {
+    if ((!strcmp(argv[k], "-clock")) && (k + 1 < argc))
+      clock_rate = strtoul(argv[++k], NULL, 10);
+    else if ((argv[k][0] != '-') && (filename == NULL))
+      filename = argv[k];
+    else
+    {
+      printf("Unknown option: %s\n", argv[k]);
+      return 1;
+    }
+  }
+
+  if (filename == NULL)
+  {
+    printf("Usage: cztables [-clock hz] file.h\n");
+    return 1;
+  }
+
+  /* the clock rate is a multiple of 1000 so that */
+  /* there are an integer number of samples per ms */
+  if ((clock_rate == 0) || (clock_rate % (1000 * CZTABLES_OUT_DIVIDER)))
+  {
+    printf("Invalid clock rate: %lu\n", clock_rate);
+    return 1;
+  }
+
+  fp = fopen(filename, "w");
+
+  if (fp == NULL)
+  {
+    printf("Error opening %s\n", filename);
+    return 1;
+  }
+
+  fprintf(fp, "/* apu tables, written by cztables (do not edit by hand) */\n");
+  fprintf(fp, "/* see gen/cztables.c and the octave directory           */\n");
+  fprintf(fp, "\n");
+  fprintf(fp, "#ifndef APU_TABLES_H\n");
+  fprintf(fp, "#define APU_TABLES_H\n");
+  fprintf(fp, "\n");
+  fprintf(fp, "#define APU_TABLES_CLOCK_RATE %lu\n", clock_rate);
+  fprintf(fp, "\n");
+
+  if (cztables_write_seq(fp, clock_rate) ||
+      cztables_write_env(fp) ||
+      cztables_write_osc(fp, clock_rate) ||
+      cztables_write_pcm(fp, clock_rate) ||
+      cztables_write_out(fp, clock_rate))
+  {
+    printf("Error writing %s\n", filename);
+    fclose(fp);
+    remove(filename);
+    return 1;
+  }
+
+  fprintf(fp, "#endif\n");
+
+  fclose(fp);
+
+  return 0;
+}
@@ -4,12 +4,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#ifdef APU_PROFILE
+#include <time.h>
+#endif
+
+/* the vector engines are built with per-function target  */
+/* attributes, so the rest of the file stays baseline x86 */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define APU_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 #include "apu.h"
 
-/* note: the tables are generated in gnu octave */
-/*       see the octave directory for .m files  */
+/* note: the tables are written by gen/cztables.c when  */
+/*       building (from the .m files in the octave dir) */
+#include "apu_tables.h"
 
 /**********/
 /* CLOCKS */
@@ -20,12 +33,16 @@
 #define APU_CLOCK_RATE        48000
 #define APU_CLOCKS_PER_SAMPLE (APU_CLOCK_RATE / APU_OUT_SAMPLING_RATE)
 
+#if APU_TABLES_CLOCK_RATE != APU_CLOCK_RATE
+#error "The apu tables were generated for another clock rate"
+#endif
+
 #define APU_SEQ_DIVIDER  8  /* seq clock is  6000 */
 #define APU_LFO_DIVIDER 32  /* lfo clock is  1500 */
 #define APU_ENV_DIVIDER  3  /* env clock is 16000 */
 #define APU_OSC_DIVIDER  1  /* osc clock is 48000 */
 #define APU_SYN_DIVIDER  1  /* syn clock is 48000 */
-#define APU_PCM_DIVIDER  1  /* pcm clock is 48000 */
+#define APU_PCM_DIVIDER  2  /* pcm clock is 24000 */
 
 #define APU_TMR_DIVIDER 96  /* lcm of the other dividers */
 
@@ -35,129 +52,10 @@ static unsigned short S_apu_timer;
 /* SEQUENCER */
 /*************/
 
-/* phase tables */
-static unsigned short S_apu_seq_phase_incs_table[224] = 
-  {  5592,  5767,  5942,  6117,  6291,  6466,  6641,  6816,
-     6991,  7165,  7340,  7515,  7690,  7864,  8039,  8214,
-     8389,  8563,  8738,  8913,  9088,  9262,  9437,  9612,
-     9787,  9961, 10136, 10311, 10486, 10661, 10835, 11010,
-    11185, 11360, 11534, 11709, 11884, 12059, 12233, 12408,
-    12583, 12758, 12932, 13107, 13282, 13457, 13631, 13806,
-    13981, 14156, 14331, 14505, 14680, 14855, 15030, 15204,
-    15379, 15554, 15729, 15903, 16078, 16253, 16428, 16602,
-    16777, 16952, 17127, 17302, 17476, 17651, 17826, 18001,
-    18175, 18350, 18525, 18700, 18874, 19049, 19224, 19399,
-    19573, 19748, 19923, 20098, 20272, 20447, 20622, 20797,
-    20972, 21146, 21321, 21496, 21671, 21845, 22020, 22195,
-    22370, 22544, 22719, 22894, 23069, 23243, 23418, 23593,
-    23768, 23942, 24117, 24292, 24467, 24642, 24816, 24991,
-    25166, 25341, 25515, 25690, 25865, 26040, 26214, 26389,
-    26564, 26739, 26913, 27088, 27263, 27438, 27613, 27787,
-    27962, 28137, 28312, 28486, 28661, 28836, 29011, 29185,
-    29360, 29535, 29710, 29884, 30059, 30234, 30409, 30583,
-    30758, 30933, 31108, 31283, 31457, 31632, 31807, 31982,
-    32156, 32331, 32506, 32681, 32855, 33030, 33205, 33380,
-    33554, 33729, 33904, 34079, 34253, 34428, 34603, 34778,
-    34953, 35127, 35302, 35477, 35652, 35826, 36001, 36176,
-    36351, 36525, 36700, 36875, 37050, 37224, 37399, 37574,
-    37749, 37923, 38098, 38273, 38448, 38623, 38797, 38972,
-    39147, 39322, 39496, 39671, 39846, 40021, 40195, 40370,
-    40545, 40720, 40894, 41069, 41244, 41419, 41594, 41768,
-    41943, 42118, 42293, 42467, 42642, 42817, 42992, 43166,
-    43341, 43516, 43691, 43865, 44040, 44215, 44390, 44564
-  };
-
-/* midi note tables */
-static unsigned char S_apu_seq_midi_note_number_table[128] = 
-  {  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-     0,  0,  0,  0,  0,  0,  0,  0,  0,  9, 10, 11,
-    12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
-    24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
-    36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
-    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
-    60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
-    72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83,
-    84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
-    96,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-     0,  0,  0,  0,  0,  0,  0
-  };
-
-static unsigned short S_apu_seq_midi_note_velocity_table[128] = 
-  { 4095, 1008, 1000,  992,  984,  976,  968,  960,
-     952,  944,  936,  928,  920,  912,  904,  896,
-     888,  880,  872,  864,  856,  848,  840,  832,
-     824,  816,  808,  800,  792,  784,  776,  768,
-     760,  752,  744,  736,  728,  720,  712,  704,
-     696,  688,  680,  672,  664,  656,  648,  640,
-     632,  624,  616,  608,  600,  592,  584,  576,
-     568,  560,  552,  544,  536,  528,  520,  512,
-     504,  496,  488,  480,  472,  464,  456,  448,
-     440,  432,  424,  416,  408,  400,  392,  384,
-     376,  368,  360,  352,  344,  336,  328,  320,
-     312,  304,  296,  288,  280,  272,  264,  256,
-     248,  240,  232,  224,  216,  208,  200,  192,
-     184,  176,  168,  160,  152,  144,  136,  128,
-     120,  112,  104,   96,   88,   80,   72,   64,
-      56,   48,   40,   32,   24,   16,    8,    0
-  };
-
-/* volume and panning (15 bit mantissas) */
-static unsigned short S_apu_inst_vol_table[128] = 
-  {     0,     2,     8,    18,    33,    51,    73,   100,
-      130,   165,   203,   246,   293,   343,   398,   457,
-      520,   587,   658,   733,   813,   896,   983,  1075,
-     1170,  1270,  1373,  1481,  1593,  1709,  1828,  1952,
-     2080,  2212,  2349,  2489,  2633,  2781,  2934,  3090,
-     3251,  3415,  3584,  3756,  3933,  4114,  4299,  4488,
-     4681,  4878,  5079,  5284,  5494,  5707,  5924,  6146,
-     6371,  6601,  6834,  7072,  7314,  7560,  7810,  8064,
-     8322,  8584,  8850,  9120,  9394,  9673,  9955, 10241,
-    10532, 10827, 11125, 11428, 11735, 12045, 12360, 12679,
-    13002, 13329, 13661, 13996, 14335, 14678, 15026, 15377,
-    15733, 16092, 16456, 16824, 17196, 17571, 17951, 18335,
-    18723, 19116, 19512, 19912, 20316, 20725, 21137, 21553,
-    21974, 22399, 22827, 23260, 23697, 24138, 24583, 25032,
-    25485, 25942, 26403, 26868, 27337, 27811, 28288, 28770,
-    29255, 29745, 30239, 30736, 31238, 31744, 32254, 32768
-  };  
-
-static unsigned short S_apu_inst_pan_L_table[128] = 
-  { 32768, 32766, 32758, 32746, 32729, 32706, 32679, 32647,
-    32610, 32568, 32522, 32470, 32413, 32352, 32286, 32214,
-    32138, 32058, 31972, 31881, 31786, 31686, 31581, 31471,
-    31357, 31238, 31114, 30986, 30853, 30715, 30572, 30425,
-    30274, 30118, 29957, 29792, 29622, 29448, 29269, 29086,
-    28899, 28707, 28511, 28311, 28106, 27897, 27684, 27467,
-    27246, 27020, 26791, 26557, 26320, 26078, 25833, 25583,
-    25330, 25073, 24812, 24548, 24279, 24008, 23732, 23453,
-    23170, 22737, 22443, 22146, 21846, 21542, 21235, 20925,
-    20611, 20294, 19975, 19652, 19326, 18997, 18666, 18331,
-    17994, 17654, 17311, 16965, 16617, 16267, 15914, 15558,
-    15200, 14840, 14478, 14113, 13746, 13377, 13006, 12633,
-    12258, 11882, 11503, 11123, 10741, 10357,  9972,  9585,
-     9196,  8807,  8416,  8023,  7630,  7235,  6839,  6442,
-     6045,  5646,  5246,  4846,  4444,  4043,  3640,  3237,
-     2833,  2430,  2025,  1620,  1216,   810,   405,     0
-  };
-
-static unsigned short S_apu_inst_pan_R_table[128] = 
-  {     0,   402,   804,  1206,  1608,  2009,  2411,  2811,
-     3212,  3612,  4011,  4410,  4808,  5205,  5602,  5998,
-     6393,  6787,  7180,  7571,  7962,  8351,  8740,  9127,
-     9512,  9896, 10279, 10660, 11039, 11417, 11793, 12167,
-    12540, 12910, 13279, 13646, 14010, 14373, 14733, 15091,
-    15447, 15800, 16151, 16500, 16846, 17190, 17531, 17869,
-    18205, 18538, 18868, 19195, 19520, 19841, 20160, 20475,
-    20788, 21097, 21403, 21706, 22006, 22302, 22595, 22884,
-    23170, 23596, 23876, 24151, 24424, 24692, 24956, 25217,
-    25474, 25727, 25976, 26221, 26462, 26699, 26932, 27161,
-    27386, 27606, 27822, 28034, 28242, 28445, 28644, 28839,
-    29029, 29215, 29396, 29573, 29745, 29913, 30076, 30235,
-    30389, 30538, 30683, 30823, 30958, 31088, 31214, 31335,
-    31451, 31562, 31669, 31771, 31867, 31959, 32046, 32128,
-    32206, 32278, 32345, 32408, 32465, 32518, 32565, 32608,
-    32645, 32678, 32705, 32728, 32745, 32758, 32765, 32768
-  };
+/* tempo range (bpm) */
+#define APU_SEQ_MIN_TEMPO     32
+#define APU_SEQ_MAX_TEMPO     255
+#define APU_SEQ_DEFAULT_TEMPO 120
 
 /*******/
 /* LFO */
@@ -189,78 +87,6 @@ enum
 #define APU_ENV_RATE_BASE_BLOCK 11
 #define APU_ENV_ZERO_INDEX      832
 
-/* step patterns */
-static unsigned short S_apu_env_step_patterns[16] = 
-  { 0x0000, 0x0080, 0x0808, 0x0888, 0x2222, 0x22A2, 0x2A2A, 0x2AAA,
-    0x5555, 0x55D5, 0x5D5D, 0x5DDD, 0x7777, 0x77F7, 0x7F7F, 0x7FFF
-  };
-
-/* parameter mapping */
-static unsigned short S_apu_env_adsr_rate_map[100] = 
-  { 127, 126, 124, 123, 122, 121, 119, 118, 117, 115,
-    114, 113, 112, 110, 109, 108, 106, 105, 104, 103,
-    101, 100,  99,  97,  96,  95,  94,  92,  91,  90,
-     89,  87,  86,  85,  83,  82,  81,  80,  78,  77,
-     76,  74,  73,  72,  71,  69,  68,  67,  65,  64,
-     63,  62,  60,  59,  58,  56,  55,  54,  53,  51,
-     50,  49,  47,  46,  45,  44,  42,  41,  40,  38,
-     37,  36,  35,  33,  32,  31,  30,  28,  27,  26,
-     24,  23,  22,  21,  19,  18,  17,  15,  14,  13,
-     12,  10,   9,   8,   6,   5,   4,   3,   1,   0
-  };
-
-static unsigned short S_apu_env_total_level_map[100] = 
-  { 1023,  824,  815,  807,  798,  790,  782,  773,  765,  756,
-     748,  740,  731,  723,  714,  706,  698,  689,  681,  672,
-     664,  656,  647,  639,  630,  622,  613,  605,  597,  588,
-     580,  571,  563,  555,  546,  538,  529,  521,  513,  504,
-     496,  487,  479,  471,  462,  454,  445,  437,  429,  420,
-     412,  403,  395,  387,  378,  370,  361,  353,  345,  336,
-     328,  319,  311,  303,  294,  286,  277,  269,  261,  252,
-     244,  235,  227,  219,  210,  202,  193,  185,  176,  168,
-     160,  151,  143,  134,  126,  118,  109,  101,   92,   84,
-      76,   67,   59,   50,   42,   34,   25,   17,    8,    0
-  };
-
-static unsigned short S_apu_env_sustain_level_map[100] = 
-  { 1023,  448,  443,  439,  434,  430,  425,  421,  416,  412,
-     407,  403,  398,  394,  389,  385,  380,  376,  371,  367,
-     362,  357,  353,  348,  344,  339,  335,  330,  326,  321,
-     317,  312,  308,  303,  299,  294,  290,  285,  281,  276,
-     272,  267,  262,  258,  253,  249,  244,  240,  235,  231,
-     226,  222,  217,  213,  208,  204,  199,  195,  190,  186,
-     181,  176,  172,  167,  163,  158,  154,  149,  145,  140,
-     136,  131,  127,  122,  118,  113,  109,  104,  100,   95,
-      91,   86,   81,   77,   72,   68,   63,   59,   54,   50,
-      45,   41,   36,   32,   27,   23,   18,   14,    9,    5
-  };
-
-static unsigned short S_apu_env_rate_ks_map[100] = 
-  {   21,   22,   22,   23,   23,   24,   24,   25,   25,   26,
-      26,   27,   27,   28,   29,   29,   30,   30,   31,   32,
-      32,   33,   34,   35,   35,   36,   37,   38,   38,   39,
-      40,   41,   42,   43,   44,   44,   45,   46,   47,   48,
-      49,   50,   52,   53,   54,   55,   56,   57,   58,   60,
-      61,   62,   64,   65,   66,   68,   69,   71,   72,   74,
-      75,   77,   78,   80,   82,   84,   85,   87,   89,   91,
-      93,   95,   97,   99,  101,  103,  105,  108,  110,  112,
-     115,  117,  119,  122,  125,  127,  130,  133,  135,  138,
-     141,  144,  147,  150,  154,  157,  160,  164,  167,  171
-  };
-
-static unsigned short S_apu_env_level_ks_map[100] = 
-  {  171,  174,  178,  182,  186,  190,  194,  198,  202,  206,
-     211,  215,  220,  224,  229,  234,  239,  244,  249,  254,
-     260,  265,  271,  277,  283,  289,  295,  301,  307,  314,
-     320,  327,  334,  341,  349,  356,  364,  371,  379,  387,
-     395,  404,  412,  421,  430,  439,  449,  458,  468,  478,
-     488,  498,  509,  520,  531,  542,  553,  565,  577,  589,
-     602,  615,  628,  641,  655,  668,  683,  697,  712,  727,
-     743,  758,  774,  791,  808,  825,  842,  860,  878,  897,
-     916,  935,  955,  976,  996, 1017, 1039, 1061, 1084, 1107,
-    1130, 1154, 1179, 1204, 1229, 1255, 1282, 1309, 1337, 1365
-  };
-
 /*******/
 /* OSC */
 /*******/
@@ -273,72 +99,6 @@ static unsigned short S_apu_env_level_ks_map[100] =
 
 #define APU_OSC_PITCH_BASE_BLOCK 2
 
-static unsigned short S_apu_osc_pitch_table[48] = 
-  { 1429, 1450, 1471, 1492,
-    1514, 1536, 1558, 1581,
-    1604, 1627, 1651, 1675,
-    1699, 1724, 1749, 1774,
-    1800, 1826, 1853, 1880,
-    1907, 1935, 1963, 1992,
-    2021, 2050, 2080, 2110,
-    2141, 2172, 2204, 2236,
-    2268, 2301, 2335, 2369,
-    2403, 2438, 2473, 2509,
-    2546, 2583, 2620, 2659,
-    2697, 2736, 2776, 2817
-  };
-
-static unsigned short S_apu_osc_pitch_deltas[48] = 
-  { 21, 21, 21, 22,
-    22, 22, 23, 23,
-    23, 24, 24, 24,
-    25, 25, 25, 26,
-    26, 27, 27, 27,
-    28, 28, 29, 29,
-    29, 30, 30, 31,
-    31, 32, 32, 32,
-    33, 34, 34, 34,
-    35, 35, 36, 37,
-    37, 37, 39, 38,
-    39, 40, 41, 41
-  };
-
-/* sine wavetable (10 bit index, 1st quarter cycle stored) */
-static unsigned short S_apu_osc_sine_table[256] = 
-  {  2137,  1731,  1543,  1419,  1326,  1252,  1190,  1137,
-     1091,  1050,  1013,   979,   949,   920,   894,   869,
-      846,   825,   804,   785,   767,   749,   732,   717,
-      701,   687,   672,   659,   646,   633,   621,   609,
-      598,   587,   576,   566,   556,   546,   536,   527,
-      518,   509,   501,   492,   484,   476,   468,   461,
-      453,   446,   439,   432,   425,   418,   411,   405,
-      399,   392,   386,   380,   375,   369,   363,   358,
-      352,   347,   341,   336,   331,   326,   321,   316,
-      311,   307,   302,   297,   293,   289,   284,   280,
-      276,   271,   267,   263,   259,   255,   251,   248,
-      244,   240,   236,   233,   229,   226,   222,   219,
-      215,   212,   209,   205,   202,   199,   196,   193,
-      190,   187,   184,   181,   178,   175,   172,   169,
-      167,   164,   161,   159,   156,   153,   151,   148,
-      146,   143,   141,   138,   136,   134,   131,   129,
-      127,   125,   122,   120,   118,   116,   114,   112,
-      110,   108,   106,   104,   102,   100,    98,    96,
-       94,    92,    91,    89,    87,    85,    83,    82,
-       80,    78,    77,    75,    74,    72,    70,    69,
-       67,    66,    64,    63,    62,    60,    59,    57,
-       56,    55,    53,    52,    51,    49,    48,    47,
-       46,    45,    43,    42,    41,    40,    39,    38,
-       37,    36,    35,    34,    33,    32,    31,    30,
-       29,    28,    27,    26,    25,    24,    23,    23,
-       22,    21,    20,    20,    19,    18,    17,    17,
-       16,    15,    15,    14,    13,    13,    12,    12,
-       11,    10,    10,     9,     9,     8,     8,     7,
-        7,     7,     6,     6,     5,     5,     5,     4,
-        4,     4,     3,     3,     3,     2,     2,     2,
-        2,     1,     1,     1,     1,     1,     1,     1,
-        0,     0,     0,     0,     0,     0,     0,     0
-  };
-
 /* level table */
 #define APU_OSC_LEVEL_NUM_BLOCKS 16   /* blocks 0 to 15 */
 #define APU_OSC_LEVEL_TABLE_SIZE 256
@@ -347,71 +107,17 @@ static unsigned short S_apu_osc_sine_table[256] =
 
 #define APU_OSC_LEVEL_ZERO_BLOCK 13   /* output is zeroed from here out */
 
-/* converting from 12 bit db value to 13 bit linear value */
-static unsigned short S_apu_osc_level_table[APU_OSC_LEVEL_TABLE_SIZE] = 
-  { 8168, 8148, 8124, 8104, 8080, 8060, 8036, 8016,
-    7992, 7972, 7952, 7928, 7908, 7884, 7864, 7844,
-    7820, 7800, 7780, 7760, 7736, 7716, 7696, 7676,
-    7656, 7632, 7612, 7592, 7572, 7552, 7532, 7512,
-    7492, 7472, 7448, 7428, 7408, 7388, 7368, 7348,
-    7328, 7308, 7292, 7272, 7252, 7232, 7212, 7192,
-    7172, 7152, 7132, 7116, 7096, 7076, 7056, 7036,
-    7020, 7000, 6980, 6964, 6944, 6924, 6904, 6888,
-    6868, 6848, 6832, 6812, 6796, 6776, 6756, 6740,
-    6720, 6704, 6684, 6668, 6648, 6632, 6612, 6596,
-    6576, 6560, 6540, 6524, 6508, 6488, 6472, 6452,
-    6436, 6420, 6400, 6384, 6368, 6348, 6332, 6316,
-    6300, 6280, 6264, 6248, 6232, 6212, 6196, 6180,
-    6164, 6148, 6132, 6112, 6096, 6080, 6064, 6048,
-    6032, 6016, 6000, 5984, 5968, 5952, 5936, 5916,
-    5900, 5884, 5872, 5856, 5840, 5824, 5808, 5792,
-    5776, 5760, 5744, 5728, 5712, 5696, 5684, 5668,
-    5652, 5636, 5620, 5604, 5592, 5576, 5560, 5544,
-    5532, 5516, 5500, 5484, 5472, 5456, 5440, 5428,
-    5412, 5396, 5384, 5368, 5352, 5340, 5324, 5312,
-    5296, 5280, 5268, 5252, 5240, 5224, 5212, 5196,
-    5184, 5168, 5156, 5140, 5128, 5112, 5100, 5084,
-    5072, 5056, 5044, 5032, 5016, 5004, 4988, 4976,
-    4964, 4948, 4936, 4924, 4908, 4896, 4884, 4868,
-    4856, 4844, 4832, 4816, 4804, 4792, 4780, 4764,
-    4752, 4740, 4728, 4712, 4700, 4688, 4676, 4664,
-    4652, 4636, 4624, 4612, 4600, 4588, 4576, 4564,
-    4552, 4540, 4528, 4512, 4500, 4488, 4476, 4464,
-    4452, 4440, 4428, 4416, 4404, 4392, 4380, 4368,
-    4356, 4344, 4336, 4324, 4312, 4300, 4288, 4276,
-    4264, 4252, 4240, 4228, 4220, 4208, 4196, 4184,
-    4172, 4160, 4152, 4140, 4128, 4116, 4104, 4096
-  };
-
 /*******/
 /* PCM */
 /*******/
 
-
-
 /*******/
 /* OUT */
 /*******/
 
-/* dac (6 bit mantissas) */
-#define APU_DAC_POS_MULT 8224
-#define APU_DAC_NEG_MULT 8160
-
-/* highpass filters (15 bit mantissas) */
-#define APU_HP_MULT_A0  32768
-#define APU_HP_MULT_A1 -32631
-#define APU_HP_MULT_B0  32700
-#define APU_HP_MULT_B1 -32700
-
 static short S_apu_hp_in[4];  /* 2 channels, 2 inputs each  */
 static short S_apu_hp_out[4]; /* 2 channels, 2 outputs each */
 
-/* lowpass filters (15 bit mantissas) */
-#define APU_LP_MULT_A0  32768
-#define APU_LP_MULT_A1 -22395
-#define APU_LP_MULT_B0   5187
-#define APU_LP_MULT_B1   5187
-
 static short S_apu_lp_in[4];
 static short S_apu_lp_out[4];
 
@@ -421,19 +127,37 @@ static short S_apu_lp_out[4];
 #define APU_DS_KERNEL_SIZE ((APU_DS_M / 2) + 1)
 #define APU_DS_BUFFER_SIZE (APU_DS_M + 1)
 
-static short S_apu_ds_kernel[APU_DS_KERNEL_SIZE] = 
-  {    -3,   -28,    -9,    32,    28,   -32,   -56,    21,
-       93,    14,  -128,   -81,   142,   178,  -113,  -295,
-       17,   403,   161,  -462,  -424,   419,   757,  -214,
-    -1129,  -232,  1494,  1072, -1803, -2819,  2009, 10211,
-    14318
-  };
-
-static short S_apu_ds_L_in[APU_DS_BUFFER_SIZE];
-static short S_apu_ds_R_in[APU_DS_BUFFER_SIZE];
+/* the input buffers are mirrored (each sample is written twice, */
+/* one buffer size apart), so that the filter window starting at  */
+/* the buffer position is always one contiguous run of samples    */
+static short S_apu_ds_L_in[2 * APU_DS_BUFFER_SIZE];
+static short S_apu_ds_R_in[2 * APU_DS_BUFFER_SIZE];
 
 static short S_apu_ds_buf_pos;
 
+/* output resampler (see apu_set_output_rate). it runs from the */
+/* clock rate to the output rate, as L / M in lowest terms: each */
+/* output sample comes M / L clocks after the last one, and its  */
+/* offset past the newest clock (in Ls) picks the row of taps.   */
+/* it reads the same mirrored input buffers as the downsampler   */
+#define APU_RS_MAX_PHASES 512
+#define APU_RS_MAX_TAPS   64
+
+/* the taps in each row sum to this (so a row has unity gain) */
+#define APU_RS_UNITY 16384
+
+#define APU_PI 3.14159265358979323846
+
+static short S_apu_rs_table[APU_RS_MAX_PHASES * APU_RS_MAX_TAPS];
+
+static unsigned int S_apu_out_rate = APU_OUT_SAMPLING_RATE;
+
+static int          S_apu_rs_flag;
+static unsigned int S_apu_rs_num_phases;
+static unsigned int S_apu_rs_step;
+static unsigned int S_apu_rs_num_taps;
+static unsigned int S_apu_rs_phase;
+
 /* stereo output */
 short G_apu_out_L;
 short G_apu_out_R;
@@ -496,13 +220,15 @@ enum
   APU_NUM_OSC_REGS 
 };
 
-#define APU_NUM_FM_VOICES (9 + 1)
+/* the voice and operator counts depend on the variant (see apu_config.h) */
+#define APU_NUM_FM_VOICES APU_CONFIG_FM_VOICES
+#define APU_NUM_FM_OPS    APU_CONFIG_FM_OPERATORS
 
 #define APU_NUM_KBDS (1 * APU_NUM_FM_VOICES)
 #define APU_NUM_SYNS (1 * APU_NUM_FM_VOICES)
 #define APU_NUM_LFOS (1 * APU_NUM_FM_VOICES)
-#define APU_NUM_ENVS (4 * APU_NUM_FM_VOICES)
-#define APU_NUM_OSCS (4 * APU_NUM_FM_VOICES)
+#define APU_NUM_ENVS (APU_NUM_FM_OPS * APU_NUM_FM_VOICES)
+#define APU_NUM_OSCS (APU_NUM_FM_OPS * APU_NUM_FM_VOICES)
 
 #define APU_KBD_REGS_BANK_SIZE (APU_NUM_KBDS * APU_NUM_KBD_REGS)
 #define APU_SYN_REGS_BANK_SIZE (APU_NUM_SYNS * APU_NUM_SYN_REGS)
@@ -526,10 +252,12 @@ static unsigned short S_apu_osc_regs_bank[APU_OSC_REGS_BANK_SIZE];
   S_apu_lfo_regs_bank[(v_no) * APU_NUM_LFO_REGS + APU_LFO_REG_##reg]
 
 #define APU_ENV_REG(v_no, e_no, reg)                                           \
-  S_apu_env_regs_bank[(4 * v_no + e_no) * APU_NUM_ENV_REGS + APU_ENV_REG_##reg]
+  S_apu_env_regs_bank[(APU_NUM_FM_OPS * (v_no) + (e_no)) * APU_NUM_ENV_REGS +  \
+                      APU_ENV_REG_##reg]
 
 #define APU_OSC_REG(v_no, o_no, reg)                                           \
-  S_apu_osc_regs_bank[(4 * v_no + o_no) * APU_NUM_OSC_REGS + APU_OSC_REG_##reg]
+  S_apu_osc_regs_bank[(APU_NUM_FM_OPS * (v_no) + (o_no)) * APU_NUM_OSC_REGS +  \
+                      APU_OSC_REG_##reg]
 
 /* pcm voices */
 enum
@@ -541,10 +269,11 @@ enum
   APU_PCM_REG_PHASE, 
   APU_PCM_REG_INDEX, 
   APU_PCM_REG_LEVEL, 
+  APU_PCM_REG_OUTPUT, 
   APU_NUM_PCM_REGS 
 };
 
-#define APU_NUM_PCM_VOICES (5 + 1)
+#define APU_NUM_PCM_VOICES APU_CONFIG_PCM_VOICES
 
 #define APU_PCM_REGS_BANK_SIZE (APU_NUM_PCM_VOICES * APU_NUM_PCM_REGS)
 
@@ -553,7 +282,7 @@ static unsigned short S_apu_pcm_regs_bank[APU_PCM_REGS_BANK_SIZE];
 #define APU_PCM_REG(voice_num, reg)                                            \
   S_apu_pcm_regs_bank[(voice_num) * APU_NUM_PCM_REGS + APU_PCM_REG_##reg]
 
-/* sequencer tracks */
+/* sequencer tracks (the tracks themselves are listed in apu.h) */
 enum
 {
   APU_SEQ_REG_SONG_NO = 0, 
@@ -561,16 +290,12 @@ enum
   APU_SEQ_REG_DELAY, 
   APU_SEQ_REG_PHASE, 
   APU_SEQ_REG_INDEX, 
+  APU_SEQ_REG_LOOP_INDEX, 
+  APU_SEQ_REG_LOOP_COUNT, 
+  APU_SEQ_REG_RETURN_INDEX, 
   APU_NUM_SEQ_REGS 
 };
 
-enum
-{
-  APU_SEQ_TRACK_MUSIC = 0, 
-  APU_SEQ_TRACK_SFX, 
-  APU_NUM_SEQ_TRACKS 
-};
-
 #define APU_SEQ_REGS_BANK_SIZE (APU_NUM_SEQ_TRACKS * APU_NUM_SEQ_REGS)
 
 static unsigned short S_apu_seq_regs_bank[APU_SEQ_REGS_BANK_SIZE];
@@ -578,32 +303,158 @@ static unsigned short S_apu_seq_regs_bank[APU_SEQ_REGS_BANK_SIZE];
 #define APU_SEQ_REG(track_num, reg)                                            \
   S_apu_seq_regs_bank[(track_num) * APU_NUM_SEQ_REGS + APU_SEQ_REG_##reg]
 
-/***********/
-/* PATCHES */
-/***********/
-
-/* wave patches */
+/* voice allocation (the same registers for fm and pcm voices) */
 enum
 {
-  APU_PATCH_PARAM_SYN_FB = 0, 
-  APU_PATCH_PARAM_SYN_ALG, 
-  APU_PATCH_PARAM_ENV_AR, 
-  APU_PATCH_PARAM_ENV_DR, 
-  APU_PATCH_PARAM_ENV_SR, 
-  APU_PATCH_PARAM_ENV_RR, 
-  APU_PATCH_PARAM_ENV_SL, 
-  APU_PATCH_PARAM_ENV_TL, 
-  APU_PATCH_PARAM_LFO_SPEED, 
-  APU_PATCH_PARAM_VIB_SENS_DEPTH, 
-  APU_PATCH_PARAM_TREM_SENS_DEPTH, 
-  APU_NUM_PATCH_PARAMS 
+  APU_ALLOC_REG_OWNER = 0,  /* 0 if none, or 1 + (16 * track) + channel */
+  APU_ALLOC_REG_NOTE, 
+  APU_ALLOC_REG_HELD, 
+  APU_ALLOC_REG_PRIORITY, 
+  APU_ALLOC_REG_AGE, 
+  APU_ALLOC_REG_IDLE,       /* fm only: the envelopes have run down */
+  APU_NUM_ALLOC_REGS 
 };
 
-#define APU_MAX_PATCHES 32
+#define APU_FM_ALLOC_REGS_BANK_SIZE  (APU_NUM_FM_VOICES * APU_NUM_ALLOC_REGS)
+#define APU_PCM_ALLOC_REGS_BANK_SIZE (APU_NUM_PCM_VOICES * APU_NUM_ALLOC_REGS)
+
+static unsigned short S_apu_fm_alloc_regs_bank[APU_FM_ALLOC_REGS_BANK_SIZE];
+static unsigned short S_apu_pcm_alloc_regs_bank[APU_PCM_ALLOC_REGS_BANK_SIZE];
+
+#define APU_FM_ALLOC_REG(v_no, reg)                                            \
+  S_apu_fm_alloc_regs_bank[(v_no) * APU_NUM_ALLOC_REGS + APU_ALLOC_REG_##reg]
+
+#define APU_PCM_ALLOC_REG(v_no, reg)                                           \
+  S_apu_pcm_alloc_regs_bank[(v_no) * APU_NUM_ALLOC_REGS + APU_ALLOC_REG_##reg]
+
+/* midi channel state. each track has its own set of channels, */
+/* and the values are indexed by sequencer command, so they    */
+/* can be passed on to a voice whenever one is allocated.      */
+#define APU_NUM_CHANNELS  16
+#define APU_DRUM_CHANNEL  9
+
+#define APU_CHAN_REGS_BANK_SIZE (APU_NUM_SEQ_TRACKS * APU_NUM_CHANNELS * 16)
+
+static unsigned char S_apu_chan_regs_bank[APU_CHAN_REGS_BANK_SIZE];
+
+#define APU_CHAN_REG(track_num, chan_num, code)                                \
+  S_apu_chan_regs_bank[((track_num) * APU_NUM_CHANNELS + (chan_num)) * 16 +    \
+                       ((code) & 0x0F)]
+
+/* the channel state that is copied to a voice */
+#define APU_NUM_CHAN_CODES 8
 
+static unsigned char S_apu_chan_codes[APU_NUM_CHAN_CODES] = 
+  { APU_SEQ_CMD_PROGRAM,      APU_SEQ_CMD_VOLUME, 
+    APU_SEQ_CMD_PANNING,      APU_SEQ_CMD_PITCH_WHEEL, 
+    APU_SEQ_CMD_PRESSURE,     APU_SEQ_CMD_MOD_WHEEL, 
+    APU_SEQ_CMD_PORTAMENTO,   APU_SEQ_CMD_SUSTAIN 
+  };
+
+/* allocator settings: the most voices that can sound at once (which */
+/* bounds the work per sample), and the voices kept for the sfx track */
+static unsigned short S_apu_fm_polyphony = APU_NUM_FM_VOICES;
+static unsigned short S_apu_pcm_polyphony = APU_NUM_PCM_VOICES;
+
+static unsigned short S_apu_fm_sfx_voices = 1;
+static unsigned short S_apu_pcm_sfx_voices = 1;
+
+static unsigned short S_apu_alloc_age;
+
+/* quality settings (see apu_set_quality) */
+static unsigned short S_apu_quality;
+
+static unsigned short S_apu_ds_num_taps = APU_DS_M / 2;
+static unsigned short S_apu_osc_steps = 1;
+static unsigned short S_apu_env_ticks = 1;
+static unsigned short S_apu_env_count;
+
+/* preview mode (see apu_set_preview) */
+static unsigned short S_apu_preview;
+static unsigned short S_apu_update_clocks = APU_CLOCKS_PER_SAMPLE;
+
+/* the most fm voices that can sound at each quality level */
+static unsigned short S_apu_quality_fm_voices[APU_NUM_QUALITY_LEVELS] = 
+  { APU_NUM_FM_VOICES, APU_NUM_FM_VOICES, 
+    APU_NUM_FM_VOICES, APU_NUM_FM_VOICES, 6, 4, 2 
+  };
+
+/* render engine (they all sound the same, see apu.h) */
+static unsigned short S_apu_engine = APU_ENGINE_FAST;
+
+static char* S_apu_engine_names[APU_NUM_ENGINES] = 
+  { "reference", "fast", "sse2", "sse41", "avx2", "avx512" };
+
+/* voice lanes for the vector engines. the operator and mixer kernels */
+/* work on the voices side by side, so their inputs are copied here   */
+/* (the fm voices, then the pcm voices), and the tables they look up  */
+/* are widened to 32 bits for the gathers                             */
+#define APU_VEC_LANES 16
+
+#if (APU_NUM_FM_VOICES + APU_NUM_PCM_VOICES) > APU_VEC_LANES
+#error "The vector engines have lanes for at most 16 voices"
+#endif
+
+static unsigned short S_apu_vec_index[APU_VEC_LANES];
+static unsigned short S_apu_vec_env_level[APU_VEC_LANES];
+static unsigned short S_apu_vec_syn_level[APU_VEC_LANES];
+
+static unsigned short S_apu_vec_level[APU_VEC_LANES];
+static unsigned short S_apu_vec_sign[APU_VEC_LANES];
+static unsigned short S_apu_vec_vol[APU_VEC_LANES];
+static unsigned short S_apu_vec_pan_L[APU_VEC_LANES];
+static unsigned short S_apu_vec_pan_R[APU_VEC_LANES];
+
+static int S_apu_vec_sine_table[256];
+static int S_apu_vec_level_table[APU_OSC_LEVEL_TABLE_SIZE];
+
+/*************/
+/* PROFILING */
+/*************/
+
+/* stage timings are in cpu cycles where the time stamp counter */
+/* can be read directly, and in clock() ticks everywhere else   */
+#ifdef APU_PROFILE
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define APU_PROFILE_CLOCK() ((unsigned long) __builtin_ia32_rdtsc())
+#else
+#define APU_PROFILE_CLOCK() ((unsigned long) clock())
+#endif
+
+/* the counters are only touched by the thread that runs the chip, */
+/* and are copied out (atomically) at the end of each block for    */
+/* the other threads to read                                        */
+static apu_profile S_apu_profile;
+static apu_profile S_apu_profile_shared;
+
+#define APU_PROFILE_STAGE(stage, call)                                         \
+  do                                                                           \
+  {                                                                            \
+    unsigned long start = APU_PROFILE_CLOCK();                                 \
+                                                                               \
+    call;                                                                      \
+                                                                               \
+    S_apu_profile.cycles[APU_STAGE_##stage] +=                                 \
+      APU_PROFILE_CLOCK() - start;                                             \
+    S_apu_profile.calls[APU_STAGE_##stage] += 1;                               \
+  } while (0)
+
+#define APU_PROFILE_COUNT(counter, amount)                                     \
+  S_apu_profile.counter += (amount)
+#else
+#define APU_PROFILE_STAGE(stage, call) call
+#define APU_PROFILE_COUNT(counter, amount)
+#endif
+
+/***********/
+/* PATCHES */
+/***********/
+
+/* wave patches (the params are listed in apu.h) */
 #define APU_PATCH_BANK_SIZE (APU_MAX_PATCHES * APU_NUM_PATCH_PARAMS)
 
-static unsigned char S_apu_patches[APU_PATCH_BANK_SIZE];
+static unsigned char  S_apu_patch_bank[APU_PATCH_BANK_SIZE];
+static unsigned char* S_apu_patches = S_apu_patch_bank;
 
 #define APU_PATCH_PARAM(patch_num, param)                                      \
   S_apu_patches[(patch_num) * APU_NUM_PATCH_PARAMS + APU_PATCH_PARAM_##param]
@@ -626,7 +477,8 @@ enum
 
 #define APU_KIT_BANK_SIZE (APU_MAX_KITS * APU_NUM_KIT_PARAMS)
 
-static unsigned char S_apu_kits[APU_KIT_BANK_SIZE];
+static unsigned char  S_apu_kit_bank[APU_KIT_BANK_SIZE];
+static unsigned char* S_apu_kits = S_apu_kit_bank;
 
 #define APU_KIT_PARAM(kit_num, param)                                          \
   S_apu_kits[(kit_num) * APU_NUM_KIT_PARAMS + APU_KIT_PARAM_##param]
@@ -651,7 +503,8 @@ enum
 
 #define APU_SAMPLE_NAMETABLE_SIZE (APU_MAX_SAMPLES * APU_NUM_SAMPLE_PARAMS)
 
-static unsigned char S_apu_samples[APU_SAMPLE_NAMETABLE_SIZE];
+static unsigned char  S_apu_sample_nametable[APU_SAMPLE_NAMETABLE_SIZE];
+static unsigned char* S_apu_samples = S_apu_sample_nametable;
 
 #define APU_SAMPLE_PARAM(samp_num, param)                                      \
   S_apu_samples[(samp_num) * APU_NUM_SAMPLE_PARAMS + APU_SAMPLE_PARAM_##param]
@@ -671,7 +524,8 @@ enum
 
 #define APU_SONG_NAMETABLE_SIZE (APU_MAX_SONGS * APU_NUM_SONG_PARAMS)
 
-static unsigned char S_apu_songs[APU_SONG_NAMETABLE_SIZE];
+static unsigned char  S_apu_song_nametable[APU_SONG_NAMETABLE_SIZE];
+static unsigned char* S_apu_songs = S_apu_song_nametable;
 
 #define APU_SONG_PARAM(song_num, param)                                        \
   S_apu_songs[(song_num) * APU_NUM_SONG_PARAMS + APU_SONG_PARAM_##param]
@@ -680,11 +534,43 @@ static unsigned char S_apu_songs[APU_SONG_NAMETABLE_SIZE];
 /* ROMS */
 /********/
 
-#define APU_MIDI_DATA_SIZE (1 << 19)
-#define APU_PCM_DATA_SIZE  (1 << 19)
+#define APU_MIDI_DATA_SIZE APU_CONFIG_MIDI_DATA_SIZE
+#define APU_PCM_DATA_SIZE  APU_CONFIG_PCM_DATA_SIZE
+
+static unsigned char  S_apu_midi_rom[APU_MIDI_DATA_SIZE];
+static unsigned char  S_apu_pcm_rom[APU_PCM_DATA_SIZE];
+
+static unsigned char* S_apu_midi_data = S_apu_midi_rom;
+static unsigned char* S_apu_pcm_data = S_apu_pcm_rom;
+
+/* the patches, kits, nametables and roms above normally point at */
+/* the banks here, but can point at a (read only) cartridge image  */
+static int S_apu_cart_flag;
 
-static unsigned char S_apu_midi_data[APU_MIDI_DATA_SIZE];
-static unsigned char S_apu_pcm_data[APU_PCM_DATA_SIZE];
+/* clearing the roms just starts a new generation. a nametable entry */
+/* is only valid if it was written during the current generation,    */
+/* and the bytes of the old songs and samples are left as they were. */
+static unsigned int S_apu_rom_gen;
+static unsigned int S_apu_song_gens[APU_MAX_SONGS];
+static unsigned int S_apu_sample_gens[APU_MAX_SAMPLES];
+
+/* (the entries in a cartridge are always valid) */
+#define APU_SONG_VALID(song_num)                                               \
+  (S_apu_cart_flag || (S_apu_song_gens[song_num] == S_apu_rom_gen))
+
+#define APU_SAMPLE_VALID(samp_num)                                             \
+  (S_apu_cart_flag || (S_apu_sample_gens[samp_num] == S_apu_rom_gen))
+
+/* midi rom allocation */
+static unsigned int   S_apu_midi_data_num_bytes;
+
+/* pcm rom allocation */
+static unsigned int   S_apu_pcm_data_num_bytes;
+
+static unsigned short S_apu_pcm_load_samp_num;
+static unsigned int   S_apu_pcm_load_addr;
+static unsigned int   S_apu_pcm_load_num_bytes;
+static unsigned char  S_apu_pcm_load_rate;
 
 /******************************************************************************/
 /* apu_reset()                                                                */
@@ -730,7 +616,7 @@ int apu_reset()
 
   for (m = 0; m < APU_NUM_FM_VOICES; m++)
   {
-    for (n = 0; n < 4; n++)
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
     {
       APU_ENV_REG(m, n, STAGE)    = APU_ENV_STAGE_R;
       APU_ENV_REG(m, n, PERIOD)   = 0;
@@ -745,14 +631,35 @@ int apu_reset()
 
   for (m = 0; m < APU_NUM_FM_VOICES; m++)
   {
-    for (n = 0; n < 4; n++)
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
     {
       APU_OSC_REG(m, n, INDEX)    = 0;
       APU_OSC_REG(m, n, MANTISSA) = 0;
     }
   }
 
+  /* every fm voice starts out released, so they are all idle */
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    APU_FM_ALLOC_REG(m, OWNER)    = 0;
+    APU_FM_ALLOC_REG(m, NOTE)     = 0;
+    APU_FM_ALLOC_REG(m, HELD)     = 0;
+    APU_FM_ALLOC_REG(m, PRIORITY) = 0;
+    APU_FM_ALLOC_REG(m, AGE)      = 0;
+    APU_FM_ALLOC_REG(m, IDLE)     = 1;
+  }
+
   /* reset other registers */
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    APU_PCM_ALLOC_REG(m, OWNER)     = 0;
+    APU_PCM_ALLOC_REG(m, NOTE)      = 0;
+    APU_PCM_ALLOC_REG(m, HELD)      = 0;
+    APU_PCM_ALLOC_REG(m, PRIORITY)  = 0;
+    APU_PCM_ALLOC_REG(m, AGE)       = 0;
+    APU_PCM_ALLOC_REG(m, IDLE)      = 0;
+  }
+
   for (m = 0; m < APU_NUM_PCM_VOICES; m++)
   {
     APU_PCM_REG(m, SAMPLE_NO) = 0;
@@ -760,11 +667,30 @@ int apu_reset()
     APU_PCM_REG(m, PANNING)   = 0;
     APU_PCM_REG(m, VELOCITY)  = 0;
 
-    APU_PCM_REG(m, PHASE) = 0;
-    APU_PCM_REG(m, INDEX) = 0;
-    APU_PCM_REG(m, LEVEL) = APU_OSC_MAX_LEVEL;
+    APU_PCM_REG(m, PHASE)   = 0;
+    APU_PCM_REG(m, INDEX)   = 0;
+    APU_PCM_REG(m, LEVEL)   = APU_OSC_MAX_LEVEL;
+    APU_PCM_REG(m, OUTPUT)  = 0;
+  }
+
+  /* channels start at the midi reset values (volume 100, pan center) */
+  for (m = 0; m < APU_NUM_SEQ_TRACKS; m++)
+  {
+    for (n = 0; n < APU_NUM_CHANNELS; n++)
+    {
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_PROGRAM)     = 0;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_VOLUME)      = 100;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_PANNING)     = 64;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_PITCH_WHEEL) = 0;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_PRESSURE)    = 0;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_MOD_WHEEL)   = 0;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_PORTAMENTO)  = 0;
+      APU_CHAN_REG(m, n, APU_SEQ_CMD_SUSTAIN)     = 0;
+    }
   }
 
+  S_apu_alloc_age = 0;
+
   for (m = 0; m < APU_NUM_SEQ_TRACKS; m++)
   {
     APU_SEQ_REG(m, SONG_NO) = 0;
@@ -772,65 +698,15 @@ int apu_reset()
     APU_SEQ_REG(m, PHASE)   = 0;
     APU_SEQ_REG(m, INDEX)   = 0;
     APU_SEQ_REG(m, DELAY)   = 0;
-  }
-
-  /* reset params */
-  for (m = 0; m < APU_MAX_PATCHES; m++)
-  {
-    APU_PATCH_PARAM(m, SYN_FB)  = 0;
-    APU_PATCH_PARAM(m, SYN_ALG) = 0;
 
-    APU_PATCH_PARAM(m, ENV_AR) = 0;
-    APU_PATCH_PARAM(m, ENV_DR) = 0;
-    APU_PATCH_PARAM(m, ENV_SR) = 0;
-    APU_PATCH_PARAM(m, ENV_RR) = 0;
-    APU_PATCH_PARAM(m, ENV_SL) = 0;
-    APU_PATCH_PARAM(m, ENV_TL) = 0;
-
-    APU_PATCH_PARAM(m, LFO_SPEED) = 0;
-    APU_PATCH_PARAM(m, VIB_SENS_DEPTH) = 0;
-    APU_PATCH_PARAM(m, TREM_SENS_DEPTH) = 0;
-  }
-
-  for (m = 0; m < APU_MAX_KITS; m++)
-  {
-    APU_KIT_PARAM(m, SAMPLE_NO_BD) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_SD) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_OH) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_CH) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_CY) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_RD) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_LT) = 0;
-    APU_KIT_PARAM(m, SAMPLE_NO_HT) = 0;
-  }
-
-  /* reset nametables */
-  for (m = 0; m < APU_MAX_SAMPLES; m++)
-  {
-    APU_SAMPLE_PARAM(m, ADDR_1) = 0x00;
-    APU_SAMPLE_PARAM(m, ADDR_2) = 0x00;
-    APU_SAMPLE_PARAM(m, ADDR_3) = 0x00;
-    APU_SAMPLE_PARAM(m, SIZE_1) = 0x00;
-    APU_SAMPLE_PARAM(m, SIZE_2) = 0x00;
-    APU_SAMPLE_PARAM(m, RATE)   = 0;
-  }
+    APU_SEQ_REG(m, LOOP_INDEX)    = 0;
+    APU_SEQ_REG(m, LOOP_COUNT)    = 0;
+    APU_SEQ_REG(m, RETURN_INDEX)  = 0;
 
-  for (m = 0; m < APU_MAX_SONGS; m++)
-  {
-    APU_SONG_PARAM(m, ADDR_1) = 0x00;
-    APU_SONG_PARAM(m, ADDR_2) = 0x00;
-    APU_SONG_PARAM(m, ADDR_3) = 0x00;
-    APU_SONG_PARAM(m, SIZE_1) = 0x00;
-    APU_SONG_PARAM(m, SIZE_2) = 0x00;
+    /* the roms are kept, so make sure nothing starts playing */
+    apu_stop_song(m);
   }
 
-  /* reset roms */
-  for (m = 0; m < APU_MIDI_DATA_SIZE; m++)
-    S_apu_midi_data[m] = 0;
-
-  for (m = 0; m < APU_PCM_DATA_SIZE; m++)
-    S_apu_pcm_data[m] = 0;
-
   /* reset filters */
   for (m = 0; m < 4; m++)
   {
@@ -841,22 +717,61 @@ int apu_reset()
     S_apu_lp_out[m] = 0;
   }
 
-  for (m = 0; m < APU_DS_BUFFER_SIZE; m++)
+  for (m = 0; m < 2 * APU_DS_BUFFER_SIZE; m++)
   {
     S_apu_ds_L_in[m] = 0;
     S_apu_ds_R_in[m] = 0;
   }
 
   S_apu_ds_buf_pos = 0;
+  S_apu_rs_phase = 0;
 
   /* reset output */
   G_apu_out_L = 0;
   G_apu_out_R = 0;
 
-  /* testing: setup the 1st patch */
+  /* testing: setup the 1st keyboard */
   APU_KBD_REG(0, VOLUME)   = 127;
   APU_KBD_REG(0, PANNING)  = 64;
 
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_clear_roms()                                                           */
+/******************************************************************************/
+int apu_clear_roms()
+{
+  /* a mapped cartridge is read only */
+  if (S_apu_cart_flag)
+    return 1;
+
+  /* reset params */
+  memset(S_apu_patches, 0, APU_PATCH_BANK_SIZE);
+  memset(S_apu_kits, 0, APU_KIT_BANK_SIZE);
+
+  /* invalidate the nametables. if the generation wraps around, */
+  /* the old entries have to be invalidated the long way        */
+  S_apu_rom_gen += 1;
+
+  if (S_apu_rom_gen == 0)
+  {
+    memset(S_apu_song_gens, 0, sizeof(S_apu_song_gens));
+    memset(S_apu_sample_gens, 0, sizeof(S_apu_sample_gens));
+
+    S_apu_rom_gen = 1;
+  }
+
+  /* new songs and samples start at the beginning of the roms */
+  S_apu_midi_data_num_bytes = 0;
+  S_apu_pcm_data_num_bytes = 0;
+
+  S_apu_pcm_load_samp_num = APU_MAX_SAMPLES;
+  S_apu_pcm_load_addr = 0;
+  S_apu_pcm_load_num_bytes = 0;
+  S_apu_pcm_load_rate = 0;
+
+  /* testing: setup the 1st patch */
   APU_PATCH_PARAM(0, ENV_AR) = 20;
   APU_PATCH_PARAM(0, ENV_DR) = 25;
   APU_PATCH_PARAM(0, ENV_SR) = 50;
@@ -870,6 +785,25 @@ int apu_reset()
   return 0;
 }
 
+/******************************************************************************/
+/* apu_wipe_roms()                                                            */
+/******************************************************************************/
+int apu_wipe_roms()
+{
+  /* a full clear, for when the bytes themselves need to be */
+  /* zero (for example, before building a cartridge image)  */
+  if (S_apu_cart_flag)
+    return 1;
+
+  memset(S_apu_samples, 0, APU_SAMPLE_NAMETABLE_SIZE);
+  memset(S_apu_songs, 0, APU_SONG_NAMETABLE_SIZE);
+
+  memset(S_apu_midi_data, 0, APU_MIDI_DATA_SIZE);
+  memset(S_apu_pcm_data, 0, APU_PCM_DATA_SIZE);
+
+  return apu_clear_roms();
+}
+
 /******************************************************************************/
 /* apu_play_note()                                                            */
 /******************************************************************************/
@@ -878,6 +812,7 @@ int apu_play_note(unsigned short inst_num, unsigned short note)
   int n;
 
   unsigned short patch_num;
+  unsigned short ar;
   unsigned short speed;
 
   if (inst_num >= APU_NUM_FM_VOICES)
@@ -891,17 +826,22 @@ int apu_play_note(unsigned short inst_num, unsigned short note)
 
   APU_KBD_REG(inst_num, NOTE) = S_apu_seq_midi_note_number_table[note];
 
+  /* the allocator sets the owner after this, if it played the note */
+  APU_FM_ALLOC_REG(inst_num, OWNER) = 0;
+  APU_FM_ALLOC_REG(inst_num, HELD)  = 0;
+  APU_FM_ALLOC_REG(inst_num, IDLE)  = 0;
+
   APU_LFO_REG(inst_num, INDEX)    = 0;
   APU_LFO_REG(inst_num, MANTISSA) = 0;
 
-  for (n = 0; n < 4; n++)
+  for (n = 0; n < APU_NUM_FM_OPS; n++)
   {
     APU_ENV_REG(inst_num, n, STAGE)    = APU_ENV_STAGE_A;
     APU_ENV_REG(inst_num, n, STEP)     = 0;
     APU_ENV_REG(inst_num, n, MANTISSA) = 0;
   }
 
-  for (n = 0; n < 4; n++)
+  for (n = 0; n < APU_NUM_FM_OPS; n++)
   {
     APU_OSC_REG(inst_num, n, INDEX)    = 0;
     APU_OSC_REG(inst_num, n, MANTISSA) = 0;
@@ -910,9 +850,12 @@ int apu_play_note(unsigned short inst_num, unsigned short note)
   /* initialize envelope block & pattern */
   patch_num = APU_KBD_REG(inst_num, PATCH_NO);
 
-  for (n = 0; n < 4; n++)
+  ar = APU_PATCH_PARAM(patch_num, ENV_AR);
+  ar = (ar > 99) ? 99 : ar;
+
+  for (n = 0; n < APU_NUM_FM_OPS; n++)
   {
-    speed = S_apu_env_adsr_rate_map[APU_PATCH_PARAM(patch_num, ENV_AR)];
+    speed = S_apu_env_adsr_rate_map[ar];
 
     APU_ENV_REG(inst_num, n, BLOCK)   = speed / APU_ENV_RATE_PATTERNS_PER_BLOCK;
     APU_ENV_REG(inst_num, n, PATTERN) = speed % APU_ENV_RATE_PATTERNS_PER_BLOCK;
@@ -923,585 +866,3986 @@ int apu_play_note(unsigned short inst_num, unsigned short note)
 }
 
 /******************************************************************************/
-/* apu_advance_sequencer()                                                    */
+/* apu_release_note()                                                         */
 /******************************************************************************/
-int apu_advance_sequencer()
+int apu_release_note(unsigned short inst_num)
 {
+  int n;
+
+  if (inst_num >= APU_NUM_FM_VOICES)
+    return 0;
+
+  for (n = 0; n < APU_NUM_FM_OPS; n++)
+    APU_ENV_REG(inst_num, n, STAGE) = APU_ENV_STAGE_R;
+
   return 0;
 }
 
 /******************************************************************************/
-/* apu_advance_lfo()                                                          */
+/* apu_play_sample()                                                          */
 /******************************************************************************/
-int apu_advance_lfo()
+int apu_play_sample(unsigned short voice_num, unsigned short samp_num, 
+                    unsigned short velocity)
 {
-  int m;
+  if (voice_num >= APU_NUM_PCM_VOICES)
+    return 0;
 
-  for (m = 0; m < APU_NUM_LFOS; m++)
-  {
+  if (samp_num >= APU_MAX_SAMPLES)
+    return 0;
 
-  }
+  if (velocity >= 128)
+    return 0;
+
+  APU_PCM_REG(voice_num, SAMPLE_NO) = samp_num;
+  APU_PCM_REG(voice_num, VELOCITY)  = velocity;
+
+  APU_PCM_ALLOC_REG(voice_num, OWNER) = 0;
+
+  APU_PCM_REG(voice_num, PHASE)   = 0;
+  APU_PCM_REG(voice_num, INDEX)   = 0;
+  APU_PCM_REG(voice_num, LEVEL)   = S_apu_seq_midi_note_velocity_table[velocity];
+  APU_PCM_REG(voice_num, OUTPUT)  = 0;
 
   return 0;
 }
 
 /******************************************************************************/
-/* apu_advance_env()                                                          */
+/* apu_sample_begin()                                                         */
 /******************************************************************************/
-int apu_advance_env()
+int apu_sample_begin(unsigned short samp_num, unsigned char rate)
 {
-  int m;
-  int n;
+  /* a mapped cartridge is read only */
+  if (S_apu_cart_flag)
+    return 1;
 
-  /* local patch param variables, for clarity */
-  unsigned char ar;
-  unsigned char dr;
-  unsigned char sr;
-  unsigned char rr;
-  unsigned char sl;
-  unsigned char tl;
+  if (samp_num >= APU_MAX_SAMPLES)
+    return 1;
 
-  /* local register variables, for clarity */
-  unsigned short patch_num;
-  unsigned short stage;
-  unsigned short period;
-  unsigned short block;
-  unsigned short pattern;
-  unsigned short step;
-  unsigned short index;
-  unsigned short mantissa;
-  unsigned short level;
+  if (rate >= APU_NUM_PCM_RATES)
+    return 1;
 
-  /* other local variables */
-  unsigned short mask;
-  unsigned short delta;
-  unsigned short increment;
-  unsigned short speed;
+  /* new samples are placed after the ones already loaded */
+  S_apu_pcm_load_samp_num = samp_num;
+  S_apu_pcm_load_addr = S_apu_pcm_data_num_bytes;
+  S_apu_pcm_load_num_bytes = 0;
+  S_apu_pcm_load_rate = rate;
 
-  for (m = 0; m < APU_NUM_FM_VOICES; m++)
-  {
-    for (n = 0; n < 4; n++)
-    {
-      /* check if period has elapsed */
-      if (APU_ENV_REG(m, n, PERIOD) > 0)
-      {
-        APU_ENV_REG(m, n, PERIOD) -= 1;
-        continue;
-      }
+  return 0;
+}
 
-      /* load registers to local variables */
-      stage     = APU_ENV_REG(m, n, STAGE);
-      period    = APU_ENV_REG(m, n, PERIOD);
-      block     = APU_ENV_REG(m, n, BLOCK);
-      pattern   = APU_ENV_REG(m, n, PATTERN);
-      step      = APU_ENV_REG(m, n, STEP);
-      index     = APU_ENV_REG(m, n, INDEX);
-      mantissa  = APU_ENV_REG(m, n, MANTISSA);
-      level     = APU_ENV_REG(m, n, LEVEL);
+/******************************************************************************/
+/* apu_sample_append()                                                        */
+/******************************************************************************/
+int apu_sample_append(unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int k;
 
-      /* load patch params to local variables */
-      patch_num = APU_KBD_REG(m, PATCH_NO);
+  if (S_apu_cart_flag)
+    return 1;
 
-      ar = APU_PATCH_PARAM(patch_num, ENV_AR);
-      dr = APU_PATCH_PARAM(patch_num, ENV_DR);
-      sr = APU_PATCH_PARAM(patch_num, ENV_SR);
-      rr = APU_PATCH_PARAM(patch_num, ENV_RR);
-      sl = APU_PATCH_PARAM(patch_num, ENV_SL);
-      tl = APU_PATCH_PARAM(patch_num, ENV_TL);
+  if (S_apu_pcm_load_samp_num >= APU_MAX_SAMPLES)
+    return 1;
 
-      ar = (ar > 99) ? 99 : ar;
-      dr = (dr > 99) ? 99 : dr;
-      sr = (sr > 99) ? 99 : sr;
-      rr = (rr > 99) ? 99 : rr;
-      sl = (sl > 99) ? 99 : sl;
-      tl = (tl > 99) ? 99 : tl;
+  if (data == NULL)
+    return 1;
 
-      /* update pattern step */
-      step += 1;
-      step &= 0x0F;
+  /* make sure the data fits in the rom, and in the nametable size field */
+  if (num_bytes > APU_PCM_DATA_SIZE - 
+                  (S_apu_pcm_load_addr + S_apu_pcm_load_num_bytes))
+  {
+    return 1;
+  }
 
-      /* determine delta for this step */
-      if (step == 0)
-        mask = 1;
-      else
-        mask = 1 << step;
+  if (num_bytes > APU_MAX_SAMPLE_SIZE - S_apu_pcm_load_num_bytes)
+    return 1;
 
-      if (block <= APU_ENV_RATE_BASE_BLOCK)
-      {
-        if (S_apu_env_step_patterns[8 + pattern] & mask)
-          delta = 1;
-        else
-          delta = 0;
-      }
-      else
-      {
-        if (S_apu_env_step_patterns[2 * pattern] & mask)
-          delta = 1 + block - APU_ENV_RATE_BASE_BLOCK;
-        else
-          delta = 0 + block - APU_ENV_RATE_BASE_BLOCK;
+  for (k = 0; k < num_bytes; k++)
+  {
+    S_apu_pcm_data[S_apu_pcm_load_addr + S_apu_pcm_load_num_bytes + k] = 
+      data[k];
+  }
 
-        if (delta > 4)
-          delta = 4;
-      }
+  S_apu_pcm_load_num_bytes += num_bytes;
 
-      /* update index */
-      if (delta > 0)
-      {
-        if (stage == APU_ENV_STAGE_A)
-        {
-          increment = index >> (5 - delta);
+  return 0;
+}
 
-          if (increment == 0)
-            increment = 1;
+/******************************************************************************/
+/* apu_sample_end()                                                           */
+/******************************************************************************/
+int apu_sample_end()
+{
+  unsigned short samp_num;
 
-          if (index >= increment)
-            index -= increment;
-          else
-            index = 0;
+  if (S_apu_cart_flag)
+    return 1;
 
-          if (index == 0)
-            stage = APU_ENV_STAGE_D;
-        }
-        else
-        {
-          if (delta > 1)
-            increment = 1 << (delta - 1);
-          else
-            increment = 1;
+  if (S_apu_pcm_load_samp_num >= APU_MAX_SAMPLES)
+    return 1;
 
-          index += increment;
+  samp_num = S_apu_pcm_load_samp_num;
 
-          if (index > APU_ENV_MAX_INDEX)
-            index = APU_ENV_MAX_INDEX;
+  /* fill in the nametable entry */
+  APU_SAMPLE_PARAM(samp_num, ADDR_1) = (S_apu_pcm_load_addr >> 16) & 0xFF;
+  APU_SAMPLE_PARAM(samp_num, ADDR_2) = (S_apu_pcm_load_addr >>  8) & 0xFF;
+  APU_SAMPLE_PARAM(samp_num, ADDR_3) = S_apu_pcm_load_addr & 0xFF;
+  APU_SAMPLE_PARAM(samp_num, SIZE_1) = (S_apu_pcm_load_num_bytes >> 8) & 0xFF;
+  APU_SAMPLE_PARAM(samp_num, SIZE_2) = S_apu_pcm_load_num_bytes & 0xFF;
+  APU_SAMPLE_PARAM(samp_num, RATE)   = S_apu_pcm_load_rate;
 
-          if ((stage == APU_ENV_STAGE_D) && 
-              (index >= S_apu_env_sustain_level_map[sl]))
-          {
-            stage = APU_ENV_STAGE_S;
-          }
-        }
-      }
+  S_apu_sample_gens[samp_num] = S_apu_rom_gen;
 
-      /* update level */
-      level = (index + S_apu_env_total_level_map[tl]) << 2;
+  S_apu_pcm_data_num_bytes = S_apu_pcm_load_addr + S_apu_pcm_load_num_bytes;
 
-      if (level > APU_ENV_MAX_LEVEL)
-        level = APU_ENV_MAX_LEVEL;
+  S_apu_pcm_load_samp_num = APU_MAX_SAMPLES;
 
-      /* reset period countdown timer */
-      if (stage == APU_ENV_STAGE_A)
-        speed = S_apu_env_adsr_rate_map[ar];
-      else if (stage == APU_ENV_STAGE_D)
-        speed = S_apu_env_adsr_rate_map[dr];
-      else if (stage == APU_ENV_STAGE_S)
-        speed = S_apu_env_adsr_rate_map[sr];
-      else
-        speed = S_apu_env_adsr_rate_map[rr];
+  return 0;
+}
 
-      block   = speed / APU_ENV_RATE_PATTERNS_PER_BLOCK;
-      pattern = speed % APU_ENV_RATE_PATTERNS_PER_BLOCK;
+/******************************************************************************/
+/* apu_load_patch()                                                           */
+/******************************************************************************/
+int apu_load_patch( unsigned short patch_num, 
+                    unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int k;
 
-      if (block < APU_ENV_RATE_BASE_BLOCK)
-        period = 1 << (APU_ENV_RATE_BASE_BLOCK - block);
-      else
-        period = 1;
+  /* a mapped cartridge is read only */
+  if (S_apu_cart_flag)
+    return 1;
 
-      /* store local variables to registers */
-      APU_ENV_REG(m, n, STAGE)    = stage;
-      APU_ENV_REG(m, n, PERIOD)   = period;
-      APU_ENV_REG(m, n, BLOCK)    = block;
-      APU_ENV_REG(m, n, PATTERN)  = pattern;
-      APU_ENV_REG(m, n, STEP)     = step;
-      APU_ENV_REG(m, n, INDEX)    = index;
-      APU_ENV_REG(m, n, MANTISSA) = mantissa;
-      APU_ENV_REG(m, n, LEVEL)    = level;
-    }
+  if (patch_num >= APU_MAX_PATCHES)
+    return 1;
+
+  if (data == NULL)
+    return 1;
+
+  /* patches are always complete */
+  if (num_bytes != APU_NUM_PATCH_PARAMS)
+    return 1;
+
+  for (k = 0; k < num_bytes; k++)
+    S_apu_patches[patch_num * APU_NUM_PATCH_PARAMS + k] = data[k];
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_load_song()                                                            */
+/******************************************************************************/
+int apu_load_song(unsigned short song_num, 
+                  unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int k;
+  unsigned int addr;
+
+  /* a mapped cartridge is read only */
+  if (S_apu_cart_flag)
+    return 1;
+
+  if (song_num >= APU_MAX_SONGS)
+    return 1;
+
+  if (data == NULL)
+    return 1;
+
+  /* make sure the song fits in the rom, and in the nametable size field */
+  if (num_bytes > APU_MAX_SONG_SIZE)
+    return 1;
+
+  if (num_bytes > APU_MIDI_DATA_SIZE - S_apu_midi_data_num_bytes)
+    return 1;
+
+  /* new songs are placed after the ones already loaded */
+  addr = S_apu_midi_data_num_bytes;
+
+  for (k = 0; k < num_bytes; k++)
+    S_apu_midi_data[addr + k] = data[k];
+
+  S_apu_midi_data_num_bytes += num_bytes;
+
+  /* fill in the nametable entry */
+  APU_SONG_PARAM(song_num, ADDR_1) = (addr >> 16) & 0xFF;
+  APU_SONG_PARAM(song_num, ADDR_2) = (addr >>  8) & 0xFF;
+  APU_SONG_PARAM(song_num, ADDR_3) = addr & 0xFF;
+  APU_SONG_PARAM(song_num, SIZE_1) = (num_bytes >> 8) & 0xFF;
+  APU_SONG_PARAM(song_num, SIZE_2) = num_bytes & 0xFF;
+
+  S_apu_song_gens[song_num] = S_apu_rom_gen;
+
+  /* a stopped track is parked at the end of its song, so any */
+  /* track that was on this entry has to be parked again      */
+  for (k = 0; k < APU_NUM_SEQ_TRACKS; k++)
+  {
+    if (APU_SEQ_REG(k, SONG_NO) == song_num)
+      apu_stop_song(k);
   }
 
   return 0;
 }
 
 /******************************************************************************/
-/* apu_advance_osc()                                                          */
+/* apu_rom_region()                                                           */
 /******************************************************************************/
-int apu_advance_osc()
+int apu_rom_region( int region, 
+                    unsigned char** data, unsigned int* num_bytes)
+{
+  if ((data == NULL) || (num_bytes == NULL))
+    return 1;
+
+  if (region == APU_ROM_REGION_PATCHES)
+  {
+    *data = S_apu_patches;
+    *num_bytes = APU_PATCH_BANK_SIZE;
+  }
+  else if (region == APU_ROM_REGION_KITS)
+  {
+    *data = S_apu_kits;
+    *num_bytes = APU_KIT_BANK_SIZE;
+  }
+  else if (region == APU_ROM_REGION_SAMPLES)
+  {
+    *data = S_apu_samples;
+    *num_bytes = APU_SAMPLE_NAMETABLE_SIZE;
+  }
+  else if (region == APU_ROM_REGION_SONGS)
+  {
+    *data = S_apu_songs;
+    *num_bytes = APU_SONG_NAMETABLE_SIZE;
+  }
+  else if (region == APU_ROM_REGION_MIDI_DATA)
+  {
+    *data = S_apu_midi_data;
+    *num_bytes = APU_MIDI_DATA_SIZE;
+  }
+  else if (region == APU_ROM_REGION_PCM_DATA)
+  {
+    *data = S_apu_pcm_data;
+    *num_bytes = APU_PCM_DATA_SIZE;
+  }
+  else
+    return 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_attach_cart()                                                          */
+/******************************************************************************/
+int apu_attach_cart(unsigned char** regions)
+{
+  int k;
+
+  if (regions == NULL)
+    return 1;
+
+  for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+  {
+    if (regions[k] == NULL)
+      return 1;
+  }
+
+  /* the chip reads straight from the cartridge (no copying) */
+  S_apu_patches   = regions[APU_ROM_REGION_PATCHES];
+  S_apu_kits      = regions[APU_ROM_REGION_KITS];
+  S_apu_samples   = regions[APU_ROM_REGION_SAMPLES];
+  S_apu_songs     = regions[APU_ROM_REGION_SONGS];
+  S_apu_midi_data = regions[APU_ROM_REGION_MIDI_DATA];
+  S_apu_pcm_data  = regions[APU_ROM_REGION_PCM_DATA];
+
+  S_apu_cart_flag = 1;
+
+  /* stop anything that was playing from the old roms */
+  for (k = 0; k < APU_NUM_SEQ_TRACKS; k++)
+    apu_stop_song(k);
+
+  for (k = 0; k < APU_NUM_PCM_VOICES; k++)
+    APU_PCM_REG(k, LEVEL) = APU_OSC_MAX_LEVEL;
+
+  /* cancel any sample that was being loaded */
+  S_apu_pcm_load_samp_num = APU_MAX_SAMPLES;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_detach_cart()                                                          */
+/******************************************************************************/
+int apu_detach_cart()
+{
+  int k;
+
+  if (!S_apu_cart_flag)
+    return 0;
+
+  /* go back to the chip's own banks */
+  S_apu_patches   = S_apu_patch_bank;
+  S_apu_kits      = S_apu_kit_bank;
+  S_apu_samples   = S_apu_sample_nametable;
+  S_apu_songs     = S_apu_song_nametable;
+  S_apu_midi_data = S_apu_midi_rom;
+  S_apu_pcm_data  = S_apu_pcm_rom;
+
+  S_apu_cart_flag = 0;
+
+  for (k = 0; k < APU_NUM_SEQ_TRACKS; k++)
+    apu_stop_song(k);
+
+  for (k = 0; k < APU_NUM_PCM_VOICES; k++)
+    APU_PCM_REG(k, LEVEL) = APU_OSC_MAX_LEVEL;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_play_song()                                                            */
+/******************************************************************************/
+int apu_play_song(unsigned short track_num, unsigned short song_num)
+{
+  if (track_num >= APU_NUM_SEQ_TRACKS)
+    return 1;
+
+  if (song_num >= APU_MAX_SONGS)
+    return 1;
+
+  APU_SEQ_REG(track_num, SONG_NO) = song_num;
+  APU_SEQ_REG(track_num, TEMPO)   = APU_SEQ_DEFAULT_TEMPO;
+  APU_SEQ_REG(track_num, DELAY)   = 0;
+  APU_SEQ_REG(track_num, PHASE)   = 0;
+  APU_SEQ_REG(track_num, INDEX)   = 0;
+
+  APU_SEQ_REG(track_num, LOOP_INDEX)    = 0;
+  APU_SEQ_REG(track_num, LOOP_COUNT)    = 0;
+  APU_SEQ_REG(track_num, RETURN_INDEX)  = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_stop_song()                                                            */
+/******************************************************************************/
+int apu_stop_song(unsigned short track_num)
 {
   int m;
-  int n;
 
-  /* local patch param variables, for clarity */
+  unsigned short song_num;
+  unsigned short owner;
 
-  /* local register variables, for clarity */
-  unsigned short patch_num;
-  unsigned short note;
-  unsigned short index;
-  unsigned short mantissa;
+  if (track_num >= APU_NUM_SEQ_TRACKS)
+    return 1;
 
-  /* other local variables */
-  unsigned short block;
-  unsigned short entry;
-  unsigned short step;
+  /* a track is stopped once its index is past the end of the song */
+  song_num = APU_SEQ_REG(track_num, SONG_NO);
 
-  int          current_pitch;
-  unsigned int phase_inc;
+  if (APU_SONG_VALID(song_num))
+  {
+    APU_SEQ_REG(track_num, INDEX) = (APU_SONG_PARAM(song_num, SIZE_1) << 8) | 
+                                     APU_SONG_PARAM(song_num, SIZE_2);
+  }
+  else
+    APU_SEQ_REG(track_num, INDEX) = 0;
+
+  APU_SEQ_REG(track_num, DELAY) = 0;
 
+  /* let go of any notes that the track was holding */
   for (m = 0; m < APU_NUM_FM_VOICES; m++)
   {
-    for (n = 0; n < 4; n++)
+    owner = APU_FM_ALLOC_REG(m, OWNER);
+
+    if ((owner == 0) || ((owner - 1) / 16 != track_num))
+      continue;
+
+    if (APU_FM_ALLOC_REG(m, HELD))
     {
-      /* load registers to local variables */
-      patch_num = APU_KBD_REG(m, PATCH_NO);
-      note      = APU_KBD_REG(m, NOTE);
-      index     = APU_OSC_REG(m, n, INDEX);
-      mantissa  = APU_OSC_REG(m, n, MANTISSA);
+      apu_release_note(m);
+      APU_FM_ALLOC_REG(m, HELD) = 0;
+    }
+  }
 
-      /* determine current pitch */
-      current_pitch = 64 * note;
+  return 0;
+}
 
-      if (current_pitch < 0)
-        current_pitch = 0;
-      else if (current_pitch > APU_OSC_MAX_PITCH)
-        current_pitch = APU_OSC_MAX_PITCH;
+/******************************************************************************/
+/* apu_seq_channel_mask()                                                     */
+/******************************************************************************/
+unsigned short apu_seq_channel_mask(unsigned short track_num)
+{
+  /* returns which midi channels of a song can be played. voices */
+  /* are allocated as notes come in, so any channel can be used  */
+  if (track_num < APU_NUM_SEQ_TRACKS)
+    return 0xFFFF;
+  else
+    return 0x0000;
+}
 
-      /* lookup phase increment */
-      block = current_pitch / (12 * 64);
-      entry = (current_pitch % (12 * 64)) / 16;
-      step  = (current_pitch % (12 * 64)) % 16;
+/******************************************************************************/
+/* apu_voice_command()                                                        */
+/******************************************************************************/
+int apu_voice_command(unsigned short inst_num, unsigned char code, 
+                      unsigned char data_1, unsigned char data_2)
+{
+  if (inst_num >= APU_NUM_FM_VOICES)
+    return 1;
 
-      phase_inc = S_apu_osc_pitch_table[entry];
-      phase_inc += (step * S_apu_osc_pitch_deltas[entry]) / 16;
+  data_1 &= 0x7F;
+  data_2 &= 0x7F;
 
-      if (block < APU_OSC_PITCH_BASE_BLOCK)
-        phase_inc = phase_inc >> (APU_OSC_PITCH_BASE_BLOCK - block);
-      else if (block > APU_OSC_PITCH_BASE_BLOCK)
-        phase_inc = phase_inc << (block - APU_OSC_PITCH_BASE_BLOCK);
+  switch (code & 0x0F)
+  {
+    case APU_SEQ_CMD_PROGRAM:
+      APU_KBD_REG(inst_num, PATCH_NO) = data_1 % APU_MAX_PATCHES;
+      break;
+
+    case APU_SEQ_CMD_VOLUME:
+      APU_KBD_REG(inst_num, VOLUME) = data_1;
+      break;
+
+    case APU_SEQ_CMD_PANNING:
+      APU_KBD_REG(inst_num, PANNING) = data_1;
+      break;
+
+    case APU_SEQ_CMD_NOTE_ON:
+      /* a note on with 0 velocity is a note off */
+      if (data_2 == 0)
+        return apu_voice_command(inst_num, APU_SEQ_CMD_NOTE_OFF, data_1, 0);
+
+      APU_KBD_REG(inst_num, VELOCITY) = data_2;
+      apu_play_note(inst_num, data_1);
+      break;
+
+    case APU_SEQ_CMD_NOTE_OFF:
+      /* only release the voice if it is still playing this note */
+      if (APU_KBD_REG(inst_num, NOTE) == S_apu_seq_midi_note_number_table[data_1])
+        apu_release_note(inst_num);
+      break;
+
+    case APU_SEQ_CMD_PITCH_WHEEL:
+      APU_KBD_REG(inst_num, WHEEL_PITCH) = data_1;
+      break;
+
+    case APU_SEQ_CMD_PRESSURE:
+      APU_KBD_REG(inst_num, WHEEL_TREM) = data_1;
+      break;
+
+    case APU_SEQ_CMD_MOD_WHEEL:
+      APU_KBD_REG(inst_num, WHEEL_VIB) = data_1;
+      break;
+
+    case APU_SEQ_CMD_PORTAMENTO:
+      APU_KBD_REG(inst_num, SW_PORTA) = (data_1 >= 64) ? 1 : 0;
+      break;
+
+    case APU_SEQ_CMD_SUSTAIN:
+      APU_KBD_REG(inst_num, SW_SUSTAIN) = (data_1 >= 64) ? 1 : 0;
+      break;
+
+    default:
+      break;
+  }
 
-      /* update phase (10.10 fixed point) */
-      mantissa += phase_inc & 0x3FF; 
+  return 0;
+}
 
-      index += (phase_inc >> 10) & 0x3FF;
-      index += (mantissa >> 10) & 0x3FF;
+/******************************************************************************/
+/* apu_set_polyphony()                                                        */
+/******************************************************************************/
+int apu_set_polyphony(unsigned short num_fm, unsigned short num_pcm)
+{
+  if ((num_fm == 0) || (num_fm > APU_NUM_FM_VOICES))
+    return 1;
 
-      index    &= 0x3FF;
-      mantissa &= 0x3FF;
+  if ((num_pcm == 0) || (num_pcm > APU_NUM_PCM_VOICES))
+    return 1;
 
-      /* store local variables to registers */
-      APU_OSC_REG(m, n, INDEX)    = index;
-      APU_OSC_REG(m, n, MANTISSA) = mantissa;
-    }
-  }
+  /* voices that are already playing are left to finish */
+  S_apu_fm_polyphony = num_fm;
+  S_apu_pcm_polyphony = num_pcm;
 
   return 0;
 }
 
 /******************************************************************************/
-/* apu_advance_syn()                                                          */
+/* apu_set_sfx_voices()                                                       */
 /******************************************************************************/
-int apu_advance_syn()
+int apu_set_sfx_voices(unsigned short num_fm, unsigned short num_pcm)
 {
-  int m;
-  int n;
+  /* the last voices are kept for the sfx track */
+  if (num_fm > APU_NUM_FM_VOICES)
+    return 1;
 
-  /* local patch param variables, for clarity */
-  unsigned char fb;
-  unsigned char alg;
+  if (num_pcm > APU_NUM_PCM_VOICES)
+    return 1;
 
-  /* local register variables, for clarity */
-  unsigned short patch_num;
-  unsigned short feedin_0;
-  unsigned short feedin_1;
-  unsigned short syn_level;
+  S_apu_fm_sfx_voices = num_fm;
+  S_apu_pcm_sfx_voices = num_pcm;
 
-  /* other local variables */
-  unsigned short adj_index;
-  unsigned short adj_level;
+  return 0;
+}
 
-  unsigned short block;
-  unsigned short entry;
+/******************************************************************************/
+/* apu_apply_cuts()                                                           */
+/******************************************************************************/
+int apu_apply_cuts()
+{
+  int preview;
+
+  /* the preview modes take the native rate and slow */
+  /* envelope cuts, whatever the quality level is    */
+  preview = (S_apu_preview != APU_PREVIEW_OFF);
+
+  S_apu_ds_num_taps = (S_apu_quality >= APU_QUALITY_SHORT_FIR) ? 
+                      8 : (APU_DS_M / 2);
+
+  S_apu_osc_steps = (preview || (S_apu_quality >= APU_QUALITY_NATIVE_RATE)) ? 
+                    S_apu_update_clocks : 1;
+
+  S_apu_env_ticks = (preview || (S_apu_quality >= APU_QUALITY_SLOW_ENV)) ? 
+                    2 : 1;
+  S_apu_env_count = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_set_quality()                                                          */
+/******************************************************************************/
+int apu_set_quality(unsigned short level)
+{
+  int m;
+  int n;
+
+  int            quietest;
+  unsigned short num_busy;
+
+  if (level >= APU_NUM_QUALITY_LEVELS)
+    return 1;
+
+  /* each level keeps the cuts of the levels above it */
+  S_apu_quality = level;
+
+  apu_apply_cuts();
+
+  /* silence the quietest voices until the rest fit */
+  while (1)
+  {
+    num_busy = 0;
+    quietest = -1;
+
+    for (m = 0; m < APU_NUM_FM_VOICES; m++)
+    {
+      if (APU_FM_ALLOC_REG(m, IDLE))
+        continue;
+
+      num_busy += 1;
+
+      if ((quietest < 0) || 
+          (APU_ENV_REG(m, 0, LEVEL) > APU_ENV_REG(quietest, 0, LEVEL)))
+      {
+        quietest = m;
+      }
+    }
+
+    if (num_busy <= S_apu_quality_fm_voices[level])
+      break;
+
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
+    {
+      APU_ENV_REG(quietest, n, STAGE) = APU_ENV_STAGE_R;
+      APU_ENV_REG(quietest, n, INDEX) = APU_ENV_MAX_INDEX;
+      APU_ENV_REG(quietest, n, LEVEL) = APU_ENV_MAX_LEVEL;
+    }
+
+    APU_SYN_REG(quietest, LEVEL) = 0;
+
+    APU_FM_ALLOC_REG(quietest, HELD) = 0;
+    APU_FM_ALLOC_REG(quietest, IDLE) = 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_get_quality()                                                          */
+/******************************************************************************/
+unsigned short apu_get_quality()
+{
+  return S_apu_quality;
+}
+
+/******************************************************************************/
+/* apu_set_preview()                                                          */
+/******************************************************************************/
+int apu_set_preview(unsigned short mode)
+{
+  if (mode >= APU_NUM_PREVIEW_MODES)
+    return 1;
+
+  S_apu_preview = mode;
+
+  /* at half rate, each update covers the clocks of two */
+  /* output samples, so the sequencer, envelopes and pcm */
+  /* voices still see every clock and keep their timing */
+  if (mode == APU_PREVIEW_HALF)
+    S_apu_update_clocks = 2 * APU_CLOCKS_PER_SAMPLE;
+  else
+    S_apu_update_clocks = APU_CLOCKS_PER_SAMPLE;
+
+  apu_apply_cuts();
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_get_preview()                                                          */
+/******************************************************************************/
+unsigned short apu_get_preview()
+{
+  return S_apu_preview;
+}
+
+/******************************************************************************/
+/* apu_set_output_rate()                                                      */
+/******************************************************************************/
+int apu_set_output_rate(unsigned int rate)
+{
+  unsigned int m;
+  unsigned int n;
+
+  unsigned int a;
+  unsigned int b;
+
+  unsigned int num_phases;
+  unsigned int step;
+  unsigned int num_taps;
+
+  short* row;
+  int    total;
+  int    biggest;
+
+  double cutoff;
+  double tau;
+  double val;
+  double sum;
+  double taps[APU_RS_MAX_TAPS];
+
+  if ((rate < APU_OUT_MIN_RATE) || (rate > APU_OUT_MAX_RATE))
+    return 1;
+
+  /* the default rate keeps the 2:1 downsampler */
+  if (rate == APU_OUT_SAMPLING_RATE)
+  {
+    S_apu_out_rate = rate;
+    S_apu_rs_flag = 0;
+    S_apu_rs_phase = 0;
+
+    return 0;
+  }
+
+  /* reduce the ratio to lowest terms */
+  a = rate;
+  b = APU_CLOCK_RATE;
+
+  while (b != 0)
+  {
+    m = a % b;
+    a = b;
+    b = m;
+  }
+
+  num_phases = rate / a;
+  step = APU_CLOCK_RATE / a;
+
+  if (num_phases > APU_RS_MAX_PHASES)
+    return 1;
+
+  /* the filter spans about 16 output samples, so the */
+  /* lower rates (under half the clock) need more taps */
+  num_taps = (step <= 2 * num_phases) ? 32 : 64;
+
+  /* blackman windowed sinc, with the cutoff a bit under the */
+  /* output nyquist. the output is num_taps / 2 clocks late,  */
+  /* so the taps for each phase are centered on that point    */
+  cutoff = 0.9 * num_phases / step;
+
+  for (m = 0; m < num_phases; m++)
+  {
+    sum = 0.0;
+
+    for (n = 0; n < num_taps; n++)
+    {
+      /* tap n reads the sample num_taps - 1 - n clocks back */
+      tau = (num_taps - 1.0 - n) - (num_taps / 2.0) + (double) m / num_phases;
+
+      if (tau == 0.0)
+        val = cutoff;
+      else
+        val = sin(APU_PI * cutoff * tau) / (APU_PI * tau);
+
+      val *= 0.42 + 0.5 * cos(2 * APU_PI * tau / num_taps) + 
+                    0.08 * cos(4 * APU_PI * tau / num_taps);
+
+      taps[n] = val;
+      sum += val;
+    }
+
+    /* round the taps, and put whatever that lost into the */
+    /* biggest one, so that every row has the same dc gain */
+    row = &S_apu_rs_table[m * APU_RS_MAX_TAPS];
+
+    total = 0;
+    biggest = 0;
+
+    for (n = 0; n < num_taps; n++)
+    {
+      row[n] = (short) floor(APU_RS_UNITY * taps[n] / sum + 0.5);
+      total += row[n];
+
+      if (abs(row[n]) > abs(row[biggest]))
+        biggest = n;
+    }
+
+    row[biggest] += APU_RS_UNITY - total;
+  }
+
+  S_apu_out_rate = rate;
+
+  S_apu_rs_flag = 1;
+  S_apu_rs_num_phases = num_phases;
+  S_apu_rs_step = step;
+  S_apu_rs_num_taps = num_taps;
+  S_apu_rs_phase = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_get_output_rate()                                                      */
+/******************************************************************************/
+unsigned int apu_get_output_rate()
+{
+  /* the number of samples that apu_update() makes per second */
+  if (S_apu_preview != APU_PREVIEW_OFF)
+    return APU_CLOCK_RATE / S_apu_update_clocks;
+
+  return S_apu_out_rate;
+}
+
+/******************************************************************************/
+/* apu_set_engine()                                                           */
+/******************************************************************************/
+int apu_set_engine(unsigned short engine)
+{
+  int k;
+
+  if (!apu_engine_supported(engine))
+    return 1;
+
+  /* the vector engines gather from 32 bit copies of these */
+  for (k = 0; k < 256; k++)
+    S_apu_vec_sine_table[k] = S_apu_osc_sine_table[k];
+
+  for (k = 0; k < APU_OSC_LEVEL_TABLE_SIZE; k++)
+    S_apu_vec_level_table[k] = S_apu_osc_level_table[k];
+
+  /* the engines share all of their state, so this can */
+  /* be switched at any time without a click           */
+  S_apu_engine = engine;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_get_engine()                                                           */
+/******************************************************************************/
+unsigned short apu_get_engine()
+{
+  return S_apu_engine;
+}
+
+/******************************************************************************/
+/* apu_engine_supported()                                                     */
+/******************************************************************************/
+int apu_engine_supported(unsigned short engine)
+{
+  if (engine >= APU_NUM_ENGINES)
+    return 0;
+
+  if ((engine == APU_ENGINE_REFERENCE) || (engine == APU_ENGINE_FAST))
+    return 1;
+
+#ifdef APU_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (engine == APU_ENGINE_SSE2)
+    return __builtin_cpu_supports("sse2") ? 1 : 0;
+  else if (engine == APU_ENGINE_SSE41)
+    return __builtin_cpu_supports("sse4.1") ? 1 : 0;
+  else if (engine == APU_ENGINE_AVX2)
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+  else if (engine == APU_ENGINE_AVX512)
+    return __builtin_cpu_supports("avx512bw") ? 1 : 0;
+#endif
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_engine_name()                                                          */
+/******************************************************************************/
+char* apu_engine_name(unsigned short engine)
+{
+  if (engine >= APU_NUM_ENGINES)
+    return NULL;
+
+  return S_apu_engine_names[engine];
+}
+
+/******************************************************************************/
+/* apu_detect_engine()                                                        */
+/******************************************************************************/
+unsigned short apu_detect_engine()
+{
+  unsigned short engine;
+
+  char* name;
+
+  /* the CZSTYLE_ENGINE environment variable picks an engine by */
+  /* name (if the cpu supports it), which is handy for checking */
+  /* a problem against the reference without rebuilding         */
+  name = getenv("CZSTYLE_ENGINE");
+
+  if (name != NULL)
+  {
+    for (engine = 0; engine < APU_NUM_ENGINES; engine++)
+    {
+      if ((!strcmp(name, S_apu_engine_names[engine])) && 
+          apu_engine_supported(engine))
+      {
+        return engine;
+      }
+    }
+  }
+
+  /* otherwise, the widest vector engine the cpu has */
+  for (engine = APU_NUM_ENGINES - 1; engine > APU_ENGINE_FAST; engine--)
+  {
+    if (apu_engine_supported(engine))
+      return engine;
+  }
+
+  return APU_ENGINE_FAST;
+}
+
+/******************************************************************************/
+/* apu_checksum_bytes()                                                       */
+/******************************************************************************/
+unsigned long apu_checksum_bytes( unsigned long hash, 
+                                  void* data, unsigned int num_bytes)
+{
+  unsigned int k;
+
+  unsigned char* bytes;
+
+  /* 32 bit fnv-1a */
+  bytes = (unsigned char*) data;
+
+  for (k = 0; k < num_bytes; k++)
+  {
+    hash ^= bytes[k];
+    hash = (hash * 16777619) & 0xFFFFFFFF;
+  }
+
+  return hash;
+}
+
+/******************************************************************************/
+/* apu_stage_checksum()                                                       */
+/******************************************************************************/
+unsigned long apu_stage_checksum(int stage)
+{
+  unsigned long hash;
+
+  /* a checksum of the state that each stage writes, so that */
+  /* engines can be compared stage by stage                   */
+  hash = 2166136261UL;
+
+  if (stage == APU_STAGE_SEQ)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_seq_regs_bank, 
+                              sizeof(S_apu_seq_regs_bank));
+    hash = apu_checksum_bytes(hash, S_apu_chan_regs_bank, 
+                              sizeof(S_apu_chan_regs_bank));
+    hash = apu_checksum_bytes(hash, S_apu_kbd_regs_bank, 
+                              sizeof(S_apu_kbd_regs_bank));
+    hash = apu_checksum_bytes(hash, S_apu_fm_alloc_regs_bank, 
+                              sizeof(S_apu_fm_alloc_regs_bank));
+    hash = apu_checksum_bytes(hash, S_apu_pcm_alloc_regs_bank, 
+                              sizeof(S_apu_pcm_alloc_regs_bank));
+  }
+  else if (stage == APU_STAGE_LFO)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_lfo_regs_bank, 
+                              sizeof(S_apu_lfo_regs_bank));
+  }
+  else if (stage == APU_STAGE_ENV)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_env_regs_bank, 
+                              sizeof(S_apu_env_regs_bank));
+  }
+  else if (stage == APU_STAGE_OSC)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_osc_regs_bank, 
+                              sizeof(S_apu_osc_regs_bank));
+  }
+  else if (stage == APU_STAGE_PCM)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_pcm_regs_bank, 
+                              sizeof(S_apu_pcm_regs_bank));
+  }
+  else if (stage == APU_STAGE_SYN)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_syn_regs_bank, 
+                              sizeof(S_apu_syn_regs_bank));
+  }
+  else if (stage == APU_STAGE_OUT)
+  {
+    hash = apu_checksum_bytes(hash, S_apu_hp_in, sizeof(S_apu_hp_in));
+    hash = apu_checksum_bytes(hash, S_apu_hp_out, sizeof(S_apu_hp_out));
+    hash = apu_checksum_bytes(hash, S_apu_lp_in, sizeof(S_apu_lp_in));
+    hash = apu_checksum_bytes(hash, S_apu_lp_out, sizeof(S_apu_lp_out));
+    hash = apu_checksum_bytes(hash, S_apu_ds_L_in, sizeof(S_apu_ds_L_in));
+    hash = apu_checksum_bytes(hash, S_apu_ds_R_in, sizeof(S_apu_ds_R_in));
+    hash = apu_checksum_bytes(hash, &S_apu_ds_buf_pos, 
+                              sizeof(S_apu_ds_buf_pos));
+  }
+  else if (stage == APU_STAGE_SAMPLE)
+  {
+    hash = apu_checksum_bytes(hash, &G_apu_out_L, sizeof(G_apu_out_L));
+    hash = apu_checksum_bytes(hash, &G_apu_out_R, sizeof(G_apu_out_R));
+    hash = apu_checksum_bytes(hash, &S_apu_rs_phase, sizeof(S_apu_rs_phase));
+  }
+
+  return hash;
+}
+
+/******************************************************************************/
+/* apu_alloc_fm_voice()                                                       */
+/******************************************************************************/
+int apu_alloc_fm_voice(unsigned short track_num)
+{
+  int m;
+
+  int            first;
+  int            last;
+  int            best;
+  unsigned short priority;
+  unsigned short num_busy;
+
+  /* the music can't use the sfx voices, */
+  /* but the sfx can use any of them     */
+  priority = (track_num == APU_SEQ_TRACK_SFX) ? 1 : 0;
+
+  last = APU_NUM_FM_VOICES;
+
+  if (track_num == APU_SEQ_TRACK_SFX)
+    first = APU_NUM_FM_VOICES - S_apu_fm_sfx_voices;
+  else
+  {
+    first = 0;
+    last -= S_apu_fm_sfx_voices;
+  }
+
+  num_busy = 0;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    if (!APU_FM_ALLOC_REG(m, IDLE))
+      num_busy += 1;
+  }
+
+  /* take an idle voice if the budget allows it (the */
+  /* sfx look through their own voices first)        */
+  if ((num_busy < S_apu_fm_polyphony) && 
+      (num_busy < S_apu_quality_fm_voices[S_apu_quality]))
+  {
+    for (m = first; m < last; m++)
+    {
+      if (APU_FM_ALLOC_REG(m, IDLE))
+        return m;
+    }
+
+    for (m = 0; m < first; m++)
+    {
+      if (APU_FM_ALLOC_REG(m, IDLE))
+        return m;
+    }
+  }
+
+  /* otherwise, steal one. the best choice is the lowest priority, */
+  /* then released before held. released voices go quietest first  */
+  /* (the carrier's envelope), and held voices go oldest first,    */
+  /* since a note that just started is still quiet in its attack.  */
+  if (track_num == APU_SEQ_TRACK_SFX)
+    first = 0;
+
+  best = -1;
+
+  for (m = first; m < last; m++)
+  {
+    /* voices played directly (not through the allocator) are left alone */
+    if (APU_FM_ALLOC_REG(m, IDLE) || (APU_FM_ALLOC_REG(m, OWNER) == 0))
+      continue;
+
+    if (APU_FM_ALLOC_REG(m, PRIORITY) > priority)
+      continue;
+
+    if (best < 0)
+      best = m;
+    else if (APU_FM_ALLOC_REG(m, PRIORITY) != APU_FM_ALLOC_REG(best, PRIORITY))
+    {
+      if (APU_FM_ALLOC_REG(m, PRIORITY) < APU_FM_ALLOC_REG(best, PRIORITY))
+        best = m;
+    }
+    else if (APU_FM_ALLOC_REG(m, HELD) != APU_FM_ALLOC_REG(best, HELD))
+    {
+      if (!APU_FM_ALLOC_REG(m, HELD))
+        best = m;
+    }
+    else if ( (!APU_FM_ALLOC_REG(m, HELD)) && 
+              (APU_ENV_REG(m, 0, LEVEL) != APU_ENV_REG(best, 0, LEVEL)))
+    {
+      if (APU_ENV_REG(m, 0, LEVEL) > APU_ENV_REG(best, 0, LEVEL))
+        best = m;
+    }
+    else if ( (unsigned short) (S_apu_alloc_age - APU_FM_ALLOC_REG(m, AGE)) > 
+              (unsigned short) (S_apu_alloc_age - APU_FM_ALLOC_REG(best, AGE)))
+    {
+      best = m;
+    }
+  }
+
+  return best;
+}
+
+/******************************************************************************/
+/* apu_alloc_pcm_voice()                                                      */
+/******************************************************************************/
+int apu_alloc_pcm_voice(unsigned short track_num)
+{
+  int m;
+
+  int            first;
+  int            last;
+  int            best;
+  unsigned short priority;
+  unsigned short num_busy;
+
+  /* same as the fm voices, except that samples are never */
+  /* held, and a voice is busy until its sample has ended */
+  priority = (track_num == APU_SEQ_TRACK_SFX) ? 1 : 0;
+
+  last = APU_NUM_PCM_VOICES;
+
+  if (track_num == APU_SEQ_TRACK_SFX)
+    first = APU_NUM_PCM_VOICES - S_apu_pcm_sfx_voices;
+  else
+  {
+    first = 0;
+    last -= S_apu_pcm_sfx_voices;
+  }
+
+  num_busy = 0;
+
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    if (APU_PCM_REG(m, LEVEL) < APU_OSC_MAX_LEVEL)
+      num_busy += 1;
+  }
+
+  if (num_busy < S_apu_pcm_polyphony)
+  {
+    for (m = first; m < last; m++)
+    {
+      if (APU_PCM_REG(m, LEVEL) >= APU_OSC_MAX_LEVEL)
+        return m;
+    }
+
+    for (m = 0; m < first; m++)
+    {
+      if (APU_PCM_REG(m, LEVEL) >= APU_OSC_MAX_LEVEL)
+        return m;
+    }
+  }
+
+  if (track_num == APU_SEQ_TRACK_SFX)
+    first = 0;
+
+  best = -1;
+
+  for (m = first; m < last; m++)
+  {
+    if ((APU_PCM_REG(m, LEVEL) >= APU_OSC_MAX_LEVEL) || 
+        (APU_PCM_ALLOC_REG(m, OWNER) == 0))
+    {
+      continue;
+    }
+
+    if (APU_PCM_ALLOC_REG(m, PRIORITY) > priority)
+      continue;
+
+    if (best < 0)
+      best = m;
+    else if (APU_PCM_ALLOC_REG(m, PRIORITY) != 
+             APU_PCM_ALLOC_REG(best, PRIORITY))
+    {
+      if (APU_PCM_ALLOC_REG(m, PRIORITY) < APU_PCM_ALLOC_REG(best, PRIORITY))
+        best = m;
+    }
+    else if (APU_PCM_REG(m, LEVEL) != APU_PCM_REG(best, LEVEL))
+    {
+      if (APU_PCM_REG(m, LEVEL) > APU_PCM_REG(best, LEVEL))
+        best = m;
+    }
+    else if ( (unsigned short) (S_apu_alloc_age - APU_PCM_ALLOC_REG(m, AGE)) > 
+              (unsigned short) (S_apu_alloc_age - APU_PCM_ALLOC_REG(best, AGE)))
+    {
+      best = m;
+    }
+  }
+
+  return best;
+}
+
+/******************************************************************************/
+/* apu_alloc_kit_piece()                                                      */
+/******************************************************************************/
+int apu_alloc_kit_piece(unsigned char note)
+{
+  /* maps general midi drum notes to the pieces of a kit */
+  switch (note)
+  {
+    case 35: case 36:
+      return APU_KIT_PARAM_SAMPLE_NO_BD;
+
+    case 37: case 38: case 39: case 40:
+      return APU_KIT_PARAM_SAMPLE_NO_SD;
+
+    case 42: case 44:
+      return APU_KIT_PARAM_SAMPLE_NO_CH;
+
+    case 46:
+      return APU_KIT_PARAM_SAMPLE_NO_OH;
+
+    case 49: case 52: case 55: case 57:
+      return APU_KIT_PARAM_SAMPLE_NO_CY;
+
+    case 51: case 53: case 59:
+      return APU_KIT_PARAM_SAMPLE_NO_RD;
+
+    case 41: case 43: case 45:
+      return APU_KIT_PARAM_SAMPLE_NO_LT;
+
+    case 47: case 48: case 50:
+      return APU_KIT_PARAM_SAMPLE_NO_HT;
+
+    default:
+      return -1;
+  }
+}
+
+/******************************************************************************/
+/* apu_alloc_note_on()                                                        */
+/******************************************************************************/
+int apu_alloc_note_on(unsigned short track_num, unsigned short chan_num, 
+                      unsigned char note, unsigned char velocity)
+{
+  int k;
+
+  int            voice_num;
+  int            piece;
+  unsigned short kit_num;
+  unsigned short samp_num;
+
+  /* the drum channel plays the kit (picked by program) on the pcm voices */
+  if (chan_num == APU_DRUM_CHANNEL)
+  {
+    piece = apu_alloc_kit_piece(note);
+
+    if (piece < 0)
+      return 0;
+
+    voice_num = apu_alloc_pcm_voice(track_num);
+
+    if (voice_num < 0)
+      return 0;
+
+    kit_num = APU_CHAN_REG(track_num, chan_num, APU_SEQ_CMD_PROGRAM);
+    kit_num %= APU_MAX_KITS;
+
+    samp_num = S_apu_kits[kit_num * APU_NUM_KIT_PARAMS + piece];
+
+    apu_play_sample(voice_num, samp_num, velocity);
+
+    APU_PCM_REG(voice_num, VOLUME) = 
+      APU_CHAN_REG(track_num, chan_num, APU_SEQ_CMD_VOLUME);
+    APU_PCM_REG(voice_num, PANNING) = 
+      APU_CHAN_REG(track_num, chan_num, APU_SEQ_CMD_PANNING);
+
+    APU_PCM_ALLOC_REG(voice_num, OWNER)     = 1 + 16 * track_num + chan_num;
+    APU_PCM_ALLOC_REG(voice_num, NOTE)      = note;
+    APU_PCM_ALLOC_REG(voice_num, HELD)      = 0;
+    APU_PCM_ALLOC_REG(voice_num, PRIORITY)  = 
+      (track_num == APU_SEQ_TRACK_SFX) ? 1 : 0;
+    APU_PCM_ALLOC_REG(voice_num, AGE)       = S_apu_alloc_age++;
+
+    return 0;
+  }
+
+  /* the other channels play on the fm voices */
+  voice_num = apu_alloc_fm_voice(track_num);
+
+  if (voice_num < 0)
+    return 0;
+
+  for (k = 0; k < APU_NUM_CHAN_CODES; k++)
+  {
+    apu_voice_command(voice_num, S_apu_chan_codes[k], 
+                      APU_CHAN_REG(track_num, chan_num, S_apu_chan_codes[k]), 
+                      0);
+  }
+
+  apu_voice_command(voice_num, APU_SEQ_CMD_NOTE_ON, note, velocity);
+
+  APU_FM_ALLOC_REG(voice_num, OWNER)    = 1 + 16 * track_num + chan_num;
+  APU_FM_ALLOC_REG(voice_num, NOTE)     = note;
+  APU_FM_ALLOC_REG(voice_num, HELD)     = 1;
+  APU_FM_ALLOC_REG(voice_num, PRIORITY) = 
+    (track_num == APU_SEQ_TRACK_SFX) ? 1 : 0;
+  APU_FM_ALLOC_REG(voice_num, AGE)      = S_apu_alloc_age++;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_seq_channel_command()                                                  */
+/******************************************************************************/
+int apu_seq_channel_command(unsigned short track_num, unsigned char code, 
+                            unsigned char data_1, unsigned char data_2)
+{
+  int m;
+
+  unsigned short chan_num;
+  unsigned short owner;
+
+  if (track_num >= APU_NUM_SEQ_TRACKS)
+    return 1;
+
+  chan_num = (code >> 4) & 0x0F;
+  owner = 1 + 16 * track_num + chan_num;
+
+  data_1 &= 0x7F;
+  data_2 &= 0x7F;
+
+  /* a note on with 0 velocity is a note off */
+  if (((code & 0x0F) == APU_SEQ_CMD_NOTE_ON) && (data_2 == 0))
+    code = (code & 0xF0) | APU_SEQ_CMD_NOTE_OFF;
+
+  /* notes go to the allocator */
+  if ((code & 0x0F) == APU_SEQ_CMD_NOTE_ON)
+    return apu_alloc_note_on(track_num, chan_num, data_1, data_2);
+
+  if ((code & 0x0F) == APU_SEQ_CMD_NOTE_OFF)
+  {
+    for (m = 0; m < APU_NUM_FM_VOICES; m++)
+    {
+      if ((APU_FM_ALLOC_REG(m, OWNER) == owner) && 
+          (APU_FM_ALLOC_REG(m, NOTE) == data_1) && 
+          (APU_FM_ALLOC_REG(m, HELD)))
+      {
+        apu_release_note(m);
+        APU_FM_ALLOC_REG(m, HELD) = 0;
+      }
+    }
+
+    return 0;
+  }
+
+  /* everything else updates the channel, and the voices playing it */
+  APU_CHAN_REG(track_num, chan_num, code) = data_1;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    if (APU_FM_ALLOC_REG(m, OWNER) == owner)
+      apu_voice_command(m, code & 0x0F, data_1, 0);
+  }
+
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    if (APU_PCM_ALLOC_REG(m, OWNER) != owner)
+      continue;
+
+    if ((code & 0x0F) == APU_SEQ_CMD_VOLUME)
+      APU_PCM_REG(m, VOLUME) = data_1;
+    else if ((code & 0x0F) == APU_SEQ_CMD_PANNING)
+      APU_PCM_REG(m, PANNING) = data_1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_sequencer()                                                    */
+/******************************************************************************/
+int apu_advance_sequencer()
+{
+  int m;
+
+  /* local register variables, for clarity */
+  unsigned short song_num;
+  unsigned short tempo;
+  unsigned short delay;
+  unsigned int   phase;
+  unsigned short index;
+  unsigned short loop_index;
+  unsigned short loop_count;
+  unsigned short return_index;
+
+  /* other local variables */
+  unsigned int   addr;
+  unsigned short size;
+  unsigned char  code;
+  unsigned char  data_1;
+  unsigned char  data_2;
+  int            looped;
+
+  for (m = 0; m < APU_NUM_SEQ_TRACKS; m++)
+  {
+    /* load registers to local variables */
+    song_num  = APU_SEQ_REG(m, SONG_NO);
+    tempo     = APU_SEQ_REG(m, TEMPO);
+    delay     = APU_SEQ_REG(m, DELAY);
+    phase     = APU_SEQ_REG(m, PHASE);
+    index     = APU_SEQ_REG(m, INDEX);
+
+    loop_index    = APU_SEQ_REG(m, LOOP_INDEX);
+    loop_count    = APU_SEQ_REG(m, LOOP_COUNT);
+    return_index  = APU_SEQ_REG(m, RETURN_INDEX);
+
+    /* load nametable entry to local variables */
+    addr =  (APU_SONG_PARAM(song_num, ADDR_1) << 16) | 
+            (APU_SONG_PARAM(song_num, ADDR_2) <<  8) | 
+             APU_SONG_PARAM(song_num, ADDR_3);
+
+    size =  (APU_SONG_PARAM(song_num, SIZE_1) << 8) | 
+             APU_SONG_PARAM(song_num, SIZE_2);
+
+    /* songs from before the last rom clear are gone */
+    if (!APU_SONG_VALID(song_num))
+      size = 0;
+
+    /* skip tracks that are not playing */
+    if (index >= size)
+      continue;
+
+    /* update phase (16 bit mantissa), and wait for the next tick */
+    if (tempo < APU_SEQ_MIN_TEMPO)
+      tempo = APU_SEQ_MIN_TEMPO;
+
+    phase += S_apu_seq_phase_incs_table[tempo - APU_SEQ_MIN_TEMPO];
+
+    APU_SEQ_REG(m, PHASE) = phase & 0xFFFF;
+
+    if (phase <= 0xFFFF)
+      continue;
+
+    if (delay > 0)
+      delay -= 1;
+
+    /* run commands until the next delay */
+    looped = 0;
+
+    while ((delay == 0) && (index < size))
+    {
+      if (addr + index + 2 >= APU_MIDI_DATA_SIZE)
+      {
+        index = size;
+        break;
+      }
+
+      code    = S_apu_midi_data[addr + index + 0];
+      data_1  = S_apu_midi_data[addr + index + 1];
+      data_2  = S_apu_midi_data[addr + index + 2];
+
+      APU_PROFILE_COUNT(seq_events, 1);
+
+      if (code == APU_SEQ_CMD_TEMPO)
+      {
+        tempo = data_1;
+
+        if (tempo < APU_SEQ_MIN_TEMPO)
+          tempo = APU_SEQ_MIN_TEMPO;
+
+        index += 2;
+      }
+      else if (code == APU_SEQ_CMD_DELAY_8)
+      {
+        delay = data_1;
+        index += 2;
+      }
+      else if (code == APU_SEQ_CMD_DELAY_16)
+      {
+        delay = data_1 | (data_2 << 8);
+        index += 3;
+      }
+      else if (code == APU_SEQ_SYS_LOOP_START)
+      {
+        index += 1;
+        loop_index = index;
+        loop_count = 0;
+      }
+      else if (code == APU_SEQ_SYS_LOOP_END)
+      {
+        index += 2;
+
+        /* the count is how many more times to play the loop, */
+        /* and is loaded the first time the end is reached    */
+        if (data_1 == 0)
+          index = loop_index;
+        else if (loop_count == 0)
+        {
+          loop_count = data_1;
+          index = loop_index;
+        }
+        else if (loop_count > 1)
+        {
+          loop_count -= 1;
+          index = loop_index;
+        }
+        else
+          loop_count = 0;
+
+        /* a loop that takes no time would never give the  */
+        /* rest of the chip a turn, so the track is stopped */
+        if (index == loop_index)
+        {
+          if (looped)
+            index = size;
+
+          looped = 1;
+        }
+      }
+      else if (code == APU_SEQ_SYS_CALL)
+      {
+        return_index = index + 3;
+        index = data_1 | (data_2 << 8);
+      }
+      else if (code == APU_SEQ_SYS_RETURN)
+      {
+        if (return_index == 0)
+          index = size;
+        else
+          index = return_index;
+
+        return_index = 0;
+      }
+      else if (code == APU_SEQ_SYS_END)
+      {
+        index = size;
+      }
+      else if ((code & 0x0F) == APU_SEQ_CMD_NOTE_ON)
+      {
+        apu_seq_channel_command(m, code, data_1, data_2);
+        index += 3;
+      }
+      else
+      {
+        apu_seq_channel_command(m, code, data_1, 0);
+        index += 2;
+      }
+    }
+
+    /* store local variables to registers */
+    APU_SEQ_REG(m, TEMPO) = tempo;
+    APU_SEQ_REG(m, DELAY) = delay;
+    APU_SEQ_REG(m, INDEX) = index;
+
+    APU_SEQ_REG(m, LOOP_INDEX)    = loop_index;
+    APU_SEQ_REG(m, LOOP_COUNT)    = loop_count;
+    APU_SEQ_REG(m, RETURN_INDEX)  = return_index;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_lfo()                                                          */
+/******************************************************************************/
+int apu_advance_lfo()
+{
+  int m;
+
+  for (m = 0; m < APU_NUM_LFOS; m++)
+  {
+
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_env()                                                          */
+/******************************************************************************/
+int apu_advance_env()
+{
+  int m;
+  int n;
+
+  /* local patch param variables, for clarity */
+  unsigned char ar;
+  unsigned char dr;
+  unsigned char sr;
+  unsigned char rr;
+  unsigned char sl;
+  unsigned char tl;
+
+  /* local register variables, for clarity */
+  unsigned short patch_num;
+  unsigned short stage;
+  unsigned short period;
+  unsigned short block;
+  unsigned short pattern;
+  unsigned short step;
+  unsigned short index;
+  unsigned short mantissa;
+  unsigned short level;
+
+  /* other local variables */
+  unsigned short mask;
+  unsigned short delta;
+  unsigned short increment;
+  unsigned short speed;
+
+  /* at lower quality, the envelopes are only updated on */
+  /* some ticks, and the periods count down that many    */
+  if (S_apu_env_ticks > 1)
+  {
+    S_apu_env_count += 1;
+
+    if (S_apu_env_count < S_apu_env_ticks)
+      return 0;
+
+    S_apu_env_count = 0;
+  }
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    /* skip idle voices */
+    if (APU_FM_ALLOC_REG(m, IDLE))
+      continue;
+
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
+    {
+      /* check if period has elapsed */
+      if (APU_ENV_REG(m, n, PERIOD) >= S_apu_env_ticks)
+      {
+        APU_ENV_REG(m, n, PERIOD) -= S_apu_env_ticks;
+        continue;
+      }
+
+      APU_PROFILE_COUNT(env_steps, 1);
+
+      /* load registers to local variables */
+      stage     = APU_ENV_REG(m, n, STAGE);
+      period    = APU_ENV_REG(m, n, PERIOD);
+      block     = APU_ENV_REG(m, n, BLOCK);
+      pattern   = APU_ENV_REG(m, n, PATTERN);
+      step      = APU_ENV_REG(m, n, STEP);
+      index     = APU_ENV_REG(m, n, INDEX);
+      mantissa  = APU_ENV_REG(m, n, MANTISSA);
+      level     = APU_ENV_REG(m, n, LEVEL);
+
+      /* load patch params to local variables */
+      patch_num = APU_KBD_REG(m, PATCH_NO);
+
+      ar = APU_PATCH_PARAM(patch_num, ENV_AR);
+      dr = APU_PATCH_PARAM(patch_num, ENV_DR);
+      sr = APU_PATCH_PARAM(patch_num, ENV_SR);
+      rr = APU_PATCH_PARAM(patch_num, ENV_RR);
+      sl = APU_PATCH_PARAM(patch_num, ENV_SL);
+      tl = APU_PATCH_PARAM(patch_num, ENV_TL);
+
+      ar = (ar > 99) ? 99 : ar;
+      dr = (dr > 99) ? 99 : dr;
+      sr = (sr > 99) ? 99 : sr;
+      rr = (rr > 99) ? 99 : rr;
+      sl = (sl > 99) ? 99 : sl;
+      tl = (tl > 99) ? 99 : tl;
+
+      /* update pattern step */
+      step += 1;
+      step &= 0x0F;
+
+      /* determine delta for this step */
+      if (step == 0)
+        mask = 1;
+      else
+        mask = 1 << step;
+
+      if (block <= APU_ENV_RATE_BASE_BLOCK)
+      {
+        if (S_apu_env_step_patterns[8 + pattern] & mask)
+          delta = 1;
+        else
+          delta = 0;
+      }
+      else
+      {
+        if (S_apu_env_step_patterns[2 * pattern] & mask)
+          delta = 1 + block - APU_ENV_RATE_BASE_BLOCK;
+        else
+          delta = 0 + block - APU_ENV_RATE_BASE_BLOCK;
+
+        if (delta > 4)
+          delta = 4;
+      }
+
+      /* update index */
+      if (delta > 0)
+      {
+        if (stage == APU_ENV_STAGE_A)
+        {
+          increment = index >> (5 - delta);
+
+          if (increment == 0)
+            increment = 1;
+
+          if (index >= increment)
+            index -= increment;
+          else
+            index = 0;
+
+          if (index == 0)
+            stage = APU_ENV_STAGE_D;
+        }
+        else
+        {
+          if (delta > 1)
+            increment = 1 << (delta - 1);
+          else
+            increment = 1;
+
+          index += increment;
+
+          if (index > APU_ENV_MAX_INDEX)
+            index = APU_ENV_MAX_INDEX;
+
+          if ((stage == APU_ENV_STAGE_D) && 
+              (index >= S_apu_env_sustain_level_map[sl]))
+          {
+            stage = APU_ENV_STAGE_S;
+          }
+        }
+      }
+
+      /* update level */
+      level = (index + S_apu_env_total_level_map[tl]) << 2;
+
+      if (level > APU_ENV_MAX_LEVEL)
+        level = APU_ENV_MAX_LEVEL;
+
+      /* reset period countdown timer */
+      if (stage == APU_ENV_STAGE_A)
+        speed = S_apu_env_adsr_rate_map[ar];
+      else if (stage == APU_ENV_STAGE_D)
+        speed = S_apu_env_adsr_rate_map[dr];
+      else if (stage == APU_ENV_STAGE_S)
+        speed = S_apu_env_adsr_rate_map[sr];
+      else
+        speed = S_apu_env_adsr_rate_map[rr];
+
+      block   = speed / APU_ENV_RATE_PATTERNS_PER_BLOCK;
+      pattern = speed % APU_ENV_RATE_PATTERNS_PER_BLOCK;
+
+      if (block < APU_ENV_RATE_BASE_BLOCK)
+        period = 1 << (APU_ENV_RATE_BASE_BLOCK - block);
+      else
+        period = 1;
+
+      /* store local variables to registers */
+      APU_ENV_REG(m, n, STAGE)    = stage;
+      APU_ENV_REG(m, n, PERIOD)   = period;
+      APU_ENV_REG(m, n, BLOCK)    = block;
+      APU_ENV_REG(m, n, PATTERN)  = pattern;
+      APU_ENV_REG(m, n, STEP)     = step;
+      APU_ENV_REG(m, n, INDEX)    = index;
+      APU_ENV_REG(m, n, MANTISSA) = mantissa;
+      APU_ENV_REG(m, n, LEVEL)    = level;
+    }
+
+    /* once every envelope is fully released, the voice is silent until */
+    /* its next note (which resets everything that would keep changing) */
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
+    {
+      if ((APU_ENV_REG(m, n, STAGE) != APU_ENV_STAGE_R) || 
+          (APU_ENV_REG(m, n, INDEX) != APU_ENV_MAX_INDEX))
+      {
+        break;
+      }
+    }
+
+    if (n == APU_NUM_FM_OPS)
+    {
+      APU_FM_ALLOC_REG(m, IDLE) = 1;
+      APU_SYN_REG(m, LEVEL) = 0;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_osc()                                                          */
+/******************************************************************************/
+int apu_advance_osc()
+{
+  int m;
+  int n;
+
+  /* local patch param variables, for clarity */
+
+  /* local register variables, for clarity */
+  unsigned short patch_num;
+  unsigned short note;
+  unsigned short index;
+  unsigned short mantissa;
+
+  /* other local variables */
+  unsigned short block;
+  unsigned short entry;
+  unsigned short step;
+
+  int          current_pitch;
+  unsigned int phase_inc;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    /* skip idle voices */
+    if (APU_FM_ALLOC_REG(m, IDLE))
+      continue;
+
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
+    {
+      /* load registers to local variables */
+      patch_num = APU_KBD_REG(m, PATCH_NO);
+      note      = APU_KBD_REG(m, NOTE);
+      index     = APU_OSC_REG(m, n, INDEX);
+      mantissa  = APU_OSC_REG(m, n, MANTISSA);
+
+      /* determine current pitch */
+      current_pitch = 64 * note;
+
+      if (current_pitch < 0)
+        current_pitch = 0;
+      else if (current_pitch > APU_OSC_MAX_PITCH)
+        current_pitch = APU_OSC_MAX_PITCH;
+
+      /* lookup phase increment */
+      block = current_pitch / (12 * 64);
+      entry = (current_pitch % (12 * 64)) / 16;
+      step  = (current_pitch % (12 * 64)) % 16;
+
+      phase_inc = S_apu_osc_pitch_table[entry];
+      phase_inc += (step * S_apu_osc_pitch_deltas[entry]) / 16;
+
+      if (block < APU_OSC_PITCH_BASE_BLOCK)
+        phase_inc = phase_inc >> (APU_OSC_PITCH_BASE_BLOCK - block);
+      else if (block > APU_OSC_PITCH_BASE_BLOCK)
+        phase_inc = phase_inc << (block - APU_OSC_PITCH_BASE_BLOCK);
+
+      /* at native rate, each update covers more than one clock */
+      phase_inc *= S_apu_osc_steps;
+
+      /* update phase (10.10 fixed point) */
+      mantissa += phase_inc & 0x3FF; 
+
+      index += (phase_inc >> 10) & 0x3FF;
+      index += (mantissa >> 10) & 0x3FF;
+
+      index    &= 0x3FF;
+      mantissa &= 0x3FF;
+
+      /* store local variables to registers */
+      APU_OSC_REG(m, n, INDEX)    = index;
+      APU_OSC_REG(m, n, MANTISSA) = mantissa;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_syn()                                                          */
+/******************************************************************************/
+int apu_advance_syn()
+{
+  int m;
+  int n;
+
+  /* local patch param variables, for clarity */
+  unsigned char fb;
+  unsigned char alg;
+
+  /* local register variables, for clarity */
+  unsigned short patch_num;
+  unsigned short feedin_0;
+  unsigned short feedin_1;
+  unsigned short syn_level;
+
+  /* other local variables */
+  unsigned short adj_index;
+  unsigned short adj_level;
+
+  unsigned short block;
+  unsigned short entry;
+
+  int osc_level[APU_NUM_FM_OPS];
+  int combined_level;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    /* skip idle voices (their level is left at 0) */
+    if (APU_FM_ALLOC_REG(m, IDLE))
+      continue;
+
+    /* load registers to local variables */
+    feedin_0 = APU_SYN_REG(m, FEEDIN_0);
+    feedin_1 = APU_SYN_REG(m, FEEDIN_1);
+    syn_level = APU_SYN_REG(m, LEVEL);
+
+    /* load patch params to local variables */
+    patch_num = APU_KBD_REG(m, PATCH_NO);
+
+    fb = APU_PATCH_PARAM(patch_num, SYN_FB);
+    alg = APU_PATCH_PARAM(patch_num, SYN_ALG);
+
+    fb = (fb > 99) ? 99 : fb;
+    alg = (alg > 7) ? 7 : alg;
+
+    for (n = 0; n < APU_NUM_FM_OPS; n++)
+    {
+      adj_index = APU_OSC_REG(m, n, INDEX);
+
+      /* sine wavetable lookup */
+      if (adj_index < 256)
+        adj_level = S_apu_osc_sine_table[adj_index];
+      else if (adj_index < 512)
+        adj_level = S_apu_osc_sine_table[511 - adj_index];
+      else if (adj_index < 768)
+        adj_level = S_apu_osc_sine_table[adj_index - 512];
+      else
+        adj_level = S_apu_osc_sine_table[1023 - adj_index];
+
+      /* apply envelope */
+      adj_level += APU_ENV_REG(m, n, LEVEL);
+
+      if (adj_level > APU_OSC_MAX_LEVEL)
+        adj_level = APU_OSC_MAX_LEVEL;
+
+      /* set final adjusted level and sign */
+      adj_level = adj_level & 0x0FFF;
+
+      if (adj_index >= 512)
+        adj_level |= 0x1000;
+
+      /* convert from db to linear and store the output */
+      block = (adj_level & 0x0FFF) / APU_OSC_LEVEL_TABLE_SIZE;
+      entry = (adj_level & 0x0FFF) % APU_OSC_LEVEL_TABLE_SIZE;
+
+      osc_level[n] = S_apu_osc_level_table[entry];
+
+      if (block > 0)
+      {
+        if (block >= APU_OSC_LEVEL_ZERO_BLOCK)
+          osc_level[n] = 0;
+        else
+          osc_level[n] = osc_level[n] >> block;
+      }
+
+      if (adj_level & 0x1000)
+        osc_level[n] = -osc_level[n];
+    }
+
+    /* for now, just output the 1st operator... */
+    combined_level = osc_level[0];
+
+    if (combined_level > 8191)
+      combined_level = 8191;
+    else if (combined_level < -8191)
+      combined_level = -8191;
+
+    if (combined_level < 0)
+      syn_level = ((-combined_level) & 0x1FFF) | 0x2000; 
+    else
+      syn_level = (combined_level & 0x1FFF);
+
+    /* store local variables to registers */
+    APU_SYN_REG(m, LEVEL) = syn_level;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_pcm()                                                          */
+/******************************************************************************/
+int apu_advance_pcm()
+{
+  int m;
+
+  /* local register variables, for clarity */
+  unsigned short samp_num;
+  unsigned int   phase;
+  unsigned short index;
+  unsigned short level;
+
+  /* other local variables */
+  unsigned int   addr;
+  unsigned short size;
+  unsigned char  rate;
+  unsigned char  data;
+
+  unsigned short adj_level;
+  unsigned short block;
+  unsigned short entry;
+
+  int pcm_level;
+
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    /* skip voices that are not playing */
+    level = APU_PCM_REG(m, LEVEL);
+
+    if (level >= APU_OSC_MAX_LEVEL)
+      continue;
+
+    /* load registers to local variables */
+    samp_num  = APU_PCM_REG(m, SAMPLE_NO);
+    phase     = APU_PCM_REG(m, PHASE);
+    index     = APU_PCM_REG(m, INDEX);
+
+    /* load nametable entry to local variables */
+    addr =  (APU_SAMPLE_PARAM(samp_num, ADDR_1) << 16) | 
+            (APU_SAMPLE_PARAM(samp_num, ADDR_2) <<  8) | 
+             APU_SAMPLE_PARAM(samp_num, ADDR_3);
+
+    size =  (APU_SAMPLE_PARAM(samp_num, SIZE_1) << 8) | 
+             APU_SAMPLE_PARAM(samp_num, SIZE_2);
+
+    if (!APU_SAMPLE_VALID(samp_num))
+      size = 0;
+
+    rate = APU_SAMPLE_PARAM(samp_num, RATE);
+    rate = (rate >= APU_NUM_PCM_RATES) ? (APU_NUM_PCM_RATES - 1) : rate;
+
+    /* stop at the end of the sample */
+    if ((index >= size) || (addr + index >= APU_PCM_DATA_SIZE))
+    {
+      APU_PCM_REG(m, LEVEL)   = APU_OSC_MAX_LEVEL;
+      APU_PCM_REG(m, OUTPUT)  = 0;
+      continue;
+    }
+
+    /* samples are 8 bits, sign & 7 bit magnitude */
+    data = S_apu_pcm_data[addr + index];
+
+    adj_level = S_apu_pcm_curve_table[data & 0x7F] + level;
+
+    if (adj_level > APU_OSC_MAX_LEVEL)
+      adj_level = APU_OSC_MAX_LEVEL;
+
+    /* convert from db to linear */
+    block = adj_level / APU_OSC_LEVEL_TABLE_SIZE;
+    entry = adj_level % APU_OSC_LEVEL_TABLE_SIZE;
+
+    pcm_level = S_apu_osc_level_table[entry];
+
+    if (block >= APU_OSC_LEVEL_ZERO_BLOCK)
+      pcm_level = 0;
+    else
+      pcm_level = pcm_level >> block;
+
+    if (data & 0x80)
+      APU_PCM_REG(m, OUTPUT) = (pcm_level & 0x1FFF) | 0x2000;
+    else
+      APU_PCM_REG(m, OUTPUT) = (pcm_level & 0x1FFF);
+
+    /* update phase (16 bit mantissa) */
+    phase += S_apu_pcm_phase_incs_table[rate];
+
+    index += (phase >> 16) & 0xFFFF;
+    phase &= 0xFFFF;
+
+    /* store local variables to registers */
+    APU_PCM_REG(m, PHASE) = phase;
+    APU_PCM_REG(m, INDEX) = index;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_out()                                                          */
+/******************************************************************************/
+int apu_advance_out()
+{
+  int m;
+  int n;
+
+  int samp;
+
+  unsigned short val;
+  unsigned short adj_level;
+  unsigned short mult;
+
+  /* 2 channels (left & right) */
+  for (n = 0; n < 2; n++)
+  {
+    /* compute mixed output (14 bit signed) */
+    samp = 0;
+
+    for (m = 0; m < APU_NUM_FM_VOICES; m++)
+    {
+      if (APU_FM_ALLOC_REG(m, IDLE))
+        continue;
+
+      val = APU_SYN_REG(m, LEVEL);
+      adj_level = val & 0x1FFF;
+
+      mult = S_apu_inst_vol_table[APU_KBD_REG(m, VOLUME)];
+      adj_level = (adj_level * mult) / 32768;
+
+      if (n == 0)
+      {
+        mult = S_apu_inst_pan_L_table[APU_KBD_REG(m, PANNING)];
+        adj_level = (adj_level * mult) / 32768;
+      }
+      else
+      {
+        mult = S_apu_inst_pan_R_table[APU_KBD_REG(m, PANNING)];
+        adj_level = (adj_level * mult) / 32768;
+      }
+
+      if (val & 0x2000)
+        samp -= adj_level;
+      else
+        samp += adj_level;
+    }
+
+    for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+    {
+      val = APU_PCM_REG(m, OUTPUT);
+      adj_level = val & 0x1FFF;
+
+      mult = S_apu_inst_vol_table[APU_PCM_REG(m, VOLUME)];
+      adj_level = (adj_level * mult) / 32768;
+
+      if (n == 0)
+      {
+        mult = S_apu_inst_pan_L_table[APU_PCM_REG(m, PANNING)];
+        adj_level = (adj_level * mult) / 32768;
+      }
+      else
+      {
+        mult = S_apu_inst_pan_R_table[APU_PCM_REG(m, PANNING)];
+        adj_level = (adj_level * mult) / 32768;
+      }
+
+      if (val & 0x2000)
+        samp -= adj_level;
+      else
+        samp += adj_level;
+    }
+
+    if (samp > 8191)
+      samp = 8191;
+    else if (samp < -8192)
+      samp = -8192;
+
+    /* apply dac (9 bits signed input, 16 bits signed output) */
+    samp = (samp + 8192) / 32;
+
+    if (samp > 511)
+      samp = 511;
+    else if (samp < 0)
+      samp = 0;
+
+    if (samp >= 256)
+      samp = (APU_DAC_POS_MULT * (samp - 256)) / 64;
+    else
+      samp = -32768 + ((APU_DAC_NEG_MULT * samp) / 64);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    /* apply highpass filter */
+    S_apu_hp_in[2 * n + 1]  = S_apu_hp_in[2 * n + 0];
+    S_apu_hp_out[2 * n + 1] = S_apu_hp_out[2 * n + 0];
+
+    S_apu_hp_in[2 * n + 0] = samp;
+    samp =  ((APU_HP_MULT_B0 * S_apu_hp_in[2 * n + 0]) / 32768) + 
+            ((APU_HP_MULT_B1 * S_apu_hp_in[2 * n + 1]) / 32768) - 
+            ((APU_HP_MULT_A1 * S_apu_hp_out[2 * n + 1]) / 32768);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    S_apu_hp_out[2 * n + 0] = samp;
+
+    /* apply lowpass filter */
+    S_apu_lp_in[2 * n + 1]  = S_apu_lp_in[2 * n + 0];
+    S_apu_lp_out[2 * n + 1] = S_apu_lp_out[2 * n + 0];
+
+    S_apu_lp_in[2 * n + 0] = samp;
+    samp =  ((APU_LP_MULT_B0 * S_apu_lp_in[2 * n + 0]) / 32768) + 
+            ((APU_LP_MULT_B1 * S_apu_lp_in[2 * n + 1]) / 32768) - 
+            ((APU_LP_MULT_A1 * S_apu_lp_out[2 * n + 1]) / 32768);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    S_apu_lp_out[2 * n + 0] = samp;
+  }
+
+  /* update downsampler filter input buffers (left & right) */
+  S_apu_ds_L_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 0 + 0];
+  S_apu_ds_R_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 1 + 0];
+
+  S_apu_ds_L_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE] = 
+    S_apu_lp_out[2 * 0 + 0];
+  S_apu_ds_R_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE] = 
+    S_apu_lp_out[2 * 1 + 0];
+
+  S_apu_ds_buf_pos = (S_apu_ds_buf_pos + 1) % APU_DS_BUFFER_SIZE;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_compute_sample()                                                       */
+/******************************************************************************/
+int apu_compute_sample()
+{
+  int m;
+
+  int samp_L;
+  int samp_R;
+
+  int adj_pos;
+  int inv_pos;
+
+  short mult;
+
+  /* apply downsampler filters (left & right) */
+  adj_pos = (S_apu_ds_buf_pos + (APU_DS_M / 2)) % APU_DS_BUFFER_SIZE;
+
+  mult = S_apu_ds_kernel[APU_DS_M / 2];
+
+  samp_L = (mult * S_apu_ds_L_in[adj_pos]) / 32768;
+  samp_R = (mult * S_apu_ds_R_in[adj_pos]) / 32768;
+
+  APU_PROFILE_COUNT(fir_taps, 2 * S_apu_ds_num_taps + 1);
+
+  /* at lower quality, only the taps nearest the center are used */
+  for (m = (APU_DS_M / 2) - S_apu_ds_num_taps; m < (APU_DS_M / 2); m++)
+  {
+    adj_pos = (S_apu_ds_buf_pos + m) % APU_DS_BUFFER_SIZE;
+    inv_pos = (S_apu_ds_buf_pos + APU_DS_M - m) % APU_DS_BUFFER_SIZE;
+
+    mult = S_apu_ds_kernel[m];
+
+    samp_L += 
+      (mult * (S_apu_ds_L_in[adj_pos] + S_apu_ds_L_in[inv_pos])) / 32768;
+
+    samp_R += 
+      (mult * (S_apu_ds_R_in[adj_pos] + S_apu_ds_R_in[inv_pos])) / 32768;
+  }
+
+  if (samp_L > 32767)
+    samp_L = 32767;
+  else if (samp_L < -32768)
+    samp_L = -32768;
+
+  if (samp_R > 32767)
+    samp_R = 32767;
+  else if (samp_R < -32768)
+    samp_R = -32768;
+
+  G_apu_out_L = samp_L;
+  G_apu_out_R = samp_R;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_dac()                                                          */
+/******************************************************************************/
+int apu_advance_dac(int* mix)
+{
+  int n;
+
+  int samp;
+
+  /* 2 channels (left & right) */
+  for (n = 0; n < 2; n++)
+  {
+    samp = mix[n];
+
+    if (samp > 8191)
+      samp = 8191;
+    else if (samp < -8192)
+      samp = -8192;
+
+    /* apply dac (9 bits signed input, 16 bits signed output) */
+    samp = (samp + 8192) / 32;
+
+    if (samp > 511)
+      samp = 511;
+    else if (samp < 0)
+      samp = 0;
+
+    if (samp >= 256)
+      samp = (APU_DAC_POS_MULT * (samp - 256)) / 64;
+    else
+      samp = -32768 + ((APU_DAC_NEG_MULT * samp) / 64);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    /* apply highpass filter */
+    S_apu_hp_in[2 * n + 1]  = S_apu_hp_in[2 * n + 0];
+    S_apu_hp_out[2 * n + 1] = S_apu_hp_out[2 * n + 0];
+
+    S_apu_hp_in[2 * n + 0] = samp;
+    samp =  ((APU_HP_MULT_B0 * S_apu_hp_in[2 * n + 0]) / 32768) + 
+            ((APU_HP_MULT_B1 * S_apu_hp_in[2 * n + 1]) / 32768) - 
+            ((APU_HP_MULT_A1 * S_apu_hp_out[2 * n + 1]) / 32768);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    S_apu_hp_out[2 * n + 0] = samp;
+
+    /* apply lowpass filter */
+    S_apu_lp_in[2 * n + 1]  = S_apu_lp_in[2 * n + 0];
+    S_apu_lp_out[2 * n + 1] = S_apu_lp_out[2 * n + 0];
+
+    S_apu_lp_in[2 * n + 0] = samp;
+    samp =  ((APU_LP_MULT_B0 * S_apu_lp_in[2 * n + 0]) / 32768) + 
+            ((APU_LP_MULT_B1 * S_apu_lp_in[2 * n + 1]) / 32768) - 
+            ((APU_LP_MULT_A1 * S_apu_lp_out[2 * n + 1]) / 32768);
+
+    if (samp > 32767)
+      samp = 32767;
+    else if (samp < -32768)
+      samp = -32768;
+
+    S_apu_lp_out[2 * n + 0] = samp;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_ds_input()                                                     */
+/******************************************************************************/
+int apu_advance_ds_input()
+{
+  /* update downsampler filter input buffers (left & right) */
+  S_apu_ds_L_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 0 + 0];
+  S_apu_ds_R_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 1 + 0];
+
+  S_apu_ds_L_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE] = 
+    S_apu_lp_out[2 * 0 + 0];
+  S_apu_ds_R_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE] = 
+    S_apu_lp_out[2 * 1 + 0];
+
+  S_apu_ds_buf_pos += 1;
+
+  if (S_apu_ds_buf_pos >= APU_DS_BUFFER_SIZE)
+    S_apu_ds_buf_pos = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_out_fast()                                                     */
+/******************************************************************************/
+int apu_advance_out_fast()
+{
+  int m;
+
+  int mix[2];
+
+  unsigned short val;
+  unsigned short adj_level;
+  unsigned short level_L;
+  unsigned short level_R;
+  unsigned short mult;
+
+  /* same as apu_advance_out(), but both channels are mixed in one */
+  /* pass over the voices, and pcm voices with no output are skipped */
+  mix[0] = 0;
+  mix[1] = 0;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    if (APU_FM_ALLOC_REG(m, IDLE))
+      continue;
+
+    val = APU_SYN_REG(m, LEVEL);
+    adj_level = val & 0x1FFF;
+
+    mult = S_apu_inst_vol_table[APU_KBD_REG(m, VOLUME)];
+    adj_level = (adj_level * mult) / 32768;
+
+    mult = S_apu_inst_pan_L_table[APU_KBD_REG(m, PANNING)];
+    level_L = (adj_level * mult) / 32768;
+
+    mult = S_apu_inst_pan_R_table[APU_KBD_REG(m, PANNING)];
+    level_R = (adj_level * mult) / 32768;
+
+    if (val & 0x2000)
+    {
+      mix[0] -= level_L;
+      mix[1] -= level_R;
+    }
+    else
+    {
+      mix[0] += level_L;
+      mix[1] += level_R;
+    }
+  }
+
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    val = APU_PCM_REG(m, OUTPUT);
+    adj_level = val & 0x1FFF;
+
+    if (adj_level == 0)
+      continue;
+
+    mult = S_apu_inst_vol_table[APU_PCM_REG(m, VOLUME)];
+    adj_level = (adj_level * mult) / 32768;
+
+    mult = S_apu_inst_pan_L_table[APU_PCM_REG(m, PANNING)];
+    level_L = (adj_level * mult) / 32768;
+
+    mult = S_apu_inst_pan_R_table[APU_PCM_REG(m, PANNING)];
+    level_R = (adj_level * mult) / 32768;
+
+    if (val & 0x2000)
+    {
+      mix[0] -= level_L;
+      mix[1] -= level_R;
+    }
+    else
+    {
+      mix[0] += level_L;
+      mix[1] += level_R;
+    }
+  }
+
+  apu_advance_dac(mix);
+  apu_advance_ds_input();
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_compute_sample_fast()                                                  */
+/******************************************************************************/
+int apu_compute_sample_fast()
+{
+  int m;
+
+  int samp_L;
+  int samp_R;
+
+  int adj_pos;
+  int inv_pos;
+
+  short mult;
+
+  /* same as apu_compute_sample(), but the buffer positions are */
+  /* stepped through (and wrapped) instead of taken modulo       */
+  adj_pos = S_apu_ds_buf_pos + (APU_DS_M / 2);
+
+  if (adj_pos >= APU_DS_BUFFER_SIZE)
+    adj_pos -= APU_DS_BUFFER_SIZE;
+
+  mult = S_apu_ds_kernel[APU_DS_M / 2];
+
+  samp_L = (mult * S_apu_ds_L_in[adj_pos]) / 32768;
+  samp_R = (mult * S_apu_ds_R_in[adj_pos]) / 32768;
+
+  APU_PROFILE_COUNT(fir_taps, 2 * S_apu_ds_num_taps + 1);
+
+  m = (APU_DS_M / 2) - S_apu_ds_num_taps;
+
+  adj_pos = S_apu_ds_buf_pos + m;
+  inv_pos = S_apu_ds_buf_pos + APU_DS_M - m;
+
+  if (adj_pos >= APU_DS_BUFFER_SIZE)
+    adj_pos -= APU_DS_BUFFER_SIZE;
+
+  if (inv_pos >= APU_DS_BUFFER_SIZE)
+    inv_pos -= APU_DS_BUFFER_SIZE;
+
+  for (; m < (APU_DS_M / 2); m++)
+  {
+    mult = S_apu_ds_kernel[m];
+
+    samp_L += 
+      (mult * (S_apu_ds_L_in[adj_pos] + S_apu_ds_L_in[inv_pos])) / 32768;
+
+    samp_R += 
+      (mult * (S_apu_ds_R_in[adj_pos] + S_apu_ds_R_in[inv_pos])) / 32768;
+
+    adj_pos += 1;
+
+    if (adj_pos >= APU_DS_BUFFER_SIZE)
+      adj_pos = 0;
+
+    if (inv_pos == 0)
+      inv_pos = APU_DS_BUFFER_SIZE;
+
+    inv_pos -= 1;
+  }
+
+  if (samp_L > 32767)
+    samp_L = 32767;
+  else if (samp_L < -32768)
+    samp_L = -32768;
+
+  if (samp_R > 32767)
+    samp_R = 32767;
+  else if (samp_R < -32768)
+    samp_R = -32768;
+
+  G_apu_out_L = samp_L;
+  G_apu_out_R = samp_R;
+
+  return 0;
+}
+
+#ifdef APU_X86_KERNELS
+/******************************************************************************/
+/* apu_ds_taps_sse2()                                                         */
+/******************************************************************************/
+__attribute__((target("sse2")))
+static int apu_ds_taps_sse2(short* window, int m)
+{
+  __m128i adj;
+  __m128i inv;
+  __m128i mult;
+  __m128i prod_lo;
+  __m128i prod_hi;
+  __m128i sum;
+
+  /* the taps pair up around the center of the window: the adjacent */
+  /* samples are read forward from m, and the inverse samples are    */
+  /* read backward from the other end, so they are loaded and then   */
+  /* reversed. each 32 bit product (mult * (adj + inv)) comes from   */
+  /* one madd over the interleaved pairs, and the division by 32768  */
+  /* rounds toward zero (by adding 32767 to the negative products)   */
+  /* so that every term matches the scalar code exactly              */
+  sum = _mm_setzero_si128();
+
+  for (; m < (APU_DS_M / 2); m += 8)
+  {
+    adj = _mm_loadu_si128((__m128i*) &window[m]);
+    inv = _mm_loadu_si128((__m128i*) &window[APU_DS_M - m - 7]);
+    mult = _mm_loadu_si128((__m128i*) &S_apu_ds_kernel[m]);
+
+    inv = _mm_shufflelo_epi16(inv, 0x1B);
+    inv = _mm_shufflehi_epi16(inv, 0x1B);
+    inv = _mm_shuffle_epi32(inv, 0x4E);
+
+    prod_lo = _mm_madd_epi16( _mm_unpacklo_epi16(adj, inv), 
+                              _mm_unpacklo_epi16(mult, mult));
+    prod_hi = _mm_madd_epi16( _mm_unpackhi_epi16(adj, inv), 
+                              _mm_unpackhi_epi16(mult, mult));
+
+    prod_lo = _mm_add_epi32(prod_lo, 
+              _mm_and_si128(_mm_srai_epi32(prod_lo, 31), 
+                            _mm_set1_epi32(32767)));
+    prod_hi = _mm_add_epi32(prod_hi, 
+              _mm_and_si128(_mm_srai_epi32(prod_hi, 31), 
+                            _mm_set1_epi32(32767)));
+
+    sum = _mm_add_epi32(sum, _mm_srai_epi32(prod_lo, 15));
+    sum = _mm_add_epi32(sum, _mm_srai_epi32(prod_hi, 15));
+  }
+
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+
+  return _mm_cvtsi128_si32(sum);
+}
+
+/******************************************************************************/
+/* apu_ds_taps_avx2()                                                         */
+/******************************************************************************/
+__attribute__((target("avx2")))
+static int apu_ds_taps_avx2(short* window, int m)
+{
+  __m256i adj;
+  __m256i inv;
+  __m256i mult;
+  __m256i prod_lo;
+  __m256i prod_hi;
+  __m256i sum;
+  __m256i reverse;
+
+  __m128i total;
+
+  /* same as the sse2 taps, 16 at a time. the unpacks work within */
+  /* each 128 bit lane, which is fine since the samples and their */
+  /* multipliers are unpacked the same way and all of the terms   */
+  /* get summed anyway. the short filter (8 taps) is one pass of  */
+  /* the sse2 loop instead                                         */
+  if ((APU_DS_M / 2) - m < 16)
+    return apu_ds_taps_sse2(window, m);
+
+  reverse = _mm256_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 
+                              6, 7, 4, 5, 2, 3, 0, 1, 
+                              14, 15, 12, 13, 10, 11, 8, 9, 
+                              6, 7, 4, 5, 2, 3, 0, 1);
+
+  sum = _mm256_setzero_si256();
+
+  for (; m < (APU_DS_M / 2); m += 16)
+  {
+    adj = _mm256_loadu_si256((__m256i*) &window[m]);
+    inv = _mm256_loadu_si256((__m256i*) &window[APU_DS_M - m - 15]);
+    mult = _mm256_loadu_si256((__m256i*) &S_apu_ds_kernel[m]);
+
+    inv = _mm256_shuffle_epi8(inv, reverse);
+    inv = _mm256_permute4x64_epi64(inv, 0x4E);
+
+    prod_lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(adj, inv), 
+                                _mm256_unpacklo_epi16(mult, mult));
+    prod_hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(adj, inv), 
+                                _mm256_unpackhi_epi16(mult, mult));
+
+    prod_lo = _mm256_add_epi32(prod_lo, 
+              _mm256_and_si256( _mm256_srai_epi32(prod_lo, 31), 
+                                _mm256_set1_epi32(32767)));
+    prod_hi = _mm256_add_epi32(prod_hi, 
+              _mm256_and_si256( _mm256_srai_epi32(prod_hi, 31), 
+                                _mm256_set1_epi32(32767)));
+
+    sum = _mm256_add_epi32(sum, _mm256_srai_epi32(prod_lo, 15));
+    sum = _mm256_add_epi32(sum, _mm256_srai_epi32(prod_hi, 15));
+  }
+
+  total = _mm_add_epi32(_mm256_castsi256_si128(sum), 
+                        _mm256_extracti128_si256(sum, 1));
+  total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4E));
+  total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xB1));
+
+  return _mm_cvtsi128_si32(total);
+}
+
+/******************************************************************************/
+/* apu_ds_taps_avx512()                                                       */
+/******************************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static int apu_ds_taps_avx512(short* window, int m)
+{
+  __m512i adj;
+  __m512i inv;
+  __m512i mult;
+  __m512i prod_lo;
+  __m512i prod_hi;
+  __m512i reverse;
+
+  /* same as the sse2 taps, with all 32 in one pass. the inverse */
+  /* samples are reversed across the whole register with a word  */
+  /* permute. the short filter falls back to the sse2 loop       */
+  if (m != 0)
+    return apu_ds_taps_sse2(window, m);
+
+  reverse = _mm512_set_epi16( 0, 1, 2, 3, 4, 5, 6, 7, 
+                              8, 9, 10, 11, 12, 13, 14, 15, 
+                              16, 17, 18, 19, 20, 21, 22, 23, 
+                              24, 25, 26, 27, 28, 29, 30, 31);
+
+  adj = _mm512_loadu_si512((void*) &window[0]);
+  inv = _mm512_loadu_si512((void*) &window[APU_DS_M - 31]);
+  mult = _mm512_loadu_si512((void*) &S_apu_ds_kernel[0]);
+
+  inv = _mm512_permutexvar_epi16(reverse, inv);
+
+  prod_lo = _mm512_madd_epi16(_mm512_unpacklo_epi16(adj, inv), 
+                              _mm512_unpacklo_epi16(mult, mult));
+  prod_hi = _mm512_madd_epi16(_mm512_unpackhi_epi16(adj, inv), 
+                              _mm512_unpackhi_epi16(mult, mult));
+
+  prod_lo = _mm512_add_epi32(prod_lo, 
+            _mm512_and_si512( _mm512_srai_epi32(prod_lo, 31), 
+                              _mm512_set1_epi32(32767)));
+  prod_hi = _mm512_add_epi32(prod_hi, 
+            _mm512_and_si512( _mm512_srai_epi32(prod_hi, 31), 
+                              _mm512_set1_epi32(32767)));
+
+  return _mm512_reduce_add_epi32(
+          _mm512_add_epi32( _mm512_srai_epi32(prod_lo, 15), 
+                            _mm512_srai_epi32(prod_hi, 15)));
+}
+
+/******************************************************************************/
+/* apu_rs_dot_sse2()                                                          */
+/******************************************************************************/
+__attribute__((target("sse2")))
+static int apu_rs_dot_sse2(short* window, short* row, int num_taps)
+{
+  int n;
+
+  __m128i sum;
+
+  /* the resampler rows line up with the window, so each */
+  /* madd is 8 products summed into 4 lanes. the row gain */
+  /* keeps the sums well inside 32 bits, so the order of */
+  /* the adds doesn't matter and this matches the scalar */
+  sum = _mm_setzero_si128();
+
+  for (n = 0; n < num_taps; n += 8)
+  {
+    sum = _mm_add_epi32(sum, 
+          _mm_madd_epi16( _mm_loadu_si128((__m128i*) &window[n]), 
+                          _mm_loadu_si128((__m128i*) &row[n])));
+  }
+
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+
+  return _mm_cvtsi128_si32(sum);
+}
+
+/******************************************************************************/
+/* apu_rs_dot_avx2()                                                          */
+/******************************************************************************/
+__attribute__((target("avx2")))
+static int apu_rs_dot_avx2(short* window, short* row, int num_taps)
+{
+  int n;
+
+  __m256i sum;
+  __m128i total;
+
+  sum = _mm256_setzero_si256();
+
+  for (n = 0; n < num_taps; n += 16)
+  {
+    sum = _mm256_add_epi32(sum, 
+          _mm256_madd_epi16(_mm256_loadu_si256((__m256i*) &window[n]), 
+                            _mm256_loadu_si256((__m256i*) &row[n])));
+  }
+
+  total = _mm_add_epi32(_mm256_castsi256_si128(sum), 
+                        _mm256_extracti128_si256(sum, 1));
+  total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4E));
+  total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xB1));
+
+  return _mm_cvtsi128_si32(total);
+}
+
+/******************************************************************************/
+/* apu_rs_dot_avx512()                                                        */
+/******************************************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static int apu_rs_dot_avx512(short* window, short* row, int num_taps)
+{
+  int n;
+
+  __m512i sum;
+
+  sum = _mm512_setzero_si512();
+
+  for (n = 0; n < num_taps; n += 32)
+  {
+    sum = _mm512_add_epi32(sum, 
+          _mm512_madd_epi16(_mm512_loadu_si512((void*) &window[n]), 
+                            _mm512_loadu_si512((void*) &row[n])));
+  }
+
+  return _mm512_reduce_add_epi32(sum);
+}
+
+/******************************************************************************/
+/* apu_div_32768_sse41()                                                      */
+/******************************************************************************/
+__attribute__((target("sse4.1")))
+static __m128i apu_div_32768_sse41(__m128i x)
+{
+  /* divides by 32768, rounding towards 0 like the scalar code */
+  return _mm_srai_epi32(_mm_add_epi32(x, 
+                        _mm_and_si128(_mm_srai_epi32(x, 31), 
+                                      _mm_set1_epi32(32767))), 15);
+}
+
+/******************************************************************************/
+/* apu_syn_levels_sse41()                                                     */
+/******************************************************************************/
+__attribute__((target("sse4.1")))
+static int apu_syn_levels_sse41()
+{
+  int k;
+
+  __m128i index;
+  __m128i level;
+  __m128i block;
+  __m128i out;
+  __m128i neg;
+  __m128i bit;
+
+  /* the 1st operator of 4 voices at once (see apu_advance_syn). */
+  /* sse4.1 has no gathers or per lane shifts, so the lookups go */
+  /* lane by lane, and the shift is done a bit of the block at a */
+  /* time                                                        */
+  for (k = 0; k < APU_VEC_LANES; k += 4)
+  {
+    index = _mm_cvtepu16_epi32(
+              _mm_loadl_epi64((__m128i*) &S_apu_vec_index[k]));
+
+    /* the 2nd and 4th quarters of the wave are read backwards */
+    level = _mm_xor_si128(index, 
+                          _mm_srai_epi32(_mm_slli_epi32(index, 23), 31));
+    level = _mm_and_si128(level, _mm_set1_epi32(0xFF));
+
+    level = _mm_setr_epi32( 
+              S_apu_osc_sine_table[_mm_extract_epi32(level, 0)], 
+              S_apu_osc_sine_table[_mm_extract_epi32(level, 1)], 
+              S_apu_osc_sine_table[_mm_extract_epi32(level, 2)], 
+              S_apu_osc_sine_table[_mm_extract_epi32(level, 3)]);
+
+    /* apply envelope */
+    level = _mm_add_epi32(level, _mm_cvtepu16_epi32(
+              _mm_loadl_epi64((__m128i*) &S_apu_vec_env_level[k])));
+    level = _mm_and_si128(level, _mm_set1_epi32(0xFFFF));
+    level = _mm_min_epi32(level, _mm_set1_epi32(APU_OSC_MAX_LEVEL));
+
+    /* convert from db to linear */
+    block = _mm_srli_epi32(level, 8);
+    level = _mm_and_si128(level, _mm_set1_epi32(0xFF));
+
+    out = _mm_setr_epi32( 
+            S_apu_osc_level_table[_mm_extract_epi32(level, 0)], 
+            S_apu_osc_level_table[_mm_extract_epi32(level, 1)], 
+            S_apu_osc_level_table[_mm_extract_epi32(level, 2)], 
+            S_apu_osc_level_table[_mm_extract_epi32(level, 3)]);
+
+    bit = _mm_and_si128(block, _mm_set1_epi32(1));
+    out = _mm_blendv_epi8(out, _mm_srli_epi32(out, 1), 
+                          _mm_cmpeq_epi32(bit, _mm_set1_epi32(1)));
+
+    bit = _mm_and_si128(block, _mm_set1_epi32(2));
+    out = _mm_blendv_epi8(out, _mm_srli_epi32(out, 2), 
+                          _mm_cmpeq_epi32(bit, _mm_set1_epi32(2)));
+
+    bit = _mm_and_si128(block, _mm_set1_epi32(4));
+    out = _mm_blendv_epi8(out, _mm_srli_epi32(out, 4), 
+                          _mm_cmpeq_epi32(bit, _mm_set1_epi32(4)));
+
+    bit = _mm_and_si128(block, _mm_set1_epi32(8));
+    out = _mm_blendv_epi8(out, _mm_srli_epi32(out, 8), 
+                          _mm_cmpeq_epi32(bit, _mm_set1_epi32(8)));
+
+    out = _mm_andnot_si128( 
+            _mm_cmpgt_epi32(block, 
+                            _mm_set1_epi32(APU_OSC_LEVEL_ZERO_BLOCK - 1)), 
+            out);
+
+    /* clamp, and set the sign (a level of 0 has none) */
+    out = _mm_min_epi32(out, _mm_set1_epi32(8191));
+
+    neg = _mm_andnot_si128(_mm_cmpeq_epi32(out, _mm_setzero_si128()), 
+                           _mm_cmpgt_epi32(index, _mm_set1_epi32(511)));
+
+    out = _mm_or_si128(out, _mm_and_si128(neg, _mm_set1_epi32(0x2000)));
+
+    _mm_storel_epi64((__m128i*) &S_apu_vec_syn_level[k], 
+                     _mm_packus_epi32(out, out));
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_syn_levels_avx2()                                                      */
+/******************************************************************************/
+__attribute__((target("avx2")))
+static int apu_syn_levels_avx2()
+{
+  int k;
+
+  __m256i index;
+  __m256i level;
+  __m256i block;
+  __m256i out;
+  __m256i neg;
+
+  /* same as apu_syn_levels_sse41(), but 8 voices at once, */
+  /* with gathers from the widened tables and lane shifts  */
+  for (k = 0; k < APU_VEC_LANES; k += 8)
+  {
+    index = _mm256_cvtepu16_epi32(
+              _mm_loadu_si128((__m128i*) &S_apu_vec_index[k]));
+
+    level = _mm256_xor_si256( 
+              index, _mm256_srai_epi32(_mm256_slli_epi32(index, 23), 31));
+    level = _mm256_and_si256(level, _mm256_set1_epi32(0xFF));
+    level = _mm256_i32gather_epi32(S_apu_vec_sine_table, level, 4);
+
+    level = _mm256_add_epi32(level, _mm256_cvtepu16_epi32(
+              _mm_loadu_si128((__m128i*) &S_apu_vec_env_level[k])));
+    level = _mm256_and_si256(level, _mm256_set1_epi32(0xFFFF));
+    level = _mm256_min_epi32(level, _mm256_set1_epi32(APU_OSC_MAX_LEVEL));
+
+    block = _mm256_srli_epi32(level, 8);
+    level = _mm256_and_si256(level, _mm256_set1_epi32(0xFF));
+
+    out = _mm256_i32gather_epi32(S_apu_vec_level_table, level, 4);
+    out = _mm256_srlv_epi32(out, block);
+
+    out = _mm256_andnot_si256( 
+            _mm256_cmpgt_epi32( 
+              block, _mm256_set1_epi32(APU_OSC_LEVEL_ZERO_BLOCK - 1)), 
+            out);
+
+    out = _mm256_min_epi32(out, _mm256_set1_epi32(8191));
+
+    neg = _mm256_andnot_si256( 
+            _mm256_cmpeq_epi32(out, _mm256_setzero_si256()), 
+            _mm256_cmpgt_epi32(index, _mm256_set1_epi32(511)));
+
+    out = _mm256_or_si256(out, 
+                          _mm256_and_si256(neg, _mm256_set1_epi32(0x2000)));
+
+    _mm_storeu_si128((__m128i*) &S_apu_vec_syn_level[k], 
+                     _mm_packus_epi32(_mm256_castsi256_si128(out), 
+                                      _mm256_extracti128_si256(out, 1)));
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_syn_levels_avx512()                                                    */
+/******************************************************************************/
+__attribute__((target("avx512f")))
+static int apu_syn_levels_avx512()
+{
+  __m512i   index;
+  __m512i   level;
+  __m512i   block;
+  __m512i   out;
+  __mmask16 zero;
+  __mmask16 neg;
+
+  /* same as apu_syn_levels_avx2(), but all 16 lanes at once */
+  index = _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((__m256i*) &S_apu_vec_index[0]));
+
+  level = _mm512_xor_si512( 
+            index, _mm512_srai_epi32(_mm512_slli_epi32(index, 23), 31));
+  level = _mm512_and_si512(level, _mm512_set1_epi32(0xFF));
+  level = _mm512_i32gather_epi32(level, S_apu_vec_sine_table, 4);
+
+  level = _mm512_add_epi32(level, _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((__m256i*) &S_apu_vec_env_level[0])));
+  level = _mm512_and_si512(level, _mm512_set1_epi32(0xFFFF));
+  level = _mm512_min_epi32(level, _mm512_set1_epi32(APU_OSC_MAX_LEVEL));
+
+  block = _mm512_srli_epi32(level, 8);
+  level = _mm512_and_si512(level, _mm512_set1_epi32(0xFF));
+
+  out = _mm512_i32gather_epi32(level, S_apu_vec_level_table, 4);
+  out = _mm512_srlv_epi32(out, block);
+
+  zero = _mm512_cmpge_epi32_mask(block, 
+                                 _mm512_set1_epi32(APU_OSC_LEVEL_ZERO_BLOCK));
+  out = _mm512_mask_mov_epi32(out, zero, _mm512_setzero_si512());
+
+  out = _mm512_min_epi32(out, _mm512_set1_epi32(8191));
+
+  neg = _mm512_cmpgt_epi32_mask(index, _mm512_set1_epi32(511)) & 
+        _mm512_cmpneq_epi32_mask(out, _mm512_setzero_si512());
+
+  out = _mm512_mask_or_epi32(out, neg, out, _mm512_set1_epi32(0x2000));
+
+  _mm256_storeu_si256((__m256i*) &S_apu_vec_syn_level[0], 
+                      _mm512_cvtepi32_epi16(out));
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_mix_lanes_sse2()                                                       */
+/******************************************************************************/
+__attribute__((target("sse2")))
+static int apu_mix_lanes_sse2(int* mix)
+{
+  int k;
+
+  __m128i level;
+  __m128i sign;
+  __m128i adj;
+  __m128i out;
+  __m128i ones;
+  __m128i sum_L;
+  __m128i sum_R;
+
+  /* 8 voices at once in 16 bit lanes. the levels are 13 bits, so */
+  /* twice a level still fits, and the high half of its product   */
+  /* with a multiplier is the product over 32768 (exactly)        */
+  ones = _mm_set1_epi16(1);
+
+  sum_L = _mm_setzero_si128();
+  sum_R = _mm_setzero_si128();
+
+  for (k = 0; k < APU_VEC_LANES; k += 8)
+  {
+    level = _mm_loadu_si128((__m128i*) &S_apu_vec_level[k]);
+    sign = _mm_loadu_si128((__m128i*) &S_apu_vec_sign[k]);
+
+    adj = _mm_mulhi_epu16(_mm_slli_epi16(level, 1), 
+                          _mm_loadu_si128((__m128i*) &S_apu_vec_vol[k]));
+    adj = _mm_slli_epi16(adj, 1);
+
+    out = _mm_mulhi_epu16(adj, 
+                          _mm_loadu_si128((__m128i*) &S_apu_vec_pan_L[k]));
+    out = _mm_sub_epi16(_mm_xor_si128(out, sign), sign);
+    sum_L = _mm_add_epi32(sum_L, _mm_madd_epi16(out, ones));
+
+    out = _mm_mulhi_epu16(adj, 
+                          _mm_loadu_si128((__m128i*) &S_apu_vec_pan_R[k]));
+    out = _mm_sub_epi16(_mm_xor_si128(out, sign), sign);
+    sum_R = _mm_add_epi32(sum_R, _mm_madd_epi16(out, ones));
+  }
+
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0x4E));
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0xB1));
+
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0x4E));
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0xB1));
+
+  mix[0] = _mm_cvtsi128_si32(sum_L);
+  mix[1] = _mm_cvtsi128_si32(sum_R);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_mix_lanes_sse41()                                                      */
+/******************************************************************************/
+__attribute__((target("sse4.1")))
+static int apu_mix_lanes_sse41(int* mix)
+{
+  int k;
+
+  __m128i sign;
+  __m128i adj;
+  __m128i out;
+  __m128i sum_L;
+  __m128i sum_R;
+
+  /* 4 voices at once in 32 bit lanes, with pmulld */
+  sum_L = _mm_setzero_si128();
+  sum_R = _mm_setzero_si128();
+
+  for (k = 0; k < APU_VEC_LANES; k += 4)
+  {
+    sign = _mm_cvtepi16_epi32(
+              _mm_loadl_epi64((__m128i*) &S_apu_vec_sign[k]));
+
+    adj = _mm_mullo_epi32(
+            _mm_cvtepu16_epi32(
+              _mm_loadl_epi64((__m128i*) &S_apu_vec_level[k])), 
+            _mm_cvtepu16_epi32(
+              _mm_loadl_epi64((__m128i*) &S_apu_vec_vol[k])));
+    adj = _mm_srli_epi32(adj, 15);
+
+    out = _mm_mullo_epi32(adj, _mm_cvtepu16_epi32(
+            _mm_loadl_epi64((__m128i*) &S_apu_vec_pan_L[k])));
+    out = _mm_srli_epi32(out, 15);
+    sum_L = _mm_add_epi32(sum_L, 
+                          _mm_sub_epi32(_mm_xor_si128(out, sign), sign));
+
+    out = _mm_mullo_epi32(adj, _mm_cvtepu16_epi32(
+            _mm_loadl_epi64((__m128i*) &S_apu_vec_pan_R[k])));
+    out = _mm_srli_epi32(out, 15);
+    sum_R = _mm_add_epi32(sum_R, 
+                          _mm_sub_epi32(_mm_xor_si128(out, sign), sign));
+  }
+
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0x4E));
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0xB1));
+
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0x4E));
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0xB1));
+
+  mix[0] = _mm_cvtsi128_si32(sum_L);
+  mix[1] = _mm_cvtsi128_si32(sum_R);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_mix_lanes_avx2()                                                       */
+/******************************************************************************/
+__attribute__((target("avx2")))
+static int apu_mix_lanes_avx2(int* mix)
+{
+  __m256i level;
+  __m256i sign;
+  __m256i adj;
+  __m256i out;
+  __m256i ones;
+  __m128i sum_L;
+  __m128i sum_R;
+
+  /* same as apu_mix_lanes_sse2(), but all 16 lanes at once */
+  ones = _mm256_set1_epi16(1);
+
+  level = _mm256_loadu_si256((__m256i*) &S_apu_vec_level[0]);
+  sign = _mm256_loadu_si256((__m256i*) &S_apu_vec_sign[0]);
+
+  adj = _mm256_mulhi_epu16( 
+          _mm256_slli_epi16(level, 1), 
+          _mm256_loadu_si256((__m256i*) &S_apu_vec_vol[0]));
+  adj = _mm256_slli_epi16(adj, 1);
+
+  out = _mm256_mulhi_epu16(adj, 
+                           _mm256_loadu_si256((__m256i*) &S_apu_vec_pan_L[0]));
+  out = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_xor_si256(out, sign), sign), 
+                          ones);
+  sum_L = _mm_add_epi32(_mm256_castsi256_si128(out), 
+                        _mm256_extracti128_si256(out, 1));
+
+  out = _mm256_mulhi_epu16(adj, 
+                           _mm256_loadu_si256((__m256i*) &S_apu_vec_pan_R[0]));
+  out = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_xor_si256(out, sign), sign), 
+                          ones);
+  sum_R = _mm_add_epi32(_mm256_castsi256_si128(out), 
+                        _mm256_extracti128_si256(out, 1));
+
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0x4E));
+  sum_L = _mm_add_epi32(sum_L, _mm_shuffle_epi32(sum_L, 0xB1));
+
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0x4E));
+  sum_R = _mm_add_epi32(sum_R, _mm_shuffle_epi32(sum_R, 0xB1));
+
+  mix[0] = _mm_cvtsi128_si32(sum_L);
+  mix[1] = _mm_cvtsi128_si32(sum_R);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_mix_lanes_avx512()                                                     */
+/******************************************************************************/
+__attribute__((target("avx512f")))
+static int apu_mix_lanes_avx512(int* mix)
+{
+  __m512i sign;
+  __m512i adj;
+  __m512i out;
+
+  /* same as apu_mix_lanes_sse41(), but all 16 lanes at once */
+  sign = _mm512_cvtepi16_epi32(
+            _mm256_loadu_si256((__m256i*) &S_apu_vec_sign[0]));
+
+  adj = _mm512_mullo_epi32( 
+          _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((__m256i*) &S_apu_vec_level[0])), 
+          _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((__m256i*) &S_apu_vec_vol[0])));
+  adj = _mm512_srli_epi32(adj, 15);
+
+  out = _mm512_mullo_epi32(adj, _mm512_cvtepu16_epi32(
+          _mm256_loadu_si256((__m256i*) &S_apu_vec_pan_L[0])));
+  out = _mm512_srli_epi32(out, 15);
+  mix[0] = _mm512_reduce_add_epi32(
+            _mm512_sub_epi32(_mm512_xor_si512(out, sign), sign));
+
+  out = _mm512_mullo_epi32(adj, _mm512_cvtepu16_epi32(
+          _mm256_loadu_si256((__m256i*) &S_apu_vec_pan_R[0])));
+  out = _mm512_srli_epi32(out, 15);
+  mix[1] = _mm512_reduce_add_epi32(
+            _mm512_sub_epi32(_mm512_xor_si512(out, sign), sign));
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_dac_sse41()                                                    */
+/******************************************************************************/
+__attribute__((target("sse4.1")))
+static int apu_advance_dac_sse41(int* mix)
+{
+  __m128i samp;
+  __m128i pos;
+  __m128i neg;
+  __m128i in_1;
+  __m128i out_1;
+
+  /* same as apu_advance_dac(), with the left and right */
+  /* channels side by side in the 2 low lanes           */
+  samp = _mm_setr_epi32(mix[0], mix[1], 0, 0);
+
+  samp = _mm_min_epi32(samp, _mm_set1_epi32(8191));
+  samp = _mm_max_epi32(samp, _mm_set1_epi32(-8192));
+
+  /* apply dac (9 bits signed input, 16 bits signed output) */
+  samp = _mm_srai_epi32(_mm_add_epi32(samp, _mm_set1_epi32(8192)), 5);
+
+  samp = _mm_min_epi32(samp, _mm_set1_epi32(511));
+  samp = _mm_max_epi32(samp, _mm_setzero_si128());
+
+  pos = _mm_srai_epi32( 
+          _mm_mullo_epi32(_mm_set1_epi32(APU_DAC_POS_MULT), 
+                          _mm_sub_epi32(samp, _mm_set1_epi32(256))), 6);
+
+  neg = _mm_add_epi32(_mm_set1_epi32(-32768), 
+        _mm_srai_epi32( 
+          _mm_mullo_epi32(_mm_set1_epi32(APU_DAC_NEG_MULT), samp), 6));
+
+  samp = _mm_blendv_epi8(neg, pos, 
+                         _mm_cmpgt_epi32(samp, _mm_set1_epi32(255)));
+
+  samp = _mm_min_epi32(samp, _mm_set1_epi32(32767));
+  samp = _mm_max_epi32(samp, _mm_set1_epi32(-32768));
+
+  /* apply highpass filter */
+  in_1 = _mm_setr_epi32(S_apu_hp_in[2 * 0 + 0], S_apu_hp_in[2 * 1 + 0], 0, 0);
+  out_1 = _mm_setr_epi32( S_apu_hp_out[2 * 0 + 0], 
+                          S_apu_hp_out[2 * 1 + 0], 0, 0);
+
+  S_apu_hp_in[2 * 0 + 1]  = S_apu_hp_in[2 * 0 + 0];
+  S_apu_hp_in[2 * 1 + 1]  = S_apu_hp_in[2 * 1 + 0];
+  S_apu_hp_out[2 * 0 + 1] = S_apu_hp_out[2 * 0 + 0];
+  S_apu_hp_out[2 * 1 + 1] = S_apu_hp_out[2 * 1 + 0];
+
+  S_apu_hp_in[2 * 0 + 0] = _mm_extract_epi32(samp, 0);
+  S_apu_hp_in[2 * 1 + 0] = _mm_extract_epi32(samp, 1);
+
+  samp = _mm_add_epi32( 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_HP_MULT_B0), samp)), 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_HP_MULT_B1), in_1)));
+  samp = _mm_sub_epi32(samp, 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_HP_MULT_A1), out_1)));
+
+  samp = _mm_min_epi32(samp, _mm_set1_epi32(32767));
+  samp = _mm_max_epi32(samp, _mm_set1_epi32(-32768));
+
+  S_apu_hp_out[2 * 0 + 0] = _mm_extract_epi32(samp, 0);
+  S_apu_hp_out[2 * 1 + 0] = _mm_extract_epi32(samp, 1);
+
+  /* apply lowpass filter */
+  in_1 = _mm_setr_epi32(S_apu_lp_in[2 * 0 + 0], S_apu_lp_in[2 * 1 + 0], 0, 0);
+  out_1 = _mm_setr_epi32( S_apu_lp_out[2 * 0 + 0], 
+                          S_apu_lp_out[2 * 1 + 0], 0, 0);
+
+  S_apu_lp_in[2 * 0 + 1]  = S_apu_lp_in[2 * 0 + 0];
+  S_apu_lp_in[2 * 1 + 1]  = S_apu_lp_in[2 * 1 + 0];
+  S_apu_lp_out[2 * 0 + 1] = S_apu_lp_out[2 * 0 + 0];
+  S_apu_lp_out[2 * 1 + 1] = S_apu_lp_out[2 * 1 + 0];
+
+  S_apu_lp_in[2 * 0 + 0] = _mm_extract_epi32(samp, 0);
+  S_apu_lp_in[2 * 1 + 0] = _mm_extract_epi32(samp, 1);
+
+  samp = _mm_add_epi32( 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_LP_MULT_B0), samp)), 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_LP_MULT_B1), in_1)));
+  samp = _mm_sub_epi32(samp, 
+          apu_div_32768_sse41( 
+            _mm_mullo_epi32(_mm_set1_epi32(APU_LP_MULT_A1), out_1)));
+
+  samp = _mm_min_epi32(samp, _mm_set1_epi32(32767));
+  samp = _mm_max_epi32(samp, _mm_set1_epi32(-32768));
+
+  S_apu_lp_out[2 * 0 + 0] = _mm_extract_epi32(samp, 0);
+  S_apu_lp_out[2 * 1 + 0] = _mm_extract_epi32(samp, 1);
+
+  return 0;
+}
+#endif
+
+/******************************************************************************/
+/* apu_advance_syn_vector()                                                   */
+/******************************************************************************/
+int apu_advance_syn_vector()
+{
+  int m;
+
+  /* same as apu_advance_syn(), but with the voices side by side. */
+  /* only the 1st operator is output for now, so that is the one  */
+  /* the kernels compute. sse2 has no way to do the lookups, and  */
+  /* runs the scalar code instead                                 */
+  if (S_apu_engine == APU_ENGINE_SSE2)
+    return apu_advance_syn();
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    S_apu_vec_index[m]      = APU_OSC_REG(m, 0, INDEX);
+    S_apu_vec_env_level[m]  = APU_ENV_REG(m, 0, LEVEL);
+  }
+
+  switch (S_apu_engine)
+  {
+#ifdef APU_X86_KERNELS
+    case APU_ENGINE_SSE41:
+      apu_syn_levels_sse41();
+      break;
+
+    case APU_ENGINE_AVX2:
+      apu_syn_levels_avx2();
+      break;
+
+    case APU_ENGINE_AVX512:
+      apu_syn_levels_avx512();
+      break;
+#endif
+
+    default:
+      return apu_advance_syn();
+  }
+
+  /* idle voices are skipped (their level is left at 0) */
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    if (!APU_FM_ALLOC_REG(m, IDLE))
+      APU_SYN_REG(m, LEVEL) = S_apu_vec_syn_level[m];
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_advance_out_vector()                                                   */
+/******************************************************************************/
+int apu_advance_out_vector()
+{
+  int m;
+  int n;
+
+  int mix[2];
+
+  unsigned short val;
+
+  /* same as apu_advance_out_fast(), but the voices are mixed side */
+  /* by side. an idle voice (or unused lane) has a level of 0, so  */
+  /* it adds nothing to the mix                                    */
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
+  {
+    val = APU_FM_ALLOC_REG(m, IDLE) ? 0 : APU_SYN_REG(m, LEVEL);
+
+    S_apu_vec_level[m]  = val & 0x1FFF;
+    S_apu_vec_sign[m]   = (val & 0x2000) ? 0xFFFF : 0;
+    S_apu_vec_vol[m]    = S_apu_inst_vol_table[APU_KBD_REG(m, VOLUME)];
+    S_apu_vec_pan_L[m]  = S_apu_inst_pan_L_table[APU_KBD_REG(m, PANNING)];
+    S_apu_vec_pan_R[m]  = S_apu_inst_pan_R_table[APU_KBD_REG(m, PANNING)];
+  }
+
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    n = APU_NUM_FM_VOICES + m;
+    val = APU_PCM_REG(m, OUTPUT);
+
+    S_apu_vec_level[n]  = val & 0x1FFF;
+    S_apu_vec_sign[n]   = (val & 0x2000) ? 0xFFFF : 0;
+    S_apu_vec_vol[n]    = S_apu_inst_vol_table[APU_PCM_REG(m, VOLUME)];
+    S_apu_vec_pan_L[n]  = S_apu_inst_pan_L_table[APU_PCM_REG(m, PANNING)];
+    S_apu_vec_pan_R[n]  = S_apu_inst_pan_R_table[APU_PCM_REG(m, PANNING)];
+  }
+
+  switch (S_apu_engine)
+  {
+#ifdef APU_X86_KERNELS
+    case APU_ENGINE_SSE2:
+      apu_mix_lanes_sse2(mix);
+      apu_advance_dac(mix);
+      break;
+
+    case APU_ENGINE_SSE41:
+      apu_mix_lanes_sse41(mix);
+      apu_advance_dac_sse41(mix);
+      break;
+
+    case APU_ENGINE_AVX2:
+      apu_mix_lanes_avx2(mix);
+      apu_advance_dac_sse41(mix);
+      break;
+
+    case APU_ENGINE_AVX512:
+      apu_mix_lanes_avx512(mix);
+      apu_advance_dac_sse41(mix);
+      break;
+#endif
+
+    default:
+      return apu_advance_out_fast();
+  }
+
+  apu_advance_ds_input();
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_compute_sample_vector()                                                */
+/******************************************************************************/
+int apu_compute_sample_vector()
+{
+  int m;
+
+  int samp_L;
+  int samp_R;
+
+  short* window_L;
+  short* window_R;
+
+  short mult;
+
+  /* same as apu_compute_sample(), but the taps are summed by the */
+  /* simd kernel for the engine. since the input buffers are      */
+  /* mirrored, the window is contiguous from the buffer position  */
+  window_L = &S_apu_ds_L_in[S_apu_ds_buf_pos];
+  window_R = &S_apu_ds_R_in[S_apu_ds_buf_pos];
+
+  mult = S_apu_ds_kernel[APU_DS_M / 2];
+
+  samp_L = (mult * window_L[APU_DS_M / 2]) / 32768;
+  samp_R = (mult * window_R[APU_DS_M / 2]) / 32768;
+
+  APU_PROFILE_COUNT(fir_taps, 2 * S_apu_ds_num_taps + 1);
+
+  m = (APU_DS_M / 2) - S_apu_ds_num_taps;
+
+  switch (S_apu_engine)
+  {
+#ifdef APU_X86_KERNELS
+    case APU_ENGINE_SSE2:
+    case APU_ENGINE_SSE41:
+      samp_L += apu_ds_taps_sse2(window_L, m);
+      samp_R += apu_ds_taps_sse2(window_R, m);
+      break;
+
+    case APU_ENGINE_AVX2:
+      samp_L += apu_ds_taps_avx2(window_L, m);
+      samp_R += apu_ds_taps_avx2(window_R, m);
+      break;
+
+    case APU_ENGINE_AVX512:
+      samp_L += apu_ds_taps_avx512(window_L, m);
+      samp_R += apu_ds_taps_avx512(window_R, m);
+      break;
+#endif
+
+    default:
+      for (; m < (APU_DS_M / 2); m++)
+      {
+        mult = S_apu_ds_kernel[m];
+
+        samp_L += 
+          (mult * (window_L[m] + window_L[APU_DS_M - m])) / 32768;
+
+        samp_R += 
+          (mult * (window_R[m] + window_R[APU_DS_M - m])) / 32768;
+      }
+      break;
+  }
+
+  if (samp_L > 32767)
+    samp_L = 32767;
+  else if (samp_L < -32768)
+    samp_L = -32768;
+
+  if (samp_R > 32767)
+    samp_R = 32767;
+  else if (samp_R < -32768)
+    samp_R = -32768;
+
+  G_apu_out_L = samp_L;
+  G_apu_out_R = samp_R;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_compute_sample_resampled()                                             */
+/******************************************************************************/
+int apu_compute_sample_resampled()
+{
+  int n;
+
+  int samp_L;
+  int samp_R;
+
+  short* window_L;
+  short* window_R;
+  short* row;
+
+  /* the newest num_taps samples in the mirrored input buffers, */
+  /* filtered with the row for the current phase               */
+  window_L = &S_apu_ds_L_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE - 
+                            S_apu_rs_num_taps];
+  window_R = &S_apu_ds_R_in[S_apu_ds_buf_pos + APU_DS_BUFFER_SIZE - 
+                            S_apu_rs_num_taps];
+
+  row = &S_apu_rs_table[S_apu_rs_phase * APU_RS_MAX_TAPS];
+
+  APU_PROFILE_COUNT(fir_taps, 2 * S_apu_rs_num_taps);
+
+  switch (S_apu_engine)
+  {
+#ifdef APU_X86_KERNELS
+    case APU_ENGINE_SSE2:
+    case APU_ENGINE_SSE41:
+      samp_L = apu_rs_dot_sse2(window_L, row, S_apu_rs_num_taps);
+      samp_R = apu_rs_dot_sse2(window_R, row, S_apu_rs_num_taps);
+      break;
+
+    case APU_ENGINE_AVX2:
+      samp_L = apu_rs_dot_avx2(window_L, row, S_apu_rs_num_taps);
+      samp_R = apu_rs_dot_avx2(window_R, row, S_apu_rs_num_taps);
+      break;
+
+    case APU_ENGINE_AVX512:
+      samp_L = apu_rs_dot_avx512(window_L, row, S_apu_rs_num_taps);
+      samp_R = apu_rs_dot_avx512(window_R, row, S_apu_rs_num_taps);
+      break;
+#endif
+
+    default:
+      samp_L = 0;
+      samp_R = 0;
+
+      for (n = 0; n < (int) S_apu_rs_num_taps; n++)
+      {
+        samp_L += window_L[n] * row[n];
+        samp_R += window_R[n] * row[n];
+      }
+      break;
+  }
+
+  samp_L /= APU_RS_UNITY;
+  samp_R /= APU_RS_UNITY;
+
+  if (samp_L > 32767)
+    samp_L = 32767;
+  else if (samp_L < -32768)
+    samp_L = -32768;
+
+  if (samp_R > 32767)
+    samp_R = 32767;
+  else if (samp_R < -32768)
+    samp_R = -32768;
+
+  G_apu_out_L = samp_L;
+  G_apu_out_R = samp_R;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* apu_update()                                                               */
+/******************************************************************************/
+int apu_update()
+{
+  int m;
+
+  int num_clocks;
+
+  /* with the resampler, the clocks per output sample vary */
+  /* (at 44.1 khz, every 147 samples take 160 clocks)      */
+  if (S_apu_rs_flag && (S_apu_preview == APU_PREVIEW_OFF))
+  {
+    S_apu_rs_phase += S_apu_rs_step;
+
+    num_clocks = S_apu_rs_phase / S_apu_rs_num_phases;
+    S_apu_rs_phase %= S_apu_rs_num_phases;
+  }
+  else
+    num_clocks = S_apu_update_clocks;
+
+  /* native rate (and preview): the operators run once per output */
+  /* sample, and the output skips the oversampling filter entirely */
+  if ((S_apu_quality >= APU_QUALITY_NATIVE_RATE) || 
+      (S_apu_preview != APU_PREVIEW_OFF))
+  {
+    /* the oscillators cover all of the clocks in one step */
+    S_apu_osc_steps = num_clocks;
+
+    for (m = 0; m < num_clocks; m++)
+    {
+      if ((S_apu_timer % APU_SEQ_DIVIDER) == 0)
+        APU_PROFILE_STAGE(SEQ, apu_advance_sequencer());
+
+      if ((S_apu_timer % APU_LFO_DIVIDER) == 0)
+        APU_PROFILE_STAGE(LFO, apu_advance_lfo());
+
+      if ((S_apu_timer % APU_ENV_DIVIDER) == 0)
+        APU_PROFILE_STAGE(ENV, apu_advance_env());
+
+      if ((S_apu_timer % APU_PCM_DIVIDER) == 0)
+        APU_PROFILE_STAGE(PCM, apu_advance_pcm());
+
+      S_apu_timer += 1;
+
+      if ((S_apu_timer % APU_TMR_DIVIDER) == 0)
+        S_apu_timer = 0;
+    }
+
+    APU_PROFILE_STAGE(OSC, apu_advance_osc());
+
+    if (S_apu_engine <= APU_ENGINE_FAST)
+      APU_PROFILE_STAGE(SYN, apu_advance_syn());
+    else
+      APU_PROFILE_STAGE(SYN, apu_advance_syn_vector());
+
+    if (S_apu_engine == APU_ENGINE_REFERENCE)
+      APU_PROFILE_STAGE(OUT, apu_advance_out());
+    else if (S_apu_engine == APU_ENGINE_FAST)
+      APU_PROFILE_STAGE(OUT, apu_advance_out_fast());
+    else
+      APU_PROFILE_STAGE(OUT, apu_advance_out_vector());
+
+#ifdef APU_PROFILE
+    S_apu_profile.samples += 1;
+#endif
+
+    G_apu_out_L = S_apu_lp_out[2 * 0 + 0];
+    G_apu_out_R = S_apu_lp_out[2 * 1 + 0];
+
+    return 0;
+  }
+
+  for (m = 0; m < num_clocks; m++)
+  {
+    if ((S_apu_timer % APU_SEQ_DIVIDER) == 0)
+      APU_PROFILE_STAGE(SEQ, apu_advance_sequencer());
+
+    if ((S_apu_timer % APU_LFO_DIVIDER) == 0)
+      APU_PROFILE_STAGE(LFO, apu_advance_lfo());
+
+    if ((S_apu_timer % APU_ENV_DIVIDER) == 0)
+      APU_PROFILE_STAGE(ENV, apu_advance_env());
+
+    if ((S_apu_timer % APU_OSC_DIVIDER) == 0)
+      APU_PROFILE_STAGE(OSC, apu_advance_osc());
+
+    if ((S_apu_timer % APU_PCM_DIVIDER) == 0)
+      APU_PROFILE_STAGE(PCM, apu_advance_pcm());
+
+    if (S_apu_engine <= APU_ENGINE_FAST)
+      APU_PROFILE_STAGE(SYN, apu_advance_syn());
+    else
+      APU_PROFILE_STAGE(SYN, apu_advance_syn_vector());
+
+    if (S_apu_engine == APU_ENGINE_REFERENCE)
+      APU_PROFILE_STAGE(OUT, apu_advance_out());
+    else if (S_apu_engine == APU_ENGINE_FAST)
+      APU_PROFILE_STAGE(OUT, apu_advance_out_fast());
+    else
+      APU_PROFILE_STAGE(OUT, apu_advance_out_vector());
+
+    S_apu_timer += 1;
+
+    if ((S_apu_timer % APU_TMR_DIVIDER) == 0)
+      S_apu_timer = 0;
+  }
+
+  if (S_apu_rs_flag)
+    APU_PROFILE_STAGE(SAMPLE, apu_compute_sample_resampled());
+  else if (S_apu_engine == APU_ENGINE_REFERENCE)
+    APU_PROFILE_STAGE(SAMPLE, apu_compute_sample());
+  else if (S_apu_engine == APU_ENGINE_FAST)
+    APU_PROFILE_STAGE(SAMPLE, apu_compute_sample_fast());
+  else
+    APU_PROFILE_STAGE(SAMPLE, apu_compute_sample_vector());
+
+#ifdef APU_PROFILE
+  S_apu_profile.samples += 1;
+#endif
+
+  return 0;
+}
 
-  int osc_level[4];
-  int combined_level;
+/******************************************************************************/
+/* apu_silent()                                                               */
+/******************************************************************************/
+int apu_silent()
+{
+  int m;
 
+  /* the chip is silent when no voice is sounding, and the filters */
+  /* have all settled to 0 (the dac maps a mix of 0 to exactly 0,   */
+  /* so nothing after it can change until a voice starts again)     */
   for (m = 0; m < APU_NUM_FM_VOICES; m++)
   {
-    /* load registers to local variables */
-    feedin_0 = APU_SYN_REG(m, FEEDIN_0);
-    feedin_1 = APU_SYN_REG(m, FEEDIN_1);
-    syn_level = APU_SYN_REG(m, LEVEL);
+    if (!APU_FM_ALLOC_REG(m, IDLE))
+      return 0;
+  }
 
-    /* load patch params to local variables */
-    patch_num = APU_KBD_REG(m, PATCH_NO);
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    if ((APU_PCM_REG(m, LEVEL) < APU_OSC_MAX_LEVEL) || 
+        (APU_PCM_REG(m, OUTPUT) & 0x1FFF))
+    {
+      return 0;
+    }
+  }
 
-    fb = APU_PATCH_PARAM(patch_num, SYN_FB);
-    alg = APU_PATCH_PARAM(patch_num, SYN_ALG);
+  for (m = 0; m < 4; m++)
+  {
+    if (S_apu_hp_in[m] || S_apu_hp_out[m] || 
+        S_apu_lp_in[m] || S_apu_lp_out[m])
+    {
+      return 0;
+    }
+  }
 
-    fb = (fb > 99) ? 99 : fb;
-    alg = (alg > 7) ? 7 : alg;
+  /* (the 2nd half of each buffer mirrors the 1st) */
+  for (m = 0; m < APU_DS_BUFFER_SIZE; m++)
+  {
+    if (S_apu_ds_L_in[m] || S_apu_ds_R_in[m])
+      return 0;
+  }
 
-    for (n = 0; n < 4; n++)
-    {
-      adj_index = APU_OSC_REG(m, n, INDEX);
+  return 1;
+}
 
-      /* sine wavetable lookup */
-      if (adj_index < 256)
-        adj_level = S_apu_osc_sine_table[adj_index];
-      else if (adj_index < 512)
-        adj_level = S_apu_osc_sine_table[511 - adj_index];
-      else if (adj_index < 768)
-        adj_level = S_apu_osc_sine_table[adj_index - 512];
-      else
-        adj_level = S_apu_osc_sine_table[1023 - adj_index];
+/******************************************************************************/
+/* apu_seq_event_due()                                                        */
+/******************************************************************************/
+int apu_seq_event_due(int num_clocks)
+{
+  int m;
+  int n;
 
-      /* apply envelope */
-      adj_level += APU_ENV_REG(m, n, LEVEL);
+  unsigned short song_num;
+  unsigned short tempo;
+  unsigned short delay;
+  unsigned int   phase;
+  unsigned short index;
+  unsigned short size;
+  unsigned short timer;
 
-      if (adj_level > APU_OSC_MAX_LEVEL)
-        adj_level = APU_OSC_MAX_LEVEL;
+  /* checks if a track would run any commands in the next num_clocks */
+  /* clocks. this follows apu_advance_sequencer() up to the point     */
+  /* where the commands are read, without changing any registers      */
+  for (m = 0; m < APU_NUM_SEQ_TRACKS; m++)
+  {
+    song_num  = APU_SEQ_REG(m, SONG_NO);
+    tempo     = APU_SEQ_REG(m, TEMPO);
+    delay     = APU_SEQ_REG(m, DELAY);
+    phase     = APU_SEQ_REG(m, PHASE);
+    index     = APU_SEQ_REG(m, INDEX);
 
-      /* set final adjusted level and sign */
-      adj_level = adj_level & 0x0FFF;
+    size =  (APU_SONG_PARAM(song_num, SIZE_1) << 8) | 
+             APU_SONG_PARAM(song_num, SIZE_2);
 
-      if (adj_index >= 512)
-        adj_level |= 0x1000;
+    if (!APU_SONG_VALID(song_num))
+      size = 0;
 
-      /* convert from db to linear and store the output */
-      block = (adj_level & 0x0FFF) / APU_OSC_LEVEL_TABLE_SIZE;
-      entry = (adj_level & 0x0FFF) % APU_OSC_LEVEL_TABLE_SIZE;
+    if (index >= size)
+      continue;
 
-      osc_level[n] = S_apu_osc_level_table[entry];
+    if (tempo < APU_SEQ_MIN_TEMPO)
+      tempo = APU_SEQ_MIN_TEMPO;
 
-      if (block > 0)
+    timer = S_apu_timer;
+
+    for (n = 0; n < num_clocks; n++)
+    {
+      if ((timer % APU_SEQ_DIVIDER) == 0)
       {
-        if (block >= APU_OSC_LEVEL_ZERO_BLOCK)
-          osc_level[n] = 0;
-        else
-          osc_level[n] = osc_level[n] >> block;
-      }
+        phase += S_apu_seq_phase_incs_table[tempo - APU_SEQ_MIN_TEMPO];
 
-      if (adj_level & 0x1000)
-        osc_level[n] = -osc_level[n];
-    }
+        if (phase > 0xFFFF)
+        {
+          phase &= 0xFFFF;
 
-    /* for now, just output the 1st operator... */
-    combined_level = osc_level[0];
+          if (delay > 0)
+            delay -= 1;
 
-    if (combined_level > 8191)
-      combined_level = 8191;
-    else if (combined_level < -8191)
-      combined_level = -8191;
+          if (delay == 0)
+            return 1;
+        }
+      }
 
-    if (combined_level < 0)
-      syn_level = ((-combined_level) & 0x1FFF) | 0x2000; 
-    else
-      syn_level = (combined_level & 0x1FFF);
+      timer += 1;
 
-    /* store local variables to registers */
-    APU_SYN_REG(m, LEVEL) = syn_level;
+      if ((timer % APU_TMR_DIVIDER) == 0)
+        timer = 0;
+    }
   }
 
   return 0;
 }
 
 /******************************************************************************/
-/* apu_advance_out()                                                          */
+/* apu_skip_silence()                                                         */
 /******************************************************************************/
-int apu_advance_out()
+unsigned int apu_skip_silence(unsigned int max_samples)
 {
   int m;
-  int n;
 
-  int samp;
+  unsigned int k;
+  unsigned int rs_phase;
+  int          num_clocks;
 
-  unsigned short val;
-  unsigned short adj_level;
-  unsigned short mult;
+  /* the reference engine always runs every stage, so that the */
+  /* other engines (which skip the silence) can be checked      */
+  if (S_apu_engine == APU_ENGINE_REFERENCE)
+    return 0;
 
-  /* 2 channels (left & right) */
-  for (n = 0; n < 2; n++)
+  if (!apu_silent())
+    return 0;
+
+  /* while silent, the output stays at 0 and only the timer, the */
+  /* sequencer, the envelope tick count and the buffer positions */
+  /* move. they are stepped here exactly as apu_update() would,  */
+  /* up to the sample in which the next sequencer command runs   */
+  for (k = 0; k < max_samples; k++)
   {
-    /* compute mixed output (14 bit signed) */
-    samp = 0;
+    rs_phase = S_apu_rs_phase;
 
-    for (m = 0; m < APU_NUM_FM_VOICES; m++)
+    if (S_apu_rs_flag && (S_apu_preview == APU_PREVIEW_OFF))
     {
-      val = APU_SYN_REG(m, LEVEL);
-      adj_level = val & 0x1FFF;
-
-      mult = S_apu_inst_vol_table[APU_KBD_REG(m, VOLUME)];
-      adj_level = (adj_level * mult) / 32768;
-
-      if (n == 0)
-      {
-        mult = S_apu_inst_pan_L_table[APU_KBD_REG(m, PANNING)];
-        adj_level = (adj_level * mult) / 32768;
-      }
-      else
-      {
-        mult = S_apu_inst_pan_R_table[APU_KBD_REG(m, PANNING)];
-        adj_level = (adj_level * mult) / 32768;
-      }
+      rs_phase += S_apu_rs_step;
 
-      if (val & 0x2000)
-        samp -= adj_level;
-      else
-        samp += adj_level;
+      num_clocks = rs_phase / S_apu_rs_num_phases;
+      rs_phase %= S_apu_rs_num_phases;
     }
-
-    if (samp > 8191)
-      samp = 8191;
-    else if (samp < -8192)
-      samp = -8192;
-
-    /* apply dac (9 bits signed input, 16 bits signed output) */
-    samp = (samp + 8192) / 32;
-
-    if (samp > 511)
-      samp = 511;
-    else if (samp < 0)
-      samp = 0;
-
-    if (samp >= 256)
-      samp = (APU_DAC_POS_MULT * (samp - 256)) / 64;
     else
-      samp = -32768 + ((APU_DAC_NEG_MULT * samp) / 64);
-
-    if (samp > 32767)
-      samp = 32767;
-    else if (samp < -32768)
-      samp = -32768;
+      num_clocks = S_apu_update_clocks;
 
-    /* apply highpass filter */
-    S_apu_hp_in[2 * n + 1]  = S_apu_hp_in[2 * n + 0];
-    S_apu_hp_out[2 * n + 1] = S_apu_hp_out[2 * n + 0];
+    if (apu_seq_event_due(num_clocks))
+      break;
 
-    S_apu_hp_in[2 * n + 0] = samp;
-    samp =  ((APU_HP_MULT_B0 * S_apu_hp_in[2 * n + 0]) / 32768) + 
-            ((APU_HP_MULT_B1 * S_apu_hp_in[2 * n + 1]) / 32768) - 
-            ((APU_HP_MULT_A1 * S_apu_hp_out[2 * n + 1]) / 32768);
+    for (m = 0; m < num_clocks; m++)
+    {
+      /* (no commands are run, and every voice is idle) */
+      if ((S_apu_timer % APU_SEQ_DIVIDER) == 0)
+        apu_advance_sequencer();
 
-    if (samp > 32767)
-      samp = 32767;
-    else if (samp < -32768)
-      samp = -32768;
+      if ((S_apu_timer % APU_ENV_DIVIDER) == 0)
+        apu_advance_env();
 
-    S_apu_hp_out[2 * n + 0] = samp;
+      S_apu_timer += 1;
 
-    /* apply lowpass filter */
-    S_apu_lp_in[2 * n + 1]  = S_apu_lp_in[2 * n + 0];
-    S_apu_lp_out[2 * n + 1] = S_apu_lp_out[2 * n + 0];
+      if ((S_apu_timer % APU_TMR_DIVIDER) == 0)
+        S_apu_timer = 0;
+    }
 
-    S_apu_lp_in[2 * n + 0] = samp;
-    samp =  ((APU_LP_MULT_B0 * S_apu_lp_in[2 * n + 0]) / 32768) + 
-            ((APU_LP_MULT_B1 * S_apu_lp_in[2 * n + 1]) / 32768) - 
-            ((APU_LP_MULT_A1 * S_apu_lp_out[2 * n + 1]) / 32768);
+    /* the output stage runs once per sample at native rate */
+    if ((S_apu_quality >= APU_QUALITY_NATIVE_RATE) || 
+        (S_apu_preview != APU_PREVIEW_OFF))
+    {
+      S_apu_osc_steps = num_clocks;
+      S_apu_ds_buf_pos = (S_apu_ds_buf_pos + 1) % APU_DS_BUFFER_SIZE;
+    }
+    else
+    {
+      S_apu_ds_buf_pos = 
+        (S_apu_ds_buf_pos + num_clocks) % APU_DS_BUFFER_SIZE;
+    }
 
-    if (samp > 32767)
-      samp = 32767;
-    else if (samp < -32768)
-      samp = -32768;
+    S_apu_rs_phase = rs_phase;
 
-    S_apu_lp_out[2 * n + 0] = samp;
+#ifdef APU_PROFILE
+    S_apu_profile.samples += 1;
+#endif
   }
 
-  /* update downsampler filter input buffers (left & right) */
-  S_apu_ds_L_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 0 + 0];
-  S_apu_ds_R_in[S_apu_ds_buf_pos] = S_apu_lp_out[2 * 1 + 0];
-
-  S_apu_ds_buf_pos = (S_apu_ds_buf_pos + 1) % APU_DS_BUFFER_SIZE;
+  if (k > 0)
+  {
+    G_apu_out_L = 0;
+    G_apu_out_R = 0;
+  }
 
-  return 0;
+  return k;
 }
 
 /******************************************************************************/
-/* apu_compute_sample()                                                       */
+/* apu_render()                                                               */
 /******************************************************************************/
-int apu_compute_sample()
+int apu_render(short* buf, unsigned int num_samples, int num_channels)
 {
-  int m;
+  unsigned int n;
+  unsigned int skipped;
 
-  int samp_L;
-  int samp_R;
+  /* the player and the tools all render through here, so they */
+  /* measure and check the same path (silence included)         */
+  if (buf == NULL)
+    return 1;
 
-  int adj_pos;
-  int inv_pos;
+  if ((num_channels != 1) && (num_channels != 2))
+    return 1;
 
-  short mult;
+  n = 0;
 
-  /* apply downsampler filters (left & right) */
-  adj_pos = (S_apu_ds_buf_pos + (APU_DS_M / 2)) % APU_DS_BUFFER_SIZE;
+  while (n < num_samples)
+  {
+    /* stretches of silence are filled in without rendering */
+    skipped = apu_skip_silence(num_samples - n);
 
-  mult = S_apu_ds_kernel[APU_DS_M / 2];
+    if (skipped > 0)
+    {
+      memset(&buf[num_channels * n], 0, 
+             num_channels * skipped * sizeof(short));
 
-  samp_L = (mult * S_apu_ds_L_in[adj_pos]) / 32768;
-  samp_R = (mult * S_apu_ds_R_in[adj_pos]) / 32768;
+      n += skipped;
+      continue;
+    }
 
-  for (m = 0; m < (APU_DS_M / 2); m++)
-  {
-    adj_pos = (S_apu_ds_buf_pos + m) % APU_DS_BUFFER_SIZE;
-    inv_pos = (S_apu_ds_buf_pos + APU_DS_M - m) % APU_DS_BUFFER_SIZE;
+    apu_update();
 
-    mult = S_apu_ds_kernel[m];
+    buf[num_channels * n] = G_apu_out_L;
 
-    samp_L += 
-      (mult * (S_apu_ds_L_in[adj_pos] + S_apu_ds_L_in[inv_pos])) / 32768;
+    if (num_channels == 2)
+      buf[num_channels * n + 1] = G_apu_out_R;
 
-    samp_R += 
-      (mult * (S_apu_ds_R_in[adj_pos] + S_apu_ds_R_in[inv_pos])) / 32768;
+    n += 1;
   }
 
-  if (samp_L > 32767)
-    samp_L = 32767;
-  else if (samp_L < -32768)
-    samp_L = -32768;
-
-  if (samp_R > 32767)
-    samp_R = 32767;
-  else if (samp_R < -32768)
-    samp_R = -32768;
+  return 0;
+}
 
-  G_apu_out_L = samp_L;
-  G_apu_out_R = samp_R;
+#ifdef APU_PROFILE
+/******************************************************************************/
+/* apu_profile_reset()                                                        */
+/******************************************************************************/
+int apu_profile_reset()
+{
+  /* only call this while nothing is rendering */
+  memset(&S_apu_profile, 0, sizeof(S_apu_profile));
+  memset(&S_apu_profile_shared, 0, sizeof(S_apu_profile_shared));
 
   return 0;
 }
 
 /******************************************************************************/
-/* apu_update()                                                               */
+/* apu_profile_end_block()                                                    */
 /******************************************************************************/
-int apu_update()
+int apu_profile_end_block()
 {
   int m;
 
-  for (m = 0; m < APU_CLOCKS_PER_SAMPLE; m++)
+  unsigned int num_active;
+
+  /* count the voices that are sounding at the end of the block */
+  num_active = 0;
+
+  for (m = 0; m < APU_NUM_FM_VOICES; m++)
   {
-    if ((S_apu_timer % APU_SEQ_DIVIDER) == 0)
-      apu_advance_sequencer();
+    if (!APU_FM_ALLOC_REG(m, IDLE))
+      num_active += 1;
+  }
 
-    if ((S_apu_timer % APU_LFO_DIVIDER) == 0)
-      apu_advance_lfo();
+  for (m = 0; m < APU_NUM_PCM_VOICES; m++)
+  {
+    if (APU_PCM_REG(m, LEVEL) < APU_OSC_MAX_LEVEL)
+      num_active += 1;
+  }
 
-    if ((S_apu_timer % APU_ENV_DIVIDER) == 0)
-      apu_advance_env();
+  S_apu_profile.blocks += 1;
+  S_apu_profile.active_voices += num_active;
 
-    if ((S_apu_timer % APU_OSC_DIVIDER) == 0)
-      apu_advance_osc();
+  if (num_active > S_apu_profile.max_active_voices)
+    S_apu_profile.max_active_voices = num_active;
 
-#if 0
-    if ((S_apu_timer % APU_PCM_DIVIDER) == 0)
-      apu_advance_pcm();
-#endif
+  /* publish the counters (each one is read and written whole, */
+  /* but a snapshot can mix counters from adjacent blocks)     */
+  for (m = 0; m < APU_NUM_STAGES; m++)
+  {
+    __atomic_store_n( &S_apu_profile_shared.cycles[m], 
+                      S_apu_profile.cycles[m], __ATOMIC_RELAXED);
+    __atomic_store_n( &S_apu_profile_shared.calls[m], 
+                      S_apu_profile.calls[m], __ATOMIC_RELAXED);
+  }
 
-    apu_advance_syn();
-    apu_advance_out();
+  __atomic_store_n( &S_apu_profile_shared.samples, 
+                    S_apu_profile.samples, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.env_steps, 
+                    S_apu_profile.env_steps, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.seq_events, 
+                    S_apu_profile.seq_events, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.fir_taps, 
+                    S_apu_profile.fir_taps, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.blocks, 
+                    S_apu_profile.blocks, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.active_voices, 
+                    S_apu_profile.active_voices, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_apu_profile_shared.max_active_voices, 
+                    S_apu_profile.max_active_voices, __ATOMIC_RELAXED);
 
-    S_apu_timer += 1;
+  return 0;
+}
 
-    if ((S_apu_timer % APU_TMR_DIVIDER) == 0)
-      S_apu_timer = 0;
+/******************************************************************************/
+/* apu_profile_get()                                                          */
+/******************************************************************************/
+int apu_profile_get(apu_profile* prof)
+{
+  int m;
+
+  if (prof == NULL)
+    return 1;
+
+  /* a snapshot as of the end of the last block */
+  for (m = 0; m < APU_NUM_STAGES; m++)
+  {
+    prof->cycles[m] = 
+      __atomic_load_n(&S_apu_profile_shared.cycles[m], __ATOMIC_RELAXED);
+    prof->calls[m] = 
+      __atomic_load_n(&S_apu_profile_shared.calls[m], __ATOMIC_RELAXED);
   }
 
-  apu_compute_sample();
+  prof->samples = 
+    __atomic_load_n(&S_apu_profile_shared.samples, __ATOMIC_RELAXED);
+  prof->env_steps = 
+    __atomic_load_n(&S_apu_profile_shared.env_steps, __ATOMIC_RELAXED);
+  prof->seq_events = 
+    __atomic_load_n(&S_apu_profile_shared.seq_events, __ATOMIC_RELAXED);
+  prof->fir_taps = 
+    __atomic_load_n(&S_apu_profile_shared.fir_taps, __ATOMIC_RELAXED);
+  prof->blocks = 
+    __atomic_load_n(&S_apu_profile_shared.blocks, __ATOMIC_RELAXED);
+  prof->active_voices = 
+    __atomic_load_n(&S_apu_profile_shared.active_voices, __ATOMIC_RELAXED);
+  prof->max_active_voices = 
+    __atomic_load_n(&S_apu_profile_shared.max_active_voices, __ATOMIC_RELAXED);
 
   return 0;
 }
-
+#endif
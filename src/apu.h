@@ -5,17 +5,253 @@
 #ifndef APU_H
 #define APU_H
 
+#include "apu_config.h"
+
 #define APU_OUT_SAMPLING_RATE   24000
 #define APU_OUT_SAMPLES_PER_MS  (APU_OUT_SAMPLING_RATE / 1000)
 
+/* the output rate can also be set at runtime, to anything that */
+/* the resampler can reach from the 48 khz clock rate (see     */
+/* apu_set_output_rate). the rate above is the default         */
+#define APU_OUT_MIN_RATE            8000
+#define APU_OUT_MAX_RATE            48000
+#define APU_OUT_MAX_SAMPLES_PER_MS  (APU_OUT_MAX_RATE / 1000)
+
+/* pcm sample rates */
+enum
+{
+  APU_PCM_RATE_8287 = 0, 
+  APU_PCM_RATE_8363, 
+  APU_PCM_RATE_11025, 
+  APU_PCM_RATE_22050, 
+  APU_NUM_PCM_RATES 
+};
+
+/* sequencer tracks */
+enum
+{
+  APU_SEQ_TRACK_MUSIC = 0, 
+  APU_SEQ_TRACK_SFX, 
+  APU_NUM_SEQ_TRACKS 
+};
+
+/* sequencer commands. the low nibble is the command, and for */
+/* channel commands the high nibble is the midi channel.      */
+enum
+{
+  APU_SEQ_CMD_TEMPO       = 0x00, /* 2 bytes: cmd, bpm          */
+  APU_SEQ_CMD_DELAY_8     = 0x01, /* 2 bytes: cmd, ticks        */
+  APU_SEQ_CMD_DELAY_16    = 0x02, /* 3 bytes: cmd, ticks (lo/hi) */
+  APU_SEQ_CMD_PROGRAM     = 0x03, /* 2 bytes: cmd, program      */
+  APU_SEQ_CMD_VOLUME      = 0x04, /* 2 bytes: cmd, volume       */
+  APU_SEQ_CMD_PANNING     = 0x05, /* 2 bytes: cmd, panning      */
+  APU_SEQ_CMD_NOTE_ON     = 0x06, /* 3 bytes: cmd, note, vel    */
+  APU_SEQ_CMD_NOTE_OFF    = 0x08, /* 2 bytes: cmd, note         */
+  APU_SEQ_CMD_PITCH_WHEEL = 0x09, /* 2 bytes: cmd, amount       */
+  APU_SEQ_CMD_PRESSURE    = 0x0A, /* 2 bytes: cmd, amount       */
+  APU_SEQ_CMD_MOD_WHEEL   = 0x0B, /* 2 bytes: cmd, amount       */
+  APU_SEQ_CMD_PORTAMENTO  = 0x0C, /* 2 bytes: cmd, on/off       */
+  APU_SEQ_CMD_SUSTAIN     = 0x0D, /* 2 bytes: cmd, on/off       */
+  APU_SEQ_CMD_SYSTEM      = 0x0F  /* see below                  */
+};
+
+/* system commands. these share the low nibble 0x0F, and the high  */
+/* nibble picks the command. loops and calls do not nest, and call */
+/* indices are from the start of the song.                         */
+enum
+{
+  APU_SEQ_SYS_LOOP_START  = 0x0F, /* 1 byte:  cmd                      */
+  APU_SEQ_SYS_LOOP_END    = 0x1F, /* 2 bytes: cmd, count (0 = forever) */
+  APU_SEQ_SYS_CALL        = 0x2F, /* 3 bytes: cmd, index (lo/hi)       */
+  APU_SEQ_SYS_RETURN      = 0x3F, /* 1 byte:  cmd                      */
+  APU_SEQ_SYS_END         = 0x4F  /* 1 byte:  cmd                      */
+};
+
+/* delays are in 960 ppqn ticks */
+#define APU_SEQ_TICKS_PER_BEAT 960
+
+/* song sizes are stored in 2 bytes */
+#define APU_MAX_SONG_SIZE 65535
+
+/* sample sizes are stored in 2 bytes */
+#define APU_MAX_SAMPLE_SIZE 65535
+
+/* patch parameters (in the order they are stored in the patch rom) */
+enum
+{
+  APU_PATCH_PARAM_SYN_FB = 0, 
+  APU_PATCH_PARAM_SYN_ALG, 
+  APU_PATCH_PARAM_ENV_AR, 
+  APU_PATCH_PARAM_ENV_DR, 
+  APU_PATCH_PARAM_ENV_SR, 
+  APU_PATCH_PARAM_ENV_RR, 
+  APU_PATCH_PARAM_ENV_SL, 
+  APU_PATCH_PARAM_ENV_TL, 
+  APU_PATCH_PARAM_LFO_SPEED, 
+  APU_PATCH_PARAM_VIB_SENS_DEPTH, 
+  APU_PATCH_PARAM_TREM_SENS_DEPTH, 
+  APU_NUM_PATCH_PARAMS 
+};
+
+#define APU_MAX_PATCHES 32
+
+/* rom regions (as stored in a cartridge image) */
+enum
+{
+  APU_ROM_REGION_PATCHES = 0, 
+  APU_ROM_REGION_KITS, 
+  APU_ROM_REGION_SAMPLES, 
+  APU_ROM_REGION_SONGS, 
+  APU_ROM_REGION_MIDI_DATA, 
+  APU_ROM_REGION_PCM_DATA, 
+  APU_NUM_ROM_REGIONS 
+};
+
+/* quality levels. each one gives up a little more of the sound to */
+/* make rendering cheaper, and keeps the cuts of the ones before it */
+enum
+{
+  APU_QUALITY_FULL = 0,     /* everything                           */
+  APU_QUALITY_SHORT_FIR,    /* downsampler uses 17 of its 65 taps   */
+  APU_QUALITY_NATIVE_RATE,  /* operators run at the output rate     */
+  APU_QUALITY_SLOW_ENV,     /* envelopes update at half rate        */
+  APU_QUALITY_VOICES_6,     /* the quietest fm voices are dropped.. */
+  APU_QUALITY_VOICES_4,     /* ..down to 6, 4, then 2 voices        */
+  APU_QUALITY_VOICES_2, 
+  APU_NUM_QUALITY_LEVELS 
+};
+
+/* pipeline stages (for profiling and checking, in the order they run) */
+enum
+{
+  APU_STAGE_SEQ = 0, 
+  APU_STAGE_LFO, 
+  APU_STAGE_ENV, 
+  APU_STAGE_OSC, 
+  APU_STAGE_PCM, 
+  APU_STAGE_SYN, 
+  APU_STAGE_OUT, 
+  APU_STAGE_SAMPLE, 
+  APU_NUM_STAGES 
+};
+
+/* preview modes, for scrubbing and thumbnails where only the pitch */
+/* and timing have to be right. the operators run once per output   */
+/* sample (at half the output rate, for the half mode) with their   */
+/* phase increments scaled to match, and the downsampler is skipped */
+enum
+{
+  APU_PREVIEW_OFF = 0, 
+  APU_PREVIEW_NATIVE,       /* output at the usual rate   */
+  APU_PREVIEW_HALF,         /* output at half of the rate */
+  APU_NUM_PREVIEW_MODES 
+};
+
+/* render engines. the reference engine is the plain scalar code, and */
+/* it defines the sound of the chip: every other engine has to match  */
+/* it bit for bit (tools/czdiff checks this). the vector engines are  */
+/* the fast engine with simd operator, mixer, filter and downsampler  */
+/* kernels, and are only available when the cpu supports them (see   */
+/* apu_detect_engine)                                                 */
+enum
+{
+  APU_ENGINE_REFERENCE = 0, 
+  APU_ENGINE_FAST, 
+  APU_ENGINE_SSE2, 
+  APU_ENGINE_SSE41, 
+  APU_ENGINE_AVX2, 
+  APU_ENGINE_AVX512, 
+  APU_NUM_ENGINES 
+};
+
+/* profiling counters: stage timings (see apu_update), the envelope */
+/* steps, sequencer commands and filter taps that were evaluated, and */
+/* the voices sounding at the end of each block (summed, and the max) */
+#ifdef APU_PROFILE
+typedef struct apu_profile
+{
+  unsigned long cycles[APU_NUM_STAGES];
+  unsigned long calls[APU_NUM_STAGES];
+  unsigned long samples;
+  unsigned long env_steps;
+  unsigned long seq_events;
+  unsigned long fir_taps;
+  unsigned long blocks;
+  unsigned long active_voices;
+  unsigned int  max_active_voices;
+} apu_profile;
+#endif
+
 /* output levels */
 extern short G_apu_out_L;
 extern short G_apu_out_R;
 
 /* function declarations */
 int apu_reset();
+int apu_clear_roms();
+int apu_wipe_roms();
 int apu_update();
 
+/* renders samples into buf (1 channel is just the left, and 2 are */
+/* left and right interleaved). where the chip is silent, up to    */
+/* the next sequencer command, the samples are filled in with 0    */
+/* instead (except on the reference engine, which never skips)     */
+int apu_render(short* buf, unsigned int num_samples, int num_channels);
+
 int apu_play_note(unsigned short inst_num, unsigned short note);
+int apu_play_sample(unsigned short voice_num, unsigned short samp_num, 
+                    unsigned short velocity);
+
+int apu_release_note(unsigned short inst_num);
+
+int apu_voice_command(unsigned short inst_num, unsigned char code, 
+                      unsigned char data_1, unsigned char data_2);
+int apu_seq_channel_command(unsigned short track_num, unsigned char code, 
+                            unsigned char data_1, unsigned char data_2);
+
+int apu_load_patch( unsigned short patch_num, 
+                    unsigned char* data, unsigned int num_bytes);
+int apu_load_song(unsigned short song_num, 
+                  unsigned char* data, unsigned int num_bytes);
+int apu_play_song(unsigned short track_num, unsigned short song_num);
+int apu_stop_song(unsigned short track_num);
+
+unsigned short apu_seq_channel_mask(unsigned short track_num);
+
+int apu_set_polyphony(unsigned short num_fm, unsigned short num_pcm);
+int apu_set_sfx_voices(unsigned short num_fm, unsigned short num_pcm);
+
+int            apu_set_quality(unsigned short level);
+unsigned short apu_get_quality();
+
+int            apu_set_preview(unsigned short mode);
+unsigned short apu_get_preview();
+
+int            apu_set_output_rate(unsigned int rate);
+unsigned int   apu_get_output_rate();
+
+int            apu_set_engine(unsigned short engine);
+unsigned short apu_get_engine();
+
+int            apu_engine_supported(unsigned short engine);
+char*          apu_engine_name(unsigned short engine);
+unsigned short apu_detect_engine();
+
+unsigned long apu_stage_checksum(int stage);
+
+int apu_sample_begin(unsigned short samp_num, unsigned char rate);
+int apu_sample_append(unsigned char* data, unsigned int num_bytes);
+int apu_sample_end();
+
+int apu_rom_region( int region, 
+                    unsigned char** data, unsigned int* num_bytes);
+int apu_attach_cart(unsigned char** regions);
+int apu_detach_cart();
+
+#ifdef APU_PROFILE
+int apu_profile_reset();
+int apu_profile_end_block();
+int apu_profile_get(apu_profile* prof);
+#endif
 
 #endif
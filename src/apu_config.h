@@ -0,0 +1,36 @@
+/******************************************************************************/
+/* apu_config.h (chip variants)                                               */
+/******************************************************************************/
+
+#ifndef APU_CONFIG_H
+#define APU_CONFIG_H
+
+/* the chip can be built in a few sizes from the same source. the  */
+/* full chip is the default, and the smaller variants are picked   */
+/* on the command line (make lite, make mini). the voice counts    */
+/* include the one that is kept for the sfx track. everything is   */
+/* a constant, so the voice and operator loops keep fixed counts.  */
+#if defined(APU_CONFIG_LITE)
+#define APU_CONFIG_NAME           "lite"
+#define APU_CONFIG_FM_VOICES      (5 + 1)
+#define APU_CONFIG_FM_OPERATORS   2
+#define APU_CONFIG_PCM_VOICES     (3 + 1)
+#define APU_CONFIG_MIDI_DATA_SIZE (1 << 17)
+#define APU_CONFIG_PCM_DATA_SIZE  (1 << 18)
+#elif defined(APU_CONFIG_MINI)
+#define APU_CONFIG_NAME           "mini"
+#define APU_CONFIG_FM_VOICES      (3 + 1)
+#define APU_CONFIG_FM_OPERATORS   2
+#define APU_CONFIG_PCM_VOICES     (1 + 1)
+#define APU_CONFIG_MIDI_DATA_SIZE (1 << 16)
+#define APU_CONFIG_PCM_DATA_SIZE  (1 << 17)
+#else
+#define APU_CONFIG_NAME           "full"
+#define APU_CONFIG_FM_VOICES      (9 + 1)
+#define APU_CONFIG_FM_OPERATORS   4
+#define APU_CONFIG_PCM_VOICES     (5 + 1)
+#define APU_CONFIG_MIDI_DATA_SIZE (1 << 19)
+#define APU_CONFIG_PCM_DATA_SIZE  (1 << 19)
+#endif
+
+#endif
@@ -2,20 +2,115 @@
 /* audio.c (sdl audio code)                                                   */
 /******************************************************************************/
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#ifdef AUDIO_USE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#ifdef AUDIO_USE_SDL
+#include <SDL2/SDL.h>
+#endif
 
 #include "audio.h"
 
 #include "apu.h"
+#include "queue.h"
+#include "wav.h"
 
 #define AUDIO_FB_MAX_MS 50
-#define AUDIO_FB_SIZE   (AUDIO_FB_MAX_MS * APU_OUT_SAMPLES_PER_MS)
+#define AUDIO_FB_SIZE   (AUDIO_FB_MAX_MS * APU_OUT_MAX_SAMPLES_PER_MS)
+
+/* the ring holds 16384 frames, so its length in ms depends on the */
+/* output rate (about 340 ms at 48 khz). must be a power of 2.     */
+#define AUDIO_RING_SIZE 16384
+#define AUDIO_RING_MASK (AUDIO_RING_SIZE - 1)
+
+/* the device period can't be longer than the frame buffer */
+#define AUDIO_MAX_PERIOD_MS AUDIO_FB_MAX_MS
+
+/* lock free single producer / single consumer ring. the render  */
+/* thread is the only one that moves the head, and the device    */
+/* (callback or thread) is the only one that moves the tail. the */
+/* positions count up forever, and are masked to index the ring. */
+static short        S_audio_ring[AUDIO_RING_SIZE];
+static unsigned int S_audio_ring_head;
+static unsigned int S_audio_ring_tail;
+
+/* counters (updated atomically, read from any thread) */
+static unsigned long S_audio_frames_rendered;
+static unsigned long S_audio_frames_played;
+static unsigned int  S_audio_underruns;
+static unsigned int  S_audio_overruns;
+
+/* output sample clock (commands from the queue are timed against it) */
+static unsigned long S_audio_clock;
+
+/* quality governor. render times are a percentage of the deadline: */
+/* over the high mark, the quality drops a level right away, and it  */
+/* only comes back up a level after a run of blocks under the low one */
+#define AUDIO_GOV_DOWN_LOAD 85
+#define AUDIO_GOV_UP_LOAD   50
+#define AUDIO_GOV_UP_BLOCKS 100
+
+static int          S_audio_gov_flag;
+static long         S_audio_gov_deadline_ns;
+static unsigned int S_audio_gov_calm_blocks;
+static unsigned int S_audio_gov_quality;
+static unsigned int S_audio_gov_demotions;
+static unsigned int S_audio_gov_promotions;
+static unsigned int S_audio_gov_max_load;
+
+/* render counters (written by the rendering thread, once per block) */
+#ifdef AUDIO_PROFILE
+static unsigned long S_audio_profile_blocks;
+static unsigned long S_audio_profile_samples;
+static unsigned long S_audio_profile_render_ns;
+static unsigned long S_audio_profile_max_render_ns;
+#endif
+
+/* the sample clock and the monotonic clock when the device started */
+static unsigned long S_audio_start_clock;
+static long          S_audio_start_sec;
+static long          S_audio_start_nsec;
+
+/* playback state */
+static int          S_audio_backend;
+static int          S_audio_running;
+static unsigned int S_audio_target_frames;
+static unsigned int S_audio_period_frames;
+static int          S_audio_sink_flag;
+
+static pthread_t    S_audio_render_thread;
+static pthread_t    S_audio_device_thread;
+
+/* the render and device threads each have their own buffer */
+static short        S_audio_render_buf[AUDIO_FB_SIZE];
+static short        S_audio_device_buf[AUDIO_FB_SIZE];
+
+#ifdef AUDIO_USE_ALSA
+static snd_pcm_t*   S_audio_alsa_pcm;
+#endif
+
+#ifdef AUDIO_USE_SDL
+static SDL_AudioDeviceID S_audio_sdl_device;
+#endif
 
 /* audio frame buffer */
 short         G_audio_frame_buffer[AUDIO_FB_SIZE];
 unsigned int  G_audio_frame_num_samples;
 
+/* the frames rendered so far (in ms), so that frame */
+/* lengths at 44.1 khz and the like don't drift       */
+static unsigned long S_audio_frame_ms;
+
 /* we can switch these to static once we're not writing to a wave file... */
 #if 0
 static short        S_audio_frame_buffer[AUDIO_FB_SIZE];
@@ -33,6 +128,11 @@ int audio_init()
     G_audio_frame_buffer[k] = 0;
 
   G_audio_frame_num_samples = 0;
+  S_audio_frame_ms = 0;
+
+  __atomic_store_n(&S_audio_clock, 0, __ATOMIC_RELEASE);
+
+  queue_init();
 
   return 0;
 }
@@ -42,31 +142,751 @@ int audio_init()
 /******************************************************************************/
 int audio_deinit()
 {
-  
+  audio_stop();
 
   return 0;
 }
 
+/******************************************************************************/
+/* audio_ring_write()                                                         */
+/******************************************************************************/
+unsigned int audio_ring_write(short* sample_buf, unsigned int num_samples)
+{
+  unsigned int k;
+  unsigned int head;
+  unsigned int tail;
+  unsigned int num_free;
+
+  /* producer side: only the head is ours */
+  head = S_audio_ring_head;
+  tail = __atomic_load_n(&S_audio_ring_tail, __ATOMIC_ACQUIRE);
+
+  num_free = AUDIO_RING_SIZE - (head - tail);
+
+  /* whatever doesn't fit is dropped */
+  if (num_samples > num_free)
+  {
+    __atomic_add_fetch(&S_audio_overruns, 1, __ATOMIC_RELAXED);
+    num_samples = num_free;
+  }
+
+  for (k = 0; k < num_samples; k++)
+    S_audio_ring[(head + k) & AUDIO_RING_MASK] = sample_buf[k];
+
+  /* publish the samples */
+  __atomic_store_n(&S_audio_ring_head, head + num_samples, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&S_audio_frames_rendered, num_samples, __ATOMIC_RELAXED);
+
+  return num_samples;
+}
+
+/******************************************************************************/
+/* audio_ring_read()                                                          */
+/******************************************************************************/
+unsigned int audio_ring_read(short* sample_buf, unsigned int num_samples)
+{
+  unsigned int k;
+  unsigned int head;
+  unsigned int tail;
+  unsigned int num_used;
+
+  /* consumer side: only the tail is ours. this is called */
+  /* from the device callback, so it never blocks         */
+  tail = S_audio_ring_tail;
+  head = __atomic_load_n(&S_audio_ring_head, __ATOMIC_ACQUIRE);
+
+  num_used = head - tail;
+
+  if (num_used > num_samples)
+    num_used = num_samples;
+
+  for (k = 0; k < num_used; k++)
+    sample_buf[k] = S_audio_ring[(tail + k) & AUDIO_RING_MASK];
+
+  /* fill the rest with silence if the renderer fell behind */
+  if (num_used < num_samples)
+  {
+    __atomic_add_fetch(&S_audio_underruns, 1, __ATOMIC_RELAXED);
+
+    for (k = num_used; k < num_samples; k++)
+      sample_buf[k] = 0;
+  }
+
+  /* hand the space back */
+  __atomic_store_n(&S_audio_ring_tail, tail + num_used, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&S_audio_frames_played, num_used, __ATOMIC_RELAXED);
+
+  return num_used;
+}
+
+/******************************************************************************/
+/* audio_ring_fill()                                                          */
+/******************************************************************************/
+unsigned int audio_ring_fill()
+{
+  unsigned int head;
+  unsigned int tail;
+
+  head = __atomic_load_n(&S_audio_ring_head, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&S_audio_ring_tail, __ATOMIC_ACQUIRE);
+
+  return head - tail;
+}
+
+/******************************************************************************/
+/* audio_sleep_ns()                                                           */
+/******************************************************************************/
+int audio_sleep_ns(long nanoseconds)
+{
+  struct timespec ts;
+
+  ts.tv_sec = nanoseconds / 1000000000L;
+  ts.tv_nsec = nanoseconds % 1000000000L;
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) != 0)
+    ;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_governor_update()                                                    */
+/******************************************************************************/
+int audio_governor_update(long render_ns)
+{
+  unsigned int   load;
+  unsigned short quality;
+
+  load = (unsigned int) (render_ns * 100 / S_audio_gov_deadline_ns);
+
+  if (load > S_audio_gov_max_load)
+    __atomic_store_n(&S_audio_gov_max_load, load, __ATOMIC_RELAXED);
+
+  quality = apu_get_quality();
+
+  /* step down as soon as a block gets close to the deadline */
+  if (load > AUDIO_GOV_DOWN_LOAD)
+  {
+    S_audio_gov_calm_blocks = 0;
+
+    if (quality + 1 < APU_NUM_QUALITY_LEVELS)
+    {
+      apu_set_quality(quality + 1);
+      __atomic_add_fetch(&S_audio_gov_demotions, 1, __ATOMIC_RELAXED);
+    }
+  }
+  /* step back up once the load has stayed low for a while */
+  else if (load < AUDIO_GOV_UP_LOAD)
+  {
+    S_audio_gov_calm_blocks += 1;
+
+    if ((S_audio_gov_calm_blocks >= AUDIO_GOV_UP_BLOCKS) && (quality > 0))
+    {
+      S_audio_gov_calm_blocks = 0;
+
+      apu_set_quality(quality - 1);
+      __atomic_add_fetch(&S_audio_gov_promotions, 1, __ATOMIC_RELAXED);
+    }
+  }
+  else
+    S_audio_gov_calm_blocks = 0;
+
+  __atomic_store_n(&S_audio_gov_quality, apu_get_quality(), __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_render_main()                                                        */
+/******************************************************************************/
+void* audio_render_main(void* arg)
+{
+  long            period_ns;
+  struct timespec start;
+  struct timespec end;
+
+  (void) arg;
+
+  period_ns = (long) S_audio_period_frames * 1000000000L / 
+              apu_get_output_rate();
+
+  /* keep the ring topped up to the latency target. the apu */
+  /* is only ever touched from this thread while running    */
+  while (__atomic_load_n(&S_audio_running, __ATOMIC_ACQUIRE))
+  {
+    if (audio_ring_fill() + S_audio_period_frames <= S_audio_target_frames)
+    {
+      if (S_audio_gov_flag)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+      audio_render_block(S_audio_render_buf, S_audio_period_frames);
+
+      if (S_audio_gov_flag)
+      {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        audio_governor_update((end.tv_sec - start.tv_sec) * 1000000000L + 
+                              (end.tv_nsec - start.tv_nsec));
+      }
+
+      audio_ring_write(S_audio_render_buf, S_audio_period_frames);
+    }
+    else
+      audio_sleep_ns(period_ns / 4);
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* audio_null_main()                                                          */
+/******************************************************************************/
+void* audio_null_main(void* arg)
+{
+  struct timespec next;
+  long            period_ns;
+
+  (void) arg;
+
+  period_ns = (long) S_audio_period_frames * 1000000000L / 
+              apu_get_output_rate();
+
+  /* a simulated device: drain one period on every tick of the   */
+  /* monotonic clock, and pass it on to the sink if there is one */
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (__atomic_load_n(&S_audio_running, __ATOMIC_ACQUIRE))
+  {
+    next.tv_nsec += period_ns;
+
+    while (next.tv_nsec >= 1000000000L)
+    {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec += 1;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+      ;
+
+    audio_ring_read(S_audio_device_buf, S_audio_period_frames);
+
+    if (S_audio_sink_flag)
+      wav_stream_write_block(S_audio_device_buf, S_audio_period_frames);
+  }
+
+  return NULL;
+}
+
+#ifdef AUDIO_USE_ALSA
+/******************************************************************************/
+/* audio_alsa_main()                                                          */
+/******************************************************************************/
+void* audio_alsa_main(void* arg)
+{
+  snd_pcm_sframes_t result;
+
+  (void) arg;
+
+  /* the blocking write paces this thread to the device clock */
+  while (__atomic_load_n(&S_audio_running, __ATOMIC_ACQUIRE))
+  {
+    audio_ring_read(S_audio_device_buf, S_audio_period_frames);
+
+    result = snd_pcm_writei(S_audio_alsa_pcm, S_audio_device_buf, 
+                            S_audio_period_frames);
+
+    /* the device ran dry, so count it and start over */
+    if (result == -EPIPE)
+    {
+      __atomic_add_fetch(&S_audio_underruns, 1, __ATOMIC_RELAXED);
+      snd_pcm_prepare(S_audio_alsa_pcm);
+    }
+    else if (result < 0)
+      snd_pcm_recover(S_audio_alsa_pcm, result, 1);
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* audio_alsa_open()                                                          */
+/******************************************************************************/
+int audio_alsa_open()
+{
+  if (snd_pcm_open(&S_audio_alsa_pcm, "default", 
+                    SND_PCM_STREAM_PLAYBACK, 0) < 0)
+  {
+    return 1;
+  }
+
+  /* mono, 16 bit, with the device buffer at the latency target */
+  if (snd_pcm_set_params( S_audio_alsa_pcm, 
+                          SND_PCM_FORMAT_S16, 
+                          SND_PCM_ACCESS_RW_INTERLEAVED, 
+                          1, apu_get_output_rate(), 1, 
+                          (S_audio_target_frames * 1000000UL) / 
+                          apu_get_output_rate()) < 0)
+  {
+    snd_pcm_close(S_audio_alsa_pcm);
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
+#ifdef AUDIO_USE_SDL
+/******************************************************************************/
+/* audio_sdl_callback()                                                       */
+/******************************************************************************/
+void audio_sdl_callback(void* userdata, Uint8* stream, int len)
+{
+  (void) userdata;
+
+  /* no locks in here: just drain the ring */
+  audio_ring_read((short*) stream, len / 2);
+}
+
+/******************************************************************************/
+/* audio_sdl_open()                                                           */
+/******************************************************************************/
+int audio_sdl_open()
+{
+  SDL_AudioSpec desired;
+  SDL_AudioSpec obtained;
+
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    return 1;
+
+  SDL_zero(desired);
+
+  desired.freq = apu_get_output_rate();
+  desired.format = AUDIO_S16SYS;
+  desired.channels = 1;
+  desired.samples = S_audio_period_frames;
+  desired.callback = audio_sdl_callback;
+
+  S_audio_sdl_device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
+
+  if (S_audio_sdl_device == 0)
+  {
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
+/******************************************************************************/
+/* audio_close_device()                                                       */
+/******************************************************************************/
+int audio_close_device()
+{
+#ifdef AUDIO_USE_ALSA
+  if (S_audio_backend == AUDIO_BACKEND_ALSA)
+  {
+    snd_pcm_drain(S_audio_alsa_pcm);
+    snd_pcm_close(S_audio_alsa_pcm);
+  }
+#endif
+
+#ifdef AUDIO_USE_SDL
+  if (S_audio_backend == AUDIO_BACKEND_SDL)
+  {
+    SDL_CloseAudioDevice(S_audio_sdl_device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+  }
+#endif
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_set_null_sink()                                                      */
+/******************************************************************************/
+int audio_set_null_sink(int enable)
+{
+  /* the null backend can pass what it plays on to the wave stream */
+  if (S_audio_running)
+    return 1;
+
+  S_audio_sink_flag = enable ? 1 : 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_set_governor()                                                       */
+/******************************************************************************/
+int audio_set_governor(int enable, unsigned int deadline_us)
+{
+  /* the deadline for each block defaults to the length of a period */
+  if (S_audio_running)
+    return 1;
+
+  S_audio_gov_flag = enable ? 1 : 0;
+  S_audio_gov_deadline_ns = (long) deadline_us * 1000;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_start()                                                              */
+/******************************************************************************/
+int audio_start(int backend, unsigned int latency_ms, unsigned int period_ms)
+{
+  struct timespec ts;
+
+  if (S_audio_running)
+    return 1;
+
+  if ((period_ms == 0) || (period_ms > AUDIO_MAX_PERIOD_MS))
+    return 1;
+
+  /* the target has to leave room for a period of headroom */
+  if (latency_ms < period_ms)
+    latency_ms = period_ms;
+
+  S_audio_period_frames = audio_ms_to_frames(period_ms);
+  S_audio_target_frames = audio_ms_to_frames(latency_ms);
+
+  if (S_audio_target_frames > AUDIO_RING_SIZE - S_audio_period_frames)
+    S_audio_target_frames = AUDIO_RING_SIZE - S_audio_period_frames;
+
+  S_audio_backend = backend;
+
+  /* the first sample in the ring is the first one played */
+  S_audio_start_clock = __atomic_load_n(&S_audio_clock, __ATOMIC_ACQUIRE);
+
+  /* reset the ring and the counters */
+  S_audio_ring_head = 0;
+  S_audio_ring_tail = 0;
+
+  S_audio_frames_rendered = 0;
+  S_audio_frames_played = 0;
+  S_audio_underruns = 0;
+  S_audio_overruns = 0;
+
+  /* the governor starts out at full quality */
+  if (S_audio_gov_flag)
+  {
+    if (S_audio_gov_deadline_ns <= 0)
+    {
+      S_audio_gov_deadline_ns = (long) S_audio_period_frames * 1000000000L / 
+                                apu_get_output_rate();
+    }
+
+    apu_set_quality(APU_QUALITY_FULL);
+  }
+
+  S_audio_gov_calm_blocks = 0;
+  S_audio_gov_quality = APU_QUALITY_FULL;
+  S_audio_gov_demotions = 0;
+  S_audio_gov_promotions = 0;
+  S_audio_gov_max_load = 0;
+
+  /* prefill the ring, so the device doesn't start out starved */
+  while (audio_ring_fill() + S_audio_period_frames <= S_audio_target_frames)
+  {
+    audio_render_block(S_audio_render_buf, S_audio_period_frames);
+    audio_ring_write(S_audio_render_buf, S_audio_period_frames);
+  }
+
+  /* open the device */
+  if (backend == AUDIO_BACKEND_NULL)
+  {
+    /* nothing to open */
+  }
+#ifdef AUDIO_USE_ALSA
+  else if (backend == AUDIO_BACKEND_ALSA)
+  {
+    if (audio_alsa_open())
+      return 1;
+  }
+#endif
+#ifdef AUDIO_USE_SDL
+  else if (backend == AUDIO_BACKEND_SDL)
+  {
+    if (audio_sdl_open())
+      return 1;
+  }
+#endif
+  else
+    return 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  S_audio_start_sec = (long) ts.tv_sec;
+  S_audio_start_nsec = ts.tv_nsec;
+
+  __atomic_store_n(&S_audio_running, 1, __ATOMIC_RELEASE);
+
+  /* start the threads */
+  if (pthread_create(&S_audio_render_thread, NULL, audio_render_main, NULL))
+    goto nope;
+
+  if (backend == AUDIO_BACKEND_NULL)
+  {
+    if (pthread_create(&S_audio_device_thread, NULL, audio_null_main, NULL))
+      goto nope_render;
+  }
+#ifdef AUDIO_USE_ALSA
+  else if (backend == AUDIO_BACKEND_ALSA)
+  {
+    if (pthread_create(&S_audio_device_thread, NULL, audio_alsa_main, NULL))
+      goto nope_render;
+  }
+#endif
+#ifdef AUDIO_USE_SDL
+  else if (backend == AUDIO_BACKEND_SDL)
+    SDL_PauseAudioDevice(S_audio_sdl_device, 0);
+#endif
+
+  return 0;
+
+nope_render:
+  __atomic_store_n(&S_audio_running, 0, __ATOMIC_RELEASE);
+  pthread_join(S_audio_render_thread, NULL);
+  audio_close_device();
+  return 1;
+
+nope:
+  __atomic_store_n(&S_audio_running, 0, __ATOMIC_RELEASE);
+  audio_close_device();
+  return 1;
+}
+
+/******************************************************************************/
+/* audio_stop()                                                               */
+/******************************************************************************/
+int audio_stop()
+{
+  if (!__atomic_load_n(&S_audio_running, __ATOMIC_ACQUIRE))
+    return 0;
+
+  __atomic_store_n(&S_audio_running, 0, __ATOMIC_RELEASE);
+
+  pthread_join(S_audio_render_thread, NULL);
+
+  if (S_audio_backend != AUDIO_BACKEND_SDL)
+    pthread_join(S_audio_device_thread, NULL);
+
+  audio_close_device();
+
+  /* anything rendered after this gets full quality again */
+  if (S_audio_gov_flag)
+    apu_set_quality(APU_QUALITY_FULL);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_get_stats()                                                          */
+/******************************************************************************/
+int audio_get_stats(audio_stats* stats)
+{
+  if (stats == NULL)
+    return 1;
+
+  stats->frames_rendered = 
+    __atomic_load_n(&S_audio_frames_rendered, __ATOMIC_RELAXED);
+  stats->frames_played = 
+    __atomic_load_n(&S_audio_frames_played, __ATOMIC_RELAXED);
+  stats->underruns = __atomic_load_n(&S_audio_underruns, __ATOMIC_RELAXED);
+  stats->overruns = __atomic_load_n(&S_audio_overruns, __ATOMIC_RELAXED);
+  stats->fill = audio_ring_fill();
+  stats->target = S_audio_target_frames;
+  stats->late_commands = queue_get_late_count();
+
+  stats->quality = __atomic_load_n(&S_audio_gov_quality, __ATOMIC_RELAXED);
+  stats->demotions = 
+    __atomic_load_n(&S_audio_gov_demotions, __ATOMIC_RELAXED);
+  stats->promotions = 
+    __atomic_load_n(&S_audio_gov_promotions, __ATOMIC_RELAXED);
+  stats->max_load = __atomic_load_n(&S_audio_gov_max_load, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* audio_render_block()                                                       */
+/******************************************************************************/
+int audio_render_block(short* sample_buf, unsigned int num_samples)
+{
+  unsigned int  k;
+  unsigned int  end;
+  unsigned long clock;
+  unsigned long next;
+
+#ifdef AUDIO_PROFILE
+  struct timespec block_start;
+  struct timespec block_end;
+  unsigned long   render_ns;
+#endif
+
+  if (sample_buf == NULL)
+    return 1;
+
+#ifdef AUDIO_PROFILE
+  clock_gettime(CLOCK_MONOTONIC, &block_start);
+#endif
+
+  /* collect the commands pushed since the last block */
+  queue_fetch();
+
+  clock = __atomic_load_n(&S_audio_clock, __ATOMIC_RELAXED);
+
+  /* render up to the next command, apply it, and keep going */
+  k = 0;
+
+  while (k < num_samples)
+  {
+    queue_apply_due(clock);
+
+    next = queue_next_time();
+
+    if (next - clock < num_samples - k)
+      end = k + (unsigned int) (next - clock);
+    else
+      end = num_samples;
+
+    clock += end - k;
+
+    apu_render(&sample_buf[k], end - k, 1);
+    k = end;
+  }
+
+  __atomic_store_n(&S_audio_clock, clock, __ATOMIC_RELEASE);
+
+#ifdef APU_PROFILE
+  apu_profile_end_block();
+#endif
+
+#ifdef AUDIO_PROFILE
+  clock_gettime(CLOCK_MONOTONIC, &block_end);
+
+  render_ns = (block_end.tv_sec - block_start.tv_sec) * 1000000000L + 
+              (block_end.tv_nsec - block_start.tv_nsec);
+
+  __atomic_store_n( &S_audio_profile_blocks, 
+                    S_audio_profile_blocks + 1, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_audio_profile_samples, 
+                    S_audio_profile_samples + num_samples, __ATOMIC_RELAXED);
+  __atomic_store_n( &S_audio_profile_render_ns, 
+                    S_audio_profile_render_ns + render_ns, __ATOMIC_RELAXED);
+
+  if (render_ns > S_audio_profile_max_render_ns)
+  {
+    __atomic_store_n( &S_audio_profile_max_render_ns, 
+                      render_ns, __ATOMIC_RELAXED);
+  }
+#endif
+
+  return 0;
+}
+
+#ifdef AUDIO_PROFILE
+/******************************************************************************/
+/* audio_profile_get()                                                        */
+/******************************************************************************/
+int audio_profile_get(audio_profile* prof)
+{
+  if (prof == NULL)
+    return 1;
+
+  prof->blocks = 
+    __atomic_load_n(&S_audio_profile_blocks, __ATOMIC_RELAXED);
+  prof->samples = 
+    __atomic_load_n(&S_audio_profile_samples, __ATOMIC_RELAXED);
+  prof->render_ns = 
+    __atomic_load_n(&S_audio_profile_render_ns, __ATOMIC_RELAXED);
+  prof->max_render_ns = 
+    __atomic_load_n(&S_audio_profile_max_render_ns, __ATOMIC_RELAXED);
+
+  return 0;
+}
+#endif
+
+/******************************************************************************/
+/* audio_ms_to_frames()                                                       */
+/******************************************************************************/
+unsigned long audio_ms_to_frames(unsigned long milliseconds)
+{
+  /* the output rate is set in the apu (24 khz by default) */
+  return milliseconds * apu_get_output_rate() / 1000;
+}
+
+/******************************************************************************/
+/* audio_get_clock()                                                          */
+/******************************************************************************/
+unsigned long audio_get_clock()
+{
+  return __atomic_load_n(&S_audio_clock, __ATOMIC_ACQUIRE);
+}
+
 /******************************************************************************/
 /* audio_update_frame()                                                       */
 /******************************************************************************/
 int audio_update_frame(unsigned short milliseconds)
 {
-  int k;
-
   if (milliseconds > AUDIO_FB_MAX_MS)
     milliseconds = AUDIO_FB_MAX_MS;
 
-  G_audio_frame_num_samples = 0;
+  G_audio_frame_num_samples = 
+    audio_ms_to_frames(S_audio_frame_ms + milliseconds) - 
+    audio_ms_to_frames(S_audio_frame_ms);
 
-  for (k = 0; k < milliseconds * APU_OUT_SAMPLES_PER_MS; k++)
-  {
-    apu_update();
+  S_audio_frame_ms += milliseconds;
 
-    G_audio_frame_buffer[k] = G_apu_out_L;
-    G_audio_frame_num_samples += 1;
-  }
+  audio_render_block(&G_audio_frame_buffer[0], G_audio_frame_num_samples);
 
   return 0;
 }
 
+/******************************************************************************/
+/* audio_get_play_clock()                                                     */
+/******************************************************************************/
+unsigned long audio_get_play_clock()
+{
+  /* the sample that the device is playing now */
+  return  S_audio_start_clock + 
+          __atomic_load_n(&S_audio_frames_played, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************/
+/* audio_time_to_sample()                                                     */
+/******************************************************************************/
+unsigned long audio_time_to_sample(long sec, long nsec)
+{
+  long elapsed_sec;
+  long elapsed_nsec;
+
+  unsigned long num_frames;
+
+  /* maps a time from the monotonic clock to the sample that can play  */
+  /* an event from then. the render thread can be up to the latency    */
+  /* target ahead of the device, so the event goes one period past it. */
+  /* (this follows the monotonic clock, not the device's own clock, so */
+  /* it can drift by the difference between them on a real device)    */
+  elapsed_sec = sec - S_audio_start_sec;
+  elapsed_nsec = nsec - S_audio_start_nsec;
+
+  if (elapsed_nsec < 0)
+  {
+    elapsed_nsec += 1000000000L;
+    elapsed_sec -= 1;
+  }
+
+  if (elapsed_sec < 0)
+    num_frames = 0;
+  else
+  {
+    num_frames =  (unsigned long) elapsed_sec * apu_get_output_rate() + 
+                  (unsigned long) elapsed_nsec * apu_get_output_rate() / 
+                  1000000000L;
+  }
+
+  return  S_audio_start_clock + num_frames + 
+          S_audio_target_frames + S_audio_period_frames;
+}
@@ -5,6 +5,44 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+/* playback backends (alsa and sdl need AUDIO_USE_ALSA / AUDIO_USE_SDL) */
+enum
+{
+  AUDIO_BACKEND_NULL = 0, 
+  AUDIO_BACKEND_ALSA, 
+  AUDIO_BACKEND_SDL 
+};
+
+/* playback statistics (in samples, except for the quality governor's: */
+/* its level, how many times it stepped down and up, and the highest   */
+/* render time seen, as a percentage of the deadline)                   */
+typedef struct audio_stats
+{
+  unsigned long frames_rendered;
+  unsigned long frames_played;
+  unsigned int  underruns;
+  unsigned int  overruns;
+  unsigned int  fill;
+  unsigned int  target;
+  unsigned int  late_commands;
+  unsigned int  quality;
+  unsigned int  demotions;
+  unsigned int  promotions;
+  unsigned int  max_load;
+} audio_stats;
+
+/* render counters (make PROFILE=1): the blocks and samples rendered, */
+/* and the time spent rendering them (in total, and the longest one)  */
+#ifdef AUDIO_PROFILE
+typedef struct audio_profile
+{
+  unsigned long blocks;
+  unsigned long samples;
+  unsigned long render_ns;
+  unsigned long max_render_ns;
+} audio_profile;
+#endif
+
 extern short        G_audio_frame_buffer[];
 extern unsigned int G_audio_frame_num_samples;
 
@@ -12,7 +50,26 @@ extern unsigned int G_audio_frame_num_samples;
 int audio_init();
 int audio_deinit();
 
-int audio_update_frame(unsigned short milliseconds);
+int audio_set_null_sink(int enable);
+int audio_set_governor(int enable, unsigned int deadline_us);
+int audio_start(int backend, unsigned int latency_ms, unsigned int period_ms);
+int audio_stop();
+int audio_get_stats(audio_stats* stats);
+
+unsigned int audio_ring_write(short* sample_buf, unsigned int num_samples);
+unsigned int audio_ring_read(short* sample_buf, unsigned int num_samples);
+unsigned int audio_ring_fill();
+
+int           audio_render_block(short* sample_buf, unsigned int num_samples);
+unsigned long audio_get_clock();
+unsigned long audio_get_play_clock();
+unsigned long audio_time_to_sample(long sec, long nsec);
+int           audio_update_frame(unsigned short milliseconds);
+unsigned long audio_ms_to_frames(unsigned long milliseconds);
+
+#ifdef AUDIO_PROFILE
+int audio_profile_get(audio_profile* prof);
+#endif
 
 #endif
 
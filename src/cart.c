@@ -0,0 +1,346 @@
+/******************************************************************************/
+/* cart.c (cartridge rom images)                                              */
+/******************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cart.h"
+
+#include "apu.h"
+
+/* image layout (all values little endian):                   */
+/*   0: "CZRM"                                                */
+/*   4: version (2 bytes), number of regions (2 bytes)        */
+/*   8: file size                                             */
+/*  12: header checksum (crc-32 of the header, with this = 0) */
+/*  16: data checksum (crc-32 of the regions, in order)       */
+/*  32: region table (offset, size for each region)           */
+/* the regions follow the header, each starting on a page so */
+/* that they can be mapped and shared between processes.     */
+#define CART_HEADER_SIZE        128
+#define CART_REGION_TABLE_POS   32
+#define CART_REGION_ALIGN       4096
+
+static unsigned char* S_cart_mmap_base = NULL;
+static size_t         S_cart_mmap_size = 0;
+
+/******************************************************************************/
+/* cart_crc32()                                                               */
+/******************************************************************************/
+unsigned long cart_crc32( unsigned long crc, 
+                          unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int k;
+  unsigned int m;
+
+  /* reflected crc-32 (as used by zip and png) */
+  crc = ~crc & 0xFFFFFFFF;
+
+  for (k = 0; k < num_bytes; k++)
+  {
+    crc ^= data[k];
+
+    for (m = 0; m < 8; m++)
+    {
+      if (crc & 1)
+        crc = (crc >> 1) ^ 0xEDB88320;
+      else
+        crc = crc >> 1;
+    }
+  }
+
+  return ~crc & 0xFFFFFFFF;
+}
+
+/******************************************************************************/
+/* cart_write_u16()                                                           */
+/******************************************************************************/
+int cart_write_u16(unsigned char* buf, unsigned int val)
+{
+  buf[0] = val & 0xFF;
+  buf[1] = (val >> 8) & 0xFF;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cart_write_u32()                                                           */
+/******************************************************************************/
+int cart_write_u32(unsigned char* buf, unsigned long val)
+{
+  buf[0] = val & 0xFF;
+  buf[1] = (val >> 8) & 0xFF;
+  buf[2] = (val >> 16) & 0xFF;
+  buf[3] = (val >> 24) & 0xFF;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* cart_read_u16()                                                            */
+/******************************************************************************/
+unsigned int cart_read_u16(unsigned char* buf)
+{
+  return buf[0] | (buf[1] << 8);
+}
+
+/******************************************************************************/
+/* cart_read_u32()                                                            */
+/******************************************************************************/
+unsigned long cart_read_u32(unsigned char* buf)
+{
+  return  ((unsigned long) buf[0])        | 
+          ((unsigned long) buf[1] <<  8)  | 
+          ((unsigned long) buf[2] << 16)  | 
+          ((unsigned long) buf[3] << 24);
+}
+
+/******************************************************************************/
+/* cart_build_file()                                                          */
+/******************************************************************************/
+int cart_build_file(char* filename)
+{
+  int k;
+
+  FILE*         fp;
+  unsigned char header[CART_HEADER_SIZE];
+  unsigned char pad[CART_REGION_ALIGN];
+
+  unsigned char* data[APU_NUM_ROM_REGIONS];
+  unsigned int   size[APU_NUM_ROM_REGIONS];
+  unsigned long  offset[APU_NUM_ROM_REGIONS];
+  unsigned long  file_size;
+  unsigned long  data_crc;
+  unsigned long  pos;
+
+  if (filename == NULL)
+    return 1;
+
+  /* the image is a copy of the chip's current roms */
+  file_size = CART_HEADER_SIZE;
+  data_crc = 0;
+
+  for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+  {
+    if (apu_rom_region(k, &data[k], &size[k]))
+      return 1;
+
+    file_size = (file_size + CART_REGION_ALIGN - 1) & ~(CART_REGION_ALIGN - 1);
+
+    offset[k] = file_size;
+    file_size += size[k];
+
+    data_crc = cart_crc32(data_crc, data[k], size[k]);
+  }
+
+  /* fill in the header */
+  for (k = 0; k < CART_HEADER_SIZE; k++)
+    header[k] = 0x00;
+
+  for (k = 0; k < CART_REGION_ALIGN; k++)
+    pad[k] = 0x00;
+
+  header[0] = 'C';
+  header[1] = 'Z';
+  header[2] = 'R';
+  header[3] = 'M';
+
+  cart_write_u16(&header[4], CART_VERSION);
+  cart_write_u16(&header[6], APU_NUM_ROM_REGIONS);
+  cart_write_u32(&header[8], file_size);
+  cart_write_u32(&header[16], data_crc);
+
+  for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+  {
+    cart_write_u32(&header[CART_REGION_TABLE_POS + 8 * k + 0], offset[k]);
+    cart_write_u32(&header[CART_REGION_TABLE_POS + 8 * k + 4], size[k]);
+  }
+
+  cart_write_u32(&header[12], cart_crc32(0, header, CART_HEADER_SIZE));
+
+  /* write the file */
+  fp = fopen(filename, "wb");
+
+  if (fp == NULL)
+    return 1;
+
+  if (fwrite(header, 1, CART_HEADER_SIZE, fp) < CART_HEADER_SIZE)
+    goto nope;
+
+  pos = CART_HEADER_SIZE;
+
+  for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+  {
+    if (fwrite(pad, 1, offset[k] - pos, fp) < offset[k] - pos)
+      goto nope;
+
+    if (fwrite(data[k], 1, size[k], fp) < size[k])
+      goto nope;
+
+    pos = offset[k] + size[k];
+  }
+
+  if (fclose(fp))
+    return 1;
+
+  return 0;
+
+nope:
+  fclose(fp);
+  return 1;
+}
+
+/******************************************************************************/
+/* cart_map_file()                                                            */
+/******************************************************************************/
+int cart_map_file(char* filename, int flags)
+{
+  int k;
+
+  int         fd;
+  struct stat st;
+
+  unsigned char  header[CART_HEADER_SIZE];
+  unsigned long  header_crc;
+  unsigned long  data_crc;
+
+  unsigned char* regions[APU_NUM_ROM_REGIONS];
+  unsigned char* data;
+  unsigned int   size;
+  unsigned long  offset;
+  unsigned long  region_size;
+
+  /* make sure the parameters are valid */
+  if (filename == NULL)
+    return 1;
+
+  if (S_cart_mmap_base != NULL)
+    return 1;
+
+  /* open and map file (read only, and shared between processes) */
+  fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return 1;
+
+  if ((fstat(fd, &st) < 0) || 
+      (st.st_size < CART_HEADER_SIZE) || (st.st_size > 0x7FFFFFFF))
+  {
+    close(fd);
+    return 1;
+  }
+
+  S_cart_mmap_size = (size_t) st.st_size;
+  S_cart_mmap_base = mmap(NULL, S_cart_mmap_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  /* the mapping stays valid after the file is closed */
+  close(fd);
+
+  if (S_cart_mmap_base == MAP_FAILED)
+  {
+    S_cart_mmap_base = NULL;
+    return 1;
+  }
+
+  /* check the header */
+  for (k = 0; k < CART_HEADER_SIZE; k++)
+    header[k] = S_cart_mmap_base[k];
+
+  if ((header[0] != 'C') || (header[1] != 'Z') || 
+      (header[2] != 'R') || (header[3] != 'M'))
+  {
+    goto nope;
+  }
+
+  if (cart_read_u16(&header[4]) != CART_VERSION)
+    goto nope;
+
+  if (cart_read_u16(&header[6]) != APU_NUM_ROM_REGIONS)
+    goto nope;
+
+  if (cart_read_u32(&header[8]) != S_cart_mmap_size)
+    goto nope;
+
+  header_crc = cart_read_u32(&header[12]);
+  cart_write_u32(&header[12], 0);
+
+  if (cart_crc32(0, header, CART_HEADER_SIZE) != header_crc)
+    goto nope;
+
+  /* check the regions. they have to match the chip's sizes */
+  for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+  {
+    if (apu_rom_region(k, &data, &size))
+      goto nope;
+
+    offset = cart_read_u32(&header[CART_REGION_TABLE_POS + 8 * k + 0]);
+    region_size = cart_read_u32(&header[CART_REGION_TABLE_POS + 8 * k + 4]);
+
+    if (region_size != size)
+      goto nope;
+
+    if ((offset < CART_HEADER_SIZE) || (offset % CART_REGION_ALIGN != 0))
+      goto nope;
+
+    if ((offset > S_cart_mmap_size) || (size > S_cart_mmap_size - offset))
+      goto nope;
+
+    regions[k] = &S_cart_mmap_base[offset];
+  }
+
+  /* checking the data touches every page of the image, */
+  /* so it is optional (the header is always checked)   */
+  if (flags & CART_MAP_FLAG_VERIFY)
+  {
+    data_crc = 0;
+
+    for (k = 0; k < APU_NUM_ROM_REGIONS; k++)
+    {
+      apu_rom_region(k, &data, &size);
+      data_crc = cart_crc32(data_crc, regions[k], size);
+    }
+
+    if (data_crc != cart_read_u32(&header[16]))
+      goto nope;
+  }
+
+  if (apu_attach_cart(regions))
+    goto nope;
+
+  return 0;
+
+nope:
+  munmap(S_cart_mmap_base, S_cart_mmap_size);
+  S_cart_mmap_base = NULL;
+  S_cart_mmap_size = 0;
+  return 1;
+}
+
+/******************************************************************************/
+/* cart_unmap_file()                                                          */
+/******************************************************************************/
+int cart_unmap_file()
+{
+  if (S_cart_mmap_base == NULL)
+    return 1;
+
+  /* the chip has to let go of the image before it goes away */
+  apu_detach_cart();
+
+  munmap(S_cart_mmap_base, S_cart_mmap_size);
+
+  S_cart_mmap_base = NULL;
+  S_cart_mmap_size = 0;
+
+  return 0;
+}
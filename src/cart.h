@@ -0,0 +1,20 @@
+/******************************************************************************/
+/* cart.h (cartridge rom images)                                              */
+/******************************************************************************/
+
+#ifndef CART_H
+#define CART_H
+
+/* image format version (bump when the layout or the chip's roms change) */
+#define CART_VERSION 1
+
+/* map flags */
+#define CART_MAP_FLAG_VERIFY 0x01
+
+/* function declarations */
+int cart_build_file(char* filename);
+
+int cart_map_file(char* filename, int flags);
+int cart_unmap_file();
+
+#endif
@@ -0,0 +1,348 @@
+/******************************************************************************/
+/* live.c (live midi input)                                                   */
+/******************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef AUDIO_USE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "live.h"
+
+#include "audio.h"
+#include "midi.h"
+#include "queue.h"
+
+#define LIVE_READ_SIZE    256
+#define LIVE_POLL_MS      10
+#define LIVE_MAX_POLL_FDS 4
+
+/* input sources */
+enum
+{
+  LIVE_SOURCE_NONE = 0, 
+  LIVE_SOURCE_FIFO, 
+  LIVE_SOURCE_ALSA 
+};
+
+static int          S_live_source = LIVE_SOURCE_NONE;
+static int          S_live_fd = -1;
+
+#ifdef AUDIO_USE_ALSA
+static snd_rawmidi_t* S_live_rawmidi = NULL;
+#endif
+
+static int          S_live_running;
+static int          S_live_done;
+static pthread_t    S_live_thread;
+
+static midi_decoder S_live_decoder;
+
+/* counters (updated by the input thread, read from any thread) */
+static unsigned long S_live_num_events;
+static unsigned int  S_live_num_dropped;
+static unsigned long S_live_latency_min;
+static unsigned long S_live_latency_max;
+static unsigned long S_live_latency_total;
+
+/******************************************************************************/
+/* live_open_fifo()                                                           */
+/******************************************************************************/
+int live_open_fifo(char* filename)
+{
+  if (filename == NULL)
+    return 1;
+
+  if (S_live_source != LIVE_SOURCE_NONE)
+    return 1;
+
+  /* opening without blocking doesn't wait for a writer */
+  S_live_fd = open(filename, O_RDONLY | O_NONBLOCK);
+
+  if (S_live_fd < 0)
+    return 1;
+
+  S_live_source = LIVE_SOURCE_FIFO;
+
+  return 0;
+}
+
+#ifdef AUDIO_USE_ALSA
+/******************************************************************************/
+/* live_open_alsa()                                                           */
+/******************************************************************************/
+int live_open_alsa(char* port_name)
+{
+  if (port_name == NULL)
+    return 1;
+
+  if (S_live_source != LIVE_SOURCE_NONE)
+    return 1;
+
+  /* "virtual" makes a sequencer port that other programs can connect to */
+  if (snd_rawmidi_open(&S_live_rawmidi, NULL, port_name, SND_RAWMIDI_NONBLOCK))
+  {
+    S_live_rawmidi = NULL;
+    return 1;
+  }
+
+  S_live_source = LIVE_SOURCE_ALSA;
+
+  return 0;
+}
+#endif
+
+/******************************************************************************/
+/* live_close_source()                                                        */
+/******************************************************************************/
+int live_close_source()
+{
+  if (S_live_source == LIVE_SOURCE_FIFO)
+  {
+    close(S_live_fd);
+    S_live_fd = -1;
+  }
+#ifdef AUDIO_USE_ALSA
+  else if (S_live_source == LIVE_SOURCE_ALSA)
+  {
+    snd_rawmidi_close(S_live_rawmidi);
+    S_live_rawmidi = NULL;
+  }
+#endif
+
+  S_live_source = LIVE_SOURCE_NONE;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* live_read()                                                                */
+/******************************************************************************/
+long live_read(unsigned char* buf, unsigned int num_bytes)
+{
+  struct pollfd fds[LIVE_MAX_POLL_FDS];
+  int           num_fds;
+  long          num_read;
+
+  /* wait for input (or for a while, so the thread can be stopped). */
+  /* returns the number of bytes read, or -1 at the end of input    */
+  if (S_live_source == LIVE_SOURCE_FIFO)
+  {
+    fds[0].fd = S_live_fd;
+    fds[0].events = POLLIN;
+    num_fds = 1;
+  }
+#ifdef AUDIO_USE_ALSA
+  else if (S_live_source == LIVE_SOURCE_ALSA)
+  {
+    num_fds = snd_rawmidi_poll_descriptors( S_live_rawmidi, 
+                                            fds, LIVE_MAX_POLL_FDS);
+  }
+#endif
+  else
+    return -1;
+
+  if (poll(fds, num_fds, LIVE_POLL_MS) <= 0)
+    return 0;
+
+  if (S_live_source == LIVE_SOURCE_FIFO)
+  {
+    num_read = (long) read(S_live_fd, buf, num_bytes);
+
+    /* the writer closed the pipe */
+    if (num_read == 0)
+      return -1;
+
+    if (num_read < 0)
+      return 0;
+  }
+#ifdef AUDIO_USE_ALSA
+  else if (S_live_source == LIVE_SOURCE_ALSA)
+  {
+    num_read = (long) snd_rawmidi_read(S_live_rawmidi, buf, num_bytes);
+
+    if (num_read == -EAGAIN)
+      return 0;
+
+    if (num_read < 0)
+      return -1;
+  }
+#endif
+  else
+    return -1;
+
+  return num_read;
+}
+
+/******************************************************************************/
+/* live_queue_event()                                                         */
+/******************************************************************************/
+int live_queue_event(unsigned char* seq_cmd, unsigned long time)
+{
+  queue_command cmd;
+  unsigned long play_clock;
+  unsigned long latency;
+
+  cmd.time = time;
+  cmd.type = QUEUE_CMD_CHANNEL;
+  cmd.voice = seq_cmd[0];
+  cmd.data_1 = seq_cmd[1];
+  cmd.data_2 = seq_cmd[2];
+
+  if (queue_push(&cmd))
+  {
+    __atomic_add_fetch(&S_live_num_dropped, 1, __ATOMIC_RELAXED);
+    return 1;
+  }
+
+  /* how long until the device plays the event */
+  play_clock = audio_get_play_clock();
+  latency = (time > play_clock) ? time - play_clock : 0;
+
+  if ((S_live_num_events == 0) || (latency < S_live_latency_min))
+    __atomic_store_n(&S_live_latency_min, latency, __ATOMIC_RELAXED);
+
+  if (latency > S_live_latency_max)
+    __atomic_store_n(&S_live_latency_max, latency, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&S_live_latency_total, latency, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&S_live_num_events, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* live_input_main()                                                          */
+/******************************************************************************/
+void* live_input_main(void* arg)
+{
+  unsigned char   buf[LIVE_READ_SIZE];
+  unsigned char   seq_cmd[3];
+  struct timespec ts;
+  unsigned long   time;
+  long            num_read;
+  long            k;
+
+  (void) arg;
+
+  while (__atomic_load_n(&S_live_running, __ATOMIC_ACQUIRE))
+  {
+    num_read = live_read(buf, LIVE_READ_SIZE);
+
+    if (num_read < 0)
+      break;
+
+    if (num_read == 0)
+      continue;
+
+    /* everything in this read arrived at (about) the same time */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    time = audio_time_to_sample((long) ts.tv_sec, ts.tv_nsec);
+
+    for (k = 0; k < num_read; k++)
+    {
+      seq_cmd[2] = 0;
+
+      if (midi_decode_byte(&S_live_decoder, buf[k], seq_cmd) > 0)
+        live_queue_event(seq_cmd, time);
+    }
+  }
+
+  __atomic_store_n(&S_live_done, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* live_start()                                                               */
+/******************************************************************************/
+int live_start()
+{
+  if (S_live_source == LIVE_SOURCE_NONE)
+    return 1;
+
+  if (S_live_running)
+    return 1;
+
+  midi_decoder_reset(&S_live_decoder);
+
+  S_live_num_events = 0;
+  S_live_num_dropped = 0;
+  S_live_latency_min = 0;
+  S_live_latency_max = 0;
+  S_live_latency_total = 0;
+
+  S_live_done = 0;
+
+  __atomic_store_n(&S_live_running, 1, __ATOMIC_RELEASE);
+
+  if (pthread_create(&S_live_thread, NULL, live_input_main, NULL))
+  {
+    __atomic_store_n(&S_live_running, 0, __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* live_stop()                                                                */
+/******************************************************************************/
+int live_stop()
+{
+  if (__atomic_load_n(&S_live_running, __ATOMIC_ACQUIRE))
+  {
+    __atomic_store_n(&S_live_running, 0, __ATOMIC_RELEASE);
+
+    pthread_join(S_live_thread, NULL);
+  }
+
+  live_close_source();
+
+  return 0;
+}
+
+/******************************************************************************/
+/* live_is_done()                                                             */
+/******************************************************************************/
+int live_is_done()
+{
+  /* the input has ended (or there never was any) */
+  if (S_live_source == LIVE_SOURCE_NONE)
+    return 1;
+
+  return __atomic_load_n(&S_live_done, __ATOMIC_ACQUIRE);
+}
+
+/******************************************************************************/
+/* live_get_stats()                                                           */
+/******************************************************************************/
+int live_get_stats(live_stats* stats)
+{
+  if (stats == NULL)
+    return 1;
+
+  stats->num_events = 
+    __atomic_load_n(&S_live_num_events, __ATOMIC_ACQUIRE);
+  stats->num_dropped = 
+    __atomic_load_n(&S_live_num_dropped, __ATOMIC_RELAXED);
+  stats->latency_min = 
+    __atomic_load_n(&S_live_latency_min, __ATOMIC_RELAXED);
+  stats->latency_max = 
+    __atomic_load_n(&S_live_latency_max, __ATOMIC_RELAXED);
+  stats->latency_total = 
+    __atomic_load_n(&S_live_latency_total, __ATOMIC_RELAXED);
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+/******************************************************************************/
+/* live.h (live midi input)                                                   */
+/******************************************************************************/
+
+#ifndef LIVE_H
+#define LIVE_H
+
+/* input statistics (latencies are in samples, from the time */
+/* an event is read until the device gets to its sample)     */
+typedef struct live_stats
+{
+  unsigned long num_events;
+  unsigned int  num_dropped;
+  unsigned long latency_min;
+  unsigned long latency_max;
+  unsigned long latency_total;
+} live_stats;
+
+/* function declarations */
+int live_open_fifo(char* filename);
+#ifdef AUDIO_USE_ALSA
+int live_open_alsa(char* port_name);
+#endif
+
+int live_start();
+int live_stop();
+int live_is_done();
+
+int live_get_stats(live_stats* stats);
+
+#endif
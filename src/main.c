@@ -6,14 +6,201 @@
 /* main.c                                                                     */
 /******************************************************************************/
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "apu.h"
 #include "audio.h"
+#include "cart.h"
+#include "live.h"
 #include "midi.h"
 #include "wav.h"
 
+/* live playback settings */
+#define MAIN_LIVE_LATENCY_MS  60
+#define MAIN_LIVE_PERIOD_MS   10
+
+static volatile sig_atomic_t S_main_interrupted = 0;
+
+/* how often to print the profiling counters (0 = never) */
+static unsigned int S_main_stats_ms = 0;
+
+/******************************************************************************/
+/* main_interrupt()                                                           */
+/******************************************************************************/
+void main_interrupt(int signum)
+{
+  (void) signum;
+
+  S_main_interrupted = 1;
+}
+
+/******************************************************************************/
+/* main_print_profile()                                                       */
+/******************************************************************************/
+int main_print_profile()
+{
+#if defined(APU_PROFILE) && defined(AUDIO_PROFILE) && defined(WAV_PROFILE)
+  int k;
+
+  apu_profile   apu_prof;
+  audio_profile audio_prof;
+  wav_profile   wav_prof;
+
+  static char* stage_names[APU_NUM_STAGES] = 
+    { "seq", "lfo", "env", "osc", "pcm", "syn", "out", "sample" };
+
+  apu_profile_get(&apu_prof);
+  audio_profile_get(&audio_prof);
+  wav_profile_get(&wav_prof);
+
+  if ((apu_prof.samples == 0) || (audio_prof.blocks == 0))
+    return 0;
+
+  fprintf(stderr, "Profile at %lu ms:", 
+                  apu_prof.samples * 1000 / apu_get_output_rate());
+
+  for (k = 0; k < APU_NUM_STAGES; k++)
+  {
+    fprintf(stderr, " %s %.1f", stage_names[k], 
+                    (double) apu_prof.cycles[k] / apu_prof.samples);
+  }
+
+  fprintf(stderr, " (cycles per sample)\n");
+  fprintf(stderr, "  Env Steps: %lu, Seq Events: %lu, FIR Taps: %lu\n", 
+                  apu_prof.env_steps, apu_prof.seq_events, 
+                  apu_prof.fir_taps);
+  fprintf(stderr, "  Voices: avg %.1f, max %u, " 
+                  "Render (us): avg %.1f, max %.1f\n", 
+                  (double) apu_prof.active_voices / apu_prof.blocks, 
+                  apu_prof.max_active_voices, 
+                  audio_prof.render_ns / (1000.0 * audio_prof.blocks), 
+                  audio_prof.max_render_ns / 1000.0);
+  fprintf(stderr, "  WAV Bytes: %lu, Stalls: %lu, Stalled (ms): %.2f\n", 
+                  wav_prof.bytes_written, wav_prof.num_stalls, 
+                  wav_prof.stall_ns / 1000000.0);
+#endif
+
+  return 0;
+}
+
+/******************************************************************************/
+/* main_play_live()                                                           */
+/******************************************************************************/
+int main_play_live(int backend, unsigned int total_ms, int input_flag)
+{
+  audio_stats     stats;
+  live_stats      input_stats;
+  struct timespec ts;
+  unsigned int    elapsed_ms;
+
+  if (audio_start(backend, MAIN_LIVE_LATENCY_MS, MAIN_LIVE_PERIOD_MS))
+  {
+    fprintf(stderr, "Error starting audio playback...\n");
+    return 1;
+  }
+
+  /* with live midi input, play until the input ends (or ctrl-c) */
+  if (input_flag)
+  {
+    signal(SIGINT, main_interrupt);
+
+    if (live_start())
+    {
+      fprintf(stderr, "Error starting midi input...\n");
+      audio_stop();
+      return 1;
+    }
+  }
+
+  /* the render thread owns the chip until playback stops */
+  ts.tv_sec = 0;
+  ts.tv_nsec = 10 * 1000 * 1000;
+
+  elapsed_ms = 0;
+
+  while (1)
+  {
+    nanosleep(&ts, NULL);
+    audio_get_stats(&stats);
+
+    elapsed_ms += 10;
+
+    if ((S_main_stats_ms > 0) && (elapsed_ms >= S_main_stats_ms))
+    {
+      main_print_profile();
+      elapsed_ms = 0;
+    }
+
+    if (S_main_interrupted)
+      break;
+
+    if (input_flag && live_is_done())
+      break;
+
+    if ((!input_flag) && 
+        (stats.frames_played >= audio_ms_to_frames(total_ms)))
+    {
+      break;
+    }
+  }
+
+  /* let the last events play out */
+  if (input_flag)
+  {
+    live_stop();
+
+    if (!S_main_interrupted)
+    {
+      ts.tv_sec = 0;
+      ts.tv_nsec = 2 * MAIN_LIVE_LATENCY_MS * 1000 * 1000;
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  audio_stop();
+  audio_get_stats(&stats);
+
+  fprintf(stderr, "Played: %lu, Rendered: %lu, Underruns: %u, Overruns: %u\n", 
+                  stats.frames_played, stats.frames_rendered, 
+                  stats.underruns, stats.overruns);
+  fprintf(stderr, "Late Commands: %u\n", stats.late_commands);
+  fprintf(stderr, "Quality: %u, Demotions: %u, Promotions: %u, " 
+                  "Max Load: %u%%\n", 
+                  stats.quality, stats.demotions, stats.promotions, 
+                  stats.max_load);
+
+  if (S_main_stats_ms > 0)
+    main_print_profile();
+
+  if (input_flag)
+  {
+    live_get_stats(&input_stats);
+
+    fprintf(stderr, "Input Events: %lu, Dropped: %u\n", 
+                    input_stats.num_events, input_stats.num_dropped);
+
+    if (input_stats.num_events > 0)
+    {
+      fprintf(stderr, "Input Latency (ms): min %.2f, avg %.2f, max %.2f\n", 
+              input_stats.latency_min * 1000.0 / apu_get_output_rate(), 
+              input_stats.latency_total * 1000.0 / 
+                ((double) input_stats.num_events * apu_get_output_rate()), 
+              input_stats.latency_max * 1000.0 / apu_get_output_rate());
+    }
+  }
+
+  return 0;
+}
+
 /******************************************************************************/
 /* main()                                                                     */
 /******************************************************************************/
@@ -21,33 +208,299 @@ int main(int argc, char *argv[])
 {
   int k;
 
+  char* out_filename;
+  char* cart_filename;
+  char* engine_name;
+  int   stream_fd;
+  int   stream_format;
+  int   mmap_flag;
+  int   song_flag;
+  int   live_backend;
+  int   input_flag;
+
+  unsigned short  frame_ms;
+  unsigned int    total_ms;
+  unsigned int    stats_ms;
+  unsigned int    rendered_ms;
+  unsigned int    num_samples;
+  short*          block_buf;
+
+  midi_context    midi_ctx;
+
+  /* parse command line:                                    */
+  /*   czstyle [-raw] [-mmap] [-cart file.rom]              */
+  /*           [-play null|alsa|sdl] [-midi-in fifo|alsa]   */
+  /*           [-deadline microseconds] [-stats ms]         */
+  /*           [-rate hz] [output.wav]                      */
+  /* an output of "-" streams to stdout instead. when       */
+  /* playing live, the null device writes to the output.   */
+  /* midi input (from a named pipe, or a virtual alsa port) */
+  /* plays the chip live, and implies -play null. with a    */
+  /* deadline (0 for a period), the quality drops as needed */
+  /* to render each block in time. a profiled build        */
+  /* (make PROFILE=1) can print its counters every so often */
+  /* with -stats. the output rate defaults to 24000 hz.    */
+  out_filename = "test_01.wav";
+  cart_filename = NULL;
+  stream_fd = -1;
+  stream_format = WAV_STREAM_FORMAT_WAV;
+  mmap_flag = 0;
+  live_backend = -1;
+  input_flag = 0;
+
+  for (k = 1; k < argc; k++)
+  {
+    if (!strcmp(argv[k], "-raw"))
+      stream_format = WAV_STREAM_FORMAT_RAW;
+    else if (!strcmp(argv[k], "-mmap"))
+      mmap_flag = 1;
+    else if ((!strcmp(argv[k], "-cart")) && (k + 1 < argc))
+      cart_filename = argv[++k];
+    else if ((!strcmp(argv[k], "-play")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      if (!strcmp(argv[k], "alsa"))
+        live_backend = AUDIO_BACKEND_ALSA;
+      else if (!strcmp(argv[k], "sdl"))
+        live_backend = AUDIO_BACKEND_SDL;
+      else
+        live_backend = AUDIO_BACKEND_NULL;
+    }
+    else if ((!strcmp(argv[k], "-deadline")) && (k + 1 < argc))
+      audio_set_governor(1, (unsigned int) atoi(argv[++k]));
+    else if ((!strcmp(argv[k], "-stats")) && (k + 1 < argc))
+    {
+      S_main_stats_ms = (unsigned int) atoi(argv[++k]);
+
+#if !(defined(APU_PROFILE) && defined(AUDIO_PROFILE) && defined(WAV_PROFILE))
+      fprintf(stderr, "Warning: built without profiling (make PROFILE=1)\n");
+#endif
+    }
+    else if ((!strcmp(argv[k], "-rate")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      if (apu_set_output_rate((unsigned int) atoi(argv[k])))
+      {
+        fprintf(stderr, "Unsupported output rate %s...\n", argv[k]);
+        return 1;
+      }
+    }
+    else if ((!strcmp(argv[k], "-midi-in")) && (k + 1 < argc))
+    {
+      k += 1;
+
+#ifdef AUDIO_USE_ALSA
+      if (!strcmp(argv[k], "alsa"))
+        input_flag = !live_open_alsa("virtual");
+      else
+#endif
+        input_flag = !live_open_fifo(argv[k]);
+
+      if (!input_flag)
+      {
+        fprintf(stderr, "Error opening midi input %s...\n", argv[k]);
+        return 1;
+      }
+
+      if (live_backend < 0)
+        live_backend = AUDIO_BACKEND_NULL;
+    }
+    else
+      out_filename = argv[k];
+  }
+
+  /* when streaming, the samples get the real stdout, */
+  /* and everything printed goes to stderr instead    */
+  if (!strcmp(out_filename, "-"))
+  {
+    stream_fd = dup(STDOUT_FILENO);
+
+    if ((stream_fd < 0) || (dup2(STDERR_FILENO, STDOUT_FILENO) < 0))
+      return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+  }
+
   audio_init();
   apu_reset();
+  apu_clear_roms();
+
+  /* pick the render engine for this cpu */
+  apu_set_engine(apu_detect_engine());
+
+  engine_name = getenv("CZSTYLE_ENGINE");
+
+  if ((engine_name != NULL) && 
+      strcmp(engine_name, apu_engine_name(apu_get_engine())))
+  {
+    fprintf(stderr, "Engine %s is not available, using %s...\n", 
+            engine_name, apu_engine_name(apu_get_engine()));
+  }
 
-  /* load midi file */
+  /* map a cartridge if there is one, or load the midi file */
+  midi_context_init(&midi_ctx);
+
+  if (cart_filename != NULL)
+    song_flag = !cart_map_file(cart_filename, CART_MAP_FLAG_VERIFY);
+  else
+  {
 #if 0
-  midi_import_file("touhou_6_apparitions.mid");
+    song_flag = !midi_import_file(&midi_ctx, "touhou_6_apparitions.mid");
 #else
-  midi_import_file("megamari_cirno_zenkusa.mid");
+    song_flag = !midi_import_file(&midi_ctx, "megamari_cirno_zenkusa.mid");
 #endif
 
+    if (song_flag)
+    {
+      song_flag = !midi_optimize( &midi_ctx, 
+                                  apu_seq_channel_mask(APU_SEQ_TRACK_MUSIC));
+    }
+
+    if (song_flag)
+      song_flag = !midi_factor_subroutines(&midi_ctx);
+
+    if (song_flag)
+    {
+      song_flag = !apu_load_song( 0, 
+                                  &midi_ctx.arena_data[midi_ctx.combined_start], 
+                                  midi_ctx.combined_num_bytes);
+    }
+  }
+
+  midi_context_deinit(&midi_ctx);
+
   /* just try writing out some stuff */
-  wav_export_open_file("test_01.wav");
-  wav_export_write_header();
+  total_ms = 0;
+
+  for (k = 0; k < 60; k++)
+    total_ms += (k % 3 == 0) ? 16 : 17;
+
+  /* live playback */
+  if (live_backend >= 0)
+  {
+    if (live_backend == AUDIO_BACKEND_NULL)
+    {
+      if (stream_fd < 0)
+        stream_fd = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+      if ((stream_fd < 0) || wav_stream_open_fd(stream_fd, stream_format))
+        return 1;
+
+      audio_set_null_sink(1);
+    }
+
+    if (input_flag)
+    {
+      /* the input plays the music channels */
+    }
+    else if (song_flag)
+      apu_play_song(APU_SEQ_TRACK_MUSIC, 0);
+    else
+      apu_play_note(0, 60);
+
+    main_play_live(live_backend, total_ms, input_flag);
+
+    if (live_backend == AUDIO_BACKEND_NULL)
+      wav_stream_close();
 
-  apu_play_note(0, 60);
+    if (cart_filename != NULL)
+      cart_unmap_file();
+
+    audio_deinit();
+
+    return 0;
+  }
+
+  if (stream_fd >= 0)
+  {
+    if (wav_stream_open_fd(stream_fd, stream_format))
+      return 1;
+  }
+  else if (mmap_flag)
+  {
+    if (wav_mmap_open_file(out_filename, audio_ms_to_frames(total_ms)))
+      return 1;
+  }
+  else
+  {
+    if (wav_export_open_file(out_filename))
+      return 1;
+
+    wav_export_write_header();
+  }
+
+  if (song_flag)
+    apu_play_song(APU_SEQ_TRACK_MUSIC, 0);
+  else
+    apu_play_note(0, 60);
+
+  stats_ms = 0;
+  rendered_ms = 0;
 
   for (k = 0; k < 60; k++)
   {
     if (k % 3 == 0)
-      audio_update_frame(16);
+      frame_ms = 16;
     else
-      audio_update_frame(17);
+      frame_ms = 17;
+
+    stats_ms += frame_ms;
+
+    if ((S_main_stats_ms > 0) && (stats_ms >= S_main_stats_ms))
+    {
+      main_print_profile();
+      stats_ms = 0;
+    }
+
+    /* render straight into the mapped file */
+    if (mmap_flag && (stream_fd < 0))
+    {
+      num_samples = audio_ms_to_frames(rendered_ms + frame_ms) - 
+                    audio_ms_to_frames(rendered_ms);
 
-    wav_export_write_block(&G_audio_frame_buffer[0], G_audio_frame_num_samples);
+      rendered_ms += frame_ms;
+
+      block_buf = wav_mmap_get_block(num_samples);
+
+      if (block_buf == NULL)
+        break;
+
+      audio_render_block(block_buf, num_samples);
+      wav_mmap_commit_block(num_samples);
+      continue;
+    }
+
+    audio_update_frame(frame_ms);
+
+    if (stream_fd >= 0)
+    {
+      if (wav_stream_write_block( &G_audio_frame_buffer[0], 
+                                  G_audio_frame_num_samples))
+      {
+        break;
+      }
+    }
+    else
+    {
+      wav_export_write_block( &G_audio_frame_buffer[0], 
+                              G_audio_frame_num_samples);
+    }
   }
 
-  wav_export_close_file();
+  if (S_main_stats_ms > 0)
+    main_print_profile();
+
+  if (stream_fd >= 0)
+    wav_stream_close();
+  else if (mmap_flag)
+    wav_mmap_close_file();
+  else
+    wav_export_close_file();
+
+  if (cart_filename != NULL)
+    cart_unmap_file();
 
   return 0;
 }
@@ -2,35 +2,528 @@
 /* midi.c (midi file import)                                                  */
 /******************************************************************************/
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include "midi.h"
 
-#define MIDI_TRACK_SIZE (64 * 1024)
+#include "apu.h"
+
+#define MIDI_ARENA_INITIAL_SIZE (16 * 1024)
+
+/* subroutine factoring */
+#define MIDI_MAX_SUBROUTINES  64
+#define MIDI_HASH_MULTIPLIER  1000003
+
+#define MIDI_NUM_FACTOR_LENGTHS 15
+
+/* section lengths (in commands) that are tried when factoring */
+static unsigned int S_midi_factor_lengths[MIDI_NUM_FACTOR_LENGTHS] = 
+  { 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+
+/* a section of the stream, by the hash of its commands */
+typedef struct midi_window
+{
+  unsigned int hash;
+  unsigned int start;
+} midi_window;
+
+/******************************************************************************/
+/* midi_context_init()                                                        */
+/******************************************************************************/
+int midi_context_init(midi_context* ctx)
+{
+  int k;
+
+  if (ctx == NULL)
+    return 1;
+
+  ctx->file_data = NULL;
+  ctx->file_size = 0;
+  ctx->cursor_pos = 0;
+  ctx->cursor_end = 0;
+
+  ctx->format = 0;
+  ctx->num_tracks = 0;
+  ctx->ppqn = 0;
+
+  ctx->arena_data = NULL;
+  ctx->arena_num_bytes = 0;
+  ctx->arena_capacity = 0;
+
+  for (k = 0; k < MIDI_MAX_TRACKS; k++)
+  {
+    ctx->track_start[k] = 0;
+    ctx->track_num_bytes[k] = 0;
+  }
+
+  ctx->combined_start = 0;
+  ctx->combined_num_bytes = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_context_reset()                                                       */
+/******************************************************************************/
+int midi_context_reset(midi_context* ctx)
+{
+  int k;
+
+  if (ctx == NULL)
+    return 1;
+
+  /* the arena memory is kept for the next file */
+  ctx->arena_num_bytes = 0;
+
+  ctx->format = 0;
+  ctx->num_tracks = 0;
+  ctx->ppqn = 0;
+
+  for (k = 0; k < MIDI_MAX_TRACKS; k++)
+  {
+    ctx->track_start[k] = 0;
+    ctx->track_num_bytes[k] = 0;
+  }
+
+  ctx->combined_start = 0;
+  ctx->combined_num_bytes = 0;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_context_deinit()                                                      */
+/******************************************************************************/
+int midi_context_deinit(midi_context* ctx)
+{
+  if (ctx == NULL)
+    return 1;
+
+  if (ctx->arena_data != NULL)
+    free(ctx->arena_data);
+
+  midi_context_init(ctx);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_arena_reserve()                                                       */
+/******************************************************************************/
+int midi_arena_reserve(midi_context* ctx, unsigned int num_bytes)
+{
+  unsigned int    new_capacity;
+  unsigned char*  new_data;
+
+  /* make sure there is room for num_bytes more bytes */
+  if (num_bytes <= ctx->arena_capacity - ctx->arena_num_bytes)
+    return 0;
+
+  if (num_bytes > 0x7FFFFFFF - ctx->arena_num_bytes)
+    return 1;
+
+  new_capacity = (ctx->arena_capacity > 0) ? 
+                  ctx->arena_capacity : MIDI_ARENA_INITIAL_SIZE;
+
+  while (new_capacity - ctx->arena_num_bytes < num_bytes)
+    new_capacity *= 2;
+
+  new_data = realloc(ctx->arena_data, new_capacity);
+
+  if (new_data == NULL)
+    return 1;
+
+  ctx->arena_data = new_data;
+  ctx->arena_capacity = new_capacity;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_emit_command()                                                        */
+/******************************************************************************/
+int midi_emit_command(midi_context* ctx, unsigned char* cmd, 
+                      unsigned int num_bytes)
+{
+  unsigned int k;
+
+  if (midi_arena_reserve(ctx, num_bytes))
+    return 1;
+
+  for (k = 0; k < num_bytes; k++)
+    ctx->arena_data[ctx->arena_num_bytes + k] = cmd[k];
+
+  ctx->arena_num_bytes += num_bytes;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_emit_delay()                                                          */
+/******************************************************************************/
+int midi_emit_delay(midi_context* ctx, unsigned long delta_time)
+{
+  unsigned char cmd[3];
+
+  while (delta_time > 0)
+  {
+    if (delta_time <= 255)
+    {
+      cmd[0] = APU_SEQ_CMD_DELAY_8;
+      cmd[1] = delta_time & 0xFF;
+
+      if (midi_emit_command(ctx, cmd, 2))
+        return 1;
+
+      delta_time = 0;
+    }
+    else if (delta_time <= 65535)
+    {
+      cmd[0] = APU_SEQ_CMD_DELAY_16;
+      cmd[1] = delta_time & 0xFF;
+      cmd[2] = (delta_time >> 8) & 0xFF;
+
+      if (midi_emit_command(ctx, cmd, 3))
+        return 1;
+
+      delta_time = 0;
+    }
+    else
+    {
+      cmd[0] = APU_SEQ_CMD_DELAY_16;
+      cmd[1] = 0xFF;
+      cmd[2] = 0xFF;
+
+      if (midi_emit_command(ctx, cmd, 3))
+        return 1;
+
+      delta_time -= 65535;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_command_size()                                                        */
+/******************************************************************************/
+unsigned int midi_command_size(unsigned char code)
+{
+  /* system commands are picked by the high nibble */
+  if ((code & 0x0F) == APU_SEQ_CMD_SYSTEM)
+  {
+    switch (code)
+    {
+      case APU_SEQ_SYS_CALL:
+        return 3;
+
+      case APU_SEQ_SYS_LOOP_END:
+        return 2;
+
+      case APU_SEQ_SYS_LOOP_START:
+      case APU_SEQ_SYS_RETURN:
+      case APU_SEQ_SYS_END:
+        return 1;
+
+      default:
+        return 0;
+    }
+  }
+
+  switch (code & 0x0F)
+  {
+    case APU_SEQ_CMD_DELAY_16:
+    case APU_SEQ_CMD_NOTE_ON:
+      return 3;
+
+    case APU_SEQ_CMD_TEMPO:
+    case APU_SEQ_CMD_DELAY_8:
+    case APU_SEQ_CMD_PROGRAM:
+    case APU_SEQ_CMD_VOLUME:
+    case APU_SEQ_CMD_PANNING:
+    case APU_SEQ_CMD_NOTE_OFF:
+    case APU_SEQ_CMD_PITCH_WHEEL:
+    case APU_SEQ_CMD_PRESSURE:
+    case APU_SEQ_CMD_MOD_WHEEL:
+    case APU_SEQ_CMD_PORTAMENTO:
+    case APU_SEQ_CMD_SUSTAIN:
+      return 2;
+
+    default:
+      return 0;
+  }
+}
+
+/******************************************************************************/
+/* midi_read_bytes()                                                          */
+/******************************************************************************/
+unsigned char* midi_read_bytes(midi_context* ctx, unsigned int num_bytes)
+{
+  unsigned char* data;
+
+  if (num_bytes > ctx->cursor_end - ctx->cursor_pos)
+    return NULL;
+
+  data = &ctx->file_data[ctx->cursor_pos];
+  ctx->cursor_pos += num_bytes;
+
+  return data;
+}
+
+/******************************************************************************/
+/* midi_read_varint()                                                         */
+/******************************************************************************/
+int midi_read_varint(midi_context* ctx, unsigned int* value)
+{
+  unsigned int  k;
+  unsigned char byte;
+
+  *value = 0;
+
+  /* variable length quantities are at most 4 bytes */
+  for (k = 0; k < 4; k++)
+  {
+    if (ctx->cursor_pos >= ctx->cursor_end)
+      return 1;
+
+    byte = ctx->file_data[ctx->cursor_pos];
+    ctx->cursor_pos += 1;
+
+    *value = (*value << 7) | (byte & 0x7F);
+
+    if (!(byte & 0x80))
+      return 0;
+  }
+
+  return 1;
+}
+
+/******************************************************************************/
+/* midi_marker_is()                                                           */
+/******************************************************************************/
+int midi_marker_is(unsigned char* text, unsigned int num_bytes, char* name)
+{
+  unsigned int  k;
+  unsigned char c;
+
+  /* compare letters and digits only, ignoring case, so */
+  /* "loopStart", "LOOP_START" and "Loop Start" all match */
+  for (k = 0; k < num_bytes; k++)
+  {
+    c = text[k];
+
+    if ((c >= 'A') && (c <= 'Z'))
+      c = c - 'A' + 'a';
+    else if (!(((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9'))))
+      continue;
+
+    if (c != *name)
+      return 0;
+
+    name += 1;
+  }
+
+  return (*name == '\0') ? 1 : 0;
+}
+
+/******************************************************************************/
+/* midi_message_num_data_bytes()                                              */
+/******************************************************************************/
+unsigned int midi_message_num_data_bytes(unsigned char message_type)
+{
+  /* number of data bytes after a channel voice status byte */
+  if ((message_type == 0x08) || 
+      (message_type == 0x09) || 
+      (message_type == 0x0A) || 
+      (message_type == 0x0B) || 
+      (message_type == 0x0E))
+  {
+    return 2;
+  }
+  else if ( (message_type == 0x0C) || 
+            (message_type == 0x0D))
+  {
+    return 1;
+  }
+  else
+    return 0;
+}
+
+/******************************************************************************/
+/* midi_voice_message()                                                       */
+/******************************************************************************/
+unsigned int midi_voice_message(unsigned char message_type, 
+                                unsigned char message_channel, 
+                                unsigned char* data, unsigned char* cmd)
+{
+  unsigned char seq_code;
+
+  /* converts a channel voice message to a sequencer command, */
+  /* and returns its size (or 0 if it has no equivalent)      */
+
+  /* determine sequencer code */
+  if (message_type == 0x08)       /* note off */
+    seq_code = APU_SEQ_CMD_NOTE_OFF;
+  else if (message_type == 0x09)  /* note on */
+    seq_code = APU_SEQ_CMD_NOTE_ON;
+  else if (message_type == 0x0A)  /* aftertouch */
+    seq_code = 0x00;
+  else if (message_type == 0x0B)  /* controller change */
+  {
+    if (data[0] == 1)              /* mod wheel */
+      seq_code = APU_SEQ_CMD_MOD_WHEEL;
+    else if (data[0] == 7)         /* set volume */
+      seq_code = APU_SEQ_CMD_VOLUME;
+    else if (data[0] == 10)        /* set panning */
+      seq_code = APU_SEQ_CMD_PANNING;
+    else if (data[0] == 65)        /* portamento switch */
+      seq_code = APU_SEQ_CMD_PORTAMENTO;
+    else if (data[0] == 69)        /* sustain pedal */
+      seq_code = APU_SEQ_CMD_SUSTAIN;
+    else
+      seq_code = 0x00;
+  }
+  else if (message_type == 0x0C)  /* program change */
+    seq_code = APU_SEQ_CMD_PROGRAM;
+  else if (message_type == 0x0D)  /* channel pressure */
+    seq_code = APU_SEQ_CMD_PRESSURE;
+  else if (message_type == 0x0E)  /* pitch wheel */
+    seq_code = APU_SEQ_CMD_PITCH_WHEEL;
+  else
+    seq_code = 0x00;
+
+  /* skip unsupported controllers, etc */
+  if (seq_code == 0x00)
+    return 0;
+
+  seq_code |= (message_channel << 4) & 0xF0;
+
+  if ((seq_code & 0x0F) == APU_SEQ_CMD_NOTE_ON)
+  {
+    cmd[0] = seq_code;
+    cmd[1] = data[0];
+    cmd[2] = data[1];
+
+    return 3;
+  }
+  else if ( ((seq_code & 0x0F) == APU_SEQ_CMD_VOLUME)     || 
+            ((seq_code & 0x0F) == APU_SEQ_CMD_PANNING)    || 
+            ((seq_code & 0x0F) == APU_SEQ_CMD_MOD_WHEEL)  || 
+            ((seq_code & 0x0F) == APU_SEQ_CMD_PORTAMENTO) || 
+            ((seq_code & 0x0F) == APU_SEQ_CMD_SUSTAIN))
+  {
+    cmd[0] = seq_code;
+    cmd[1] = data[1];
+
+    return 2;
+  }
+  else
+  {
+    cmd[0] = seq_code;
+    cmd[1] = data[0];
+
+    return 2;
+  }
+}
+
+/******************************************************************************/
+/* midi_decoder_reset()                                                       */
+/******************************************************************************/
+int midi_decoder_reset(midi_decoder* dec)
+{
+  if (dec == NULL)
+    return 1;
+
+  dec->status_byte = 0x00;
+  dec->num_data_bytes = 0;
+  dec->data_count = 0;
+  dec->data[0] = 0x00;
+  dec->data[1] = 0x00;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_decode_byte()                                                         */
+/******************************************************************************/
+unsigned int midi_decode_byte(midi_decoder* dec, unsigned char byte, 
+                              unsigned char* cmd)
+{
+  /* decodes a live midi stream one byte at a time. when a byte   */
+  /* completes a message, the sequencer command for it is written */
+  /* to cmd and its size is returned (otherwise, 0 is returned)   */
+
+  /* real time messages can show up anywhere, */
+  /* and they don't affect the running status */
+  if (byte >= 0xF8)
+    return 0;
+
+  /* status byte */
+  if (byte & 0x80)
+  {
+    dec->data_count = 0;
+
+    /* sysex and system common messages cancel the running status, */
+    /* and their data bytes are dropped until the next status byte */
+    if (byte >= 0xF0)
+    {
+      dec->status_byte = 0x00;
+      dec->num_data_bytes = 0;
+    }
+    else
+    {
+      dec->status_byte = byte;
+      dec->num_data_bytes = 
+        midi_message_num_data_bytes((byte >> 4) & 0x0F);
+    }
+
+    return 0;
+  }
+
+  /* data byte (with no status byte to go with it) */
+  if (dec->status_byte == 0x00)
+    return 0;
 
-static FILE* S_midi_import_fp;
+  dec->data[dec->data_count] = byte;
+  dec->data_count += 1;
 
-static unsigned short S_midi_format;
-static unsigned short S_midi_num_tracks;
-static unsigned short S_midi_ppqn;
+  if (dec->data_count < dec->num_data_bytes)
+    return 0;
 
-static unsigned char  S_midi_combined_data[MIDI_TRACK_SIZE];
-static unsigned int   S_midi_combined_num_bytes;
+  /* the message is complete. the status byte is kept, */
+  /* so that the next data byte starts a new message   */
+  dec->data_count = 0;
 
-static unsigned char  S_midi_track_data[MIDI_TRACK_SIZE];
-static unsigned int   S_midi_track_num_bytes;
+  if (dec->num_data_bytes == 1)
+    dec->data[1] = 0x00;
+
+  return midi_voice_message((dec->status_byte >> 4) & 0x0F, 
+                            dec->status_byte & 0x0F, 
+                            dec->data, cmd);
+}
 
 /******************************************************************************/
 /* midi_parse_header()                                                        */
 /******************************************************************************/
-int midi_parse_header()
+int midi_parse_header(midi_context* ctx)
 {
-  unsigned char buf[5];
-  unsigned int  header_size;
+  unsigned char* buf;
+  unsigned int   header_size;
 
-  /* chunk name "MThd" */
-  if (fread(buf, sizeof(unsigned char), 4, S_midi_import_fp) < 4)
+  /* chunk name "MThd", header size */
+  buf = midi_read_bytes(ctx, 8);
+
+  if (buf == NULL)
     return 1;
 
   if ((buf[0] != 0x4D) || (buf[1] != 0x54) || 
@@ -39,438 +532,1500 @@ int midi_parse_header()
     return 1;
   }
 
-  /* header size */
-  if (fread(buf, sizeof(unsigned char), 4, S_midi_import_fp) < 4)
+  header_size = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+
+  if (header_size != 6)
+    return 1;
+
+  /* format, number of tracks, parts per quarter note */
+  buf = midi_read_bytes(ctx, 6);
+
+  if (buf == NULL)
+    return 1;
+
+  ctx->format = (buf[0] << 8) | buf[1];
+
+  if (ctx->format > 1)
+    return 1;
+  
+  ctx->num_tracks = (buf[2] << 8) | buf[3];
+
+  if (ctx->num_tracks > MIDI_MAX_TRACKS)
     return 1;
 
-  header_size = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+  ctx->ppqn = (buf[4] << 8) | buf[5];
+
+  if (ctx->ppqn & 0x8000)
+    return 1;
+
+  if ((ctx->ppqn == 0) || (ctx->ppqn > 960))
+    return 1;
+
+  if ((960 % ctx->ppqn) != 0)
+    return 1;
+
+#if 1
+  /* testing */
+  printf("MIDI Header Size: %d\n", header_size);
+  printf("MIDI Format: %d\n", ctx->format);
+  printf("MIDI Num Tracks: %d\n", ctx->num_tracks);
+  printf("MIDI PPQN: %d\n", ctx->ppqn);
+#endif
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_parse_track()                                                         */
+/******************************************************************************/
+int midi_parse_track(midi_context* ctx)
+{
+  unsigned char* buf;
+  unsigned char  data[2];
+  unsigned char  cmd[3];
+  unsigned int   chunk_size;
+  unsigned int   chunk_end;
+
+  unsigned int  delta_time;
+  unsigned char status_byte;
+
+  unsigned char message_type;
+  unsigned char message_channel;
+
+  unsigned char meta_code;
+  unsigned int  event_size;
+
+  unsigned int  num_data_bytes;
+  unsigned int  cmd_size;
+
+  unsigned int  microsecs_per_beat;
+  unsigned char tempo;
+
+  /* skip over any unknown chunks, until a track (or the end of the file) */
+  ctx->cursor_end = ctx->file_size;
+
+  while (1)
+  {
+    /* chunk name, chunk size */
+    buf = midi_read_bytes(ctx, 8);
+
+    if (buf == NULL)
+      return 1;
+
+    chunk_size = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+
+    /* the chunk has to fit in the file */
+    if (chunk_size > ctx->file_size - ctx->cursor_pos)
+      return 1;
+
+    chunk_end = ctx->cursor_pos + chunk_size;
+
+    if ((buf[0] == 0x4D) && (buf[1] == 0x54) && 
+        (buf[2] == 0x72) && (buf[3] == 0x6B))
+    {
+      break;
+    }
+
+    ctx->cursor_pos = chunk_end;
+  }
+
+  printf("Chunk Size: %d\n", chunk_size);
+
+  /* no event can read past the end of this chunk */
+  ctx->cursor_end = chunk_end;
+
+  /* reset running status */
+  status_byte = 0x00;
+
+  message_type = 0;
+  message_channel = 0;
+
+  /* read track events */
+  while (1)
+  {
+    /* read delta time */
+    if (midi_read_varint(ctx, &delta_time))
+      return 1;
+
+    /* the sequencer assumes 960 PPQN */
+    delta_time *= (APU_SEQ_TICKS_PER_BEAT / ctx->ppqn);
+
+    /* output "delay" sequencer commands if necessary */
+    if (midi_emit_delay(ctx, delta_time))
+      return 1;
+
+    /* read status byte or 1st data byte */
+    buf = midi_read_bytes(ctx, 1);
+
+    if (buf == NULL)
+      return 1;
+
+    data[0] = 0x00;
+    data[1] = 0x00;
+
+    /* check for running status */
+    /* if a data byte is encountered here, assume that the (implicit) */
+    /* status byte is the same as it was for the previous midi event  */
+    if (buf[0] & 0x80)
+    {
+      status_byte = buf[0];
+
+      message_type = (status_byte >> 4) & 0x0F;
+      message_channel = status_byte & 0x0F;
+
+      /* read data byte(s) */
+      num_data_bytes = midi_message_num_data_bytes(message_type);
+
+      if (num_data_bytes > 0)
+      {
+        buf = midi_read_bytes(ctx, num_data_bytes);
+
+        if (buf == NULL)
+          return 1;
+
+        data[0] = buf[0];
+
+        if (num_data_bytes == 2)
+          data[1] = buf[1];
+      }
+    }
+    else
+    {
+      data[0] = buf[0];
+
+      /* read remaining data byte(s) */
+      if (midi_message_num_data_bytes(message_type) == 2)
+      {
+        buf = midi_read_bytes(ctx, 1);
+
+        if (buf == NULL)
+          return 1;
+
+        data[1] = buf[0];
+      }
+    }
+
+    /* meta event */
+    if (status_byte == 0xFF)
+    {
+      /* read meta code, event size */
+      buf = midi_read_bytes(ctx, 1);
+
+      if (buf == NULL)
+        return 1;
+
+      meta_code = buf[0];
+
+      if (midi_read_varint(ctx, &event_size))
+        return 1;
+
+      /* end of track */
+      if (meta_code == 0x2F)
+      {
+        if (event_size != 0)
+          return 1;
+
+        /* the next chunk starts after this one, */
+        /* even if there is junk after the event */
+        ctx->cursor_pos = chunk_end;
+
+        printf("Success!\n");
+        return 0;
+      }
+      /* set tempo */
+      else if (meta_code == 0x51)
+      {
+        if (event_size != 3)
+          return 1;
+
+        buf = midi_read_bytes(ctx, 3);
+
+        if (buf == NULL)
+          return 1;
+
+        microsecs_per_beat =  ((buf[0] << 16) & 0xFF0000) | 
+                              ((buf[1] <<  8) & 0x00FF00) | 
+                               (buf[2]        & 0x0000FF);
+
+        if (microsecs_per_beat == 0)
+          return 1;
+
+        tempo = ((60 * 1000 * 1000) / microsecs_per_beat) & 0xFF;
+
+        cmd[0] = APU_SEQ_CMD_TEMPO;
+        cmd[1] = tempo;
+
+        if (midi_emit_command(ctx, cmd, 2))
+          return 1;
+
+        printf("Found Set Tempo Event, %d, Tempo: %d\n", microsecs_per_beat, tempo);
+      }
+      /* text or marker (checked for loop points) */
+      else if ((meta_code == 0x01) || (meta_code == 0x06))
+      {
+        buf = midi_read_bytes(ctx, event_size);
+
+        if (buf == NULL)
+          return 1;
+
+        if (midi_marker_is(buf, event_size, "loopstart"))
+        {
+          cmd[0] = APU_SEQ_SYS_LOOP_START;
+
+          if (midi_emit_command(ctx, cmd, 1))
+            return 1;
+        }
+        else if (midi_marker_is(buf, event_size, "loopend"))
+        {
+          cmd[0] = APU_SEQ_SYS_LOOP_END;
+          cmd[1] = 0;
+
+          if (midi_emit_command(ctx, cmd, 2))
+            return 1;
+        }
+      }
+      /* skip other meta events */
+      else
+      {
+        if (midi_read_bytes(ctx, event_size) == NULL)
+          return 1;
+      }
+
+      /* reset running status */
+      status_byte = 0x00;
+
+      message_type = 0;
+      message_channel = 0;
+    }
+    /* sysex event */
+    else if ((status_byte == 0xF0) || (status_byte == 0xF7))
+    {
+      /* read event size, skip sysex event */
+      if (midi_read_varint(ctx, &event_size))
+        return 1;
+
+      if (midi_read_bytes(ctx, event_size) == NULL)
+        return 1;
+
+      /* reset running status */
+      status_byte = 0x00;
+
+      message_type = 0;
+      message_channel = 0;
+    }
+    /* midi voice events */
+    else if ((status_byte >= 0x80) && (status_byte <= 0xEF))
+    {
+      /* some game music marks the loop start with controller 111 */
+      if ((message_type == 0x0B) && (data[0] == 111))
+      {
+        cmd[0] = APU_SEQ_SYS_LOOP_START;
+
+        if (midi_emit_command(ctx, cmd, 1))
+          return 1;
+
+        continue;
+      }
+
+      /* convert to a sequencer command */
+      cmd_size = midi_voice_message(message_type, message_channel, data, cmd);
+
+      /* skip unsupported controllers, etc */
+      if (cmd_size == 0)
+        continue;
+
+      if (midi_emit_command(ctx, cmd, cmd_size))
+        return 1;
+    }
+    else
+    {
+      printf("Unknown MIDI Message.\n");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_track_next_event()                                                    */
+/******************************************************************************/
+int midi_track_next_event(midi_context* ctx, unsigned int* pos, 
+                          unsigned int end, unsigned long* time)
+{
+  unsigned char code;
+  unsigned int  size;
+
+  /* skip over delays (accumulating them) until the next actual event */
+  while (*pos < end)
+  {
+    code = ctx->arena_data[*pos];
+    size = midi_command_size(code);
+
+    if ((size == 0) || (size > end - *pos))
+      return 1;
+
+    if (code == APU_SEQ_CMD_DELAY_8)
+      *time += ctx->arena_data[*pos + 1];
+    else if (code == APU_SEQ_CMD_DELAY_16)
+    {
+      *time +=  ctx->arena_data[*pos + 1] | 
+                (ctx->arena_data[*pos + 2] << 8);
+    }
+    else
+      return 0;
+
+    *pos += size;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_event_order()                                                         */
+/******************************************************************************/
+unsigned int midi_event_order(unsigned char* cmd)
+{
+  /* among events at the same time, the note offs go first and then  */
+  /* the loop end, so that notes ending at the loop point still get  */
+  /* released, and notes starting there wait for the next time round */
+  if ((cmd[0] & 0x0F) == APU_SEQ_CMD_NOTE_OFF)
+    return 0;
+  else if (((cmd[0] & 0x0F) == APU_SEQ_CMD_NOTE_ON) && (cmd[2] == 0))
+    return 0;
+  else if (cmd[0] == APU_SEQ_SYS_LOOP_END)
+    return 1;
+  else
+    return 2;
+}
+
+/******************************************************************************/
+/* midi_merge_earlier()                                                       */
+/******************************************************************************/
+int midi_merge_earlier( unsigned long* time, unsigned int* order, 
+                        unsigned int a, unsigned int b)
+{
+  /* compare by time, then by event order, then by track */
+  if (time[a] != time[b])
+    return (time[a] < time[b]) ? 1 : 0;
+
+  if (order[a] != order[b])
+    return (order[a] < order[b]) ? 1 : 0;
+
+  return (a < b) ? 1 : 0;
+}
+
+/******************************************************************************/
+/* midi_merge_tracks()                                                        */
+/******************************************************************************/
+int midi_merge_tracks(midi_context* ctx)
+{
+  unsigned int  k;
+  unsigned int  m;
+  unsigned int  child;
+  unsigned int  tmp;
+
+  /* per track cursors */
+  unsigned int  pos[MIDI_MAX_TRACKS];
+  unsigned int  end[MIDI_MAX_TRACKS];
+  unsigned long time[MIDI_MAX_TRACKS];
+  unsigned int  order[MIDI_MAX_TRACKS];
+
+  /* min heap of track numbers, ordered by the time of their next */
+  /* event. ties go by event order and then to the lower track, so */
+  /* the tempo map and other events at the same time come out in   */
+  /* track order.                                                  */
+  unsigned int  heap[MIDI_MAX_TRACKS];
+  unsigned int  heap_size;
+
+  unsigned long last_time;
+  unsigned long end_time;
+  unsigned int  size;
+  unsigned char cmd[3];
+
+  heap_size = 0;
+
+  for (k = 0; k < ctx->num_tracks; k++)
+  {
+    pos[k] = ctx->track_start[k];
+    end[k] = ctx->track_start[k] + ctx->track_num_bytes[k];
+    time[k] = 0;
+
+    if (midi_track_next_event(ctx, &pos[k], end[k], &time[k]))
+      return 1;
+
+    if (pos[k] >= end[k])
+      continue;
+
+    order[k] = midi_event_order(&ctx->arena_data[pos[k]]);
+
+    /* sift up */
+    m = heap_size;
+    heap[heap_size] = k;
+    heap_size += 1;
+
+    while ((m > 0) && 
+           midi_merge_earlier(time, order, heap[m], heap[(m - 1) / 2]))
+    {
+      tmp = heap[m];
+      heap[m] = heap[(m - 1) / 2];
+      heap[(m - 1) / 2] = tmp;
+      m = (m - 1) / 2;
+    }
+  }
+
+  ctx->combined_start = ctx->arena_num_bytes;
+  last_time = 0;
+
+  while (heap_size > 0)
+  {
+    k = heap[0];
+
+    /* copy the earliest event, with the delay since the last one */
+    if (midi_emit_delay(ctx, time[k] - last_time))
+      return 1;
+
+    last_time = time[k];
+
+    size = midi_command_size(ctx->arena_data[pos[k]]);
+
+    for (m = 0; m < size; m++)
+      cmd[m] = ctx->arena_data[pos[k] + m];
+
+    if (midi_emit_command(ctx, cmd, size))
+      return 1;
+
+    pos[k] += size;
+
+    if (midi_track_next_event(ctx, &pos[k], end[k], &time[k]))
+      return 1;
+
+    /* remove the track if it is finished */
+    if (pos[k] >= end[k])
+    {
+      heap_size -= 1;
+      heap[0] = heap[heap_size];
+    }
+    else
+      order[k] = midi_event_order(&ctx->arena_data[pos[k]]);
+
+    /* sift down */
+    m = 0;
+
+    while (2 * m + 1 < heap_size)
+    {
+      child = 2 * m + 1;
+
+      if ((child + 1 < heap_size) && 
+          midi_merge_earlier(time, order, heap[child + 1], heap[child]))
+      {
+        child += 1;
+      }
+
+      if (midi_merge_earlier(time, order, heap[m], heap[child]))
+        break;
+
+      tmp = heap[m];
+      heap[m] = heap[child];
+      heap[child] = tmp;
+      m = child;
+    }
+  }
+
+  /* the song ends when the last track does */
+  end_time = last_time;
+
+  for (k = 0; k < ctx->num_tracks; k++)
+  {
+    if (time[k] > end_time)
+      end_time = time[k];
+  }
+
+  if (midi_emit_delay(ctx, end_time - last_time))
+    return 1;
+
+  ctx->combined_num_bytes = ctx->arena_num_bytes - ctx->combined_start;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_release_held_notes()                                                  */
+/******************************************************************************/
+int midi_release_held_notes(midi_context* ctx, unsigned char held[16][128])
+{
+  unsigned int  k;
+  unsigned int  m;
+  unsigned char buf[2];
+
+  /* the loop end jumps back without releasing anything, */
+  /* so the notes still on there get their note offs now */
+  for (k = 0; k < 16; k++)
+  {
+    for (m = 0; m < 128; m++)
+    {
+      if (!held[k][m])
+        continue;
+
+      buf[0] = ((k << 4) & 0xF0) | APU_SEQ_CMD_NOTE_OFF;
+      buf[1] = m;
+
+      if (midi_emit_command(ctx, buf, 2))
+        return 1;
+
+      held[k][m] = 0;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* midi_resolve_loops()                                                       */
+/******************************************************************************/
+int midi_resolve_loops(midi_context* ctx)
+{
+  unsigned int  k;
+  unsigned int  m;
+
+  unsigned int  pos;
+  unsigned int  end;
+  unsigned long time;
+  unsigned long last_time;
+  unsigned long end_time;
+
+  unsigned int  num_events;
+  unsigned int* event_pos;
+  unsigned long* event_time;
+
+  /* loop points (num_events means the start or end of the song) */
+  int           loop_flag;
+  unsigned int  loop_start;
+  unsigned int  loop_end;
+  unsigned long loop_start_time;
+  unsigned long loop_end_time;
+
+  unsigned char code;
+  unsigned int  size;
+  unsigned char buf[3];
+
+  /* notes that are on, by channel and note number */
+  unsigned char held[16][128];
+
+  /* count the events in the combined stream */
+  pos = ctx->combined_start;
+  end = ctx->combined_start + ctx->combined_num_bytes;
+  num_events = 0;
+
+  while (pos < end)
+  {
+    size = midi_command_size(ctx->arena_data[pos]);
+
+    if ((size == 0) || (size > end - pos))
+      return 1;
+
+    pos += size;
+    num_events += 1;
+  }
+
+  event_pos = malloc((num_events + 1) * sizeof(unsigned int));
+  event_time = malloc((num_events + 1) * sizeof(unsigned long));
+
+  if ((event_pos == NULL) || (event_time == NULL))
+    goto nope;
+
+  /* list the events (everything but the delays) with their times */
+  pos = ctx->combined_start;
+  time = 0;
+  num_events = 0;
+
+  while (1)
+  {
+    if (midi_track_next_event(ctx, &pos, end, &time))
+      goto nope;
+
+    if (pos >= end)
+      break;
+
+    event_pos[num_events] = pos;
+    event_time[num_events] = time;
+    num_events += 1;
+
+    pos += midi_command_size(ctx->arena_data[pos]);
+  }
+
+  end_time = time;
+
+  /* use the first loop start and the last loop end after it, */
+  /* since some files repeat the markers on every track       */
+  loop_flag = 0;
+  loop_start = num_events;
+  loop_end = num_events;
+
+  for (k = 0; k < num_events; k++)
+  {
+    code = ctx->arena_data[event_pos[k]];
+
+    if (code == APU_SEQ_SYS_LOOP_START)
+    {
+      if (loop_start == num_events)
+        loop_start = k;
+
+      loop_flag = 1;
+    }
+    else if (code == APU_SEQ_SYS_LOOP_END)
+    {
+      if ((loop_start == num_events) || (k > loop_start))
+        loop_end = k;
+
+      loop_flag = 1;
+    }
+  }
+
+  if (!loop_flag)
+  {
+    free(event_pos);
+    free(event_time);
+    return 0;
+  }
+
+  /* a loop end before the loop start is ignored, and a */
+  /* missing start or end is the start or end of song   */
+  if ((loop_start != num_events) && (loop_end < loop_start))
+    loop_end = num_events;
+
+  loop_start_time = (loop_start == num_events) ? 0 : event_time[loop_start];
+  loop_end_time = (loop_end == num_events) ? end_time : event_time[loop_end];
+
+  /* a loop that takes no time can't be played */
+  if (loop_end_time <= loop_start_time)
+  {
+    loop_flag = 0;
+    loop_start = num_events;
+    loop_end = num_events;
+    loop_end_time = end_time;
+  }
+
+  /* write out the events with just the one pair of markers. */
+  /* anything after the loop end would never play, so it goes, */
+  /* and the notes still held there are released at the end    */
+  ctx->combined_start = ctx->arena_num_bytes;
+  last_time = 0;
+
+  for (k = 0; k < 16; k++)
+  {
+    for (m = 0; m < 128; m++)
+      held[k][m] = 0;
+  }
+
+  if (loop_flag && (loop_start == num_events))
+  {
+    buf[0] = APU_SEQ_SYS_LOOP_START;
+
+    if (midi_emit_command(ctx, buf, 1))
+      goto nope;
+  }
+
+  for (k = 0; k < num_events; k++)
+  {
+    code = ctx->arena_data[event_pos[k]];
+
+    if ((k != loop_start) && (k != loop_end) && 
+        ((code == APU_SEQ_SYS_LOOP_START) || (code == APU_SEQ_SYS_LOOP_END)))
+    {
+      continue;
+    }
+
+    if (midi_emit_delay(ctx, event_time[k] - last_time))
+      goto nope;
+
+    last_time = event_time[k];
+
+    size = midi_command_size(code);
+
+    for (m = 0; m < size; m++)
+      buf[m] = ctx->arena_data[event_pos[k] + m];
+
+    if ((code & 0x0F) == APU_SEQ_CMD_NOTE_ON)
+      held[(code >> 4) & 0x0F][buf[1] & 0x7F] = (buf[2] != 0) ? 1 : 0;
+    else if ((code & 0x0F) == APU_SEQ_CMD_NOTE_OFF)
+      held[(code >> 4) & 0x0F][buf[1] & 0x7F] = 0;
+
+    if ((k == loop_end) && midi_release_held_notes(ctx, held))
+      goto nope;
+
+    if (midi_emit_command(ctx, buf, size))
+      goto nope;
+
+    if (k == loop_end)
+      break;
+  }
+
+  if (midi_emit_delay(ctx, loop_end_time - last_time))
+    goto nope;
+
+  if (loop_flag && (loop_end == num_events))
+  {
+    if (midi_release_held_notes(ctx, held))
+      goto nope;
+
+    buf[0] = APU_SEQ_SYS_LOOP_END;
+    buf[1] = 0;
+
+    if (midi_emit_command(ctx, buf, 2))
+      goto nope;
+  }
+
+  ctx->combined_num_bytes = ctx->arena_num_bytes - ctx->combined_start;
+
+  /* testing */
+  printf("Loop Points: %lu -> %lu\n", loop_start_time, loop_end_time);
+
+  free(event_pos);
+  free(event_time);
+
+  return 0;
+
+nope:
+  free(event_pos);
+  free(event_time);
+  return 1;
+}
+
+/******************************************************************************/
+/* midi_optimize()                                                            */
+/******************************************************************************/
+int midi_optimize(midi_context* ctx, unsigned short channel_mask)
+{
+  unsigned int  k;
+  unsigned int  m;
+
+  unsigned int  pos;
+  unsigned int  end;
+  unsigned long time;
+  unsigned long last_time;
+  unsigned long end_time;
+
+  unsigned int  num_events;
+  unsigned int* event_pos;
+  unsigned long* event_time;
+  unsigned char* event_keep;
+
+  unsigned char code;
+  unsigned char cmd;
+  unsigned char channel;
+  unsigned int  size;
+  unsigned char buf[3];
+
+  /* last value written for each channel and state command */
+  /* (the tempo is kept in the channel 0 slot for command 0) */
+  short         state[16][16];
+
+  unsigned int  old_num_bytes;
+
+  if (ctx == NULL)
+    return 1;
+
+  /* count the events in the combined stream */
+  pos = ctx->combined_start;
+  end = ctx->combined_start + ctx->combined_num_bytes;
+  num_events = 0;
+
+  while (pos < end)
+  {
+    size = midi_command_size(ctx->arena_data[pos]);
+
+    if ((size == 0) || (size > end - pos))
+      return 1;
+
+    pos += size;
+    num_events += 1;
+  }
+
+  event_pos = malloc((num_events + 1) * sizeof(unsigned int));
+  event_time = malloc((num_events + 1) * sizeof(unsigned long));
+  event_keep = malloc(num_events + 1);
+
+  if ((event_pos == NULL) || (event_time == NULL) || (event_keep == NULL))
+    goto nope;
+
+  /* list the events (everything but the delays) with their times */
+  pos = ctx->combined_start;
+  time = 0;
+  num_events = 0;
+
+  while (1)
+  {
+    if (midi_track_next_event(ctx, &pos, end, &time))
+      goto nope;
+
+    if (pos >= end)
+      break;
+
+    event_pos[num_events] = pos;
+    event_time[num_events] = time;
+    event_keep[num_events] = 1;
+    num_events += 1;
+
+    pos += midi_command_size(ctx->arena_data[pos]);
+  }
+
+  end_time = time;
+
+  /* the chip state is unknown when the song starts */
+  for (k = 0; k < 16; k++)
+  {
+    for (m = 0; m < 16; m++)
+      state[k][m] = -1;
+  }
+
+  for (k = 0; k < num_events; k++)
+  {
+    code = ctx->arena_data[event_pos[k]];
+    cmd = code & 0x0F;
+    channel = (code >> 4) & 0x0F;
+
+    /* system commands always stay. the state at the loop */
+    /* start depends on the way in, so it isn't known     */
+    if (cmd == APU_SEQ_CMD_SYSTEM)
+    {
+      if (code == APU_SEQ_SYS_LOOP_START)
+      {
+        for (m = 0; m < 256; m++)
+          state[m / 16][m % 16] = -1;
+      }
+
+      continue;
+    }
+
+    /* tempo changes are for all channels */
+    if (code == APU_SEQ_CMD_TEMPO)
+    {
+      if (state[0][cmd] == ctx->arena_data[event_pos[k] + 1])
+        event_keep[k] = 0;
+      else
+        state[0][cmd] = ctx->arena_data[event_pos[k] + 1];
+
+      continue;
+    }
+
+    /* strip channels that nothing will play */
+    if (!(channel_mask & (1 << channel)))
+    {
+      event_keep[k] = 0;
+      continue;
+    }
+
+    /* notes always play */
+    if ((cmd == APU_SEQ_CMD_NOTE_ON) || (cmd == APU_SEQ_CMD_NOTE_OFF))
+      continue;
+
+    /* a continuous controller that is written again on the same tick */
+    /* never gets heard, since the voices don't run between commands  */
+    if ((cmd == APU_SEQ_CMD_VOLUME)       || 
+        (cmd == APU_SEQ_CMD_PANNING)      || 
+        (cmd == APU_SEQ_CMD_PITCH_WHEEL)  || 
+        (cmd == APU_SEQ_CMD_PRESSURE)     || 
+        (cmd == APU_SEQ_CMD_MOD_WHEEL))
+    {
+      for (m = k + 1; (m < num_events) && (event_time[m] == event_time[k]); m++)
+      {
+        if ((ctx->arena_data[event_pos[m]] & 0x0F) == APU_SEQ_CMD_SYSTEM)
+          break;
+
+        if (ctx->arena_data[event_pos[m]] == code)
+        {
+          event_keep[k] = 0;
+          break;
+        }
+      }
 
-  if (header_size != 6)
-    return 1;
+      if (event_keep[k] == 0)
+        continue;
+    }
 
-  /* format */
-  if (fread(buf, sizeof(unsigned char), 2, S_midi_import_fp) < 2)
-    return 1;
+    /* drop writes that don't change anything */
+    if (state[channel][cmd] == ctx->arena_data[event_pos[k] + 1])
+      event_keep[k] = 0;
+    else
+      state[channel][cmd] = ctx->arena_data[event_pos[k] + 1];
+  }
 
-  S_midi_format = (buf[0] << 8) | buf[1];
+  /* write out the kept events, merging the delays between them */
+  old_num_bytes = ctx->combined_num_bytes;
+  ctx->combined_start = ctx->arena_num_bytes;
+  last_time = 0;
 
-  if (S_midi_format > 1)
-    return 1;
-  
-  /* number of tracks */
-  if (fread(buf, sizeof(unsigned char), 2, S_midi_import_fp) < 2)
-    return 1;
+  for (k = 0; k < num_events; k++)
+  {
+    if (!event_keep[k])
+      continue;
 
-  S_midi_num_tracks = (buf[0] << 8) | buf[1];
+    if (midi_emit_delay(ctx, event_time[k] - last_time))
+      goto nope;
 
-  if (S_midi_num_tracks > 16)
-    return 1;
+    last_time = event_time[k];
 
-  /* parts per quarter note */
-  if (fread(buf, sizeof(unsigned char), 2, S_midi_import_fp) < 2)
-    return 1;
+    size = midi_command_size(ctx->arena_data[event_pos[k]]);
 
-  S_midi_ppqn = (buf[0] << 8) | buf[1];
+    for (m = 0; m < size; m++)
+      buf[m] = ctx->arena_data[event_pos[k] + m];
 
-  if (S_midi_ppqn & 0x8000)
-    return 1;
+    if (midi_emit_command(ctx, buf, size))
+      goto nope;
+  }
 
-  if ((S_midi_ppqn == 0) || (S_midi_ppqn > 960))
-    return 1;
+  if (midi_emit_delay(ctx, end_time - last_time))
+    goto nope;
 
-  if ((960 % S_midi_ppqn) != 0)
-    return 1;
+  ctx->combined_num_bytes = ctx->arena_num_bytes - ctx->combined_start;
 
-#if 1
   /* testing */
-  printf("MIDI Header Size: %d\n", header_size);
-  printf("MIDI Format: %d\n", S_midi_format);
-  printf("MIDI Num Tracks: %d\n", S_midi_num_tracks);
-  printf("MIDI PPQN: %d\n", S_midi_ppqn);
-#endif
+  printf("Optimized Size: %d -> %d (%d%% smaller)\n", 
+          old_num_bytes, ctx->combined_num_bytes, 
+          (old_num_bytes > 0) ? 
+          (100 * (old_num_bytes - ctx->combined_num_bytes) / old_num_bytes) : 0);
+
+  free(event_pos);
+  free(event_time);
+  free(event_keep);
 
   return 0;
+
+nope:
+  free(event_pos);
+  free(event_time);
+  free(event_keep);
+  return 1;
 }
 
 /******************************************************************************/
-/* midi_parse_track()                                                         */
+/* midi_tokens_equal()                                                        */
 /******************************************************************************/
-int midi_parse_track()
+int midi_tokens_equal( midi_context* ctx, 
+                        unsigned int* tok_pos, unsigned char* tok_size, 
+                        unsigned int a, unsigned int b, unsigned int len)
 {
   unsigned int k;
+  unsigned int m;
 
-  unsigned char buf[5];
-  unsigned int  chunk_size;
-
-  unsigned int  delta_time;
-  unsigned char status_byte;
+  /* check that two sections with the same hash really match */
+  for (k = 0; k < len; k++)
+  {
+    if (tok_size[a + k] != tok_size[b + k])
+      return 0;
 
-  unsigned char message_type;
-  unsigned char message_channel;
+    for (m = 0; m < tok_size[a + k]; m++)
+    {
+      if (ctx->arena_data[tok_pos[a + k] + m] != 
+          ctx->arena_data[tok_pos[b + k] + m])
+      {
+        return 0;
+      }
+    }
+  }
 
-  unsigned char meta_code;
-  unsigned int  event_size;
+  return 1;
+}
 
-  unsigned char seq_code;
+/******************************************************************************/
+/* midi_window_compare()                                                      */
+/******************************************************************************/
+int midi_window_compare(const void* a, const void* b)
+{
+  const midi_window* w_a = a;
+  const midi_window* w_b = b;
 
-  unsigned int  microsecs_per_beat;
-  unsigned char tempo;
+  /* sort by hash, then by position */
+  if (w_a->hash != w_b->hash)
+    return (w_a->hash < w_b->hash) ? -1 : 1;
 
-  /* chunk name "MTrk" */
-  if (fread(buf, sizeof(unsigned char), 4, S_midi_import_fp) < 4)
-    return 1;
+  if (w_a->start != w_b->start)
+    return (w_a->start < w_b->start) ? -1 : 1;
 
-  if ((buf[0] != 0x4D) || (buf[1] != 0x54) || 
-      (buf[2] != 0x72) || (buf[3] != 0x6B))
-  {
-    return 1;
-  }
+  return 0;
+}
 
-  /* chunk size */
-  if (fread(buf, sizeof(unsigned char), 4, S_midi_import_fp) < 4)
+/******************************************************************************/
+/* midi_factor_subroutines()                                                  */
+/******************************************************************************/
+int midi_factor_subroutines(midi_context* ctx)
+{
+  unsigned int  k;
+  unsigned int  m;
+  unsigned int  n;
+
+  unsigned int  pos;
+  unsigned int  end;
+  unsigned int  size;
+  unsigned char buf[3];
+
+  /* the stream as a list of commands. a command's sub is -1 if */
+  /* it is an ordinary command, -2 if it is a system command,   */
+  /* and otherwise the subroutine that it calls                 */
+  unsigned int    num_tokens;
+  unsigned int*   tok_pos;
+  unsigned char*  tok_size;
+  int*            tok_sub;
+  unsigned int*   tok_hash;
+
+  /* prefix sums of the hashes, sizes, and unusable commands */
+  unsigned int*   sum_hash;
+  unsigned int*   sum_size;
+  unsigned int*   sum_bad;
+
+  /* subroutine bodies */
+  unsigned int    num_subs;
+  unsigned int    sub_first[MIDI_MAX_SUBROUTINES];
+  unsigned int    sub_count[MIDI_MAX_SUBROUTINES];
+  unsigned int    sub_addr[MIDI_MAX_SUBROUTINES];
+  unsigned int    sub_total;
+  unsigned int*   sub_pos;
+  unsigned char*  sub_size;
+
+  /* search state */
+  midi_window*    windows;
+  unsigned int    num_windows;
+  unsigned int*   cand_starts;
+  unsigned int*   best_starts;
+  unsigned int    num_cands;
+  unsigned int    num_best;
+  unsigned int    best_len;
+  long            best_saving;
+  long            saving;
+  unsigned int    li;
+  unsigned int    len;
+  unsigned int    len_pow;
+  unsigned int    bytes;
+  unsigned int    last_end;
+  int             len_alive[MIDI_NUM_FACTOR_LENGTHS];
+
+  unsigned int    old_num_bytes;
+
+  if (ctx == NULL)
     return 1;
 
-  chunk_size = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+  /* count the commands in the combined stream */
+  pos = ctx->combined_start;
+  end = ctx->combined_start + ctx->combined_num_bytes;
+  num_tokens = 0;
 
-  printf("Chunk Size: %d\n", chunk_size);
+  while (pos < end)
+  {
+    size = midi_command_size(ctx->arena_data[pos]);
 
-  /* reset running status */
-  status_byte = 0x00;
+    if ((size == 0) || (size > end - pos))
+      return 1;
 
-  message_type = 0;
-  message_channel = 0;
+    pos += size;
+    num_tokens += 1;
+  }
 
-  /* read track events */
-  while (1)
+  tok_pos = malloc((num_tokens + 1) * sizeof(unsigned int));
+  tok_size = malloc(num_tokens + 1);
+  tok_sub = malloc((num_tokens + 1) * sizeof(int));
+  tok_hash = malloc((num_tokens + 1) * sizeof(unsigned int));
+  sum_hash = malloc((num_tokens + 1) * sizeof(unsigned int));
+  sum_size = malloc((num_tokens + 1) * sizeof(unsigned int));
+  sum_bad = malloc((num_tokens + 1) * sizeof(unsigned int));
+  sub_pos = malloc((num_tokens + 1) * sizeof(unsigned int));
+  sub_size = malloc(num_tokens + 1);
+  windows = malloc((num_tokens + 1) * sizeof(midi_window));
+  cand_starts = malloc((num_tokens + 1) * sizeof(unsigned int));
+  best_starts = malloc((num_tokens + 1) * sizeof(unsigned int));
+
+  if ((tok_pos == NULL) || (tok_size == NULL) || (tok_sub == NULL)   || 
+      (tok_hash == NULL) || (sum_hash == NULL) || (sum_size == NULL) || 
+      (sum_bad == NULL)  || (sub_pos == NULL)  || (sub_size == NULL) || 
+      (windows == NULL)  || (cand_starts == NULL) || (best_starts == NULL))
   {
-    /* read delta time */
-    for (k = 0; k < 4; k++)
-    {
-      if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-        return 1;
+    goto nope;
+  }
 
-      if (k == 0)
-        delta_time = buf[0] & 0x7F;
-      else
-        delta_time = (delta_time << 7) | (buf[0] & 0x7F);
+  /* list the commands, with a hash of each one's bytes */
+  pos = ctx->combined_start;
 
-      if (!(buf[0] & 0x80))
-        break;
-    }
+  for (k = 0; k < num_tokens; k++)
+  {
+    size = midi_command_size(ctx->arena_data[pos]);
 
-    /* the sequencer assumes 960 PPQN */
-    delta_time *= (960 / S_midi_ppqn);
+    tok_pos[k] = pos;
+    tok_size[k] = size;
+    tok_hash[k] = 2166136261u;
 
-    /* output "delay" sequencer commands if necessary */
-    while (delta_time > 0)
+    for (m = 0; m < size; m++)
     {
-      if (delta_time <= 255)
-      {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = 0x01;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = delta_time & 0xFF;
-        S_midi_track_num_bytes += 2;
-        delta_time = 0;
-      }
-      else if (delta_time <= 65535)
-      {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = 0x02;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = delta_time & 0xFF;
-        S_midi_track_data[S_midi_track_num_bytes + 2] = (delta_time >> 8) & 0xFF;
-        S_midi_track_num_bytes += 3;
-        delta_time = 0;
-      }
-      else
-      {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = 0x02;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = 0xFF;
-        S_midi_track_data[S_midi_track_num_bytes + 2] = 0xFF;
-        S_midi_track_num_bytes += 3;
-        delta_time -= 65535;
-      }
+      tok_hash[k] ^= ctx->arena_data[pos + m];
+      tok_hash[k] *= 16777619u;
     }
 
-    /* read status byte or 1st data byte */
-    if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-      return 1;
+    /* loop markers stay where they are */
+    if ((ctx->arena_data[pos] & 0x0F) == APU_SEQ_CMD_SYSTEM)
+      tok_sub[k] = -2;
+    else
+      tok_sub[k] = -1;
 
-    /* check for running status */
-    /* if a data byte is encountered here, assume that the (implicit) */
-    /* status byte is the same as it was for the previous midi event  */
-    if (buf[0] & 0x80)
-    {
-      status_byte = buf[0];
+    pos += size;
+  }
 
-      message_type = (status_byte >> 4) & 0x0F;
-      message_channel = status_byte & 0x0F;
+  for (k = 0; k < MIDI_NUM_FACTOR_LENGTHS; k++)
+    len_alive[k] = 1;
 
-      /* read data byte(s) */
-      if ((message_type == 0x08) || 
-          (message_type == 0x09) || 
-          (message_type == 0x0A) || 
-          (message_type == 0x0B) || 
-          (message_type == 0x0E))
-      {
-        if (fread(&buf[0], sizeof(unsigned char), 2, S_midi_import_fp) < 2)
-          return 1;
-      }
-      else if ( (message_type == 0x0C) || 
-                (message_type == 0x0D))
-      {
-        if (fread(&buf[0], sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-          return 1;
+  num_subs = 0;
+  sub_total = 0;
 
-        buf[1] = 0x00;
-      }
-    }
-    else
+  /* each round, move the repeated section that saves the most */
+  /* space into a subroutine. replacing sections with calls    */
+  /* can only make the other sections save less, so a length   */
+  /* that saved nothing once is not tried again.               */
+  while (num_subs < MIDI_MAX_SUBROUTINES)
+  {
+    sum_hash[0] = 0;
+    sum_size[0] = 0;
+    sum_bad[0] = 0;
+
+    for (k = 0; k < num_tokens; k++)
     {
-      /* read remaining data byte(s) */
-      if ((message_type == 0x08) || 
-          (message_type == 0x09) || 
-          (message_type == 0x0A) || 
-          (message_type == 0x0B) || 
-          (message_type == 0x0E))
-      {
-        if (fread(&buf[1], sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-          return 1;
-      }
-      else if ( (message_type == 0x0C) || 
-                (message_type == 0x0D))
-      {
-        buf[1] = 0x00;
-      }
+      sum_hash[k + 1] = sum_hash[k] * MIDI_HASH_MULTIPLIER + tok_hash[k];
+      sum_size[k + 1] = sum_size[k] + tok_size[k];
+      sum_bad[k + 1] = sum_bad[k] + ((tok_sub[k] != -1) ? 1 : 0);
     }
 
-    /* meta event */
-    if (status_byte == 0xFF)
+    best_saving = 0;
+    best_len = 0;
+    num_best = 0;
+
+    for (li = 0; li < MIDI_NUM_FACTOR_LENGTHS; li++)
     {
-      /* read meta code */
-      if (fread(&meta_code, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-        return 1;
+      len = S_midi_factor_lengths[li];
 
-      /* read event size */
-      for (k = 0; k < 4; k++)
+      if ((!len_alive[li]) || (2 * len > num_tokens))
       {
-        if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-          return 1;
+        len_alive[li] = 0;
+        continue;
+      }
 
-        if (k == 0)
-          event_size = buf[0] & 0x7F;
-        else
-          event_size = (event_size << 7) | (buf[0] & 0x7F);
+      len_alive[li] = 0;
 
-        if (!(buf[0] & 0x80))
-          break;
-      }
+      len_pow = 1;
 
-      /* end of track */
-      if (meta_code == 0x2F)
+      for (k = 0; k < len; k++)
+        len_pow *= MIDI_HASH_MULTIPLIER;
+
+      /* hash every section of this length without system commands */
+      num_windows = 0;
+
+      for (k = 0; k + len <= num_tokens; k++)
       {
-        if (event_size != 0)
-          return 1;
+        if (sum_bad[k + len] != sum_bad[k])
+          continue;
 
-        printf("Success!\n");
-        return 0;
+        windows[num_windows].hash = sum_hash[k + len] - sum_hash[k] * len_pow;
+        windows[num_windows].start = k;
+        num_windows += 1;
       }
-      /* set tempo */
-      else if (meta_code == 0x51)
-      {
-        if (event_size != 3)
-          return 1;
 
-        if (fread(buf, sizeof(unsigned char), 3, S_midi_import_fp) < 3)
-          return 1;
+      qsort(windows, num_windows, sizeof(midi_window), midi_window_compare);
 
-        microsecs_per_beat =  ((buf[0] << 16) & 0xFF0000) | 
-                              ((buf[1] <<  8) & 0x00FF00) | 
-                               (buf[2]        & 0x0000FF);
+      /* go through the runs of matching hashes, taking */
+      /* sections that don't overlap from left to right */
+      for (k = 0; k < num_windows; k = m)
+      {
+        for (m = k + 1; (m < num_windows) && 
+                        (windows[m].hash == windows[k].hash); m++);
 
-        tempo = ((60 * 1000 * 1000) / microsecs_per_beat) & 0xFF;
+        if (m - k < 2)
+          continue;
 
-        S_midi_track_data[S_midi_track_num_bytes + 0] = 0x00;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = tempo;
-        S_midi_track_num_bytes += 2;
+        cand_starts[0] = windows[k].start;
+        num_cands = 1;
+        last_end = windows[k].start + len;
 
-        printf("Found Set Tempo Event, %d, Tempo: %d\n", microsecs_per_beat, tempo);
-      }
-      /* skip other meta events */
-      else
-      {
-        for (k = 0; k < event_size; k++)
+        for (n = k + 1; n < m; n++)
         {
-          if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-            return 1;
+          if (windows[n].start < last_end)
+            continue;
+
+          if (!midi_tokens_equal(ctx, tok_pos, tok_size, 
+                                  windows[k].start, windows[n].start, len))
+          {
+            continue;
+          }
+
+          cand_starts[num_cands] = windows[n].start;
+          num_cands += 1;
+          last_end = windows[n].start + len;
         }
-      }
 
-      /* reset running status */
-      status_byte = 0x00;
+        if (num_cands < 2)
+          continue;
 
-      message_type = 0;
-      message_channel = 0;
-    }
-    /* sysex event */
-    else if ((status_byte == 0xF0) || (status_byte == 0xF7))
-    {
-      /* read event size */
-      for (k = 0; k < 4; k++)
-      {
-        if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-          return 1;
+        /* each copy becomes a call, and the body gets a return */
+        bytes = sum_size[windows[k].start + len] - sum_size[windows[k].start];
 
-        if (k == 0)
-          event_size = buf[0] & 0x7F;
-        else
-          event_size = (event_size << 7) | (buf[0] & 0x7F);
+        saving = (long) num_cands * bytes - 
+                 ((long) num_cands * 3 + bytes + 1 + ((num_subs == 0) ? 1 : 0));
 
-        if (!(buf[0] & 0x80))
-          break;
-      }
+        if (saving <= 0)
+          continue;
 
-      /* skip sysex event */
-      for (k = 0; k < event_size; k++)
-      {
-        if (fread(buf, sizeof(unsigned char), 1, S_midi_import_fp) < 1)
-          return 1;
-      }
+        len_alive[li] = 1;
 
-      /* reset running status */
-      status_byte = 0x00;
+        if (saving > best_saving)
+        {
+          best_saving = saving;
+          best_len = len;
+          num_best = num_cands;
 
-      message_type = 0;
-      message_channel = 0;
-    }
-    /* midi voice events */
-    else if ((status_byte >= 0x80) && (status_byte <= 0xEF))
-    {
-      /* determine sequencer code */
-      if (message_type == 0x08)       /* note off */
-        seq_code = 0x08;
-      else if (message_type == 0x09)  /* note on */
-        seq_code = 0x06;
-      else if (message_type == 0x0A)  /* aftertouch */
-        seq_code = 0x00;
-      else if (message_type == 0x0B)  /* controller change */
-      {
-        if (buf[0] == 1)              /* mod wheel */
-          seq_code = 0x0B;
-        else if (buf[0] == 7)         /* set volume */
-          seq_code = 0x04;
-        else if (buf[0] == 10)        /* set panning */
-          seq_code = 0x05;
-        else if (buf[0] == 65)        /* portamento switch */
-          seq_code = 0x0C;
-        else if (buf[0] == 69)        /* sustain pedal */
-          seq_code = 0x0D;
-        else
-          seq_code = 0x00;
+          for (n = 0; n < num_cands; n++)
+            best_starts[n] = cand_starts[n];
+        }
       }
-      else if (message_type == 0x0C)  /* program change */
-        seq_code = 0x03;
-      else if (message_type == 0x0D)  /* channel pressure */
-        seq_code = 0x0A;
-      else if (message_type == 0x0E)  /* pitch wheel */
-        seq_code = 0x09;
-      else
-        seq_code = 0x00;
+    }
 
-      /* skip unsupported controllers, etc */
-      if (seq_code == 0x00)
-        continue;
+    if (best_saving <= 0)
+      break;
 
-      seq_code |= (message_channel << 4) & 0xF0;
+    /* copy the body */
+    sub_first[num_subs] = sub_total;
+    sub_count[num_subs] = best_len;
 
-      if ((seq_code & 0x0F) == 0x06)
-      {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = seq_code;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = buf[0];
-        S_midi_track_data[S_midi_track_num_bytes + 2] = buf[1];
-        S_midi_track_num_bytes += 3;
-      }
-      else if ( ((seq_code & 0x0F) == 0x04) || 
-                ((seq_code & 0x0F) == 0x05) || 
-                ((seq_code & 0x0F) == 0x0B) || 
-                ((seq_code & 0x0F) == 0x0C) || 
-                ((seq_code & 0x0F) == 0x0D))
+    for (k = 0; k < best_len; k++)
+    {
+      sub_pos[sub_total] = tok_pos[best_starts[0] + k];
+      sub_size[sub_total] = tok_size[best_starts[0] + k];
+      sub_total += 1;
+    }
+
+    /* replace each copy with a call */
+    n = 0;
+    m = 0;
+
+    for (k = 0; k < num_tokens; )
+    {
+      if ((n < num_best) && (k == best_starts[n]))
       {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = seq_code;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = buf[1];
-        S_midi_track_num_bytes += 2;
+        tok_pos[m] = 0;
+        tok_size[m] = 3;
+        tok_sub[m] = num_subs;
+        tok_hash[m] = 0;
+
+        k += best_len;
+        n += 1;
       }
       else
       {
-        S_midi_track_data[S_midi_track_num_bytes + 0] = seq_code;
-        S_midi_track_data[S_midi_track_num_bytes + 1] = buf[0];
-        S_midi_track_num_bytes += 2;
+        tok_pos[m] = tok_pos[k];
+        tok_size[m] = tok_size[k];
+        tok_sub[m] = tok_sub[k];
+        tok_hash[m] = tok_hash[k];
+
+        k += 1;
       }
+
+      m += 1;
+    }
+
+    num_tokens = m;
+    num_subs += 1;
+  }
+
+  /* leave the stream alone if nothing repeats */
+  if (num_subs == 0)
+    goto ok;
+
+  /* the subroutines go after the main stream and an end command */
+  size = 0;
+
+  for (k = 0; k < num_tokens; k++)
+    size += tok_size[k];
+
+  size += 1;
+
+  for (k = 0; k < num_subs; k++)
+  {
+    sub_addr[k] = size;
+
+    for (m = 0; m < sub_count[k]; m++)
+      size += sub_size[sub_first[k] + m];
+
+    size += 1;
+  }
+
+  if (size > APU_MAX_SONG_SIZE)
+    goto nope;
+
+  /* write out the new stream */
+  old_num_bytes = ctx->combined_num_bytes;
+  ctx->combined_start = ctx->arena_num_bytes;
+
+  for (k = 0; k < num_tokens; k++)
+  {
+    if (tok_sub[k] >= 0)
+    {
+      buf[0] = APU_SEQ_SYS_CALL;
+      buf[1] = sub_addr[tok_sub[k]] & 0xFF;
+      buf[2] = (sub_addr[tok_sub[k]] >> 8) & 0xFF;
     }
     else
     {
-      printf("Unknown MIDI Message.\n");
-      return 1;
+      for (m = 0; m < tok_size[k]; m++)
+        buf[m] = ctx->arena_data[tok_pos[k] + m];
+    }
+
+    if (midi_emit_command(ctx, buf, tok_size[k]))
+      goto nope;
+  }
+
+  buf[0] = APU_SEQ_SYS_END;
+
+  if (midi_emit_command(ctx, buf, 1))
+    goto nope;
+
+  for (k = 0; k < num_subs; k++)
+  {
+    for (m = sub_first[k]; m < sub_first[k] + sub_count[k]; m++)
+    {
+      for (n = 0; n < sub_size[m]; n++)
+        buf[n] = ctx->arena_data[sub_pos[m] + n];
+
+      if (midi_emit_command(ctx, buf, sub_size[m]))
+        goto nope;
     }
+
+    buf[0] = APU_SEQ_SYS_RETURN;
+
+    if (midi_emit_command(ctx, buf, 1))
+      goto nope;
   }
 
+  ctx->combined_num_bytes = ctx->arena_num_bytes - ctx->combined_start;
+
+  /* testing */
+  printf("Factored Size: %d -> %d (%d subroutines)\n", 
+          old_num_bytes, ctx->combined_num_bytes, num_subs);
+
+  goto ok;
+
+nope:
+  free(tok_pos);
+  free(tok_size);
+  free(tok_sub);
+  free(tok_hash);
+  free(sum_hash);
+  free(sum_size);
+  free(sum_bad);
+  free(sub_pos);
+  free(sub_size);
+  free(windows);
+  free(cand_starts);
+  free(best_starts);
+  return 1;
+
+ok:
+  free(tok_pos);
+  free(tok_size);
+  free(tok_sub);
+  free(tok_hash);
+  free(sum_hash);
+  free(sum_size);
+  free(sum_bad);
+  free(sub_pos);
+  free(sub_size);
+  free(windows);
+  free(cand_starts);
+  free(best_starts);
   return 0;
 }
 
 /******************************************************************************/
 /* midi_import_file()                                                         */
 /******************************************************************************/
-int midi_import_file(char* filename)
+int midi_import_file(midi_context* ctx, char* filename)
 {
   unsigned int k;
 
-  /* make sure filename is valid */
+  int         fd;
+  struct stat st;
+
+  /* make sure the parameters are valid */
+  if (ctx == NULL)
+    return 1;
+
   if (filename == NULL)
     return 1;
 
-  /* open file */
-  S_midi_import_fp = fopen(filename, "rb");
+  /* open and map file */
+  fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return 1;
+
+  if ((fstat(fd, &st) < 0) || (st.st_size <= 0) || (st.st_size > 0x7FFFFFFF))
+  {
+    close(fd);
+    return 1;
+  }
+
+  ctx->file_size = (unsigned int) st.st_size;
+  ctx->file_data = mmap(NULL, ctx->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  /* the mapping stays valid after the file is closed */
+  close(fd);
 
-  if (S_midi_import_fp == NULL)
+  if (ctx->file_data == MAP_FAILED)
+  {
+    ctx->file_data = NULL;
     return 1;
+  }
 
-  /* initialize combined data (all tracks) */
-  for (k = 0; k < MIDI_TRACK_SIZE; k++)
-    S_midi_combined_data[k] = 0x00;
+  ctx->cursor_pos = 0;
+  ctx->cursor_end = ctx->file_size;
 
-  S_midi_combined_num_bytes = 0;
+  /* start from an empty arena */
+  midi_context_reset(ctx);
 
   /* start parsing the file */
-  if (midi_parse_header())
+  if (midi_parse_header(ctx))
     goto nope;
 
-  for (k = 0; k < S_midi_num_tracks; k++)
+  for (k = 0; k < ctx->num_tracks; k++)
   {
-    /* initialize track data */
-    for (k = 0; k < MIDI_TRACK_SIZE; k++)
-      S_midi_track_data[k] = 0x00;
-
-    S_midi_track_num_bytes = 0;
+    /* each track's data goes after the previous one's */
+    ctx->track_start[k] = ctx->arena_num_bytes;
 
     /* parse track */
-    if (midi_parse_track())
+    if (midi_parse_track(ctx))
       goto nope;
 
-    /* consolidate tracks */
-    /* ... */
+    ctx->track_num_bytes[k] = ctx->arena_num_bytes - ctx->track_start[k];
 
     /* testing */
-    printf("Track Size: %d\n", S_midi_track_num_bytes);
+    printf("Track Size: %d\n", ctx->track_num_bytes[k]);
   }
 
-  /* close file */
-  fclose(S_midi_import_fp);
+  /* consolidate tracks */
+  if (midi_merge_tracks(ctx))
+    goto nope;
+
+  if (midi_resolve_loops(ctx))
+    goto nope;
+
+  /* testing */
+  printf("Combined Size: %d\n", ctx->combined_num_bytes);
+
+  /* unmap file */
+  munmap(ctx->file_data, ctx->file_size);
+  ctx->file_data = NULL;
 
   goto ok;
 
 nope:
   printf("Error parsing MIDI file...\n");
-  fclose(S_midi_import_fp);
+  munmap(ctx->file_data, ctx->file_size);
+  ctx->file_data = NULL;
   return 1;
 
 ok:
   return 0;
 }
-
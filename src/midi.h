@@ -5,8 +5,57 @@
 #ifndef MIDI_H
 #define MIDI_H
 
+#define MIDI_MAX_TRACKS 16
+
+/* importer state. the converted sequencer data for each track */
+/* (and for all tracks combined) is stored in a growable arena */
+/* that is reused from file to file. a context can only be     */
+/* used by one thread at a time, but each thread can have one. */
+typedef struct midi_context
+{
+  /* mapped file, parsing cursor */
+  unsigned char*  file_data;
+  unsigned int    file_size;
+  unsigned int    cursor_pos;
+  unsigned int    cursor_end;
+
+  /* header */
+  unsigned short  format;
+  unsigned short  num_tracks;
+  unsigned short  ppqn;
+
+  /* converted data */
+  unsigned char*  arena_data;
+  unsigned int    arena_num_bytes;
+  unsigned int    arena_capacity;
+
+  unsigned int    track_start[MIDI_MAX_TRACKS];
+  unsigned int    track_num_bytes[MIDI_MAX_TRACKS];
+
+  unsigned int    combined_start;
+  unsigned int    combined_num_bytes;
+} midi_context;
+
+/* incremental decoder for live midi streams (keeps the running status) */
+typedef struct midi_decoder
+{
+  unsigned char   status_byte;
+  unsigned int    num_data_bytes;
+  unsigned int    data_count;
+  unsigned char   data[2];
+} midi_decoder;
+
 /* function declarations */
-int midi_import_file(char* filename);
+int midi_context_init(midi_context* ctx);
+int midi_context_reset(midi_context* ctx);
+int midi_context_deinit(midi_context* ctx);
 
-#endif
+int midi_import_file(midi_context* ctx, char* filename);
+int midi_optimize(midi_context* ctx, unsigned short channel_mask);
+int midi_factor_subroutines(midi_context* ctx);
 
+int           midi_decoder_reset(midi_decoder* dec);
+unsigned int  midi_decode_byte( midi_decoder* dec, unsigned char byte, 
+                                unsigned char* cmd);
+
+#endif
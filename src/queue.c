@@ -0,0 +1,259 @@
+/******************************************************************************/
+/* queue.c (chip command queue)                                               */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+#include "apu.h"
+
+/* bounded queue size (must be a power of 2) */
+#define QUEUE_SIZE  1024
+#define QUEUE_MASK  (QUEUE_SIZE - 1)
+
+/* commands waiting for their time to come (render thread only) */
+#define QUEUE_MAX_PENDING 256
+
+/* bounded lock free queue (after dmitry vyukov's). any thread can  */
+/* push: it claims a cell by moving the enqueue position with a     */
+/* compare and swap, then publishes it with the cell's sequence.    */
+/* only the render thread pops, so its position is a plain variable */
+typedef struct queue_cell
+{
+  unsigned long   sequence;
+  queue_command   cmd;
+} queue_cell;
+
+static queue_cell     S_queue_cells[QUEUE_SIZE];
+static unsigned long  S_queue_enqueue_pos;
+static unsigned long  S_queue_dequeue_pos;
+
+/* pending commands, sorted by time */
+static queue_command  S_queue_pending[QUEUE_MAX_PENDING];
+static unsigned int   S_queue_num_pending;
+
+/* number of commands that were applied after their time */
+static unsigned int   S_queue_late_count;
+
+/******************************************************************************/
+/* queue_init()                                                               */
+/******************************************************************************/
+int queue_init()
+{
+  unsigned long k;
+
+  for (k = 0; k < QUEUE_SIZE; k++)
+    __atomic_store_n(&S_queue_cells[k].sequence, k, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&S_queue_enqueue_pos, 0, __ATOMIC_RELAXED);
+  S_queue_dequeue_pos = 0;
+
+  S_queue_num_pending = 0;
+
+  __atomic_store_n(&S_queue_late_count, 0, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* queue_push()                                                               */
+/******************************************************************************/
+int queue_push(queue_command* cmd)
+{
+  queue_cell*   cell;
+  unsigned long pos;
+  unsigned long seq;
+  long          diff;
+
+  if (cmd == NULL)
+    return 1;
+
+  pos = __atomic_load_n(&S_queue_enqueue_pos, __ATOMIC_RELAXED);
+
+  while (1)
+  {
+    cell = &S_queue_cells[pos & QUEUE_MASK];
+    seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    diff = (long) (seq - pos);
+
+    /* the cell is free: try to claim it */
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n(&S_queue_enqueue_pos, &pos, pos + 1, 
+                                      1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        break;
+      }
+    }
+    /* the cell hasn't been popped yet, so the queue is full */
+    else if (diff < 0)
+      return 1;
+    /* another thread got here first */
+    else
+      pos = __atomic_load_n(&S_queue_enqueue_pos, __ATOMIC_RELAXED);
+  }
+
+  cell->cmd = *cmd;
+
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* queue_pop()                                                                */
+/******************************************************************************/
+int queue_pop(queue_command* cmd)
+{
+  queue_cell*   cell;
+  unsigned long pos;
+  unsigned long seq;
+
+  if (cmd == NULL)
+    return 1;
+
+  pos = S_queue_dequeue_pos;
+  cell = &S_queue_cells[pos & QUEUE_MASK];
+  seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+
+  /* nothing has been published here yet */
+  if ((long) (seq - (pos + 1)) < 0)
+    return 1;
+
+  *cmd = cell->cmd;
+
+  /* hand the cell back for the next lap around the queue */
+  __atomic_store_n(&cell->sequence, pos + QUEUE_SIZE, __ATOMIC_RELEASE);
+
+  S_queue_dequeue_pos = pos + 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* queue_fetch()                                                              */
+/******************************************************************************/
+int queue_fetch()
+{
+  unsigned int  k;
+  queue_command cmd;
+
+  /* move new commands into the pending list. commands with the */
+  /* same time stay in the order they were pushed. if the list  */
+  /* is full, the rest wait in the queue until the next block   */
+  while (S_queue_num_pending < QUEUE_MAX_PENDING)
+  {
+    if (queue_pop(&cmd))
+      break;
+
+    for (k = S_queue_num_pending; k > 0; k--)
+    {
+      if (S_queue_pending[k - 1].time <= cmd.time)
+        break;
+
+      S_queue_pending[k] = S_queue_pending[k - 1];
+    }
+
+    S_queue_pending[k] = cmd;
+    S_queue_num_pending += 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* queue_next_time()                                                          */
+/******************************************************************************/
+unsigned long queue_next_time()
+{
+  if (S_queue_num_pending == 0)
+    return (unsigned long) -1;
+
+  return S_queue_pending[0].time;
+}
+
+/******************************************************************************/
+/* queue_apply_command()                                                      */
+/******************************************************************************/
+int queue_apply_command(queue_command* cmd)
+{
+  switch (cmd->type)
+  {
+    case QUEUE_CMD_NOTE_ON:
+      return apu_voice_command( cmd->voice, APU_SEQ_CMD_NOTE_ON, 
+                                cmd->data_1, cmd->data_2);
+
+    case QUEUE_CMD_NOTE_OFF:
+      return apu_voice_command( cmd->voice, APU_SEQ_CMD_NOTE_OFF, 
+                                cmd->data_1, 0);
+
+    case QUEUE_CMD_PATCH:
+      return apu_voice_command( cmd->voice, APU_SEQ_CMD_PROGRAM, 
+                                cmd->data_1, 0);
+
+    case QUEUE_CMD_VOLUME:
+      return apu_voice_command( cmd->voice, APU_SEQ_CMD_VOLUME, 
+                                cmd->data_1, 0);
+
+    case QUEUE_CMD_PANNING:
+      return apu_voice_command( cmd->voice, APU_SEQ_CMD_PANNING, 
+                                cmd->data_1, 0);
+
+    case QUEUE_CMD_SFX_START:
+      return apu_play_song(APU_SEQ_TRACK_SFX, cmd->data_1);
+
+    case QUEUE_CMD_SFX_STOP:
+      return apu_stop_song(APU_SEQ_TRACK_SFX);
+
+    case QUEUE_CMD_SAMPLE:
+      return apu_play_sample(cmd->voice, cmd->data_1, cmd->data_2);
+
+    case QUEUE_CMD_CHANNEL:
+      return apu_seq_channel_command( APU_SEQ_TRACK_MUSIC, cmd->voice, 
+                                      cmd->data_1, cmd->data_2);
+
+    default:
+      return 1;
+  }
+}
+
+/******************************************************************************/
+/* queue_apply_due()                                                          */
+/******************************************************************************/
+int queue_apply_due(unsigned long time)
+{
+  unsigned int k;
+  unsigned int num_due;
+
+  /* apply the commands whose time has come */
+  for (num_due = 0; num_due < S_queue_num_pending; num_due++)
+  {
+    if (S_queue_pending[num_due].time > time)
+      break;
+
+    if (S_queue_pending[num_due].time < time)
+      __atomic_add_fetch(&S_queue_late_count, 1, __ATOMIC_RELAXED);
+
+    queue_apply_command(&S_queue_pending[num_due]);
+  }
+
+  if (num_due == 0)
+    return 0;
+
+  for (k = num_due; k < S_queue_num_pending; k++)
+    S_queue_pending[k - num_due] = S_queue_pending[k];
+
+  S_queue_num_pending -= num_due;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* queue_get_late_count()                                                     */
+/******************************************************************************/
+unsigned int queue_get_late_count()
+{
+  return __atomic_load_n(&S_queue_late_count, __ATOMIC_RELAXED);
+}
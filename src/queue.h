@@ -0,0 +1,45 @@
+/******************************************************************************/
+/* queue.h (chip command queue)                                               */
+/******************************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/* command types */
+enum
+{
+  QUEUE_CMD_NOTE_ON = 0,  /* voice, note, velocity */
+  QUEUE_CMD_NOTE_OFF,     /* voice, note           */
+  QUEUE_CMD_PATCH,        /* voice, patch          */
+  QUEUE_CMD_VOLUME,       /* voice, volume         */
+  QUEUE_CMD_PANNING,      /* voice, panning        */
+  QUEUE_CMD_SFX_START,    /* song                  */
+  QUEUE_CMD_SFX_STOP,     /* (nothing)             */
+  QUEUE_CMD_SAMPLE,       /* pcm voice, sample, velocity */
+  QUEUE_CMD_CHANNEL       /* sequencer code, data bytes (music track) */
+};
+
+/* a command, and the output sample that it should happen on */
+/* (anything already in the past happens as soon as it can)  */
+typedef struct queue_command
+{
+  unsigned long   time;
+  unsigned char   type;
+  unsigned char   voice;
+  unsigned char   data_1;
+  unsigned char   data_2;
+} queue_command;
+
+/* function declarations */
+int queue_init();
+
+int queue_push(queue_command* cmd);
+int queue_pop(queue_command* cmd);
+
+int           queue_fetch();
+unsigned long queue_next_time();
+int           queue_apply_due(unsigned long time);
+
+unsigned int  queue_get_late_count();
+
+#endif
@@ -2,53 +2,131 @@
 /* wav.c (wave file import and export)                                        */
 /******************************************************************************/
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef WAV_PROFILE
+#include <time.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "wav.h"
 
+#include "apu.h"
+
 #define WAV_AUDIO_FORMAT     1
 #define WAV_NUM_CHANNELS     1
 #define WAV_BIT_RESOLUTION  16
 #define WAV_SAMPLE_SIZE     (WAV_NUM_CHANNELS * (WAV_BIT_RESOLUTION / 8))
 
+#define WAV_HEADER_SIZE     44
+
+/* streamed wave files have unknown length, so the */
+/* sizes are set to the maximum (as sox/ffmpeg do) */
+#define WAV_STREAM_DATA_SIZE 0xFFFFFFFF
+
+/* import formats */
+#define WAV_FORMAT_PCM        0x0001
+#define WAV_FORMAT_FLOAT      0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+#define WAV_IMPORT_MAX_CHANNELS 8
+
+/* the source is read this many frames at a time */
+#define WAV_IMPORT_CHUNK_FRAMES 1024
+
+/* resampler (windowed sinc, kernel table interpolated between phases) */
+#define WAV_RS_ZERO_CROSSINGS   16
+#define WAV_RS_PHASES           256
+#define WAV_RS_KERNEL_SIZE      (WAV_RS_ZERO_CROSSINGS * WAV_RS_PHASES + 1)
+
+#define WAV_RS_HISTORY_SIZE     2048  /* power of 2 */
+#define WAV_RS_HISTORY_MASK     (WAV_RS_HISTORY_SIZE - 1)
+
+/* the importer downsamples by at most this much */
+#define WAV_RS_MAX_RATIO        ((WAV_RS_HISTORY_SIZE / 2) / \
+                                 (2 * WAV_RS_ZERO_CROSSINGS))
+
+#define WAV_PI 3.14159265358979323846
+
+static unsigned int S_wav_pcm_rates[APU_NUM_PCM_RATES] = 
+  { 8287, 8363, 11025, 22050 };
+
 static FILE* S_wav_export_fp;
 
+static int           S_wav_stream_fd = -1;
+static int           S_wav_stream_format;
+static off_t         S_wav_stream_start;
+static unsigned long S_wav_stream_num_bytes;
+
+static int            S_wav_mmap_fd;
+static unsigned char* S_wav_mmap_base;
+static size_t         S_wav_mmap_size;
+static unsigned int   S_wav_mmap_max_samples;
+static unsigned int   S_wav_mmap_num_samples;
+
+/* the counters are added to from whichever thread is writing */
+#ifdef WAV_PROFILE
+static unsigned long S_wav_profile_bytes_written;
+static unsigned long S_wav_profile_stall_ns;
+static unsigned long S_wav_profile_num_stalls;
+
+#define WAV_PROFILE_ADD(counter, amount)                                       \
+  __atomic_fetch_add(&S_wav_profile_##counter, (amount), __ATOMIC_RELAXED)
+#else
+#define WAV_PROFILE_ADD(counter, amount)
+#endif
+
+#ifdef WAV_PROFILE
 /******************************************************************************/
-/* wav_export_open_file()                                                     */
+/* wav_profile_time_ns()                                                      */
 /******************************************************************************/
-int wav_export_open_file(char* filename)
+unsigned long wav_profile_time_ns()
 {
-  /* make sure filename is valid */
-  if (filename == NULL)
-    return 1;
-
-  /* open file */
-  S_wav_export_fp = fopen(filename, "w+b");
+  struct timespec ts;
 
-  if (S_wav_export_fp == NULL)
-    return 1;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-  return 0;
+  return (unsigned long) ts.tv_sec * 1000000000UL + ts.tv_nsec;
 }
 
 /******************************************************************************/
-/* wav_export_close_file()                                                    */
+/* wav_profile_get()                                                          */
 /******************************************************************************/
-int wav_export_close_file()
+int wav_profile_get(wav_profile* prof)
 {
-  /* close file */
-  fclose(S_wav_export_fp);
+  if (prof == NULL)
+    return 1;
+
+  prof->bytes_written = 
+    __atomic_load_n(&S_wav_profile_bytes_written, __ATOMIC_RELAXED);
+  prof->stall_ns = 
+    __atomic_load_n(&S_wav_profile_stall_ns, __ATOMIC_RELAXED);
+  prof->num_stalls = 
+    __atomic_load_n(&S_wav_profile_num_stalls, __ATOMIC_RELAXED);
 
   return 0;
 }
+#endif
 
 /******************************************************************************/
-/* wav_export_write_header()                                                  */
+/* wav_fill_header()                                                          */
 /******************************************************************************/
-int wav_export_write_header()
+int wav_fill_header(unsigned char* header, unsigned int data_subchunk_size)
 {
-  char id_field[4];
+  unsigned int m;
 
   unsigned short audio_format;
   unsigned short num_channels;
@@ -59,85 +137,114 @@ int wav_export_write_header()
 
   unsigned int  chunk_size;
   unsigned int  header_subchunk_size;
-  unsigned int  data_subchunk_size;
 
   /* set and compute values */
   audio_format = WAV_AUDIO_FORMAT;
   num_channels = WAV_NUM_CHANNELS;
-  sampling_rate = 24000; /* this is set in apu.h */
+  sampling_rate = apu_get_output_rate();
   bit_resolution = WAV_BIT_RESOLUTION;
   sample_size = WAV_SAMPLE_SIZE;
   byte_rate = sampling_rate * WAV_SAMPLE_SIZE;
 
   header_subchunk_size = 16;
-  data_subchunk_size = 0;
-  chunk_size = 4 + (8 + header_subchunk_size) + (8 + data_subchunk_size);
 
-  /* write 'RIFF' */
-  id_field[0] = 'R';
-  id_field[1] = 'I';
-  id_field[2] = 'F';
-  id_field[3] = 'F';
+  if (data_subchunk_size == WAV_STREAM_DATA_SIZE)
+    chunk_size = WAV_STREAM_DATA_SIZE;
+  else
+    chunk_size = 4 + (8 + header_subchunk_size) + (8 + data_subchunk_size);
 
-  if (fwrite(id_field, 1, 4, S_wav_export_fp) < 4)
-    return 1;
+  /* 'RIFF', chunk size, 'WAVE' */
+  header[0] = 'R';
+  header[1] = 'I';
+  header[2] = 'F';
+  header[3] = 'F';
 
-  /* write chunk size */
-  if (fwrite(&chunk_size, 4, 1, S_wav_export_fp) < 1)
-    return 1;
+  for (m = 0; m < 4; m++)
+    header[4 + m] = (chunk_size >> (8 * m)) & 0xFF;
 
-  /* write 'WAVE' */
-  id_field[0] = 'W';
-  id_field[1] = 'A';
-  id_field[2] = 'V';
-  id_field[3] = 'E';
+  header[8]  = 'W';
+  header[9]  = 'A';
+  header[10] = 'V';
+  header[11] = 'E';
 
-  if (fwrite(id_field, 1, 4, S_wav_export_fp) < 4)
-    return 1;
+  /* 'fmt ', header subchunk size, header subchunk */
+  header[12] = 'f';
+  header[13] = 'm';
+  header[14] = 't';
+  header[15] = ' ';
 
-  /* write 'fmt ' */
-  id_field[0] = 'f';
-  id_field[1] = 'm';
-  id_field[2] = 't';
-  id_field[3] = ' ';
+  for (m = 0; m < 4; m++)
+    header[16 + m] = (header_subchunk_size >> (8 * m)) & 0xFF;
 
-  if (fwrite(id_field, 1, 4, S_wav_export_fp) < 4)
-    return 1;
+  header[20] = audio_format & 0xFF;
+  header[21] = (audio_format >> 8) & 0xFF;
 
-  /* write header subchunk size */
-  if (fwrite(&header_subchunk_size, 4, 1, S_wav_export_fp) < 1)
-    return 1;
+  header[22] = num_channels & 0xFF;
+  header[23] = (num_channels >> 8) & 0xFF;
 
-  /* write header subchunk */
-  if (fwrite(&audio_format, 2, 1, S_wav_export_fp) < 1)
-    return 1;
+  for (m = 0; m < 4; m++)
+    header[24 + m] = (sampling_rate >> (8 * m)) & 0xFF;
 
-  if (fwrite(&num_channels, 2, 1, S_wav_export_fp) < 1)
-    return 1;
+  for (m = 0; m < 4; m++)
+    header[28 + m] = (byte_rate >> (8 * m)) & 0xFF;
 
-  if (fwrite(&sampling_rate, 4, 1, S_wav_export_fp) < 1)
-    return 1;
+  header[32] = sample_size & 0xFF;
+  header[33] = (sample_size >> 8) & 0xFF;
 
-  if (fwrite(&byte_rate, 4, 1, S_wav_export_fp) < 1)
-    return 1;
+  header[34] = bit_resolution & 0xFF;
+  header[35] = (bit_resolution >> 8) & 0xFF;
 
-  if (fwrite(&sample_size, 2, 1, S_wav_export_fp) < 1)
-    return 1;
+  /* 'data', data subchunk size */
+  header[36] = 'd';
+  header[37] = 'a';
+  header[38] = 't';
+  header[39] = 'a';
+
+  for (m = 0; m < 4; m++)
+    header[40 + m] = (data_subchunk_size >> (8 * m)) & 0xFF;
 
-  if (fwrite(&bit_resolution, 2, 1, S_wav_export_fp) < 1)
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_export_open_file()                                                     */
+/******************************************************************************/
+int wav_export_open_file(char* filename)
+{
+  /* make sure filename is valid */
+  if (filename == NULL)
     return 1;
 
-  /* write 'data' */
-  id_field[0] = 'd';
-  id_field[1] = 'a';
-  id_field[2] = 't';
-  id_field[3] = 'a';
+  /* open file */
+  S_wav_export_fp = fopen(filename, "w+b");
 
-  if (fwrite(id_field, 1, 4, S_wav_export_fp) < 4)
+  if (S_wav_export_fp == NULL)
     return 1;
 
-  /* write data subchunk size */
-  if (fwrite(&data_subchunk_size, 4, 1, S_wav_export_fp) < 1)
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_export_close_file()                                                    */
+/******************************************************************************/
+int wav_export_close_file()
+{
+  /* close file */
+  fclose(S_wav_export_fp);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_export_write_header()                                                  */
+/******************************************************************************/
+int wav_export_write_header()
+{
+  unsigned char header[WAV_HEADER_SIZE];
+
+  wav_fill_header(header, 0);
+
+  if (fwrite(header, 1, WAV_HEADER_SIZE, S_wav_export_fp) < WAV_HEADER_SIZE)
     return 1;
 
   return 0;
@@ -190,6 +297,744 @@ int wav_export_write_block(short* sample_buf, unsigned int num_samples)
   if (fwrite(sample_buf, 2, num_samples, S_wav_export_fp) < num_samples)
     return 1;
 
+  WAV_PROFILE_ADD(bytes_written, num_samples * WAV_SAMPLE_SIZE);
+
+  return 0;
+}
+
+
+/******************************************************************************/
+/* wav_stream_write_bytes()                                                   */
+/******************************************************************************/
+int wav_stream_write_bytes(unsigned char* buf, unsigned int num_bytes)
+{
+  ssize_t       result;
+  struct pollfd pfd;
+
+#ifdef WAV_PROFILE
+  unsigned long start;
+#endif
+
+  while (num_bytes > 0)
+  {
+    result = write(S_wav_stream_fd, buf, num_bytes);
+
+    if (result > 0)
+    {
+      WAV_PROFILE_ADD(bytes_written, result);
+
+      buf += result;
+      num_bytes -= result;
+      continue;
+    }
+
+    if ((result < 0) && (errno == EINTR))
+      continue;
+
+    /* if the reader is behind (non-blocking pipe or socket), */
+    /* wait until it drains before writing the rest           */
+    if ((result < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+    {
+      pfd.fd = S_wav_stream_fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+
+#ifdef WAV_PROFILE
+      start = wav_profile_time_ns();
+#endif
+
+      result = poll(&pfd, 1, -1);
+
+      /* only the wait itself counts as a stall */
+      WAV_PROFILE_ADD(num_stalls, 1);
+      WAV_PROFILE_ADD(stall_ns, wav_profile_time_ns() - start);
+
+      if ((result < 0) && (errno != EINTR))
+        return 1;
+
+      if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return 1;
+
+      continue;
+    }
+
+    /* reader went away, or some other error */
+    return 1;
+  }
+
   return 0;
 }
 
+/******************************************************************************/
+/* wav_stream_open_fd()                                                       */
+/******************************************************************************/
+int wav_stream_open_fd(int fd, int format)
+{
+  unsigned char header[WAV_HEADER_SIZE];
+
+  /* make sure the parameters are valid */
+  if (fd < 0)
+    return 1;
+
+  if ((format != WAV_STREAM_FORMAT_RAW) && (format != WAV_STREAM_FORMAT_WAV))
+    return 1;
+
+  S_wav_stream_fd = fd;
+  S_wav_stream_format = format;
+  S_wav_stream_num_bytes = 0;
+
+  /* this is -1 for pipes and sockets, which can't be seeked */
+  S_wav_stream_start = lseek(fd, 0, SEEK_CUR);
+
+  /* the header is written up front, since we can't seek back later */
+  if (S_wav_stream_format == WAV_STREAM_FORMAT_WAV)
+  {
+    wav_fill_header(header, WAV_STREAM_DATA_SIZE);
+
+    if (wav_stream_write_bytes(header, WAV_HEADER_SIZE))
+      return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_stream_close()                                                         */
+/******************************************************************************/
+int wav_stream_close()
+{
+  unsigned char header[WAV_HEADER_SIZE];
+
+  if (S_wav_stream_fd < 0)
+    return 1;
+
+  /* if the stream went to a regular file, the sizes can be */
+  /* filled in now (as long as they fit in the header)      */
+  if ((S_wav_stream_format == WAV_STREAM_FORMAT_WAV) && 
+      (S_wav_stream_start >= 0) && 
+      (S_wav_stream_num_bytes < WAV_STREAM_DATA_SIZE - WAV_HEADER_SIZE) && 
+      (lseek(S_wav_stream_fd, S_wav_stream_start, SEEK_SET) == 
+       S_wav_stream_start))
+  {
+    wav_fill_header(header, S_wav_stream_num_bytes);
+    wav_stream_write_bytes(header, WAV_HEADER_SIZE);
+  }
+
+  close(S_wav_stream_fd);
+  S_wav_stream_fd = -1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_stream_write_block()                                                   */
+/******************************************************************************/
+int wav_stream_write_block(short* sample_buf, unsigned int num_samples)
+{
+  /* check input parameters */
+  if (sample_buf == NULL)
+    return 1;
+
+  if (num_samples == 0)
+    return 1;
+
+  if (S_wav_stream_fd < 0)
+    return 1;
+
+  /* write samples */
+  if (wav_stream_write_bytes((unsigned char*) sample_buf, 
+                             num_samples * WAV_SAMPLE_SIZE))
+  {
+    return 1;
+  }
+
+  S_wav_stream_num_bytes += num_samples * WAV_SAMPLE_SIZE;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_mmap_open_file()                                                       */
+/******************************************************************************/
+int wav_mmap_open_file(char* filename, unsigned int max_samples)
+{
+  int result;
+
+  /* make sure the parameters are valid */
+  if (filename == NULL)
+    return 1;
+
+  if (max_samples == 0)
+    return 1;
+
+  /* open file */
+  S_wav_mmap_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (S_wav_mmap_fd < 0)
+    return 1;
+
+  /* preallocate the whole file, so that writing */
+  /* into the mapping can't fail on a full disk  */
+  S_wav_mmap_size = WAV_HEADER_SIZE + (size_t) max_samples * WAV_SAMPLE_SIZE;
+
+  result = posix_fallocate(S_wav_mmap_fd, 0, S_wav_mmap_size);
+
+  /* not all filesystems support this, so just set the size in that case */
+  if ((result == EINVAL) || (result == EOPNOTSUPP))
+    result = ftruncate(S_wav_mmap_fd, S_wav_mmap_size);
+
+  if (result != 0)
+    goto nope;
+
+  /* map file */
+  S_wav_mmap_base = mmap( NULL, S_wav_mmap_size, PROT_READ | PROT_WRITE, 
+                          MAP_SHARED, S_wav_mmap_fd, 0);
+
+  if (S_wav_mmap_base == MAP_FAILED)
+    goto nope;
+
+  S_wav_mmap_max_samples = max_samples;
+  S_wav_mmap_num_samples = 0;
+
+  return 0;
+
+nope:
+  close(S_wav_mmap_fd);
+  S_wav_mmap_fd = -1;
+  S_wav_mmap_base = NULL;
+  return 1;
+}
+
+/******************************************************************************/
+/* wav_mmap_close_file()                                                      */
+/******************************************************************************/
+int wav_mmap_close_file()
+{
+  int result;
+
+  if (S_wav_mmap_base == NULL)
+    return 1;
+
+  /* finalize the header now that the length is known */
+  wav_fill_header(S_wav_mmap_base, S_wav_mmap_num_samples * WAV_SAMPLE_SIZE);
+
+  result = 0;
+
+  if (munmap(S_wav_mmap_base, S_wav_mmap_size))
+    result = 1;
+
+  /* drop any of the preallocated space that went unused */
+  if (ftruncate(S_wav_mmap_fd, WAV_HEADER_SIZE + 
+                (size_t) S_wav_mmap_num_samples * WAV_SAMPLE_SIZE))
+  {
+    result = 1;
+  }
+
+  if (close(S_wav_mmap_fd))
+    result = 1;
+
+  S_wav_mmap_fd = -1;
+  S_wav_mmap_base = NULL;
+
+  return result;
+}
+
+/******************************************************************************/
+/* wav_mmap_get_block()                                                       */
+/******************************************************************************/
+short* wav_mmap_get_block(unsigned int num_samples)
+{
+  /* returns where the next num_samples samples should be */
+  /* rendered to, or NULL if they would not fit in the file */
+  if (S_wav_mmap_base == NULL)
+    return NULL;
+
+  if (num_samples > S_wav_mmap_max_samples - S_wav_mmap_num_samples)
+    return NULL;
+
+  return (short*) (S_wav_mmap_base + WAV_HEADER_SIZE) + S_wav_mmap_num_samples;
+}
+
+/******************************************************************************/
+/* wav_mmap_commit_block()                                                    */
+/******************************************************************************/
+int wav_mmap_commit_block(unsigned int num_samples)
+{
+  if (S_wav_mmap_base == NULL)
+    return 1;
+
+  if (num_samples > S_wav_mmap_max_samples - S_wav_mmap_num_samples)
+    return 1;
+
+  S_wav_mmap_num_samples += num_samples;
+
+  WAV_PROFILE_ADD(bytes_written, num_samples * WAV_SAMPLE_SIZE);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* wav_import_read_u16()                                                      */
+/******************************************************************************/
+unsigned int wav_import_read_u16(unsigned char* buf)
+{
+  return buf[0] | (buf[1] << 8);
+}
+
+/******************************************************************************/
+/* wav_import_read_u32()                                                      */
+/******************************************************************************/
+unsigned int wav_import_read_u32(unsigned char* buf)
+{
+  return  ((unsigned int) buf[0])         | ((unsigned int) buf[1] <<  8) | 
+          ((unsigned int) buf[2] << 16)   | ((unsigned int) buf[3] << 24);
+}
+
+/******************************************************************************/
+/* wav_import_decode_frame()                                                  */
+/******************************************************************************/
+double wav_import_decode_frame(unsigned char* frame, 
+                                unsigned int format, 
+                                unsigned int num_channels, 
+                                unsigned int bit_resolution)
+{
+  unsigned int  k;
+  unsigned int  bytes_per_samp;
+  unsigned int  raw;
+  long          val;
+  float         fval;
+  double        sum;
+
+  /* mix the frame down to mono, scaled to [-1, 1] */
+  bytes_per_samp = bit_resolution / 8;
+  sum = 0.0;
+
+  for (k = 0; k < num_channels; k++)
+  {
+    if (format == WAV_FORMAT_FLOAT)
+    {
+      raw = wav_import_read_u32(&frame[k * 4]);
+      memcpy(&fval, &raw, 4);
+      sum += fval;
+    }
+    else if (bit_resolution == 8)
+      sum += (frame[k] - 128) / 128.0;
+    else if (bit_resolution == 16)
+    {
+      val = (long) wav_import_read_u16(&frame[k * 2]);
+      val = (val >= 32768) ? (val - 65536) : val;
+      sum += val / 32768.0;
+    }
+    else if (bit_resolution == 24)
+    {
+      val = (long) ( frame[k * 3 + 0] | 
+                    (frame[k * 3 + 1] << 8) | 
+                    (frame[k * 3 + 2] << 16));
+      val = (val >= 8388608L) ? (val - 16777216L) : val;
+      sum += val / 8388608.0;
+    }
+    else
+    {
+      raw = wav_import_read_u32(&frame[k * bytes_per_samp]);
+      sum += ((raw >= 0x80000000) ?  -((double) (~raw) + 1.0) : 
+                                      (double) raw) / 2147483648.0;
+    }
+  }
+
+  return sum / num_channels;
+}
+
+/******************************************************************************/
+/* wav_import_encode_sample()                                                 */
+/******************************************************************************/
+unsigned char wav_import_encode_sample(double val, int flags)
+{
+  double mag;
+  int    code;
+
+  /* triangular dither, one step wide (1/128 of full scale) */
+  if (flags & WAV_IMPORT_FLAG_DITHER)
+  {
+    val += ((double) rand() / RAND_MAX - (double) rand() / RAND_MAX) / 128.0;
+  }
+
+  /* samples are sign & 7 bit magnitude, where */
+  /* the magnitude m is (2m + 1) / 255         */
+  mag = (val < 0.0) ? -val : val;
+  code = (int) floor(((255.0 * mag) - 1.0) / 2.0 + 0.5);
+
+  if (code < 0)
+    code = 0;
+  else if (code > 127)
+    code = 127;
+
+  if (val < 0.0)
+    code |= 0x80;
+
+  return (unsigned char) code;
+}
+
+/******************************************************************************/
+/* wav_import_file()                                                          */
+/******************************************************************************/
+int wav_import_file(char* filename, unsigned short samp_num, int flags)
+{
+  FILE*         fp;
+  unsigned char buf[40];
+
+  unsigned int  k;
+  unsigned int  m;
+  unsigned int  chunk_size;
+  long          data_start;
+  unsigned int  data_size;
+
+  unsigned int  format;
+  unsigned int  num_channels;
+  unsigned int  src_rate;
+  unsigned int  dst_rate;
+  unsigned int  bit_resolution;
+  unsigned int  frame_size;
+  unsigned char rate;
+
+  unsigned int  num_frames;
+  unsigned int  frames_left;
+  unsigned int  frames_read;
+  int           pass;
+
+  unsigned char*  frame_buf;
+  float*          kernel;
+  float*          history;
+  unsigned char   out_buf[WAV_IMPORT_CHUNK_FRAMES];
+  unsigned int    out_count;
+  unsigned int    total_out;
+
+  double  scale;
+  double  peak;
+  double  gain;
+  double  half_width;
+  double  val;
+  double  x;
+  double  t;
+  double  w;
+  double  frac;
+
+  unsigned long   in_count;
+  unsigned long   out_index;
+  unsigned long   pos_num;
+  unsigned long   center;
+  long            first;
+  long            last;
+  long            i;
+  int             flushing;
+  int             done;
+
+  /* make sure the parameters are valid */
+  if (filename == NULL)
+    return 1;
+
+  fp = fopen(filename, "rb");
+
+  if (fp == NULL)
+    return 1;
+
+  frame_buf = NULL;
+  kernel = NULL;
+  history = NULL;
+
+  /* riff header */
+  if (fread(buf, 1, 12, fp) < 12)
+    goto nope;
+
+  if ((buf[0] != 'R') || (buf[1] != 'I') || (buf[2] != 'F') || 
+      (buf[3] != 'F') || (buf[8] != 'W') || (buf[9] != 'A') || 
+      (buf[10] != 'V') || (buf[11] != 'E'))
+  {
+    goto nope;
+  }
+
+  /* find the format and data chunks, skipping anything else */
+  format = 0;
+  num_channels = 0;
+  src_rate = 0;
+  bit_resolution = 0;
+  data_start = -1;
+  data_size = 0;
+
+  while (fread(buf, 1, 8, fp) == 8)
+  {
+    chunk_size = wav_import_read_u32(&buf[4]);
+
+    if ((buf[0] == 'f') && (buf[1] == 'm') && 
+        (buf[2] == 't') && (buf[3] == ' '))
+    {
+      if ((chunk_size < 16) || (chunk_size > sizeof(buf)))
+        goto nope;
+
+      if (fread(buf, 1, chunk_size, fp) < chunk_size)
+        goto nope;
+
+      format = wav_import_read_u16(&buf[0]);
+      num_channels = wav_import_read_u16(&buf[2]);
+      src_rate = wav_import_read_u32(&buf[4]);
+      bit_resolution = wav_import_read_u16(&buf[14]);
+
+      /* the actual format is the start of the sub format guid */
+      if ((format == WAV_FORMAT_EXTENSIBLE) && (chunk_size >= 26))
+        format = wav_import_read_u16(&buf[24]);
+
+      if (chunk_size & 1)
+        fseek(fp, 1, SEEK_CUR);
+    }
+    else if ( (buf[0] == 'd') && (buf[1] == 'a') && 
+              (buf[2] == 't') && (buf[3] == 'a'))
+    {
+      data_start = ftell(fp);
+      data_size = chunk_size;
+      break;
+    }
+    else
+    {
+      if (fseek(fp, chunk_size + (chunk_size & 1), SEEK_CUR))
+        goto nope;
+    }
+  }
+
+  /* check the format */
+  if ((data_start < 0) || (num_channels == 0))
+    goto nope;
+
+  if (num_channels > WAV_IMPORT_MAX_CHANNELS)
+    goto nope;
+
+  if (format == WAV_FORMAT_PCM)
+  {
+    if ((bit_resolution != 8) && (bit_resolution != 16) && 
+        (bit_resolution != 24) && (bit_resolution != 32))
+    {
+      goto nope;
+    }
+  }
+  else if (format == WAV_FORMAT_FLOAT)
+  {
+    if (bit_resolution != 32)
+      goto nope;
+  }
+  else
+    goto nope;
+
+  if (src_rate == 0)
+    goto nope;
+
+  frame_size = num_channels * (bit_resolution / 8);
+  num_frames = data_size / frame_size;
+
+  /* pick the closest supported rate */
+  rate = 0;
+
+  for (k = 1; k < APU_NUM_PCM_RATES; k++)
+  {
+    if (abs((int) S_wav_pcm_rates[k] - (int) src_rate) < 
+        abs((int) S_wav_pcm_rates[rate] - (int) src_rate))
+    {
+      rate = k;
+    }
+  }
+
+  dst_rate = S_wav_pcm_rates[rate];
+
+  if (src_rate > WAV_RS_MAX_RATIO * dst_rate)
+    goto nope;
+
+  /* allocate buffers */
+  frame_buf = malloc(WAV_IMPORT_CHUNK_FRAMES * frame_size);
+  kernel = malloc(WAV_RS_KERNEL_SIZE * sizeof(float));
+  history = malloc(WAV_RS_HISTORY_SIZE * sizeof(float));
+
+  if ((frame_buf == NULL) || (kernel == NULL) || (history == NULL))
+    goto nope;
+
+  /* build the resampler kernel (blackman windowed sinc, one side). */
+  /* when downsampling, the cutoff is lowered to the new nyquist.   */
+  scale = (dst_rate < src_rate) ? ((double) dst_rate / src_rate) : 1.0;
+
+  kernel[0] = 1.0f;
+
+  for (k = 1; k < WAV_RS_KERNEL_SIZE; k++)
+  {
+    x = (double) k / WAV_RS_PHASES;
+    w = (double) k / (WAV_RS_KERNEL_SIZE - 1);
+
+    kernel[k] = (float) ((sin(WAV_PI * x) / (WAV_PI * x)) * 
+                          (0.42 + 0.5 * cos(WAV_PI * w) + 0.08 * cos(2 * WAV_PI * w)));
+  }
+
+  half_width = WAV_RS_ZERO_CROSSINGS / scale;
+
+  /* if normalizing, the 1st pass just finds the peak */
+  gain = 1.0;
+
+  for (pass = (flags & WAV_IMPORT_FLAG_NORMALIZE) ? 0 : 1; pass < 2; pass++)
+  {
+    if (fseek(fp, data_start, SEEK_SET))
+      goto nope;
+
+    if (pass == 1)
+    {
+      if (apu_sample_begin(samp_num, rate))
+        goto nope;
+    }
+
+    peak = 0.0;
+
+    for (k = 0; k < WAV_RS_HISTORY_SIZE; k++)
+      history[k] = 0.0f;
+
+    in_count = 0;
+    out_index = 0;
+    out_count = 0;
+    total_out = 0;
+    frames_left = num_frames;
+    done = 0;
+
+    while (!done)
+    {
+      /* read the next chunk of input, or pad with silence at the end */
+      if (frames_left > 0)
+      {
+        frames_read = (frames_left < WAV_IMPORT_CHUNK_FRAMES) ? 
+                        frames_left : WAV_IMPORT_CHUNK_FRAMES;
+
+        if (fread(frame_buf, frame_size, frames_read, fp) < frames_read)
+          goto nope;
+
+        frames_left -= frames_read;
+        flushing = 0;
+      }
+      else if (pass == 0)
+        break;
+      else
+      {
+        frames_read = WAV_IMPORT_CHUNK_FRAMES;
+        flushing = 1;
+      }
+
+      for (m = 0; (m < frames_read) && (!done); m++)
+      {
+        if (flushing)
+          val = 0.0;
+        else
+        {
+          val = wav_import_decode_frame(&frame_buf[m * frame_size], 
+                                        format, num_channels, bit_resolution);
+        }
+
+        if (pass == 0)
+        {
+          if (val > peak)
+            peak = val;
+          else if (-val > peak)
+            peak = -val;
+
+          continue;
+        }
+
+        history[in_count & WAV_RS_HISTORY_MASK] = (float) (val * gain);
+        in_count += 1;
+
+        /* compute the outputs whose kernels are now fully covered. */
+        /* output n is centered at input n * src_rate / dst_rate.   */
+        while (!done)
+        {
+          pos_num = out_index * src_rate;
+          center = pos_num / dst_rate;
+          frac = (double) (pos_num % dst_rate) / dst_rate;
+
+          if (center >= num_frames)
+          {
+            done = 1;
+            break;
+          }
+
+          if ((double) center + frac + half_width >= (double) in_count)
+            break;
+
+          first = (long) ceil(center + frac - half_width);
+          last = (long) floor(center + frac + half_width);
+
+          if (first < 0)
+            first = 0;
+
+          val = 0.0;
+
+          for (i = first; i <= last; i++)
+          {
+            t = ((double) i - (double) center - frac) * scale;
+            t = ((t < 0.0) ? -t : t) * WAV_RS_PHASES;
+
+            k = (unsigned int) t;
+
+            if (k >= WAV_RS_KERNEL_SIZE - 1)
+              continue;
+
+            w = kernel[k] + (kernel[k + 1] - kernel[k]) * (t - k);
+            val += history[i & WAV_RS_HISTORY_MASK] * w;
+          }
+
+          out_buf[out_count] = wav_import_encode_sample(val * scale, flags);
+          out_count += 1;
+          out_index += 1;
+
+          if (out_count == WAV_IMPORT_CHUNK_FRAMES)
+          {
+            if (apu_sample_append(out_buf, out_count))
+              goto nope;
+
+            total_out += out_count;
+            out_count = 0;
+          }
+
+          /* the nametable can't hold anything longer than this */
+          if (total_out + out_count == APU_MAX_SAMPLE_SIZE)
+          {
+            printf("Sample truncated to %d bytes.\n", APU_MAX_SAMPLE_SIZE);
+            done = 1;
+          }
+        }
+      }
+    }
+
+    if (pass == 0)
+    {
+      gain = (peak > 0.0) ? (1.0 / peak) : 1.0;
+      continue;
+    }
+
+    if ((out_count > 0) && apu_sample_append(out_buf, out_count))
+      goto nope;
+
+    total_out += out_count;
+
+    if (apu_sample_end())
+      goto nope;
+  }
+
+#if 1
+  /* testing */
+  printf("WAV Import: %d Hz -> %d Hz, %d bytes\n", src_rate, dst_rate, total_out);
+#endif
+
+  free(frame_buf);
+  free(kernel);
+  free(history);
+  fclose(fp);
+
+  return 0;
+
+nope:
+  printf("Error importing WAV file...\n");
+  free(frame_buf);
+  free(kernel);
+  free(history);
+  fclose(fp);
+  return 1;
+}
@@ -5,11 +5,48 @@
 #ifndef WAV_H
 #define WAV_H
 
+/* stream formats */
+enum
+{
+  WAV_STREAM_FORMAT_RAW = 0, 
+  WAV_STREAM_FORMAT_WAV 
+};
+
+/* import flags */
+#define WAV_IMPORT_FLAG_NORMALIZE 0x01
+#define WAV_IMPORT_FLAG_DITHER    0x02
+
+/* output counters (make PROFILE=1): the bytes written, and the waits */
+/* for a slow stream reader (how many, and the time spent in them)     */
+#ifdef WAV_PROFILE
+typedef struct wav_profile
+{
+  unsigned long bytes_written;
+  unsigned long stall_ns;
+  unsigned long num_stalls;
+} wav_profile;
+#endif
+
 /* function declarations */
 int wav_export_open_file(char* filename);
 int wav_export_close_file();
 int wav_export_write_header();
 int wav_export_write_block(short* sample_buf, unsigned int num_samples);
 
+int wav_stream_open_fd(int fd, int format);
+int wav_stream_close();
+int wav_stream_write_block(short* sample_buf, unsigned int num_samples);
+
+int     wav_mmap_open_file(char* filename, unsigned int max_samples);
+int     wav_mmap_close_file();
+short*  wav_mmap_get_block(unsigned int num_samples);
+int     wav_mmap_commit_block(unsigned int num_samples);
+
+int wav_import_file(char* filename, unsigned short samp_num, int flags);
+
+#ifdef WAV_PROFILE
+int wav_profile_get(wav_profile* prof);
+#endif
+
 #endif
 
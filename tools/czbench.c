@@ -0,0 +1,551 @@
+/******************************************************************************/
+/* gbstyle (prototype code for Felisynth) - No Shinobi Knows Me 2026          */
+/******************************************************************************/
+
+/******************************************************************************/
+/* czbench.c (render benchmarks)                                              */
+/******************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apu.h"
+
+/* each scenario is rendered a few times after a short warmup, */
+/* and the fastest run is reported (it has the least noise)    */
+#define CZBENCH_DEFAULT_SECONDS 5
+#define CZBENCH_WARMUP_SAMPLES  (APU_OUT_SAMPLING_RATE / 2)
+#define CZBENCH_NUM_RUNS        3
+#define CZBENCH_BLOCK_SIZE      240
+
+/* generated songs */
+#define CZBENCH_SONG_SIZE 4096
+
+#define CZBENCH_DRUM_SAMPLE_SIZE 8192
+
+typedef struct czbench_scenario
+{
+  char* name;
+  int   (*setup)(int param);
+  int   param;
+} czbench_scenario;
+
+#ifdef APU_PROFILE
+static char* S_czbench_stage_names[APU_NUM_STAGES] =
+  { "seq", "lfo", "env", "osc", "pcm", "syn", "out", "sample" };
+#endif
+
+static char* S_czbench_preview_names[APU_NUM_PREVIEW_MODES] =
+  { "off", "native", "half" };
+
+static unsigned short S_czbench_engine = APU_ENGINE_FAST;
+static unsigned short S_czbench_preview = APU_PREVIEW_OFF;
+
+static unsigned char  S_czbench_song[CZBENCH_SONG_SIZE];
+static unsigned int   S_czbench_song_num_bytes;
+
+/******************************************************************************/
+/* czbench_song_byte()                                                        */
+/******************************************************************************/
+int czbench_song_byte(unsigned char val)
+{
+  if (S_czbench_song_num_bytes >= CZBENCH_SONG_SIZE)
+    return 1;
+
+  S_czbench_song[S_czbench_song_num_bytes] = val;
+  S_czbench_song_num_bytes += 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_song_delay()                                                       */
+/******************************************************************************/
+int czbench_song_delay(unsigned int ticks)
+{
+  czbench_song_byte(APU_SEQ_CMD_DELAY_16);
+  czbench_song_byte(ticks & 0xFF);
+  czbench_song_byte((ticks >> 8) & 0xFF);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_play_song()                                                        */
+/******************************************************************************/
+int czbench_play_song()
+{
+  if (S_czbench_song_num_bytes >= CZBENCH_SONG_SIZE)
+    return 1;
+
+  if (apu_load_song(0, S_czbench_song, S_czbench_song_num_bytes))
+    return 1;
+
+  if (apu_play_song(APU_SEQ_TRACK_MUSIC, 0))
+    return 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_setup_idle()                                                       */
+/******************************************************************************/
+int czbench_setup_idle(int param)
+{
+  /* nothing playing: this is the floor for every other scenario */
+  (void) param;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_setup_fm()                                                         */
+/******************************************************************************/
+int czbench_setup_fm(int param)
+{
+  int m;
+
+  /* held notes on the first few fm voices, using the testing patch */
+  for (m = 0; m < param; m++)
+  {
+    apu_voice_command(m, APU_SEQ_CMD_VOLUME, 100, 0);
+    apu_voice_command(m, APU_SEQ_CMD_NOTE_ON, 48 + 5 * m, 100);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_setup_alg()                                                        */
+/******************************************************************************/
+int czbench_setup_alg(int param)
+{
+  int m;
+
+  unsigned char patch[APU_NUM_PATCH_PARAMS];
+
+  /* a full chord on patch 1, which uses the given algorithm */
+  memset(patch, 0, sizeof(patch));
+
+  patch[APU_PATCH_PARAM_SYN_FB] = 50;
+  patch[APU_PATCH_PARAM_SYN_ALG] = param;
+  patch[APU_PATCH_PARAM_ENV_AR] = 20;
+  patch[APU_PATCH_PARAM_ENV_DR] = 25;
+  patch[APU_PATCH_PARAM_ENV_SR] = 50;
+  patch[APU_PATCH_PARAM_ENV_RR] = 40;
+  patch[APU_PATCH_PARAM_ENV_SL] = 60;
+  patch[APU_PATCH_PARAM_ENV_TL] = 99;
+  patch[APU_PATCH_PARAM_LFO_SPEED] = 24;
+  patch[APU_PATCH_PARAM_VIB_SENS_DEPTH] = (1 << 3) | 7;
+
+  if (apu_load_patch(1, patch, APU_NUM_PATCH_PARAMS))
+    return 1;
+
+  for (m = 0; m < 10; m++)
+  {
+    apu_voice_command(m, APU_SEQ_CMD_PROGRAM, 1, 0);
+    apu_voice_command(m, APU_SEQ_CMD_VOLUME, 100, 0);
+    apu_voice_command(m, APU_SEQ_CMD_NOTE_ON, 48 + 5 * m, 100);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_setup_drums()                                                      */
+/******************************************************************************/
+int czbench_setup_drums(int param)
+{
+  int k;
+
+  unsigned char data[CZBENCH_DRUM_SAMPLE_SIZE];
+  unsigned long seed;
+
+  (void) param;
+
+  /* a burst of noise (the kits all start out pointing at sample 0) */
+  seed = 1;
+
+  for (k = 0; k < CZBENCH_DRUM_SAMPLE_SIZE; k++)
+  {
+    seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+    data[k] = (seed >> 16) & 0xFF;
+  }
+
+  if (apu_sample_begin(0, APU_PCM_RATE_22050))
+    return 1;
+
+  if (apu_sample_append(data, CZBENCH_DRUM_SAMPLE_SIZE))
+    return 1;
+
+  if (apu_sample_end())
+    return 1;
+
+  /* sixteenth notes at 180 bpm, 3 pieces per step so that */
+  /* all of the pcm voices are kept busy (and stolen from) */
+  S_czbench_song_num_bytes = 0;
+
+  czbench_song_byte(APU_SEQ_CMD_TEMPO);
+  czbench_song_byte(180);
+  czbench_song_byte((9 << 4) | APU_SEQ_CMD_VOLUME);
+  czbench_song_byte(127);
+  czbench_song_byte(APU_SEQ_SYS_LOOP_START);
+
+  for (k = 0; k < 16; k++)
+  {
+    czbench_song_byte((9 << 4) | APU_SEQ_CMD_NOTE_ON);
+    czbench_song_byte((k % 2) ? 38 : 36);
+    czbench_song_byte(100);
+
+    czbench_song_byte((9 << 4) | APU_SEQ_CMD_NOTE_ON);
+    czbench_song_byte((k % 4) ? 42 : 46);
+    czbench_song_byte(100);
+
+    czbench_song_byte((9 << 4) | APU_SEQ_CMD_NOTE_ON);
+    czbench_song_byte(41 + 2 * (k % 4));
+    czbench_song_byte(100);
+
+    czbench_song_delay(APU_SEQ_TICKS_PER_BEAT / 4);
+  }
+
+  czbench_song_byte(APU_SEQ_SYS_LOOP_END);
+  czbench_song_byte(0);
+  czbench_song_byte(APU_SEQ_SYS_END);
+
+  return czbench_play_song();
+}
+
+/******************************************************************************/
+/* czbench_setup_dense()                                                      */
+/******************************************************************************/
+int czbench_setup_dense(int param)
+{
+  int k;
+  int n;
+
+  (void) param;
+
+  /* every melodic channel restrikes a note each sixteenth at */
+  /* 240 bpm, which keeps the allocator stealing constantly   */
+  S_czbench_song_num_bytes = 0;
+
+  czbench_song_byte(APU_SEQ_CMD_TEMPO);
+  czbench_song_byte(240);
+
+  for (n = 0; n < 9; n++)
+  {
+    czbench_song_byte((n << 4) | APU_SEQ_CMD_VOLUME);
+    czbench_song_byte(100);
+  }
+
+  czbench_song_byte(APU_SEQ_SYS_LOOP_START);
+
+  for (k = 0; k < 8; k++)
+  {
+    for (n = 0; n < 9; n++)
+    {
+      czbench_song_byte((n << 4) | APU_SEQ_CMD_NOTE_ON);
+      czbench_song_byte(36 + 4 * n + k);
+      czbench_song_byte(64 + 7 * n);
+    }
+
+    czbench_song_delay(APU_SEQ_TICKS_PER_BEAT / 4);
+
+    for (n = 0; n < 9; n++)
+    {
+      czbench_song_byte((n << 4) | APU_SEQ_CMD_NOTE_OFF);
+      czbench_song_byte(36 + 4 * n + k);
+    }
+  }
+
+  czbench_song_byte(APU_SEQ_SYS_LOOP_END);
+  czbench_song_byte(0);
+  czbench_song_byte(APU_SEQ_SYS_END);
+
+  return czbench_play_song();
+}
+
+static czbench_scenario S_czbench_scenarios[] =
+  { { "idle",       czbench_setup_idle,   0 }, 
+    { "fm_1",       czbench_setup_fm,     1 }, 
+    { "fm_4",       czbench_setup_fm,     4 }, 
+    { "fm_10",      czbench_setup_fm,     10 }, 
+    { "alg_0",      czbench_setup_alg,    0 }, 
+    { "alg_1",      czbench_setup_alg,    1 }, 
+    { "alg_2",      czbench_setup_alg,    2 }, 
+    { "alg_3",      czbench_setup_alg,    3 }, 
+    { "alg_4",      czbench_setup_alg,    4 }, 
+    { "alg_5",      czbench_setup_alg,    5 }, 
+    { "alg_6",      czbench_setup_alg,    6 }, 
+    { "alg_7",      czbench_setup_alg,    7 }, 
+    { "pcm_drums",  czbench_setup_drums,  0 }, 
+    { "dense_midi", czbench_setup_dense,  0 }
+  };
+
+#define CZBENCH_NUM_SCENARIOS                                                  \
+  (sizeof(S_czbench_scenarios) / sizeof(S_czbench_scenarios[0]))
+
+/******************************************************************************/
+/* czbench_time_ns()                                                          */
+/******************************************************************************/
+double czbench_time_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+/******************************************************************************/
+/* czbench_render()                                                           */
+/******************************************************************************/
+int czbench_render(long num_samples)
+{
+  long n;
+  long size;
+
+  static short buf[CZBENCH_BLOCK_SIZE];
+
+  /* rendered in blocks like the player does it */
+  for (n = 0; n < num_samples; n += size)
+  {
+    size = num_samples - n;
+
+    if (size > CZBENCH_BLOCK_SIZE)
+      size = CZBENCH_BLOCK_SIZE;
+
+    apu_render(buf, (unsigned int) size, 1);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czbench_run_scenario()                                                     */
+/******************************************************************************/
+int czbench_run_scenario(czbench_scenario* sc, long num_samples, int last)
+{
+  int k;
+
+  double start;
+  double elapsed;
+  double best;
+
+#ifdef APU_PROFILE
+  apu_profile prof;
+  apu_profile best_prof;
+#endif
+
+  best = 0;
+
+  for (k = 0; k < CZBENCH_NUM_RUNS; k++)
+  {
+    /* every run starts from the same state, so they are repeatable */
+    apu_reset();
+    apu_clear_roms();
+    apu_set_quality(APU_QUALITY_FULL);
+    apu_set_engine(S_czbench_engine);
+    apu_set_preview(S_czbench_preview);
+
+    if (sc->setup(sc->param))
+      return 1;
+
+    czbench_render(CZBENCH_WARMUP_SAMPLES);
+
+#ifdef APU_PROFILE
+    apu_profile_reset();
+#endif
+
+    start = czbench_time_ns();
+
+    czbench_render(num_samples);
+
+    elapsed = czbench_time_ns() - start;
+
+    if ((k == 0) || (elapsed < best))
+    {
+      best = elapsed;
+
+#ifdef APU_PROFILE
+      apu_profile_end_block();
+      apu_profile_get(&prof);
+      best_prof = prof;
+#endif
+    }
+  }
+
+  if (best <= 0)
+    best = 1;
+
+  printf("    {\n");
+  printf("      \"name\": \"%s\",\n", sc->name);
+  printf("      \"samples\": %ld,\n", num_samples);
+  printf("      \"ns_per_sample\": %.2f,\n", best / num_samples);
+  printf("      \"realtime_factor\": %.2f", 
+         (num_samples * 1000000000.0 / apu_get_output_rate()) / best);
+
+#ifdef APU_PROFILE
+  /* stage costs are per output sample, so the scenarios compare */
+  printf(",\n      \"cycles_per_sample\": {\n");
+
+  for (k = 0; k < APU_NUM_STAGES; k++)
+  {
+    printf("        \"%s\": %.2f%s\n", S_czbench_stage_names[k], 
+           (double) best_prof.cycles[k] / best_prof.samples, 
+           (k < APU_NUM_STAGES - 1) ? "," : "");
+  }
+
+  printf("      },\n");
+  printf("      \"env_steps_per_sample\": %.2f,\n", 
+         (double) best_prof.env_steps / best_prof.samples);
+  printf("      \"fir_taps_per_sample\": %.2f,\n", 
+         (double) best_prof.fir_taps / best_prof.samples);
+  printf("      \"seq_events\": %lu\n", best_prof.seq_events);
+#else
+  printf("\n");
+#endif
+
+  printf("    }%s\n", last ? "" : ",");
+
+  return 0;
+}
+
+/******************************************************************************/
+/* main()                                                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+  unsigned int k;
+
+  char* label;
+  char* only;
+  long  seconds;
+
+  /* parse command line:                                  */
+  /*   czbench [-seconds n] [-label text] [-only scenario]  */
+  /*           [-engine name] [-preview mode] [-rate hz]   */
+  /* the results are written to stdout as json, and the    */
+  /* engine defaults to the one the player would pick.     */
+  /* in preview mode, samples are at the preview rate     */
+  label = "";
+  only = NULL;
+  seconds = CZBENCH_DEFAULT_SECONDS;
+
+  S_czbench_engine = apu_detect_engine();
+
+  for (k = 1; k < (unsigned int) argc; k++)
+  {
+    if ((!strcmp(argv[k], "-seconds")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+      seconds = strtol(argv[k], NULL, 10);
+    }
+    else if ((!strcmp(argv[k], "-label")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+      label = argv[k];
+    }
+    else if ((!strcmp(argv[k], "-only")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+      only = argv[k];
+    }
+    else if ((!strcmp(argv[k], "-engine")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+
+      for (S_czbench_engine = 0; 
+           S_czbench_engine < APU_NUM_ENGINES; 
+           S_czbench_engine++)
+      {
+        if (!strcmp(argv[k], apu_engine_name(S_czbench_engine)))
+          break;
+      }
+
+      if (!apu_engine_supported(S_czbench_engine))
+      {
+        fprintf(stderr, "Unknown or unsupported engine: %s\n", argv[k]);
+        return 1;
+      }
+    }
+    else if ((!strcmp(argv[k], "-rate")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+
+      if (apu_set_output_rate((unsigned int) atoi(argv[k])))
+      {
+        fprintf(stderr, "Unsupported output rate: %s\n", argv[k]);
+        return 1;
+      }
+    }
+    else if ((!strcmp(argv[k], "-preview")) && (k + 1 < (unsigned int) argc))
+    {
+      k += 1;
+
+      for (S_czbench_preview = 0; 
+           S_czbench_preview < APU_NUM_PREVIEW_MODES; 
+           S_czbench_preview++)
+      {
+        if (!strcmp(argv[k], S_czbench_preview_names[S_czbench_preview]))
+          break;
+      }
+
+      if (S_czbench_preview == APU_NUM_PREVIEW_MODES)
+      {
+        fprintf(stderr, "Unknown preview mode: %s\n", argv[k]);
+        return 1;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Usage: czbench [-seconds n] [-label text] ");
+      fprintf(stderr, "[-only scenario] [-engine name] [-preview mode] ");
+      fprintf(stderr, "[-rate hz]\n");
+      return 1;
+    }
+  }
+
+  if (seconds < 1)
+    seconds = 1;
+
+  apu_set_preview(S_czbench_preview);
+
+  printf("{\n");
+  printf("  \"label\": \"%s\",\n", label);
+  printf("  \"config\": \"%s\",\n", APU_CONFIG_NAME);
+  printf("  \"engine\": \"%s\",\n", apu_engine_name(S_czbench_engine));
+  printf("  \"preview\": \"%s\",\n", 
+         S_czbench_preview_names[S_czbench_preview]);
+  printf("  \"sample_rate\": %u,\n", apu_get_output_rate());
+#ifdef APU_PROFILE
+  printf("  \"profile\": true,\n");
+#else
+  printf("  \"profile\": false,\n");
+#endif
+  printf("  \"scenarios\": [\n");
+
+  for (k = 0; k < CZBENCH_NUM_SCENARIOS; k++)
+  {
+    if ((only != NULL) && strcmp(only, S_czbench_scenarios[k].name))
+      continue;
+
+    if (czbench_run_scenario( &S_czbench_scenarios[k], 
+                              seconds * apu_get_output_rate(), 
+                              (only != NULL) || 
+                              (k == CZBENCH_NUM_SCENARIOS - 1)))
+    {
+      fprintf(stderr, "Scenario %s failed\n", S_czbench_scenarios[k].name);
+      return 1;
+    }
+  }
+
+  printf("  ]\n");
+  printf("}\n");
+
+  return 0;
+}
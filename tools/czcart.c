@@ -0,0 +1,107 @@
+/******************************************************************************/
+/* gbstyle (prototype code for Felisynth) - No Shinobi Knows Me 2026          */
+/******************************************************************************/
+
+/******************************************************************************/
+/* czcart.c (cartridge image builder)                                         */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "cart.h"
+#include "midi.h"
+#include "wav.h"
+
+/******************************************************************************/
+/* main()                                                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+  int k;
+
+  char*           out_filename;
+  unsigned short  song_num;
+  unsigned short  samp_num;
+
+  midi_context    midi_ctx;
+
+  /* parse command line:                                         */
+  /*   czcart output.rom [-song file.mid]... [-sample file.wav]... */
+  /* songs and samples are numbered in the order they are given  */
+  if (argc < 2)
+  {
+    printf("Usage: czcart output.rom ");
+    printf("[-song file.mid]... [-sample file.wav]...\n");
+    return 1;
+  }
+
+  out_filename = argv[1];
+
+  /* start from all zero roms, so images are reproducible */
+  apu_reset();
+  apu_wipe_roms();
+  midi_context_init(&midi_ctx);
+
+  song_num = 0;
+  samp_num = 0;
+
+  for (k = 2; k < argc; k++)
+  {
+    if ((!strcmp(argv[k], "-song")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      if (midi_import_file(&midi_ctx, argv[k]))
+        goto nope;
+
+      if (midi_optimize(&midi_ctx, apu_seq_channel_mask(APU_SEQ_TRACK_MUSIC)))
+        goto nope;
+
+      if (midi_factor_subroutines(&midi_ctx))
+        goto nope;
+
+      if (apu_load_song(song_num, 
+                        &midi_ctx.arena_data[midi_ctx.combined_start], 
+                        midi_ctx.combined_num_bytes))
+      {
+        goto nope;
+      }
+
+      printf("Song %d: %s\n", song_num, argv[k]);
+      song_num += 1;
+    }
+    else if ((!strcmp(argv[k], "-sample")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      if (wav_import_file(argv[k], samp_num, WAV_IMPORT_FLAG_NORMALIZE))
+        goto nope;
+
+      printf("Sample %d: %s\n", samp_num, argv[k]);
+      samp_num += 1;
+    }
+    else
+    {
+      printf("Unknown option: %s\n", argv[k]);
+      goto nope;
+    }
+  }
+
+  midi_context_deinit(&midi_ctx);
+
+  if (cart_build_file(out_filename))
+  {
+    printf("Error writing cartridge image...\n");
+    return 1;
+  }
+
+  return 0;
+
+nope:
+  printf("Error loading %s\n", argv[k]);
+  midi_context_deinit(&midi_ctx);
+  return 1;
+}
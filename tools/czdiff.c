@@ -0,0 +1,589 @@
+/******************************************************************************/
+/* gbstyle (prototype code for Felisynth) - No Shinobi Knows Me 2026          */
+/******************************************************************************/
+
+/******************************************************************************/
+/* czdiff.c (engine differential checker)                                     */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "midi.h"
+
+#define CZDIFF_DEFAULT_RUNS     20
+#define CZDIFF_DEFAULT_SECONDS  2
+#define CZDIFF_DEFAULT_BLOCK    240
+
+/* fuzzed runs use a few random samples and patches */
+#define CZDIFF_NUM_SAMPLES      4
+#define CZDIFF_NUM_PATCHES      8
+#define CZDIFF_MAX_SAMPLE_SIZE  8000
+
+#define CZDIFF_NUM_FM_VOICES    APU_CONFIG_FM_VOICES
+#define CZDIFF_NUM_PCM_VOICES   APU_CONFIG_PCM_VOICES
+
+static char* S_czdiff_stage_names[APU_NUM_STAGES] =
+  { "seq", "lfo", "env", "osc", "pcm", "syn", "out", "sample" };
+
+/* commands that the fuzzer sends to voices and channels */
+static unsigned char S_czdiff_codes[] =
+  { APU_SEQ_CMD_PROGRAM, 
+    APU_SEQ_CMD_VOLUME, 
+    APU_SEQ_CMD_PANNING, 
+    APU_SEQ_CMD_PITCH_WHEEL, 
+    APU_SEQ_CMD_PRESSURE, 
+    APU_SEQ_CMD_MOD_WHEEL, 
+    APU_SEQ_CMD_PORTAMENTO, 
+    APU_SEQ_CMD_SUSTAIN
+  };
+
+#define CZDIFF_NUM_CODES (sizeof(S_czdiff_codes) / sizeof(S_czdiff_codes[0]))
+
+/* each block has a checksum for the state of every stage, */
+/* and then one for the samples it output                  */
+#define CZDIFF_NUM_SUMS (APU_NUM_STAGES + 1)
+#define CZDIFF_OUTPUT_SUM APU_NUM_STAGES
+
+/* the song to check (if there is one) */
+static unsigned char* S_czdiff_song_data;
+static unsigned int   S_czdiff_song_num_bytes;
+
+/* one run through an engine */
+typedef struct czdiff_run
+{
+  short*          samples;
+  unsigned long*  checksums;
+  unsigned int    num_blocks;
+  unsigned int    block_size;
+} czdiff_run;
+
+static unsigned long S_czdiff_rand_state;
+
+/******************************************************************************/
+/* czdiff_rand()                                                              */
+/******************************************************************************/
+unsigned int czdiff_rand(unsigned int range)
+{
+  /* a fixed generator, so runs are the same on every machine */
+  S_czdiff_rand_state =
+    (S_czdiff_rand_state * 1103515245 + 12345) & 0xFFFFFFFF;
+
+  return ((S_czdiff_rand_state >> 8) & 0xFFFFFF) % range;
+}
+
+/******************************************************************************/
+/* czdiff_checksum()                                                          */
+/******************************************************************************/
+unsigned long czdiff_checksum(unsigned long hash, short* data, unsigned int num)
+{
+  unsigned int k;
+
+  /* 32 bit fnv-1a, over the samples (low byte first) */
+  for (k = 0; k < num; k++)
+  {
+    hash ^= data[k] & 0xFF;
+    hash = (hash * 16777619) & 0xFFFFFFFF;
+    hash ^= (data[k] >> 8) & 0xFF;
+    hash = (hash * 16777619) & 0xFFFFFFFF;
+  }
+
+  return hash;
+}
+
+/******************************************************************************/
+/* czdiff_setup_fuzz()                                                        */
+/******************************************************************************/
+int czdiff_setup_fuzz()
+{
+  unsigned int k;
+  unsigned int n;
+  unsigned int num_bytes;
+
+  unsigned char data[CZDIFF_MAX_SAMPLE_SIZE];
+  unsigned char patch[APU_NUM_PATCH_PARAMS];
+
+  /* random samples, at random rates */
+  for (k = 0; k < CZDIFF_NUM_SAMPLES; k++)
+  {
+    num_bytes = 1 + czdiff_rand(CZDIFF_MAX_SAMPLE_SIZE);
+
+    for (n = 0; n < num_bytes; n++)
+      data[n] = czdiff_rand(256);
+
+    if (apu_sample_begin(k, czdiff_rand(APU_NUM_PCM_RATES)))
+      return 1;
+
+    if (apu_sample_append(data, num_bytes))
+      return 1;
+
+    if (apu_sample_end())
+      return 1;
+  }
+
+  /* random patches (the params are allowed to go out of range) */
+  for (k = 0; k < CZDIFF_NUM_PATCHES; k++)
+  {
+    for (n = 0; n < APU_NUM_PATCH_PARAMS; n++)
+      patch[n] = czdiff_rand(128);
+
+    if (apu_load_patch(k, patch, APU_NUM_PATCH_PARAMS))
+      return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czdiff_fuzz_block()                                                        */
+/******************************************************************************/
+int czdiff_fuzz_block()
+{
+  unsigned int k;
+  unsigned int n;
+  unsigned int num_events;
+
+  unsigned char code;
+  unsigned char patch[APU_NUM_PATCH_PARAMS];
+
+  /* a handful of random register writes before each block */
+  num_events = czdiff_rand(4);
+
+  for (k = 0; k < num_events; k++)
+  {
+    switch (czdiff_rand(6))
+    {
+      case 0:
+        apu_voice_command(czdiff_rand(CZDIFF_NUM_FM_VOICES), 
+                          APU_SEQ_CMD_NOTE_ON, 
+                          24 + czdiff_rand(72), czdiff_rand(128));
+        break;
+
+      case 1:
+        apu_release_note(czdiff_rand(CZDIFF_NUM_FM_VOICES));
+        break;
+
+      case 2:
+        apu_voice_command(czdiff_rand(CZDIFF_NUM_FM_VOICES), 
+                          S_czdiff_codes[czdiff_rand(CZDIFF_NUM_CODES)], 
+                          czdiff_rand(128), 0);
+        break;
+
+      case 3:
+        apu_play_sample(czdiff_rand(CZDIFF_NUM_PCM_VOICES), 
+                        czdiff_rand(CZDIFF_NUM_SAMPLES), 
+                        czdiff_rand(128));
+        break;
+
+      case 4:
+        /* channel commands go through the allocator (and the */
+        /* drum channel sets the volume of the pcm voices)    */
+        code = czdiff_rand(16) << 4;
+
+        if (czdiff_rand(2))
+          code |= APU_SEQ_CMD_NOTE_ON;
+        else
+          code |= S_czdiff_codes[czdiff_rand(CZDIFF_NUM_CODES)];
+
+        apu_seq_channel_command(APU_SEQ_TRACK_MUSIC, code, 
+                                24 + czdiff_rand(72), 1 + czdiff_rand(127));
+        break;
+
+      default:
+        /* rewrite a patch while it may be playing */
+        for (n = 0; n < APU_NUM_PATCH_PARAMS; n++)
+          patch[n] = czdiff_rand(128);
+
+        apu_load_patch(czdiff_rand(CZDIFF_NUM_PATCHES), 
+                       patch, APU_NUM_PATCH_PARAMS);
+        break;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czdiff_render()                                                            */
+/******************************************************************************/
+int czdiff_render( czdiff_run* run, unsigned short engine, 
+                   unsigned long seed, unsigned short quality)
+{
+  unsigned int  k;
+  unsigned int  n;
+
+  /* every run starts from the same state, and sees the same inputs */
+  S_czdiff_rand_state = seed;
+
+  apu_reset();
+  apu_clear_roms();
+  apu_set_quality(quality);
+  apu_set_engine(engine);
+
+  if (S_czdiff_song_data != NULL)
+  {
+    if (apu_load_song(0, S_czdiff_song_data, S_czdiff_song_num_bytes))
+      return 1;
+
+    apu_play_song(APU_SEQ_TRACK_MUSIC, 0);
+  }
+  else if (czdiff_setup_fuzz())
+    return 1;
+
+  for (k = 0; k < run->num_blocks; k++)
+  {
+    if (S_czdiff_song_data == NULL)
+      czdiff_fuzz_block();
+
+    /* rendered as it would be in the player, so the skipped */
+    /* samples and state are checked against the reference   */
+    apu_render(&run->samples[2 * k * run->block_size], run->block_size, 2);
+
+    for (n = 0; n < APU_NUM_STAGES; n++)
+      run->checksums[k * CZDIFF_NUM_SUMS + n] = apu_stage_checksum(n);
+
+    run->checksums[k * CZDIFF_NUM_SUMS + CZDIFF_OUTPUT_SUM] = 
+      czdiff_checksum(2166136261UL, 
+                      &run->samples[2 * k * run->block_size], 
+                      2 * run->block_size);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czdiff_compare()                                                           */
+/******************************************************************************/
+int czdiff_compare(czdiff_run* ref, czdiff_run* test, unsigned long seed)
+{
+  unsigned int k;
+  unsigned int n;
+  unsigned int num_samples;
+
+  int first_block;
+  int first_stage;
+  int first_sample;
+
+  /* the first block where any checksum differs, and the */
+  /* earliest stage (in pipeline order) that differs there */
+  first_block = -1;
+  first_stage = -1;
+
+  for (k = 0; (k < ref->num_blocks) && (first_block < 0); k++)
+  {
+    for (n = 0; n < CZDIFF_NUM_SUMS; n++)
+    {
+      if (ref->checksums[k * CZDIFF_NUM_SUMS + n] !=
+          test->checksums[k * CZDIFF_NUM_SUMS + n])
+      {
+        first_block = k;
+        first_stage = n;
+        break;
+      }
+    }
+  }
+
+  /* the first output sample that differs */
+  first_sample = -1;
+  num_samples = ref->num_blocks * ref->block_size;
+
+  for (k = 0; k < 2 * num_samples; k++)
+  {
+    if (ref->samples[k] != test->samples[k])
+    {
+      first_sample = k / 2;
+      break;
+    }
+  }
+
+  if ((first_block < 0) && (first_sample < 0))
+  {
+    printf("Seed %lu: %u blocks match\n", seed, ref->num_blocks);
+    return 0;
+  }
+
+  printf("Seed %lu: DIVERGED\n", seed);
+
+  /* (the output checksum only differs on its own if the */
+  /* state matched, which would be a bug in the checker)  */
+  if (first_block >= 0)
+  {
+    printf("  First divergent block: %d (samples %d to %d), stage %s\n", 
+           first_block, 
+           first_block * ref->block_size, 
+           (first_block + 1) * ref->block_size - 1, 
+           (first_stage < APU_NUM_STAGES) ? 
+             S_czdiff_stage_names[first_stage] : "output");
+  }
+
+  if (first_sample >= 0)
+  {
+    printf("  First output divergence: sample %d, "
+           "left %d vs %d, right %d vs %d\n", 
+           first_sample, 
+           ref->samples[2 * first_sample + 0], 
+           test->samples[2 * first_sample + 0], 
+           ref->samples[2 * first_sample + 1], 
+           test->samples[2 * first_sample + 1]);
+  }
+
+  return 1;
+}
+
+/******************************************************************************/
+/* czdiff_load_song()                                                         */
+/******************************************************************************/
+int czdiff_load_song(char* filename)
+{
+  midi_context midi_ctx;
+
+  midi_context_init(&midi_ctx);
+
+  if (midi_import_file(&midi_ctx, filename))
+    goto nope;
+
+  if (midi_optimize(&midi_ctx, apu_seq_channel_mask(APU_SEQ_TRACK_MUSIC)))
+    goto nope;
+
+  if (midi_factor_subroutines(&midi_ctx))
+    goto nope;
+
+  S_czdiff_song_num_bytes = midi_ctx.combined_num_bytes;
+  S_czdiff_song_data = malloc(S_czdiff_song_num_bytes);
+
+  if (S_czdiff_song_data == NULL)
+    goto nope;
+
+  memcpy( S_czdiff_song_data, 
+          &midi_ctx.arena_data[midi_ctx.combined_start], 
+          S_czdiff_song_num_bytes);
+
+  midi_context_deinit(&midi_ctx);
+
+  return 0;
+
+nope:
+  midi_context_deinit(&midi_ctx);
+  return 1;
+}
+
+/******************************************************************************/
+/* czdiff_alloc_run()                                                         */
+/******************************************************************************/
+int czdiff_alloc_run(czdiff_run* run, unsigned int num_blocks, 
+                     unsigned int block_size)
+{
+  run->num_blocks = num_blocks;
+  run->block_size = block_size;
+
+  run->samples = malloc(2 * sizeof(short) * num_blocks * block_size);
+  run->checksums = malloc(sizeof(unsigned long) * num_blocks * CZDIFF_NUM_SUMS);
+
+  if ((run->samples == NULL) || (run->checksums == NULL))
+    return 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czdiff_free_run()                                                          */
+/******************************************************************************/
+int czdiff_free_run(czdiff_run* run)
+{
+  if (run->samples != NULL)
+  {
+    free(run->samples);
+    run->samples = NULL;
+  }
+
+  if (run->checksums != NULL)
+  {
+    free(run->checksums);
+    run->checksums = NULL;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/* main()                                                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+  int k;
+
+  unsigned short  engine;
+  unsigned short  first_engine;
+  unsigned short  last_engine;
+  unsigned long   seed;
+  unsigned int    num_runs;
+  unsigned int    seconds;
+  unsigned int    block_size;
+  int             quality;
+  char*           song_filename;
+
+  unsigned int    num_blocks;
+  unsigned int    num_failed;
+  unsigned int    num_checked;
+  unsigned short  run_quality;
+
+  czdiff_run      ref;
+  czdiff_run      test;
+
+  /* parse command line:                                         */
+  /*   czdiff [-engine name] [-seed n] [-runs n] [-seconds n]    */
+  /*          [-block samples] [-quality level] [-song file.mid] */
+  /*          [-rate hz]                                         */
+  /* each run renders the same inputs through the reference and  */
+  /* the given engine (or each engine that this cpu supports).   */
+  /* fuzzed runs write random registers and patches (and pick a  */
+  /* random quality level, unless one is given), and a song is   */
+  /* played as is. a rate other than 24000 uses the resampler.   */
+  first_engine = APU_ENGINE_FAST;
+  last_engine = APU_NUM_ENGINES - 1;
+  seed = 1;
+  num_runs = CZDIFF_DEFAULT_RUNS;
+  seconds = CZDIFF_DEFAULT_SECONDS;
+  block_size = CZDIFF_DEFAULT_BLOCK;
+  quality = -1;
+  song_filename = NULL;
+
+  for (k = 1; k < argc; k++)
+  {
+    if ((!strcmp(argv[k], "-engine")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      for (engine = 0; engine < APU_NUM_ENGINES; engine++)
+      {
+        if (!strcmp(argv[k], apu_engine_name(engine)))
+          break;
+      }
+
+      if (engine == APU_NUM_ENGINES)
+      {
+        printf("Unknown engine: %s\n", argv[k]);
+        return 1;
+      }
+
+      if (!apu_engine_supported(engine))
+      {
+        printf("The %s engine is not supported on this cpu\n", argv[k]);
+        return 1;
+      }
+
+      first_engine = engine;
+      last_engine = engine;
+    }
+    else if ((!strcmp(argv[k], "-seed")) && (k + 1 < argc))
+      seed = strtoul(argv[++k], NULL, 10);
+    else if ((!strcmp(argv[k], "-runs")) && (k + 1 < argc))
+      num_runs = atoi(argv[++k]);
+    else if ((!strcmp(argv[k], "-seconds")) && (k + 1 < argc))
+      seconds = atoi(argv[++k]);
+    else if ((!strcmp(argv[k], "-block")) && (k + 1 < argc))
+      block_size = atoi(argv[++k]);
+    else if ((!strcmp(argv[k], "-quality")) && (k + 1 < argc))
+      quality = atoi(argv[++k]);
+    else if ((!strcmp(argv[k], "-song")) && (k + 1 < argc))
+      song_filename = argv[++k];
+    else if ((!strcmp(argv[k], "-rate")) && (k + 1 < argc))
+    {
+      k += 1;
+
+      if (apu_set_output_rate((unsigned int) atoi(argv[k])))
+      {
+        printf("Unsupported output rate: %s\n", argv[k]);
+        return 1;
+      }
+    }
+    else
+    {
+      printf("Unknown option: %s\n", argv[k]);
+      return 1;
+    }
+  }
+
+  if ((seconds == 0) || (block_size == 0) || 
+      (quality >= APU_NUM_QUALITY_LEVELS))
+  {
+    printf("Invalid options...\n");
+    return 1;
+  }
+
+  if (song_filename != NULL)
+  {
+    if (czdiff_load_song(song_filename))
+    {
+      printf("Error loading %s\n", song_filename);
+      return 1;
+    }
+
+    /* the song plays the same every time */
+    num_runs = 1;
+  }
+
+  num_blocks = (seconds * apu_get_output_rate() + block_size - 1) / block_size;
+
+  if (czdiff_alloc_run(&ref, num_blocks, block_size) || 
+      czdiff_alloc_run(&test, num_blocks, block_size))
+  {
+    printf("Out of memory...\n");
+    return 1;
+  }
+
+  num_failed = 0;
+  num_checked = 0;
+
+  for (engine = first_engine; engine <= last_engine; engine++)
+  {
+    if (!apu_engine_supported(engine))
+    {
+      printf("Skipping the %s engine (not supported on this cpu)\n", 
+             apu_engine_name(engine));
+      continue;
+    }
+
+    printf("Checking the %s engine against the reference (%u runs)\n", 
+           apu_engine_name(engine), num_runs);
+
+    for (k = 0; k < (int) num_runs; k++)
+    {
+      /* the quality level is picked from the seed, */
+      /* so that a failing seed can be replayed     */
+      S_czdiff_rand_state = seed + k;
+
+      if (quality >= 0)
+        run_quality = quality;
+      else
+        run_quality = czdiff_rand(APU_NUM_QUALITY_LEVELS);
+
+      if (czdiff_render(&ref, APU_ENGINE_REFERENCE, seed + k, run_quality) || 
+          czdiff_render(&test, engine, seed + k, run_quality))
+      {
+        printf("Error setting up seed %lu\n", seed + k);
+        return 1;
+      }
+
+      if (czdiff_compare(&ref, &test, seed + k))
+        num_failed += 1;
+
+      num_checked += 1;
+    }
+  }
+
+  printf("%u of %u runs diverged\n", num_failed, num_checked);
+
+  czdiff_free_run(&ref);
+  czdiff_free_run(&test);
+
+  if (S_czdiff_song_data != NULL)
+  {
+    free(S_czdiff_song_data);
+    S_czdiff_song_data = NULL;
+  }
+
+  return (num_failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,534 @@
+/******************************************************************************/
+/* gbstyle (prototype code for Felisynth) - No Shinobi Knows Me 2026          */
+/******************************************************************************/
+
+/******************************************************************************/
+/* czscale.c (multi-instance scaling benchmark)                               */
+/******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <linux/perf_event.h>
+
+#include "apu.h"
+#include "cart.h"
+#include "midi.h"
+
+/* the chip is a singleton, so each instance is its own process. */
+/* the roms are loaded before forking, so every instance shares  */
+/* them (as they would with a mapped cartridge)                  */
+#define CZSCALE_DEFAULT_SECONDS 5
+#define CZSCALE_MAX_INSTANCES   256
+#define CZSCALE_MAX_CPUS        256
+
+/* adding a cpu has to improve the total by this much (percent), */
+/* or that is where the scaling stops (the knee)                 */
+#define CZSCALE_KNEE_GAIN 10
+
+#define CZSCALE_BLOCK_SIZE 240
+
+/* what each instance reports back to the parent */
+typedef struct czscale_result
+{
+  long  render_ns;
+  long  cache_misses;
+  long  cache_refs;
+  long  rss_kb;
+  long  pss_kb;
+  long  private_kb;
+} czscale_result;
+
+static int S_czscale_cpus[CZSCALE_MAX_CPUS];
+static int S_czscale_num_cpus;
+
+/******************************************************************************/
+/* czscale_time_ns()                                                          */
+/******************************************************************************/
+long czscale_time_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/******************************************************************************/
+/* czscale_open_counter()                                                     */
+/******************************************************************************/
+int czscale_open_counter(unsigned long config)
+{
+  struct perf_event_attr attr;
+
+  /* hardware counters for this process only. this fails */
+  /* in most containers and vms, and that is reported    */
+  memset(&attr, 0, sizeof(attr));
+
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/******************************************************************************/
+/* czscale_read_memory()                                                      */
+/******************************************************************************/
+int czscale_read_memory(czscale_result* result)
+{
+  FILE* fp;
+  char  line[256];
+  long  val;
+
+  result->rss_kb = -1;
+  result->pss_kb = -1;
+  result->private_kb = -1;
+
+  /* pss splits the shared pages (the roms, the code) */
+  /* between the processes that have them mapped      */
+  fp = fopen("/proc/self/smaps_rollup", "r");
+
+  if (fp == NULL)
+    return 1;
+
+  result->private_kb = 0;
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    if (sscanf(line, "Rss: %ld", &val) == 1)
+      result->rss_kb = val;
+    else if (sscanf(line, "Pss: %ld", &val) == 1)
+      result->pss_kb = val;
+    else if (sscanf(line, "Private_Clean: %ld", &val) == 1)
+      result->private_kb += val;
+    else if (sscanf(line, "Private_Dirty: %ld", &val) == 1)
+      result->private_kb += val;
+  }
+
+  fclose(fp);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czscale_instance()                                                         */
+/******************************************************************************/
+int czscale_instance(int cpu, int start_fd, int result_fd, long num_samples)
+{
+  long n;
+  long size;
+  char go;
+
+  short buf[CZSCALE_BLOCK_SIZE];
+
+  int fd_misses;
+  int fd_refs;
+
+  cpu_set_t       cpus;
+  czscale_result  result;
+
+  /* pin to one of the cpus in use for this trial */
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+
+  apu_play_song(APU_SEQ_TRACK_MUSIC, 0);
+
+  fd_misses = czscale_open_counter(PERF_COUNT_HW_CACHE_MISSES);
+  fd_refs = czscale_open_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+
+  /* wait until every instance is ready */
+  if (read(start_fd, &go, 1) != 1)
+    return 1;
+
+  if (fd_misses >= 0)
+    ioctl(fd_misses, PERF_EVENT_IOC_ENABLE, 0);
+
+  if (fd_refs >= 0)
+    ioctl(fd_refs, PERF_EVENT_IOC_ENABLE, 0);
+
+  result.render_ns = czscale_time_ns();
+
+  /* rendered in blocks like the player does it */
+  for (n = 0; n < num_samples; n += size)
+  {
+    size = num_samples - n;
+
+    if (size > CZSCALE_BLOCK_SIZE)
+      size = CZSCALE_BLOCK_SIZE;
+
+    apu_render(buf, (unsigned int) size, 1);
+
+#ifdef APU_PROFILE
+    if (size == CZSCALE_BLOCK_SIZE)
+      apu_profile_end_block();
+#endif
+  }
+
+  result.render_ns = czscale_time_ns() - result.render_ns;
+
+  result.cache_misses = -1;
+  result.cache_refs = -1;
+
+  if (fd_misses >= 0)
+  {
+    if (read(fd_misses, &result.cache_misses, sizeof(long)) != sizeof(long))
+      result.cache_misses = -1;
+  }
+
+  if (fd_refs >= 0)
+  {
+    if (read(fd_refs, &result.cache_refs, sizeof(long)) != sizeof(long))
+      result.cache_refs = -1;
+  }
+
+  czscale_read_memory(&result);
+
+  if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+    return 1;
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czscale_trial()                                                            */
+/******************************************************************************/
+int czscale_trial(int num_instances, int num_cpus, long num_samples, 
+                  double* total_rtf, czscale_result* avg)
+{
+  int k;
+
+  int   start_pipe[2];
+  int   result_pipe[2];
+  pid_t pids[CZSCALE_MAX_INSTANCES];
+  long  wall_ns;
+  int   num_misses;
+  int   num_refs;
+
+  czscale_result result;
+
+  if ((pipe(start_pipe) < 0) || (pipe(result_pipe) < 0))
+    return 1;
+
+  /* instances are spread over the cpus in use, round robin */
+  for (k = 0; k < num_instances; k++)
+  {
+    pids[k] = fork();
+
+    if (pids[k] < 0)
+      return 1;
+
+    if (pids[k] == 0)
+    {
+      close(start_pipe[1]);
+      close(result_pipe[0]);
+
+      _exit(czscale_instance( S_czscale_cpus[k % num_cpus], 
+                              start_pipe[0], result_pipe[1], num_samples));
+    }
+  }
+
+  close(start_pipe[0]);
+  close(result_pipe[1]);
+
+  /* give them a moment to set up, and then let them all go */
+  usleep(100000);
+
+  wall_ns = czscale_time_ns();
+
+  for (k = 0; k < num_instances; k++)
+  {
+    if (write(start_pipe[1], "g", 1) != 1)
+      return 1;
+  }
+
+  close(start_pipe[1]);
+
+  memset(avg, 0, sizeof(*avg));
+  num_misses = 0;
+  num_refs = 0;
+
+  for (k = 0; k < num_instances; k++)
+  {
+    if (read(result_pipe[0], &result, sizeof(result)) != sizeof(result))
+      return 1;
+
+    avg->render_ns += result.render_ns;
+    avg->rss_kb += result.rss_kb;
+    avg->pss_kb += result.pss_kb;
+    avg->private_kb += result.private_kb;
+
+    if (result.cache_misses >= 0)
+    {
+      avg->cache_misses += result.cache_misses;
+      num_misses += 1;
+    }
+
+    if (result.cache_refs >= 0)
+    {
+      avg->cache_refs += result.cache_refs;
+      num_refs += 1;
+    }
+  }
+
+  wall_ns = czscale_time_ns() - wall_ns;
+
+  close(result_pipe[0]);
+
+  for (k = 0; k < num_instances; k++)
+    waitpid(pids[k], NULL, 0);
+
+  avg->render_ns /= num_instances;
+  avg->rss_kb /= num_instances;
+  avg->pss_kb /= num_instances;
+  avg->private_kb /= num_instances;
+
+  avg->cache_misses = (num_misses > 0) ? avg->cache_misses / num_misses : -1;
+  avg->cache_refs = (num_refs > 0) ? avg->cache_refs / num_refs : -1;
+
+  /* audio seconds rendered by all instances, per wall clock second */
+  *total_rtf = (num_instances * (double) num_samples / APU_OUT_SAMPLING_RATE) / 
+               (wall_ns / 1000000000.0);
+
+  return 0;
+}
+
+/******************************************************************************/
+/* czscale_load_song()                                                        */
+/******************************************************************************/
+int czscale_load_song(char* filename)
+{
+  midi_context midi_ctx;
+
+  midi_context_init(&midi_ctx);
+
+  if (midi_import_file(&midi_ctx, filename))
+    goto nope;
+
+  if (midi_optimize(&midi_ctx, apu_seq_channel_mask(APU_SEQ_TRACK_MUSIC)))
+    goto nope;
+
+  if (midi_factor_subroutines(&midi_ctx))
+    goto nope;
+
+  if (apu_load_song(0, &midi_ctx.arena_data[midi_ctx.combined_start], 
+                    midi_ctx.combined_num_bytes))
+  {
+    goto nope;
+  }
+
+  midi_context_deinit(&midi_ctx);
+
+  return 0;
+
+nope:
+  midi_context_deinit(&midi_ctx);
+  return 1;
+}
+
+/******************************************************************************/
+/* main()                                                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+  int k;
+  int n;
+  int m;
+
+  char* song_filename;
+  char* cart_filename;
+  int   max_instances;
+  int   max_cpus;
+  long  seconds;
+  int   first;
+  int   num_trials;
+  int   knees[CZSCALE_MAX_INSTANCES];
+
+  double          rtf;
+  double          last_rtf;
+  cpu_set_t       cpus;
+  czscale_result  avg;
+
+  /* parse command line:                                       */
+  /*   czscale [-song file.mid | -cart file.rom] [-seconds n]  */
+  /*           [-instances n] [-cpus n]                        */
+  /* each trial runs some number of instances of the chip (1,  */
+  /* 2, 4.. up to the max) over some number of cpus (1.. up to */
+  /* the max, and never more than the instances), and the      */
+  /* results are written to stdout as json                     */
+  song_filename = "megamari_cirno_zenkusa.mid";
+  cart_filename = NULL;
+  seconds = CZSCALE_DEFAULT_SECONDS;
+  max_instances = -1;
+  max_cpus = -1;
+
+  for (k = 1; k < argc; k++)
+  {
+    if ((!strcmp(argv[k], "-song")) && (k + 1 < argc))
+      song_filename = argv[++k];
+    else if ((!strcmp(argv[k], "-cart")) && (k + 1 < argc))
+      cart_filename = argv[++k];
+    else if ((!strcmp(argv[k], "-seconds")) && (k + 1 < argc))
+      seconds = atol(argv[++k]);
+    else if ((!strcmp(argv[k], "-instances")) && (k + 1 < argc))
+      max_instances = atoi(argv[++k]);
+    else if ((!strcmp(argv[k], "-cpus")) && (k + 1 < argc))
+      max_cpus = atoi(argv[++k]);
+    else
+    {
+      fprintf(stderr, "Usage: czscale [-song file.mid | -cart file.rom] ");
+      fprintf(stderr, "[-seconds n] [-instances n] [-cpus n]\n");
+      return 1;
+    }
+  }
+
+  /* the cpus this process is allowed to run on */
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+    return 1;
+
+  S_czscale_num_cpus = 0;
+
+  for (k = 0; (k < CPU_SETSIZE) && (S_czscale_num_cpus < CZSCALE_MAX_CPUS); k++)
+  {
+    if (CPU_ISSET(k, &cpus))
+      S_czscale_cpus[S_czscale_num_cpus++] = k;
+  }
+
+  if ((max_cpus < 1) || (max_cpus > S_czscale_num_cpus))
+    max_cpus = S_czscale_num_cpus;
+
+  if (max_instances < 1)
+    max_instances = 2 * max_cpus;
+
+  if (max_instances > CZSCALE_MAX_INSTANCES)
+    max_instances = CZSCALE_MAX_INSTANCES;
+
+  if (seconds < 1)
+    seconds = 1;
+
+  /* the midi importer is chatty, so it talks to stderr */
+  apu_reset();
+  apu_clear_roms();
+  apu_set_engine(apu_detect_engine());
+
+  if (cart_filename != NULL)
+  {
+    if (cart_map_file(cart_filename, CART_MAP_FLAG_VERIFY))
+    {
+      fprintf(stderr, "Error mapping %s\n", cart_filename);
+      return 1;
+    }
+  }
+  else
+  {
+    fflush(stdout);
+    k = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    n = czscale_load_song(song_filename);
+
+    fflush(stdout);
+    dup2(k, STDOUT_FILENO);
+    close(k);
+
+    if (n)
+    {
+      fprintf(stderr, "Error loading %s\n", song_filename);
+      return 1;
+    }
+  }
+
+  printf("{\n");
+  printf("  \"cpus\": %d,\n", max_cpus);
+  printf("  \"seconds\": %ld,\n", seconds);
+  printf("  \"trials\": [\n");
+
+  first = 1;
+
+  num_trials = 0;
+
+  for (n = 1; n <= max_instances; n *= 2)
+  {
+    last_rtf = 0;
+    knees[num_trials] = 1;
+
+    for (m = 1; (m <= max_cpus) && (m <= n); m++)
+    {
+      if (czscale_trial(n, m, seconds * APU_OUT_SAMPLING_RATE, &rtf, &avg))
+      {
+        fprintf(stderr, "Error running %d instances on %d cpus\n", n, m);
+        return 1;
+      }
+
+      /* the knee is the last cpu count that still helped */
+      if ((m > 1) && (knees[num_trials] == m - 1) && 
+          (rtf * 100 >= last_rtf * (100 + CZSCALE_KNEE_GAIN)))
+      {
+        knees[num_trials] = m;
+      }
+
+      last_rtf = rtf;
+
+      printf("%s    {\n", first ? "" : ",\n");
+      printf("      \"instances\": %d,\n", n);
+      printf("      \"cpus\": %d,\n", m);
+      printf("      \"total_realtime_factor\": %.2f,\n", rtf);
+      printf("      \"instance_realtime_factor\": %.2f,\n", 
+             (seconds * 1000000000.0) / avg.render_ns);
+      printf("      \"rss_kb\": %ld,\n", avg.rss_kb);
+      printf("      \"pss_kb\": %ld,\n", avg.pss_kb);
+      printf("      \"private_kb\": %ld,\n", avg.private_kb);
+
+      if ((avg.cache_misses >= 0) && (avg.cache_refs > 0))
+      {
+        printf("      \"cache_miss_rate\": %.4f,\n", 
+               (double) avg.cache_misses / avg.cache_refs);
+      }
+      else
+        printf("      \"cache_miss_rate\": null,\n");
+
+      printf("      \"instance_render_ms\": %.1f\n", avg.render_ns / 1000000.0);
+      printf("    }");
+
+      first = 0;
+    }
+
+    num_trials += 1;
+  }
+
+  printf("\n  ],\n");
+
+  /* for each number of instances, the most cpus worth using */
+  printf("  \"knees\": [\n");
+
+  for (k = 0, n = 1; k < num_trials; k++, n *= 2)
+  {
+    printf("    { \"instances\": %d, \"cpus\": %d }%s\n", 
+           n, knees[k], (k < num_trials - 1) ? "," : "");
+  }
+
+  printf("  ]\n");
+  printf("}\n");
+
+  if (cart_filename != NULL)
+    cart_unmap_file();
+
+  return 0;
+}